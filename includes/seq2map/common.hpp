@@ -359,6 +359,26 @@ namespace seq2map
         static const String s_magicString;
     };
 
+    /**
+     * A read-only view of a contiguous block of memory. The life of the
+     * underlying storage can optionally be extended by holding a shared
+     * owner, i.e. a memory-mapped region.
+     */
+    struct MemoryBlock
+    {
+        typedef boost::shared_ptr<const void> Owner;
+
+        MemoryBlock() : data(NULL), size(0) {}
+        MemoryBlock(const uchar* data, size_t size, const Owner& owner = Owner())
+        : data(data), size(size), owner(owner) {}
+
+        inline bool IsEmpty() const { return data == NULL || size == 0; }
+
+        const uchar* data;
+        size_t       size;
+        Owner        owner;
+    };
+
     /**
      * An interface to represent any class that can be serialised into
      * an array of type T.
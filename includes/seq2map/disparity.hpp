@@ -131,6 +131,57 @@ namespace seq2map
     protected:
         virtual void Init();
     };
+
+    /**
+     * Lossless codec for disparity maps quantised to 16-bit integers.
+     *
+     * Each row is predicted from its left neighbour, or from the first pixel
+     * of the previous row for the first column, and the zigzagged residuals
+     * are written as byte-aligned tokens with zero runs collapsed. The header
+     * carries the linear mapping used to quantise the map, so decoding writes
+     * floating-point disparities directly without an intermediate 16U image.
+     */
+    class DisparityCodec
+    {
+    public:
+        /**
+         * Encode a disparity map.
+         *
+         * \param dpm single precision disparity map.
+         * \param alpha scale of the linear mapping from disparity to 16U.
+         * \param beta offset of the linear mapping from disparity to 16U.
+         * \param buf output buffer of the encoded stream.
+         * \return true if the map is successfully encoded.
+         */
+        static bool Encode(const cv::Mat& dpm, double alpha, double beta, std::vector<uchar>& buf);
+
+        /**
+         * Decode an encoded stream to a CV_32F disparity map in one pass.
+         *
+         * \param data pointer to the encoded stream.
+         * \param size number of bytes of the encoded stream.
+         * \param dpm decoded disparity map.
+         * \return true if the stream is successfully decoded.
+         */
+        static bool Decode(const uchar* data, size_t size, cv::Mat& dpm);
+
+        /**
+         * Check if a stream starts with the magic number of the codec.
+         */
+        static bool IsEncoded(const uchar* data, size_t size);
+
+    private:
+        struct Header
+        {
+            char   magic[8];
+            int    rows;
+            int    cols;
+            double alpha; ///< scale of the disparity-to-16U mapping
+            double beta;  ///< offset of the disparity-to-16U mapping
+        };
+
+        static const String s_magicNumber;
+    };
 }
 
 #endif //DISPARITY_HPP
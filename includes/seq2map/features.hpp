@@ -1,6 +1,7 @@
 #ifndef FEATURES_HPP
 #define FEATURES_HPP
 #include <list>
+#include <map>
 #include <seq2map/common.hpp>
 
 namespace seq2map
@@ -39,6 +40,45 @@ namespace seq2map
         }
     };
 
+    /**
+     * A uniform grid of buckets over the image plane to index key points by
+     * their locations, for fixed-radius searches in constant time per cell.
+     */
+    class KeyPointGrid
+    {
+    public:
+        /* ctor */ KeyPointGrid() : m_cellSize(0), m_cols(0), m_rows(0) {}
+
+        /**
+         * Build the grid from a set of key points.
+         *
+         * \param keypoints key points to be indexed.
+         * \param cellSize width and height of each bucket in pixels.
+         */
+        /* ctor */ KeyPointGrid(const KeyPoints& keypoints, float cellSize);
+
+        /**
+         * Find all the key points within a radius of a location.
+         *
+         * \param pt centre of the search in image pixels.
+         * \param radius radius of the search in image pixels.
+         * \param found indices of the key points found are appended to the list.
+         */
+        void Search(const cv::Point2f& pt, float radius, IndexList& found) const;
+
+        inline float GetCellSize() const { return m_cellSize; }
+        inline bool IsEmpty() const      { return m_points.empty(); }
+
+    private:
+        float m_cellSize;
+        int   m_cols;
+        int   m_rows;
+        cv::Point2f m_origin;
+        std::vector<cv::Point2f> m_points; ///< key point locations
+        std::vector<size_t> m_offsets;     ///< start of each bucket in m_items, followed by the end of the last one
+        std::vector<size_t> m_items;       ///< key point indices sorted by buckets
+    };
+
     /**
      * The class deficated to the collection of image features. As most of the
      * operations related to image feature involve more than one feature, it is
@@ -95,20 +135,78 @@ namespace seq2map
 
         virtual bool Store(Path& path) const;
         virtual bool Restore(const Path& path);
+
+        /**
+         * Serialise the feature set to a binary stream.
+         */
+        bool Store(std::ostream& os) const;
+
+        /**
+         * Deserialise the feature set from a binary stream.
+         */
+        bool Restore(std::istream& is);
+
+        /**
+         * Deserialise the feature set from a block of memory. When the block
+         * is in the "CV4" layout and has an owner, the descriptor matrix is
+         * wrapped over the block without a copy, and shall be treated as
+         * read-only; see GetMutableDescriptors.
+         */
+        bool Restore(const MemoryBlock& blk);
         
         inline bool IsEmpty() const    { return m_keypoints.empty(); }
         inline size_t GetSize() const  { return m_keypoints.size();  }
         inline int GetNormType() const { return m_normType; }
+        inline bool IsMapped() const   { return m_owner.get() != NULL; }
         inline const KeyPoints& GetKeyPoints() const { return m_keypoints;   }
+
+        /**
+         * Get a shallow copy of the descriptors for reading. When the set is
+         * mapped the matrix aliases the mapped block, which is shared with
+         * every other set restored from it, so it must not be written to.
+         */
         inline const cv::Mat GetDescriptors() const  { return m_descriptors; }
 
+        /**
+         * Get the descriptors for writing. Mapped descriptors are copied to
+         * memory owned by the set first, so the writes never reach the
+         * mapped block.
+         */
+        cv::Mat GetMutableDescriptors();
+
+        /**
+         * Get the spatial index of the key points. A grid is built on the
+         * first request of a cell size and kept for later requests of the
+         * same size, so repeated matching against the set shares it. The
+         * grids are dropped only when the key points change, i.e. when the
+         * set is restored or appended to; a copy or an assignment shares the
+         * grids of its source as the key points are the same.
+         */
+        const KeyPointGrid& GetKeyPointGrid(float cellSize) const;
+
     protected:
         static const String s_fileMagicNumber;
         static const char   s_fileHeaderSep;
+        static const size_t s_fileBlockAlignment;
+        static const size_t s_keypointColumnBytes;
+
+        bool RestoreHeader(std::istream& is, String& version, int& depth, cv::Size2i& matSize);
+
+        static void PackKeyPoints(const KeyPoints& keypoints, uchar* columns);
+        static void UnpackKeyPoints(const uchar* columns, size_t n, KeyPoints& keypoints);
+        static void WritePadding(std::ostream& os, size_t offset);
+
+        static inline size_t GetAlignedSize(size_t bytes)
+        { return (bytes + s_fileBlockAlignment - 1) / s_fileBlockAlignment * s_fileBlockAlignment; }
 
         KeyPoints m_keypoints;
         cv::Mat   m_descriptors;
         int       m_normType;
+        MemoryBlock::Owner m_owner; ///< keeps mapped descriptors alive
+        typedef std::map<float, boost::shared_ptr<const KeyPointGrid> > KeyPointGrids;
+        static const size_t s_maxKeyPointGrids;
+
+        mutable KeyPointGrids m_grids; ///< lazily built spatial indices, by cell size
     };
 
     /**
@@ -289,7 +387,7 @@ namespace seq2map
          */
         FeatureMatcher(bool exhaustive = true, bool uniqueness = true, bool symmetric = false, float maxRatio = 0.6f, bool useGpu = true)
         : m_exhaustive(exhaustive), m_uniqueness(uniqueness), m_symmetric(symmetric),
-          m_maxRatio(maxRatio), m_useGpu(useGpu), m_maxDistance(0.01f),
+          m_maxRatio(maxRatio), m_useGpu(useGpu), m_useNative(true), m_maxDistance(0.01f),
           m_descMatchingMetre("DMatching",     "features/s"),
           m_ratioTestMetre   ("Ratio Test",    "matches/s"),
           m_symmetryTestMetre("Symmetry Test", "matches/s"),
@@ -305,6 +403,19 @@ namespace seq2map
          */
         ImageFeatureMap operator() (const ImageFeatureSet& src, const ImageFeatureSet& dst);
 
+        /**
+         * Guided matching. Each source feature is compared only with the
+         * target features within a radius of its predicted location in the
+         * target image, found using the spatial index of the target set.
+         * Source features predicted at NaN are matched exhaustively.
+         *
+         * \param src source feature set.
+         * \param dst target feature set.
+         * \param predictions predicted image location of each source feature.
+         * \param radius search radius in image pixels.
+         */
+        ImageFeatureMap operator() (const ImageFeatureSet& src, const ImageFeatureSet& dst, const Points2F& predictions, float radius);
+
         //
         // Accessors
         //
@@ -321,6 +432,19 @@ namespace seq2map
         inline void SetDistanceThreshold(float threshold) { m_maxDistance = threshold; }
         inline float GetDistanceThreshold() const         { return m_maxDistance; }
 
+        /**
+         * Enable the built-in multi-threaded matchers for exhaustive matching
+         * on CPU in place of cv::BFMatcher. Binary descriptors get identical
+         * matches, while L2 distances of floating-point descriptors agree up
+         * to rounding errors.
+         *
+         * The native matchers also find the nearest source feature of each
+         * target feature in the same pass, so the symmetry test becomes a
+         * mutual nearest neighbour check without a second round of matching.
+         */
+        inline void SetNativeMatching(bool enable) { m_useNative = enable; }
+        inline bool GetNativeMatching() const      { return m_useNative;   }
+
         /**
          *
          */
@@ -338,13 +462,18 @@ namespace seq2map
 
     protected:
         static cv::Mat NormaliseDescriptors(const cv::Mat& desc);
-        FeatureMatches MatchDescriptors(const cv::Mat& src, const cv::Mat& dst, int metric, bool ratioTest = true);
+        bool IsNativelyMatchable(const cv::Mat& desc, int metric) const;
+        void KnnMatchDescriptors(const cv::Mat& src, const cv::Mat& dst, int metric, int k, std::vector<std::vector<cv::DMatch> >& knn, std::vector<cv::DMatch>* backward = NULL);
+        FeatureMatches MatchDescriptors(const cv::Mat& src, const cv::Mat& dst, int metric, bool ratioTest = true, std::vector<cv::DMatch>* backward = NULL);
+        FeatureMatches MatchDescriptors(const cv::Mat& src, const cv::Mat& dst, int metric, bool ratioTest, const KeyPointGrid& grid, const Points2F& predictions, float radius, std::vector<cv::DMatch>* backward);
+        FeatureMatches SelectMatches(const std::vector<std::vector<cv::DMatch> >& knn, int metric, int d, bool ratioTest);
 
         Filters m_filters;
         bool  m_exhaustive;
         bool  m_uniqueness;
         bool  m_symmetric;
         bool  m_useGpu;
+        bool  m_useNative;
         float m_maxDistance;
         float m_maxRatio;
         Speedometre m_descMatchingMetre;
@@ -353,8 +482,10 @@ namespace seq2map
         Speedometre m_filteringMetre;
 
     private:
+        ImageFeatureMap Match(const ImageFeatureSet& src, const ImageFeatureSet& dst, const Points2F* predictions, float radius);
         static void RunUniquenessTest(FeatureMatches& forward);
         static void RunSymmetryTest(FeatureMatches& forward, const FeatureMatches& backward, const std::vector<size_t>& idmap, size_t maxSrcIdx);
+        static void RunSymmetryTest(FeatureMatches& forward, const std::vector<cv::DMatch>& backward);
         float GetDistanceThreshold(float ratio, int metric, size_t d);
     };
 
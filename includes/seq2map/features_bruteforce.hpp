@@ -0,0 +1,108 @@
+#ifndef FEATURES_BRUTEFORCE_HPP
+#define FEATURES_BRUTEFORCE_HPP
+#include <seq2map/common.hpp>
+
+namespace seq2map
+{
+    typedef std::vector<std::vector<cv::DMatch> > KnnMatches;
+    typedef std::vector<std::vector<int> > CandidateLists;
+    typedef std::vector<std::vector<float> > CandidateDistances;
+
+    /**
+     * Exhaustive k-nearest neighbour search of binary descriptors in the
+     * Hamming space. Descriptors are compared block by block for cache reuse
+     * and the query descriptors are processed in parallel. AVX-512 or AVX2
+     * popcount kernels are used when the build enables the instruction sets,
+     * otherwise a scalar kernel is used. The results are identical to those
+     * of cv::BFMatcher with cv::NORM_HAMMING.
+     */
+    class HammingMatcher
+    {
+    public:
+        /**
+         * Find the k nearest training descriptors of each query descriptor.
+         *
+         * \param query CV_8U query descriptors, one per row.
+         * \param train CV_8U training descriptors, one per row.
+         * \param knn k nearest matches of each query descriptor, sorted by distance.
+         * \param k number of neighbours, either 1 or 2.
+         * \param reverse optional nearest query descriptor of each training
+         *        descriptor, found in the same pass; an entry has a negative
+         *        trainIdx when there is no query descriptor.
+         * \return true if the search is done, false if the arguments are invalid.
+         */
+        static bool KnnMatch(const cv::Mat& query, const cv::Mat& train, KnnMatches& knn, int k, std::vector<cv::DMatch>* reverse = NULL);
+
+        /**
+         * Compute the distances of each query descriptor to its own list of
+         * training descriptors, as in guided matching.
+         *
+         * \param query CV_8U query descriptors, one per row.
+         * \param train CV_8U training descriptors, one per row.
+         * \param candidates indices of the training descriptors to be compared
+         *        with each query descriptor.
+         * \param dist distances in the order of the candidates.
+         * \return true if the distances are computed, false if the arguments are invalid.
+         */
+        static bool Distances(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates, CandidateDistances& dist);
+
+        /**
+         * Name of the popcount kernel compiled in.
+         */
+        static String GetKernelName();
+
+        /**
+         * Number of bytes per descriptor processed by the kernel at a time;
+         * descriptors are zero-padded to a multiple of it.
+         */
+        static const size_t KernelBytes;
+    };
+
+    /**
+     * Exhaustive k-nearest neighbour search of floating-point descriptors in
+     * the Euclidean space. Squared distances are expanded to
+     * |q|^2 + |t|^2 - 2 q.t so the dot products of a block of query and a
+     * block of training descriptors come from one matrix multiplication.
+     * The tiles are reduced to the best candidates as soon as they are
+     * computed, so the full distance matrix is never materialised. Query
+     * blocks are processed in parallel.
+     */
+    class L2Matcher
+    {
+    public:
+        /**
+         * Find the k nearest training descriptors of each query descriptor.
+         *
+         * \param query CV_32F query descriptors, one per row.
+         * \param train CV_32F training descriptors, one per row.
+         * \param knn k nearest matches of each query descriptor, sorted by distance.
+         * \param k number of neighbours, either 1 or 2.
+         * \param metric either cv::NORM_L2 or cv::NORM_L2SQR.
+         * \param reverse optional nearest query descriptor of each training
+         *        descriptor, found in the same pass.
+         * \return true if the search is done, false if the arguments are invalid.
+         */
+        static bool KnnMatch(const cv::Mat& query, const cv::Mat& train, KnnMatches& knn, int k, int metric, std::vector<cv::DMatch>* reverse = NULL);
+
+        /**
+         * Compute the distances of each query descriptor to its own list of
+         * training descriptors, as in guided matching.
+         *
+         * \param query CV_32F query descriptors, one per row.
+         * \param train CV_32F training descriptors, one per row.
+         * \param candidates indices of the training descriptors to be compared
+         *        with each query descriptor.
+         * \param dist distances in the order of the candidates.
+         * \param metric either cv::NORM_L2 or cv::NORM_L2SQR.
+         * \return true if the distances are computed, false if the arguments are invalid.
+         */
+        static bool Distances(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates, CandidateDistances& dist, int metric);
+
+        /**
+         * Scale each row of the descriptors to unit length. Zero rows are left
+         * as they are.
+         */
+        static cv::Mat Normalise(const cv::Mat& desc);
+    };
+}
+#endif // FEATURES_BRUTEFORCE_HPP
@@ -7,6 +7,11 @@ namespace seq2map
 {
     /**
      * A geometry matrix wraps a cv::Mat that stores coordinates of n-dimensional elements.
+     *
+     * Copies made from a const geometry or by a const assignment are deep; copies made from a
+     * non-const geometry or a temporary share the matrix. Reshaping shares the matrix whenever
+     * the memory layout allows. Use Clone() to get a private copy before modifying a geometry
+     * in place.
      */
     class Geometry
     {
@@ -40,6 +45,11 @@ namespace seq2map
          */
         Geometry(const Geometry& g) : shape(g.shape), mat(g.mat.clone()) {}
 
+        /**
+         * Move constructor taking over the geometry matrix of a temporary.
+         */
+        Geometry(Geometry&& g) : shape(g.shape), mat(g.mat) { g.mat.release(); }
+
         /**
          * Destructor
          */
@@ -66,6 +76,16 @@ namespace seq2map
          */
         Geometry& operator= (const Geometry& g);
 
+        /**
+         * Move assignment from a temporary; cloning will be avoided if no transpose is needed
+         */
+        Geometry& operator= (Geometry&& g);
+
+        /**
+         * Make a deep copy of the geometry.
+         */
+        Geometry Clone() const { return Geometry(shape, mat.clone()); }
+
         /**
          * Calculate per-element subtraction
          */
@@ -88,9 +108,10 @@ namespace seq2map
         Geometry operator[] (const IndexList& indices) const;
 
         /**
-         * Change the memory layout of elements.
+         * Change the memory layout of elements. The returned geometry shares the matrix
+         * unless a transpose is needed.
          */
-        Geometry Reshape(Shape shape) const { return Geometry(shape) = *this; }
+        Geometry Reshape(Shape shape) const;
         Geometry Reshape(Shape shape)       { return Geometry(shape) = *this; }
 
         Geometry Reshape(const Geometry& g) const;
@@ -299,21 +320,34 @@ namespace seq2map
 
         static size_t GetCovMatCols(CovarianceType type, size_t dims);
 
+        /**
+         * Propagate packed covariances through Jacobians by C' = J * C * J'.
+         * Blocks of elements are processed in parallel by the shared
+         * ThreadPool, and the common shapes use fixed-size kernels.
+         *
+         * \param cov N0-by-D0*(D0+1)/2 packed covariances, or an empty matrix for identities.
+         * \param jac N1-by-D0*D1 Jacobians stored column by column, as taken by Transform().
+         * \param d0 dimensionality of the source space.
+         * \param d1 dimensionality of the target space.
+         * \return max(N0,N1)-by-D1*(D1+1)/2 packed CV_64F covariances, or an empty matrix
+         *         if N0 and N1 are different and neither is one.
+         */
+        static cv::Mat PropagateCovMat(const cv::Mat& cov, const cv::Mat& jac, size_t d0, size_t d1);
+
+        /**
+         * Reciprocal condition number below which a covariance is taken as
+         * singular and the distances of its element are set to zero.
+         */
+        static double GetConditionThreshold() { return s_rcondThreshold; }
+
         const CovarianceType type; ///< shape of covariance matrix
         const size_t dims;         ///< dimensionality
 
     private:
-        struct Metres
-        {
-            Speedometre tfm;
-            Speedometre cov;
-        };
-
         static double s_rcondThreshold;
 
-        Geometry m_cov;         ///< error covariance coefficients
-        mutable Geometry m_icv; ///< inverse covariance coefficients, automatically calculated from cov
-        mutable Metres m_metres;
+        Geometry m_cov; ///< error covariance coefficients
+        Geometry m_icv; ///< inverse covariance coefficients, recalculated whenever cov changes so a metric can be evaluated concurrently
     };
 
     /**
@@ -413,7 +447,7 @@ namespace seq2map
         /**
          * Copy constructor
          */
-        GeometricMapping(GeometricMapping& mapping) : indices(mapping.indices), src(mapping.src), dst(mapping.dst), metric(mapping.metric) {}
+        GeometricMapping(const GeometricMapping& mapping) : indices(mapping.indices), src(mapping.src), dst(mapping.dst), metric(mapping.metric) {}
 
         /**
          * Extract sub-elements.
@@ -495,6 +529,9 @@ namespace seq2map
 
     /**
      * A rotation transform rotate given points/vectors about its rotation axis.
+     * The matrix and the angle-axis vector are kept in fixed-size storage so
+     * composing, inverting and vectorising rotations does not touch the heap;
+     * cv::Mat copies are only made by the cv::Mat-based accessors.
      */
     class Rotation : public GeometricTransform
     {
@@ -518,12 +555,12 @@ namespace seq2map
         // Constructors
         //
         Rotation(Parameterisation param, cv::Mat rmat);
-        Rotation(Parameterisation param = RODRIGUES) : Rotation(param, cv::Mat::eye(3, 3, CV_64F)) {}
+        Rotation(Parameterisation param = RODRIGUES) : m_rmat(cv::Matx33d::eye()), m_rvec(0, 0, 0), m_param(param) {}
 
         //
         // Comparison
         //
-        inline bool operator== (const Rotation& rhs) const { return cv::norm(m_rmat, rhs.m_rmat) < 1e-6; }
+        inline bool operator== (const Rotation& rhs) const { return cv::norm(m_rmat - rhs.m_rmat) < 1e-6; }
         inline bool operator!= (const Rotation& rhs) const { return !(*this == rhs); }
 
         inline bool IsIdentity() const { return *this == Identity; }
@@ -532,14 +569,27 @@ namespace seq2map
         // Creation and conversion
         //
         bool FromMatrix(const cv::Mat& rmat);
-        bool FromVector(const Vec& rvec) { return FromVector(cv::Mat(rvec)); }
+        bool FromVector(const Vec& rvec);
         bool FromVector(const cv::Mat& rvec);
         bool FromAngles(double x, double y, double z);
 
+        /**
+         * Set the rotation from an SO(3) matrix without leaving fixed-size
+         * storage. Unlike FromMatrix the matrix is taken as it is, therefore
+         * it has to be orthonormal.
+         */
+        void FromMatx(const cv::Matx33d& rmat);
+
+        /**
+         * Set the rotation from an angle-axis vector without leaving
+         * fixed-size storage.
+         */
+        void FromVec(const cv::Vec3d& rvec);
+
         /**
          * Get the rotation as an SO(3) matrix.
          */
-        inline cv::Mat ToMatrix() const { return m_rmat.clone(); }
+        inline cv::Mat ToMatrix() const { return cv::Mat(m_rmat, true); }
 
         /**
          * Get the rotation as a 3-vector.
@@ -549,7 +599,7 @@ namespace seq2map
         /**
          *
          */
-        inline cv::Mat ToVector() const { return m_rvec.clone(); }
+        inline cv::Mat ToVector() const { return cv::Mat(m_rvec, true); }
 
         /**
          * Get the rotation as three angles.
@@ -562,6 +612,16 @@ namespace seq2map
         inline Parameterisation GetParameterisation() const { return m_param; }
         inline void SetParametersiation(Parameterisation param) { m_param = param; }
 
+        /**
+         * Get the fixed-size rotation matrix.
+         */
+        inline const cv::Matx33d& GetMatx() const { return m_rmat; }
+
+        /**
+         * Get the fixed-size angle-axis vector.
+         */
+        inline const cv::Vec3d& GetVec() const { return m_rvec; }
+
         //
         // Applying the transform
         //
@@ -584,16 +644,24 @@ namespace seq2map
         virtual bool Restore(const Vec& v);
         virtual size_t GetDimension() const { return 3; }
 
+        /**
+         * De-vectorise the rotation from the first GetDimension() elements of
+         * a buffer, without copying them to a Vec.
+         */
+        bool Restore(const double* v);
+
         static const Rotation Identity;
 
     private:
-        cv::Mat m_rmat; ///< the 3-by-3 rotation matrix managed by the class; might refer to an external variable
-        cv::Mat m_rvec;
+        cv::Matx33d m_rmat; ///< the 3-by-3 rotation matrix
+        cv::Vec3d   m_rvec; ///< the angle-axis form of m_rmat
         Parameterisation m_param;
     };
 
     /**
      * An Euclidean transform actualises rigid transform in 3D Euclidean space.
+     * Like Rotation, the translation is kept in fixed-size storage, so
+     * composition and inversion are done without heap allocation.
      */
     class EuclideanTransform : public GeometricTransform
     {
@@ -612,9 +680,7 @@ namespace seq2map
          * Default constructor.
          */
         EuclideanTransform(Rotation::Parameterisation rform = Rotation::EULER_ANGLES)
-        : m_matrix(cv::Mat::eye(3, 4, CV_64F)),
-          m_tvec(m_matrix.rowRange(0, 3).colRange(3, 4)),
-          m_rotation(rform, m_matrix.rowRange(0, 3).colRange(0, 3)) {}
+        : m_tvec(0, 0, 0), m_rotation(rform) {}
 
         /**
          * Construction from a rotation matrix and a translation vector
@@ -672,7 +738,7 @@ namespace seq2map
         /**
          *
          */
-        void SetTranslation(const cv::Vec3d& tvec) { cv::Mat(tvec, false).reshape(1, 3).copyTo(m_tvec); }
+        void SetTranslation(const cv::Vec3d& tvec) { m_tvec = tvec; }
 
         /**
          * Set the rotation and translation components given a transform matrix.
@@ -690,9 +756,14 @@ namespace seq2map
         inline const Rotation& GetRotation() const { return m_rotation; }
 
         /**
-         * Get the translation.
+         * Get a copy of the translation as a 3-by-1 matrix.
+         */
+        inline cv::Mat GetTranslation() const { return cv::Mat(m_tvec, true); }
+
+        /**
+         * Get the fixed-size translation vector.
          */
-        inline cv::Mat GetTranslation() const { return m_tvec; }
+        inline const cv::Vec3d& GetTranslationVec() const { return m_tvec; }
 
         /**
          * Get the whole transform as a matrix.
@@ -706,7 +777,7 @@ namespace seq2map
         /**
          *
          */
-        bool IsIdentity() const { return m_rotation.IsIdentity() && cv::norm(m_tvec) == 0; }
+        bool IsIdentity() const { return m_rotation.IsIdentity() && m_tvec == cv::Vec3d(0, 0, 0); }
 
         //
         // Creation and conversion
@@ -733,6 +804,17 @@ namespace seq2map
         virtual Point3F& operator() (Point3F& pt) const;
         virtual Point3D& operator() (Point3D& pt) const;
         virtual Geometry& operator() (Geometry& g) const { return (*this)(g, g.GetDimension() == 3); }
+
+        /**
+         * Transform Euclidean 3D or homogeneous 4D points. The result is a
+         * new matrix assigned to g, so the matrix g held before is never
+         * written and may be shared with a constant geometry.
+         *
+         * \param g points to be transformed.
+         * \param euclidean true to get Euclidean 3D points, false to get
+         *        homogeneous 4D points.
+         * \return Reference to g.
+         */
         Geometry& operator() (Geometry& g, bool euclidean) const;
 
         using GeometricTransform::operator();
@@ -753,9 +835,8 @@ namespace seq2map
         static const EuclideanTransform Identity;
 
     protected:
-        cv::Mat m_matrix;
-        cv::Mat m_tvec;
-        Rotation m_rotation;
+        cv::Vec3d m_tvec;     ///< translation part of the transform
+        Rotation  m_rotation; ///< rotation part of the transform
     };
 
     typedef std::vector<EuclideanTransform> EuclideanTransforms;
@@ -887,10 +968,13 @@ namespace seq2map
         virtual Point3F& operator() (Point3F& pt) const { return (*proj)(pose(pt)); }
         virtual Point3D& operator() (Point3D& pt) const { return (*proj)(pose(pt)); }
 
-        virtual Geometry Project(const Geometry& g, ProjectiveSpace space = EUCLIDEAN_2D) const { return proj->Project(pose(Geometry(g), true), space); }
+        virtual Geometry Project(const Geometry& g, ProjectiveSpace space = EUCLIDEAN_2D) const { Geometry x(g.shape, g.mat); return proj->Project(pose(x, true), space); }
         virtual Geometry Backproject(const Geometry& g) const { return pose.GetInverse().GetRotation()(proj->Backproject(g)); }
 
-        virtual Geometry GetJacobian(const Geometry& g, const Geometry& proj) const { return this->proj->GetJacobian(pose(Geometry(g), true), proj); }
+        /**
+         * Jacobian of the delegated projection chained with the rotation of the pose.
+         */
+        virtual Geometry GetJacobian(const Geometry& g, const Geometry& proj) const;
 
         virtual String GetModelName() const { return proj->GetModelName(); }
 
@@ -954,6 +1038,27 @@ namespace seq2map
 
         virtual Geometry Project(const Geometry& g, ProjectiveSpace space = EUCLIDEAN_2D) const;
 
+        /**
+         * Project a batch of points given in structure-of-arrays form into
+         * caller-provided buffers, optionally with the Jacobians. No memory
+         * is allocated.
+         *
+         * \param n number of points.
+         * \param X x coordinates of the points in the camera frame.
+         * \param Y y coordinates of the points in the camera frame.
+         * \param Z z coordinates of the points in the camera frame.
+         * \param u x coordinates of the projected points.
+         * \param v y coordinates of the projected points.
+         * \param jac six arrays receiving dx/dX, dy/dX, dx/dY, dy/dY, dx/dZ
+         *        and dy/dZ as in GetJacobian(), or NULL to skip them.
+         */
+        virtual void ProjectBatch(size_t n, const double* X, const double* Y, const double* Z, double* u, double* v, double* const* jac = NULL) const;
+
+        /**
+         * Single-precision version of ProjectBatch.
+         */
+        virtual void ProjectBatch(size_t n, const float* X, const float* Y, const float* Z, float* u, float* v, float* const* jac = NULL) const;
+
         //
         // Backward projection
         //
@@ -995,7 +1100,7 @@ namespace seq2map
         {
             RADIAL_TANGENTIAL_DISTORTION = 4,  // 4-dof distortion including k1, k2, p1 and p2
             HIGH_RADIAL_DISTORTION       = 5,  // 5-dof distortion including k1, k2, p1, p2, and k3
-            RATIONAL_RADIAL_DISTORTION   = 7,  // 7-dof distortion including k1, k2, p1, p2, k3, k4, k5 and k6
+            RATIONAL_RADIAL_DISTORTION   = 8,  // 8-dof distortion including k1, k2, p1, p2, k3, k4, k5 and k6
             THIN_PSISM_DISTORTION        = 12, // 12-dof distortion including k1, k2, p1, p2, k3, k4, k5, k6, s1, s2, s3 and s4
             TILTED_SENSOR_DISTORTION     = 14  // 14-dof distortion including k1, k2, p1, p2, k3, k4, k5, k6, s1, s2, s3, s4, tau_x and tau_y
         };
@@ -1041,6 +1146,18 @@ namespace seq2map
         virtual Point3D& operator() (Point3D& pt) const;
         virtual Geometry Project(const Geometry& g, ProjectiveSpace space = EUCLIDEAN_2D) const;
 
+        /**
+         * Batch projection following the distortion model of cv::projectPoints.
+         * The Jacobians are differentiated in closed form through the radial,
+         * tangential, thin prism and tilted sensor terms.
+         */
+        virtual void ProjectBatch(size_t n, const double* X, const double* Y, const double* Z, double* u, double* v, double* const* jac = NULL) const;
+
+        /**
+         * Single-precision version of ProjectBatch.
+         */
+        virtual void ProjectBatch(size_t n, const float* X, const float* Y, const float* Z, float* u, float* v, float* const* jac = NULL) const;
+
         using GeometricTransform::operator();
 
         //
@@ -1048,6 +1165,12 @@ namespace seq2map
         //
         virtual Geometry Backproject(const Geometry& g) const;
 
+        //
+        // Differentiation
+        //
+        virtual Geometry GetJacobian(const Geometry& g) const;
+        virtual Geometry GetJacobian(const Geometry& g, const Geometry& proj) const { return GetJacobian(g); }
+
         //
         // Persistence
         //
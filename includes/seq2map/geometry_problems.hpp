@@ -31,18 +31,78 @@ namespace seq2map
                 double secs;
             };
 
-            InlierSelector() : threshold(-1) {}
+            /**
+             * Wald's sequential probability ratio test to reject a bad
+             * hypothesis before all the data are evaluated (Matas and Chum,
+             * "Randomized RANSAC with sequential probability ratio test",
+             * ICCV 2005).
+             */
+            struct SequentialTest
+            {
+                /**
+                 * \param epsilon probability of a datum being consistent with a good model.
+                 * \param delta probability of a datum being consistent with a bad model.
+                 * \param cost time to make a hypothesis, in the unit of evaluating one datum.
+                 */
+                SequentialTest(double epsilon, double delta, double cost);
+                inline bool IsEnabled() const { return threshold > 0; }
+
+                double consistent;   ///< log-likelihood ratio update of a consistent datum
+                double inconsistent; ///< log-likelihood ratio update of an inconsistent datum
+                double threshold;    ///< log of the decision threshold to reject a hypothesis
+            };
+
+            /**
+             * Randomly permuted chunks of the evaluation data.
+             */
+            struct Chunks
+            {
+                std::vector<GeometricMapping> data; ///< chunk data extracted from the objective
+                std::vector<Indices> indices;       ///< positions of the chunk elements in the objective data
+            };
+
+            InlierSelector() : threshold(-1), running(0) {}
 
             InlierSelector(AlignmentObjective::ConstOwn& objective, double threshold)
-            : objective(objective), threshold(threshold) {}
+            : objective(objective), threshold(threshold), running(0) {}
 
             bool operator() (const EuclideanTransform& tform, IndexList& inliers) const;
-            bool operator() (const EuclideanTransform& tform, IndexList& inliers, IndexList& outliers) const;
+            bool operator() (const EuclideanTransform& tform, IndexList& inliers, IndexList& outliers, int depth = CV_64F) const;
+
+            /**
+             * Evaluate the data chunk by chunk and stop as soon as the test
+             * decides the transform is a bad model.
+             *
+             * \param tform the transform to evaluate.
+             * \param chunks evaluation data made by Split().
+             * \param test the sequential test.
+             * \param inliers sorted indices of inliers, incomplete if rejected.
+             * \param outliers sorted indices of outliers, incomplete if rejected.
+             * \param rejected set to true if the evaluation is abandoned.
+             * \param depth precision of the residuals, either CV_32F or CV_64F.
+             * \return true if the evaluation is done or abandoned, false on error.
+             */
+            bool operator() (const EuclideanTransform& tform, const Chunks& chunks, const SequentialTest& test, IndexList& inliers, IndexList& outliers, bool& rejected, int depth = CV_64F) const;
+
+            /**
+             * Split the data of the objective into randomly permuted chunks.
+             *
+             * \param size maximum number of elements per chunk.
+             * \param rng random number generator for the permutation.
+             * \param chunks the split data.
+             */
+            void Split(size_t size, cv::RNG& rng, Chunks& chunks) const;
+
             inline bool IsEnabled() const { return threshold > 0; }
 
             AlignmentObjective::ConstOwn objective;
             double threshold;
-            mutable Speedometre metre;
+            mutable Speedometre metre; ///< ticks while at least one evaluation is in progress
+            mutable size_t running;    ///< number of evaluations in progress
+
+        private:
+            void StartMetre() const;
+            void StopMetre(size_t amount) const;
         };
 
         /**
@@ -67,7 +127,35 @@ namespace seq2map
          */
         virtual AlignmentObjective::Own GetSubObjective(const IndexList& indices) const = 0;
 
+        /**
+         * Evaluate the objective over all the data.
+         */
+        virtual cv::Mat operator() (const EuclideanTransform& tform) const { return Evaluate(tform, m_data); }
+
+        /**
+         * Evaluate the objective over a part of the data, which has to be
+         * extracted from GetData() to stay in the normalised form.
+         */
+        cv::Mat operator() (const EuclideanTransform& tform, const GeometricMapping& data) const { return Evaluate(tform, data); }
+
+        /**
+         * Evaluate the objective over a part of the data in the given
+         * precision. Objectives without a single-precision implementation
+         * evaluate in double precision whatever the depth is.
+         *
+         * \param depth CV_32F for single precision, or CV_64F.
+         */
+        cv::Mat operator() (const EuclideanTransform& tform, const GeometricMapping& data, int depth) const
+        { return depth == CV_32F ? EvaluateSingle(tform, data) : Evaluate(tform, data); }
+
     protected:
+        virtual cv::Mat Evaluate(const EuclideanTransform& tform, const GeometricMapping& data) const = 0;
+
+        /**
+         * Single-precision evaluation, falling back to Evaluate() by default.
+         */
+        virtual cv::Mat EvaluateSingle(const EuclideanTransform& tform, const GeometricMapping& data) const { return Evaluate(tform, data); }
+
         GeometricMapping m_data;
     };
 
@@ -100,13 +188,14 @@ namespace seq2map
 
         virtual AlignmentObjective::Own GetSubObjective(const IndexList& indices) const;
 
+        EuclideanTransform M0;
+        EuclideanTransform M1;
+
+    protected:
         //
         // Evaluation
         //
-        virtual cv::Mat operator() (const EuclideanTransform& tform) const;
-
-        EuclideanTransform M0;
-        EuclideanTransform M1;
+        virtual cv::Mat Evaluate(const EuclideanTransform& tform, const GeometricMapping& data) const;
 
     private:
         ProjectionModel::ConstOwn m_src;
@@ -133,12 +222,35 @@ namespace seq2map
 
         virtual AlignmentObjective::Own GetSubObjective(const IndexList& indices) const;
 
+        /**
+         * Evaluate the residuals by a fused kernel that transforms, projects,
+         * propagates the covariances and computes the distances of a block of
+         * points at a time in structure-of-arrays form, without allocating
+         * memory. The kernel covers pinhole and Bouguet models, optionally
+         * posed, with Euclidean, weighted Euclidean and 3D Mahalanobis metrics.
+         *
+         * \param tform transform applied to the source geometry.
+         * \param data correspondences to be evaluated.
+         * \param residuals buffer of data.GetSize() elements receiving the distances.
+         * \return true if the residuals are written, false if the model, the
+         *         metric or the data layout is not covered by the kernel.
+         */
+        bool EvaluateFused(const EuclideanTransform& tform, const GeometricMapping& data, double* residuals) const;
+
+        /**
+         * Single-precision version of the fused kernel, which carries twice
+         * as many points per SIMD register. The accuracy suits inlier
+         * selection rather than optimisation.
+         */
+        bool EvaluateFused(const EuclideanTransform& tform, const GeometricMapping& data, float* residuals) const;
+
+    protected:
         //
         // Evaluation
         //
-        virtual cv::Mat operator() (const EuclideanTransform& tform) const;
+        virtual cv::Mat Evaluate(const EuclideanTransform& tform, const GeometricMapping& data) const;
+        virtual cv::Mat EvaluateSingle(const EuclideanTransform& tform, const GeometricMapping& data) const;
 
-    protected:
         ProjectionModel::ConstOwn m_proj;
         bool m_forward;
 
@@ -207,10 +319,11 @@ namespace seq2map
 
         virtual AlignmentObjective::Own GetSubObjective(const IndexList& indices) const;
 
+    protected:
         //
         // Evaluation
         //
-        virtual cv::Mat operator() (const EuclideanTransform& tform) const;
+        virtual cv::Mat Evaluate(const EuclideanTransform& tform, const GeometricMapping& data) const;
 
     private:
         struct GradientImage
@@ -240,10 +353,11 @@ namespace seq2map
 
         virtual AlignmentObjective::Own GetSubObjective(const IndexList& indices) const;
 
+    protected:
         //
         // Evaluation
         //
-        virtual cv::Mat operator() (const EuclideanTransform& tform) const;
+        virtual cv::Mat Evaluate(const EuclideanTransform& tform, const GeometricMapping& data) const;
     };
 
     /**
@@ -262,6 +376,8 @@ namespace seq2map
             bool valid;
         };
 
+        typedef std::vector<Estimate> Estimates;
+
         /**
          * Solve relative pose from the source geometry to the target specified by mapping.
          *
@@ -271,6 +387,19 @@ namespace seq2map
          * \return True if the estimate is valid, otherwise false.
          */
         virtual bool operator() (const GeometricMapping& mapping, Estimate& estimate) const = 0;
+
+        /**
+         * Solve all the poses consistent with the correspondences. A minimal
+         * solver may find more than one pose, which are left to the caller to
+         * disambiguate. The default implementation returns the only estimate
+         * made by operator().
+         *
+         * \param mapping Correspondences used to find the poses.
+         * \param estimates Candidate poses, empty if the data admit no solution.
+         *
+         * \return True if the solver runs successfully, otherwise false.
+         */
+        virtual bool Solve(const GeometricMapping& mapping, Estimates& estimates) const;
         
         /**
          * Get the minimum number of correspondences required to yeild a valid pose estimate.
@@ -286,15 +415,38 @@ namespace seq2map
     class EssentialMatrixDecomposer : public PoseEstimator
     {
     public:
-        EssentialMatrixDecomposer(const ProjectionModel::ConstOwn& srcProj, const ProjectionModel::ConstOwn& dstProj)
-        : m_srcProj(srcProj), m_dstProj(dstProj) {}
+        enum Method
+        {
+            EIGHT_POINT, ///< solve by cv::findEssentialMat from at least eight correspondences
+            FIVE_POINT   ///< solve a minimal set by the five-point method of Li and Hartley, which yields up to ten poses; requires WITH_FIVEPOINTS
+        };
 
+        EssentialMatrixDecomposer(const ProjectionModel::ConstOwn& srcProj, const ProjectionModel::ConstOwn& dstProj, Method method = EIGHT_POINT)
+        : m_srcProj(srcProj), m_dstProj(dstProj), m_method(method) {}
+
+        /**
+         * Solve the pose by cv::findEssentialMat. A minimal set of the
+         * five-point method is rejected since its solutions are equally
+         * consistent with the data; use Solve() to get all of them.
+         */
         virtual bool operator() (const GeometricMapping& mapping, Estimate& estimate) const;
-        virtual size_t GetMinPoints() const { return 8; }
+
+        /**
+         * Solve the candidate poses. Each essential matrix from a minimal set
+         * is decomposed to the pose that puts all the correspondences in front
+         * of both cameras; those failing the cheirality test are dropped.
+         * Non-minimal sets are solved as in operator().
+         */
+        virtual bool Solve(const GeometricMapping& mapping, Estimates& estimates) const;
+        virtual size_t GetMinPoints() const { return m_method == FIVE_POINT ? 5 : 8; }
 
     private:
+        bool Backproject(const GeometricMapping& mapping, GeometricMapping& bpm) const;
+        static size_t Decompose(const cv::Mat& E, const GeometricMapping& bpm, EuclideanTransform& pose);
+
         const ProjectionModel::ConstOwn m_srcProj;
         const ProjectionModel::ConstOwn m_dstProj;
+        const Method m_method;
     };
 
     /**
@@ -303,13 +455,44 @@ namespace seq2map
     class PerspevtivePoseEstimator : public PoseEstimator
     {
     public:
-        PerspevtivePoseEstimator(const ProjectionModel::ConstOwn& proj) : m_proj(proj) {}
+        enum Method
+        {
+            EPNP, ///< solve by cv::solvePnP with the EPnP method
+            P3P   ///< solve a minimal set by the closed-form Lambda Twist method, which yields up to four poses
+        };
+
+        PerspevtivePoseEstimator(const ProjectionModel::ConstOwn& proj, Method method = EPNP)
+        : m_proj(proj), m_method(method) {}
 
+        /**
+         * Solve the pose by cv::solvePnP. A minimal set of the P3P method is
+         * rejected since its solutions are equally consistent with the data;
+         * use Solve() to get all of them.
+         */
         virtual bool operator() (const GeometricMapping& mapping, Estimate& estimate) const;
-        virtual size_t GetMinPoints() const { return 6; }
+
+        /**
+         * Solve the candidate poses. A minimal set of three correspondences
+         * gives the poses that put all the points in front of the camera.
+         * Non-minimal sets are solved as in operator().
+         */
+        virtual bool Solve(const GeometricMapping& mapping, Estimates& estimates) const;
+        virtual size_t GetMinPoints() const { return m_method == P3P ? 3 : 6; }
 
     private:
+        /**
+         * Lambda Twist P3P solver of Persson and Nordberg.
+         *
+         * \param x three object points.
+         * \param y unit bearing vectors of the three image points.
+         * \param R rotations of the solutions.
+         * \param t translations of the solutions.
+         * \return number of solutions, up to four.
+         */
+        static int SolveP3P(const cv::Vec3d x[3], const cv::Vec3d y[3], cv::Matx33d R[4], cv::Vec3d t[4]);
+
         const ProjectionModel::ConstOwn m_proj;
+        const Method m_method;
     };
 
     /**
@@ -349,6 +532,7 @@ namespace seq2map
         InversePoseEstimator(PoseEstimator::ConstOwn estimator) : m_estimator(estimator) {}
 
         virtual bool operator() (const GeometricMapping& mapping, Estimate& estimate) const;
+        virtual bool Solve(const GeometricMapping& mapping, Estimates& estimates) const;
         virtual size_t GetMinPoints() const { return m_estimator ? m_estimator->GetMinPoints() : 0; }
 
     private:
@@ -363,9 +547,11 @@ namespace seq2map
     public:
         enum Strategy
         {
-            RANSAC,
+            RANSAC,          ///< uniform sampling with the iteration bound derived from the minimum inlier ratio
             LMEDS,
-            MSAC
+            MSAC,
+            ADAPTIVE_RANSAC, ///< uniform sampling with the iteration bound tightened by the best inlier ratio found so far
+            PROSAC           ///< progressive sampling from the best ranked correspondences, with adaptive termination
         };
 
         typedef std::vector<AlignmentObjective::InlierSelector> Selectors;
@@ -375,7 +561,9 @@ namespace seq2map
         // Constructor
         //
         ConsensusPoseEstimator()
-        : m_maxIter(100), m_minInlierRatio(0.5f), m_confidence(0.95f), m_optimisation(false), m_verbose(false), m_threaded(true) {}
+        : m_strategy(RANSAC), m_maxIter(100), m_minInlierRatio(0.5f), m_confidence(0.95f), m_optimisation(false), m_verbose(false), m_threads(0),
+          m_sequentialTest(false), m_sprtDelta(0.05f), m_sprtCost(200), m_chunkSize(64),
+          m_localOptimisation(false), m_loIterations(5), m_loMaxRuns(10), m_singlePrecision(false) {}
 
         //
         // Pose estimation
@@ -401,32 +589,164 @@ namespace seq2map
         inline void DisableOptimisation() { m_optimisation = false; }
         inline void SetVerbose(bool verbose) { m_verbose = verbose; }
 
+        /**
+         * Enable early rejection of hypotheses by Wald's sequential probability
+         * ratio test. The data of each selector are evaluated in randomly
+         * permuted chunks and a hypothesis is abandoned as soon as it is
+         * unlikely to reach the minimum inlier ratio.
+         *
+         * \param delta probability of a datum being consistent with a bad hypothesis.
+         * \param cost time to make a hypothesis, in the unit of evaluating one datum.
+         * \param chunk number of data evaluated at a time.
+         */
+        inline void EnableSequentialTest(double delta = 0.05f, double cost = 200, size_t chunk = 64)
+        { m_sequentialTest = true; m_sprtDelta = delta; m_sprtCost = cost; m_chunkSize = chunk > 0 ? chunk : 1; }
+        inline void DisableSequentialTest() { m_sequentialTest = false; }
+
+        /**
+         * Enable local optimisation of LO-RANSAC (Chum et al., DAGM 2003).
+         * Each time a hypothesis beats the best one so far, the pose is
+         * refined against all the objectives over its inliers and kept if the
+         * refined pose gathers more inliers.
+         *
+         * \param iterations number of damped Gauss-Newton updates per run.
+         * \param maxRuns maximum number of runs in a call.
+         */
+        inline void EnableLocalOptimisation(size_t iterations = 5, size_t maxRuns = 10)
+        { m_localOptimisation = true; m_loIterations = iterations > 0 ? iterations : 1; m_loMaxRuns = maxRuns; }
+        inline void DisableLocalOptimisation() { m_localOptimisation = false; }
+
+        /**
+         * Evaluate the hypotheses in single precision, as far as the
+         * objectives support it. The post-estimation optimisation and the
+         * final inlier selection are always done in double precision.
+         */
+        inline void EnableSinglePrecision()  { m_singlePrecision = true;  }
+        inline void DisableSinglePrecision() { m_singlePrecision = false; }
+
+        /**
+         * Set the number of hypotheses evaluated concurrently by the shared
+         * ThreadPool. Samples are always drawn by the calling thread and the
+         * hypotheses are compared in the order they are drawn, hence the
+         * outcome under a fixed random seed does not depend on the setting.
+         *
+         * \param threads number of concurrent hypotheses; zero to follow the
+         *        size of the pool, and one to run on the calling thread only.
+         */
+        inline void SetThreads(size_t threads) { m_threads = threads; }
+        inline size_t GetThreads() const       { return m_threads; }
+
+        /**
+         * Set the ranking of correspondences used by the PROSAC strategy.
+         *
+         * \param order indices of the correspondences of the solver's mapping,
+         *        from the most to the least reliable one. An empty or
+         *        incomplete ranking makes PROSAC fall back to uniform sampling.
+         */
+        inline void SetSamplingOrder(const Indices& order) { m_order = order; }
+        inline const Indices& GetSamplingOrder() const     { return m_order; }
+
         inline void AddSelector(const AlignmentObjective::InlierSelector& selector) { m_selectors.push_back(selector); }
         inline void SetSolver(PoseEstimator::ConstOwn& solver) { m_solver = solver; }
         inline Selectors& GetSelectors() { return m_selectors; }
         size_t GetPopulation() const;
 
+        /**
+         * Number of trials needed to draw at least one outlier-free sample
+         * with the given confidence, k = log(1 - p) / log(1 - w^s).
+         *
+         * \param inlierRatio ratio w of inliers in the population.
+         * \param samples size s of a sample.
+         * \param confidence probability p of drawing an outlier-free sample.
+         * \param maxIter upper bound of the result.
+         * \return the number of trials rounded up, capped by maxIter.
+         */
+        static size_t GetRequiredIterations(double inlierRatio, size_t samples, double confidence, size_t maxIter);
+
     private:
-        struct EvalResult
+        struct Hypothesis
         {
-            bool success;
-            IndexList accepted;
-            IndexList rejected;
+            Hypothesis() : solved(false), evaluated(false), rejected(false), candidates(0), hits(0), solveTime(0), evalTime(0) {}
+
+            IndexList samples;   ///< indices of the minimal set of correspondences
+            Estimate  trial;     ///< the best pose solved from the samples
+            IndexLists inliers;  ///< per-selector inliers
+            IndexLists outliers; ///< per-selector outliers
+            bool   solved;       ///< the inner pose estimator succeeded
+            bool   evaluated;    ///< all the selectors succeeded
+            bool   rejected;     ///< no pose solved from the samples survives the sequential test
+            size_t candidates;   ///< number of poses solved from the samples
+            size_t hits;         ///< total number of inliers
+            double solveTime;    ///< time spent on solving, in seconds
+            double evalTime;     ///< time spent on evaluation, in seconds
         };
 
-        static IndexList DrawSamples(size_t population, size_t samples);
-        static void EvalThread(const AlignmentObjective::InlierSelector& g, const EuclideanTransform& tf, EvalResult& result);
+        /**
+         * Progressive sampling of PROSAC (Chum and Matas, CVPR 2005). The
+         * samples are drawn from a growing set of the top ranked
+         * correspondences, which reaches the whole population after the
+         * given number of trials.
+         */
+        class ProgressiveSampler
+        {
+        public:
+            ProgressiveSampler(const Indices& order, size_t samples, size_t trials);
+            IndexList operator() (cv::RNG& rng);
+
+        private:
+            const Indices& m_order;
+            const size_t m_samples;
+            size_t m_trial; ///< index of the current trial
+            size_t m_size;  ///< size of the top ranked subset to draw samples from
+            double m_tn;    ///< expected number of trials drawing only from the subset
+            size_t m_tn1;   ///< trial at which the subset grows
+        };
+
+        static IndexList DrawSamples(size_t population, size_t samples, cv::RNG& rng);
+        typedef std::vector<AlignmentObjective::InlierSelector::Chunks> ChunksList;
+
+        void EvalHypothesis(const GeometricMapping& mapping, const ChunksList* chunks, const AlignmentObjective::InlierSelector::SequentialTest* test, Hypothesis& hypothesis) const;
+
+        /**
+         * Refine a pose against the sub-objectives of all the selectors built
+         * from the given inliers. Shared by the final optimisation and the
+         * local optimisation of LO-RANSAC, which configure the solver.
+         *
+         * \param inliers per-selector inliers.
+         * \param levmar the configured solver.
+         * \param pose initial pose, replaced by the refined one on success.
+         * \param state final state of the solver.
+         * \return true if the solver succeeds.
+         */
+        bool Refine(const IndexLists& inliers, LevenbergMarquardtAlgorithm& levmar, EuclideanTransform& pose, LeastSquaresSolver::State& state) const;
+
+        /**
+         * Refine the pose of a hypothesis over its inliers and re-evaluate it.
+         *
+         * \return true if the refined pose has more inliers, in which case
+         *         the hypothesis is updated.
+         */
+        bool LocalOptimise(Hypothesis& hypothesis) const;
 
         Strategy m_strategy;
         PoseEstimator::ConstOwn m_solver;
         Selectors m_selectors;
+        Indices m_order;
 
         size_t m_maxIter;
         double m_minInlierRatio;
         double m_confidence;
         bool m_optimisation;
         bool m_verbose;
-        bool m_threaded;
+        size_t m_threads;
+        bool   m_sequentialTest;
+        double m_sprtDelta;
+        double m_sprtCost;
+        size_t m_chunkSize;
+        bool   m_localOptimisation;
+        size_t m_loIterations;
+        size_t m_loMaxRuns;
+        bool   m_singlePrecision;
     };
 
     /**
@@ -523,7 +843,7 @@ namespace seq2map
              * \return Transformed estimate.
              */
             Estimate Transform(const EuclideanTransform& tform) const
-            { return Estimate(tform(Geometry(structure)), metric ? metric->Transform(tform) : Metric::Own()); }
+            { Geometry g(structure.shape, structure.mat); return Estimate(tform(g), metric ? metric->Transform(tform) : Metric::Own()); }
 
             Geometry structure;
             Metric::Own metric;
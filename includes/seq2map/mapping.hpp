@@ -343,7 +343,7 @@ namespace seq2map
         };
 
         MultiObjectiveOutlierFilter(size_t maxIterations, double minInlierRatio, double confidence, double sigma)
-        : maxIterations(maxIterations), minInlierRatio(minInlierRatio), confidence(confidence), optimisation(true), sigma(sigma) {}
+        : maxIterations(maxIterations), minInlierRatio(minInlierRatio), confidence(confidence), optimisation(true), sigma(sigma), strategy(ConsensusPoseEstimator::RANSAC), sequentialTest(false), localOptimisation(false), singlePrecision(false) {}
 
         virtual bool operator() (ImageFeatureMap& map, IndexList& inliers);
 
@@ -354,6 +354,10 @@ namespace seq2map
         double confidence;
         double sigma;
         bool optimisation;
+        ConsensusPoseEstimator::Strategy strategy; ///< sampling and termination strategy; PROSAC ranks matches by descriptor distance
+        bool sequentialTest; ///< abandon bad hypotheses early by the sequential probability ratio test
+        bool localOptimisation; ///< refine each new best hypothesis over its inliers as in LO-RANSAC
+        bool singlePrecision; ///< evaluate hypotheses in single precision; the final refinement stays in double
     };
 
     /**
@@ -445,21 +449,33 @@ namespace seq2map
         {
             OutlierRejectionOptions(int model)
             : model(model),
+              strategy(ConsensusPoseEstimator::RANSAC),
               maxIterations  (30   ),
               minInlierRatio ( 0.50),
               confidence     ( 0.50),
               epipolarEps    ( 1e3 ),
               sigma          ( 1.0f),
               fastMetric     (false),
+              sequentialTest (false),
+              fivePoint      (false),
+              threePoint     (false),
+              localOptim     (false),
+              singlePrecision(false),
               photometricDamp( 1.0f) {}
 
             int model;              ///< strategies to identify outliers from noisy feature matches
+            ConsensusPoseEstimator::Strategy strategy; ///< sampling and termination strategy of the consensus estimator
             size_t maxIterations;   ///< the upper bound of trials
             double minInlierRatio;  ///< the percentage of inliers minimally required to accept a motion hypothesis
             double confidence;      ///< desired confidence to obtain a valid result, from zero to one
             double epipolarEps;     ///< threshold of the epipolar objective, in the normalised image pixel
             double sigma;           ///< threshold to determine if a model is fit or not
             bool fastMetric;        ///< reduce Mahalanobis metric to a weighted Euclidean one for acceleration
+            bool sequentialTest;    ///< abandon bad motion hypotheses after evaluating part of the data
+            bool fivePoint;         ///< solve epipolar alignment hypotheses from five correspondences instead of eight
+            bool threePoint;        ///< solve projective alignment hypotheses from three correspondences instead of six
+            bool localOptim;        ///< refine each new best motion hypothesis over its inliers during the consensus
+            bool singlePrecision;   ///< evaluate motion hypotheses in single precision, leaving the final refinement in double
             double photometricDamp; ///< damping factor for photometric alignment model
         };
 
@@ -480,6 +496,16 @@ namespace seq2map
             bool extractDescriptor;  ///< Recompute descriptor for each recovered landmark, set to false to re-use a previously extracted descriptor.
         };
 
+        /**
+         * Options for motion-guided matching.
+         */
+        struct GuidedMatchingOptions
+        {
+            GuidedMatchingOptions() : radius(0) {}
+
+            double radius; ///< Maximum distance between a predicted feature location and a match hypothesis, in image pixels. Set to a non-positive value to disable guided matching.
+        };
+
         /**
          * Feature tracking statistics updated each time the operator is in action.
          */
@@ -516,18 +542,19 @@ namespace seq2map
         public:
             EpipolarObjectiveBuilder(
                 const boost::shared_ptr<const PosedProjection>& pi, const boost::shared_ptr<const PosedProjection>& pj,
-                double epsilon, AlignmentObjective::InlierSelector::Stats& stats)
-            : pi(pi), pj(pj), epsilon(epsilon), ObjectiveBuilder(stats) {}
+                double epsilon, EssentialMatrixDecomposer::Method method, AlignmentObjective::InlierSelector::Stats& stats)
+            : pi(pi), pj(pj), epsilon(epsilon), method(method), ObjectiveBuilder(stats) {}
 
             virtual bool AddData(size_t i, size_t j, size_t k, const ImageFeature& fi, const ImageFeature& fj, size_t localIdx);
             virtual bool Build(GeometricMapping& data, AlignmentObjective::InlierSelector& selector, double sigma);
-            virtual PoseEstimator::Own GetSolver() const { return PoseEstimator::Own(new EssentialMatrixDecomposer(pi, pj)); }
+            virtual PoseEstimator::Own GetSolver() const { return PoseEstimator::Own(new EssentialMatrixDecomposer(pi, pj, method)); }
             virtual String ToString() const { return "EPIPOLAR"; }
 
             const boost::shared_ptr<const PosedProjection> pi;
             const boost::shared_ptr<const PosedProjection> pj;
 
             double epsilon;
+            EssentialMatrixDecomposer::Method method;
 
         private:
             GeometricMapping::ImageToImageBuilder m_builder;
@@ -541,8 +568,8 @@ namespace seq2map
         public:
             PerspectiveObjectiveBuilder(
                 const ProjectionModel::ConstOwn& p, const StructureEstimation::Estimate& g,
-                bool forward, bool reduceMetric, bool prebuilt, AlignmentObjective::InlierSelector::Stats& stats)
-            : p(p), g(g), forward(forward), ObjectiveBuilder(stats, reduceMetric), m_prebuilt(prebuilt) {}
+                bool forward, bool reduceMetric, bool prebuilt, PerspevtivePoseEstimator::Method method, AlignmentObjective::InlierSelector::Stats& stats)
+            : p(p), g(g), forward(forward), method(method), ObjectiveBuilder(stats, reduceMetric), m_prebuilt(prebuilt) {}
 
             virtual bool AddData(size_t i, size_t j, size_t k, const ImageFeature& fi, const ImageFeature& fj, size_t localIdx);
             virtual bool Build(GeometricMapping& data, AlignmentObjective::InlierSelector& selector, double sigma);
@@ -554,6 +581,7 @@ namespace seq2map
             const ProjectionModel::ConstOwn p;
             const StructureEstimation::Estimate& g;
             const bool forward;
+            const PerspevtivePoseEstimator::Method method;
 
         private:
             GeometricMapping::WorldToImageBuilder m_builder;
@@ -653,6 +681,17 @@ namespace seq2map
          */
         IndexList GetFeatureImageIndices(const ImageFeatureSet& f, const cv::Size& imageSize) const;
 
+        /**
+         * Predict the image locations of features in the target frame.
+         *
+         * \param g Structure of the features in the source frame.
+         * \param p Projection model of the target frame.
+         * \param motion Pose of the target frame with respect to the source.
+         * \param n Number of features.
+         * \return Predicted locations, with NaN for the features not having a valid structure.
+         */
+        Points2F PredictFeatureLocations(const StructureEstimation::Estimate& g, const ProjectionModel& p, const EuclideanTransform& motion, size_t n) const;
+
         /**
          * Find features in the next frame using optical flow.
          *
@@ -702,6 +741,7 @@ namespace seq2map
         ConflictResolution policy; ///< Landmark merge policy
         OutlierRejectionOptions outlierRejection; ///< outlier rejection options
         InlierInjectionOptions  inlierInjection;  ///< inlier recovery options
+        GuidedMatchingOptions   guidedMatching;   ///< motion-guided matching options
         TriangulationMethod     triangulation;    ///< triangulation method
         bool rendering;
 
@@ -709,13 +749,16 @@ namespace seq2map
         static bool StringToAlignment(const String& flag, int& model);
         static bool StringToFlow(const String& flow, int& scheme);
         static bool StringToTriangulation(const String& triangulation, TriangulationMethod& method);
+        static bool StringToStrategy(const String& strategy, ConsensusPoseEstimator::Strategy& value);
         static String AlignmentToString(int model);
         static String FlowToString(int scheme);
         static String TriangulationToString(TriangulationMethod method);
+        static String StrategyToString(ConsensusPoseEstimator::Strategy strategy);
 
         String m_alignString;
         String m_flowString;
         String m_triangulation;
+        String m_strategy;
         double m_epipolarEps;
     };
 }
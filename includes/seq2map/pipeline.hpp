@@ -0,0 +1,229 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+#include <deque>
+#include <map>
+#include <boost/thread.hpp>
+#include <seq2map/common.hpp>
+
+namespace seq2map
+{
+    /**
+     * A thread-safe FIFO queue of limited capacity connecting two stages of
+     * a pipeline. Producers are blocked when the queue is full, and consumers
+     * are blocked when it is empty, which propagates backpressure upstream.
+     */
+    template<typename T>
+    class BoundedQueue
+    {
+    public:
+        /**
+         * \param capacity maximum number of queued items.
+         * \param producers number of producers, each has to call Close() when
+         *        it finishes; the queue is closed after the last one does so.
+         */
+        /* ctor */ BoundedQueue(size_t capacity, size_t producers = 1)
+        : m_capacity(std::max<size_t>(capacity, 1)), m_producers(producers), m_aborted(false) {}
+
+        /**
+         * Enqueue an item, blocking while the queue is full.
+         *
+         * \return false if the queue has been aborted.
+         */
+        bool Push(const T& item)
+        {
+            boost::unique_lock<boost::mutex> locker(m_mtx);
+
+            while (!m_aborted && m_items.size() >= m_capacity)
+            {
+                m_notFull.wait(locker);
+            }
+
+            if (m_aborted)
+            {
+                return false;
+            }
+
+            m_items.push_back(item);
+            m_notEmpty.notify_one();
+
+            return true;
+        }
+
+        /**
+         * Dequeue an item, blocking while the queue is empty.
+         *
+         * \return false if the queue is aborted, or closed and drained.
+         */
+        bool Pop(T& item)
+        {
+            boost::unique_lock<boost::mutex> locker(m_mtx);
+
+            while (!m_aborted && m_items.empty() && m_producers > 0)
+            {
+                m_notEmpty.wait(locker);
+            }
+
+            if (m_aborted || m_items.empty())
+            {
+                return false;
+            }
+
+            item = m_items.front();
+            m_items.pop_front();
+            m_notFull.notify_one();
+
+            return true;
+        }
+
+        /**
+         * Signal that a producer has finished. Items already in the queue
+         * can still be popped.
+         */
+        void Close()
+        {
+            boost::lock_guard<boost::mutex> locker(m_mtx);
+
+            if (m_producers > 0 && --m_producers == 0)
+            {
+                m_notEmpty.notify_all();
+            }
+        }
+
+        /**
+         * Discard all the queued items and release blocked threads.
+         */
+        void Abort()
+        {
+            boost::lock_guard<boost::mutex> locker(m_mtx);
+
+            m_aborted = true;
+            m_items.clear();
+            m_notEmpty.notify_all();
+            m_notFull.notify_all();
+        }
+
+    private:
+        const size_t  m_capacity;
+        size_t        m_producers;
+        bool          m_aborted;
+        std::deque<T> m_items;
+        boost::mutex  m_mtx;
+        boost::condition_variable m_notFull;
+        boost::condition_variable m_notEmpty;
+    };
+
+    /**
+     * Restores the sequential order of items processed concurrently. Indices
+     * are handed out by the buffer, which holds back a new index until the
+     * number of items in flight falls below the window size. Completed items
+     * are then released strictly in the order of their indices.
+     */
+    template<typename T>
+    class ReorderBuffer
+    {
+    public:
+        /**
+         * \param items total number of items to be processed.
+         * \param window maximum number of items in flight.
+         */
+        /* ctor */ ReorderBuffer(size_t items, size_t window)
+        : m_items(items), m_window(std::max<size_t>(window, 1)), m_next(0), m_released(0), m_aborted(false) {}
+
+        /**
+         * Get the index of the next item to be processed, blocking while the
+         * window is full.
+         *
+         * \return false if all the indices have been handed out or the
+         *         buffer has been aborted.
+         */
+        bool Next(size_t& idx)
+        {
+            boost::unique_lock<boost::mutex> locker(m_mtx);
+
+            while (!m_aborted && m_next < m_items && m_next >= m_released + m_window)
+            {
+                m_itemReleased.wait(locker);
+            }
+
+            if (m_aborted || m_next >= m_items)
+            {
+                return false;
+            }
+
+            idx = m_next++;
+
+            return true;
+        }
+
+        /**
+         * Deliver a completed item.
+         */
+        void Put(size_t idx, const T& item)
+        {
+            boost::lock_guard<boost::mutex> locker(m_mtx);
+
+            m_completed[idx] = item;
+            m_itemPut.notify_all();
+        }
+
+        /**
+         * Take the next item in order, blocking until it is completed.
+         *
+         * \return false if all the items have been released or the buffer
+         *         has been aborted.
+         */
+        bool Get(T& item)
+        {
+            boost::unique_lock<boost::mutex> locker(m_mtx);
+
+            if (m_released >= m_items)
+            {
+                return false;
+            }
+
+            typename std::map<size_t, T>::iterator itr;
+
+            while (!m_aborted && (itr = m_completed.find(m_released)) == m_completed.end())
+            {
+                m_itemPut.wait(locker);
+            }
+
+            if (m_aborted)
+            {
+                return false;
+            }
+
+            item = itr->second;
+            m_completed.erase(itr);
+            m_released++;
+            m_itemReleased.notify_all();
+
+            return true;
+        }
+
+        /**
+         * Stop handing out indices and release blocked threads.
+         */
+        void Abort()
+        {
+            boost::lock_guard<boost::mutex> locker(m_mtx);
+
+            m_aborted = true;
+            m_completed.clear();
+            m_itemPut.notify_all();
+            m_itemReleased.notify_all();
+        }
+
+    private:
+        const size_t m_items;
+        const size_t m_window;
+        size_t m_next;
+        size_t m_released;
+        bool   m_aborted;
+        std::map<size_t, T> m_completed;
+        boost::mutex m_mtx;
+        boost::condition_variable m_itemPut;
+        boost::condition_variable m_itemReleased;
+    };
+}
+#endif // PIPELINE_HPP
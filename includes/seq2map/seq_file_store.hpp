@@ -1,12 +1,409 @@
 #ifndef SEQ_FILE_STORE_HPP
 #define SEQ_FILE_STORE_HPP
 
+#include <fstream>
+#include <list>
+#include <sstream>
+#include <boost/cstdint.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
 #include <seq2map/common.hpp>
 
 namespace seq2map
 {
     /**
-     * 
+     * A single-file container packing a sequence of binary items. The items
+     * are appended one after another, each aligned to a 64-byte boundary, and
+     * indexed by an offset table written to the end of the file. For reading
+     * the container is memory-mapped so an item can be accessed without any
+     * per-item file operation.
+     *
+     * The layout of a container is:
+     *
+     *   [magic|padding] [item 0] [item 1] ... [item n-1] [table] [trailer]
+     *
+     * where the table holds n (offset,bytes) pairs and the trailer holds the
+     * offset of the table, the number of items and the magic number again.
+     */
+    class PackedFileContainer
+    {
+    public:
+        /* ctor */ PackedFileContainer() : m_dataEnd(0), m_mappedEnd(0), m_dirty(false) {}
+        /* dtor */ virtual ~PackedFileContainer() { Commit(); }
+
+        /**
+         * Create an empty container for writing. Existing file is truncated.
+         */
+        bool Create(const Path& path);
+
+        /**
+         * Open an existing container and memory-map it for reading. Items
+         * can still be appended to the opened container.
+         */
+        bool Open(const Path& path);
+
+        /**
+         * Append an item to the end of the container.
+         */
+        bool Append(const String& bytes);
+
+        /**
+         * Write the offset table and the trailer to make the container
+         * readable. This is done automatically on destruction.
+         */
+        bool Commit();
+
+        /**
+         * Get a read-only view of an item. The returned block holds a shared
+         * reference to the mapped region so it remains valid even after the
+         * container is closed.
+         */
+        MemoryBlock GetItem(size_t idx);
+
+        inline size_t GetItems() const { return m_items.size(); }
+        inline Path   GetPath()  const { return m_path; }
+
+        static const size_t Alignment = 64;
+
+    private:
+        struct Entry
+        {
+            boost::uint64_t offset;
+            boost::uint64_t bytes;
+        };
+
+        typedef std::vector<Entry> Entries;
+
+        bool WriteIndex();
+        bool Map();
+
+        static const String s_magicNumber;
+
+        Path         m_path;
+        Entries      m_items;
+        std::fstream m_stream;
+        MemoryBlock  m_mapped;
+        boost::uint64_t m_dataEnd;   ///< end of the last item
+        boost::uint64_t m_mappedEnd; ///< end of the items covered by the mapping
+        bool         m_dirty;
+        boost::mutex m_mutex;
+    };
+
+    /**
+     * A least-recently-used cache of decoded items, which can be shared by
+     * stores of different item types. An item is keyed by the identifier a
+     * store registered with the cache and the index of the item in the store.
+     * Cached items are never handed out for writing; a store inserts and
+     * returns copies made by cloneItem.
+     */
+    class ItemCache : public Referenced<ItemCache>
+    {
+    public:
+        typedef std::pair<size_t, size_t> Key;
+        typedef boost::shared_ptr<const void> Item;
+
+        /**
+         * Construct a cache holding items up to the given bytes.
+         */
+        ItemCache(size_t capacity) : m_capacity(capacity), m_bytes(0), m_stores(0), m_hits(0), m_misses(0) {}
+
+        /**
+         * Get an identifier for a store to key its items.
+         */
+        size_t Register();
+
+        /**
+         * Look up an item and mark it the most recently used.
+         *
+         * \return the item, or a null pointer if not cached.
+         */
+        Item Find(const Key& key);
+
+        /**
+         * Add an item, evicting the least recently used ones if the capacity
+         * is exceeded. Items larger than the capacity are not cached.
+         */
+        void Insert(const Key& key, const Item& item, size_t bytes);
+
+        /**
+         * Remove all the items and reset the counters.
+         */
+        void Clear();
+
+        inline size_t GetCapacity() const { return m_capacity; }
+        inline size_t GetBytes()    const { return m_bytes;    }
+        inline size_t GetItems()    const { return m_index.size(); }
+        inline size_t GetHits()     const { return m_hits;     }
+        inline size_t GetMisses()   const { return m_misses;   }
+
+    private:
+        struct Entry
+        {
+            Key    key;
+            Item   item;
+            size_t bytes;
+        };
+
+        typedef std::list<Entry> Entries;
+        typedef std::map<Key, Entries::iterator> Index;
+
+        const size_t m_capacity;
+        size_t       m_bytes;
+        size_t       m_stores;
+        size_t       m_hits;
+        size_t       m_misses;
+        Entries      m_entries; ///< most recently used first
+        Index        m_index;
+        boost::mutex m_mtx;
+    };
+
+    /**
+     * Estimate the memory footprint of an item. Item types holding dynamic
+     * data should provide an overload.
+     */
+    template<typename T> size_t memoryUsage(const T& data) { return sizeof(data); }
+
+    /**
+     * Make a copy of an item that shares no writable data with the source,
+     * so a retrieved item can be modified without touching the cached one.
+     * Item types whose copies share buffers should provide an overload.
+     */
+    template<typename T> T cloneItem(const T& data) { return data; }
+
+    /**
+     * Asynchronous read-ahead of items following a declared access pattern.
+     * The items to be retrieved in the next few positions of the pattern are
+     * loaded on background threads and held until they are no longer needed
+     * in the look-ahead window, or the memory budget is reached.
+     */
+    template<typename T>
+    class ReadAheadBuffer
+    {
+    public:
+        typedef boost::function<bool(size_t, T&)> Loader;
+
+        /**
+         * Constructor.
+         *
+         * \param loader Function to read an item synchronously.
+         * \param pattern Indices of items in the order they are retrieved.
+         * \param depth Number of positions of the pattern to read ahead.
+         * \param budget Maximum bytes of items held by the buffer.
+         * \param threads Number of reading threads.
+         */
+        ReadAheadBuffer(const Loader& loader, const Indices& pattern, size_t depth, size_t budget, size_t threads)
+        : m_loader(loader), m_pattern(pattern), m_depth(depth), m_budget(budget), m_cursor(0), m_bytes(0), m_stop(false)
+        {
+            for (size_t i = 0; i < std::max(threads, (size_t)1); i++)
+            {
+                m_threads.create_thread(boost::bind(&ReadAheadBuffer<T>::Worker, this));
+            }
+        }
+
+        /**
+         * Destructor stops and joins all the reading threads.
+         */
+        virtual ~ReadAheadBuffer()
+        {
+            {
+                boost::lock_guard<boost::mutex> locker(m_mtx);
+                m_stop = true;
+            }
+
+            m_cond.notify_all();
+            m_threads.join_all();
+        }
+
+        /**
+         * Take an item from the buffer and advance along the pattern. Blocks
+         * if the item is being loaded.
+         *
+         * \return false if the item is not expected in the look-ahead window
+         *  or failed to load, in which case the caller shall read it itself.
+         */
+        bool Retrieve(size_t idx, T& data)
+        {
+            boost::unique_lock<boost::mutex> locker(m_mtx);
+
+            if (!Advance(idx))
+            {
+                return false;
+            }
+
+            typename Slots::iterator itr = m_slots.find(idx);
+            bool found = false;
+
+            if (itr != m_slots.end())
+            {
+                while (itr->second.state == Slot::LOADING)
+                {
+                    m_cond.wait(locker);
+                }
+
+                if (itr->second.state == Slot::READY)
+                {
+                    // the slot is released unless the item is due again in
+                    // the window, in which case the caller gets a copy
+                    data = Find(idx, m_cursor) == INVALID_INDEX ? itr->second.data : cloneItem(itr->second.data);
+                    found = true;
+                }
+            }
+
+            Evict();
+            m_cond.notify_all();
+
+            return found;
+        }
+
+        /**
+         * Advance along the pattern without taking the item, when it has been
+         * obtained elsewhere.
+         */
+        void Skip(size_t idx)
+        {
+            boost::lock_guard<boost::mutex> locker(m_mtx);
+
+            if (Advance(idx))
+            {
+                Evict();
+                m_cond.notify_all();
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            enum State { LOADING, READY, FAILED };
+
+            Slot() : state(LOADING), bytes(0) {}
+
+            State  state;
+            T      data;
+            size_t bytes;
+        };
+
+        typedef std::map<size_t, Slot> Slots;
+
+        /**
+         * Move the cursor past the first position of an item in the window.
+         */
+        bool Advance(size_t idx)
+        {
+            const size_t pos = Find(idx, m_cursor);
+
+            if (pos == INVALID_INDEX)
+            {
+                return false;
+            }
+
+            m_cursor = pos + 1;
+
+            return true;
+        }
+
+        /**
+         * Find the first position of an item in the look-ahead window
+         * starting from a position.
+         */
+        size_t Find(size_t idx, size_t from) const
+        {
+            const size_t until = std::min(m_cursor + m_depth, m_pattern.size());
+
+            for (size_t pos = from; pos < until; pos++)
+            {
+                if (m_pattern[pos] == idx) return pos;
+            }
+
+            return INVALID_INDEX;
+        }
+
+        /**
+         * Release the loaded items no longer needed in the window.
+         */
+        void Evict()
+        {
+            for (typename Slots::iterator itr = m_slots.begin(); itr != m_slots.end(); )
+            {
+                if (itr->second.state != Slot::LOADING && Find(itr->first, m_cursor) == INVALID_INDEX)
+                {
+                    m_bytes -= itr->second.bytes;
+                    m_slots.erase(itr++);
+                }
+                else
+                {
+                    itr++;
+                }
+            }
+        }
+
+        void Worker()
+        {
+            boost::unique_lock<boost::mutex> locker(m_mtx);
+
+            while (!m_stop)
+            {
+                // the next item in the window not yet loaded
+                const size_t until = std::min(m_cursor + m_depth, m_pattern.size());
+                size_t pos = m_cursor;
+
+                for (; pos < until && m_slots.find(m_pattern[pos]) != m_slots.end(); pos++);
+
+                // the immediately needed item is always allowed to exceed the budget
+                if (pos == until || (m_bytes >= m_budget && pos > m_cursor))
+                {
+                    m_cond.wait(locker);
+                    continue;
+                }
+
+                const size_t idx = m_pattern[pos];
+                m_slots[idx] = Slot();
+
+                locker.unlock();
+
+                T data;
+                bool loaded = false;
+
+                try
+                {
+                    loaded = m_loader(idx, data);
+                }
+                catch (std::exception& ex)
+                {
+                    E_ERROR << "error reading ahead item " << idx;
+                    E_ERROR << ex.what();
+                }
+
+                const size_t bytes = loaded ? memoryUsage(data) : 0;
+
+                locker.lock();
+
+                Slot& slot = m_slots[idx];
+                slot.state = loaded ? Slot::READY : Slot::FAILED;
+                slot.data  = data;
+                slot.bytes = bytes;
+
+                m_bytes += bytes;
+                m_cond.notify_all();
+            }
+        }
+
+        const Loader  m_loader;
+        const Indices m_pattern;
+        const size_t  m_depth;
+        const size_t  m_budget;
+        size_t        m_cursor;
+        size_t        m_bytes;
+        bool          m_stop;
+        Slots         m_slots;
+        boost::mutex  m_mtx;
+        boost::condition_variable m_cond;
+        boost::thread_group m_threads;
+    };
+
+    /**
+     * A store of items with each of them written to an individual file in
+     * the root folder, or optionally packed into a PackedFileContainer.
      */
     template <typename T>
     class SequentialFileStore
@@ -14,6 +411,27 @@ namespace seq2map
       public Persistent<Path>
     {
     public:
+        /* ctor */ SequentialFileStore() : m_cacheId(INVALID_INDEX) {}
+
+        /**
+         * Copy constructor. The read-ahead buffer is not shared with the copy.
+         */
+        SequentialFileStore(const SequentialFileStore<T>& store)
+        : m_root(store.m_root), m_filenames(store.m_filenames), m_container(store.m_container), m_cacheId(INVALID_INDEX) {}
+
+        /* dtor */ virtual ~SequentialFileStore() {}
+
+        SequentialFileStore<T>& operator= (const SequentialFileStore<T>& store)
+        {
+            m_root      = store.m_root;
+            m_filenames = store.m_filenames;
+            m_container = store.m_container;
+            m_readAhead.reset();
+            m_cache.reset();
+
+            return *this;
+        }
+
         bool Create(const Path& root, size_t allocated = 128)
         {
             if (!makeOutDir(root))
@@ -25,6 +443,9 @@ namespace seq2map
             m_root = root;
             m_filenames.clear();
             m_filenames.reserve(allocated);
+            m_container.reset();
+            m_readAhead.reset();
+            m_cache.reset();
 
             return true;
         }
@@ -54,6 +475,47 @@ namespace seq2map
             Create(root, filenames);
         }
 
+        /**
+         * Switch the store to the packed layout, in which all the items are
+         * appended to a single container file in the root folder. Items
+         * already in the store are migrated to the container.
+         *
+         * \param container File name of the container.
+         * \return true if the store is successfully packed.
+         */
+        bool Pack(const String& container = "items.pack")
+        {
+            if (IsPacked())
+            {
+                E_ERROR << "store already packed to " << m_container->GetPath();
+                return false;
+            }
+
+            boost::shared_ptr<PackedFileContainer> packed(new PackedFileContainer());
+
+            if (!packed->Create(m_root / container))
+            {
+                E_ERROR << "error creating container " << container;
+                return false;
+            }
+
+            for (size_t i = 0; i < m_filenames.size(); i++)
+            {
+                T data;
+                std::ostringstream os(std::ios::out | std::ios::binary);
+
+                if (!Retrieve(m_root / m_filenames[i], data) || !Append(os, data) || !packed->Append(os.str()))
+                {
+                    E_ERROR << "error packing " << m_filenames[i];
+                    return false;
+                }
+            }
+
+            m_container = packed;
+
+            return m_container->Commit();
+        }
+
         bool Append(const String& filename, const T& data)
         {
             // TODO: duplication check
@@ -61,6 +523,33 @@ namespace seq2map
             // ..
             // .
 
+            String bytes;
+            return Encode(filename, data, bytes) && AppendEncoded(filename, bytes);
+        }
+
+        /**
+         * Encode an item ahead of appending it by AppendEncoded(). The store
+         * is not modified so items can be encoded concurrently, then appended
+         * in order. In the packed layout the item is serialised to the buffer,
+         * otherwise the item file is written and the buffer is left empty.
+         */
+        bool Encode(const String& filename, const T& data, String& bytes) const
+        {
+            if (IsPacked())
+            {
+                std::ostringstream os(std::ios::out | std::ios::binary);
+
+                if (!Append(os, data))
+                {
+                    E_ERROR << "error encoding " << filename;
+                    return false;
+                }
+
+                bytes = os.str();
+
+                return true;
+            }
+
             Path to = m_root / filename;
 
             if (!Append(to, data))
@@ -69,6 +558,22 @@ namespace seq2map
                 return false;
             }
 
+            bytes.clear();
+
+            return true;
+        }
+
+        /**
+         * Append an item previously encoded by Encode().
+         */
+        bool AppendEncoded(const String& filename, const String& bytes)
+        {
+            if (IsPacked() && !m_container->Append(bytes))
+            {
+                E_ERROR << "error packing " << filename << " to " << m_container->GetPath();
+                return false;
+            }
+
             m_filenames.push_back(filename);
 
             return true;
@@ -82,7 +587,75 @@ namespace seq2map
                 return false;
             }
 
-            return Retrieve(m_root / m_filenames[idx], data);
+            const ItemCache::Key key(m_cacheId, idx);
+
+            if (m_cache)
+            {
+                ItemCache::Item item = m_cache->Find(key);
+
+                if (item)
+                {
+                    if (m_readAhead) m_readAhead->Skip(idx);
+
+                    data = cloneItem(*boost::static_pointer_cast<const T>(item));
+                    return true;
+                }
+            }
+
+            if (!(m_readAhead && m_readAhead->Retrieve(idx, data)) && !Load(idx, data))
+            {
+                return false;
+            }
+
+            if (m_cache)
+            {
+                m_cache->Insert(key, boost::shared_ptr<const T>(new T(cloneItem(data))), memoryUsage(data));
+            }
+
+            return true;
+        }
+
+        /**
+         * Attach a cache of retrieved items, which can be shared with other
+         * stores. Pass a null pointer to detach the cache.
+         */
+        void SetCache(const ItemCache::Own& cache) const
+        {
+            m_cache   = cache;
+            m_cacheId = cache ? cache->Register() : INVALID_INDEX;
+        }
+
+        /**
+         * Declare the order in which items are going to be retrieved, so they
+         * can be read ahead on background threads. Retrieving an item out of
+         * the declared order falls back to a synchronous read. An empty
+         * pattern disables the read-ahead.
+         *
+         * \param pattern Indices of items in the order of retrieval.
+         * \param depth Number of positions of the pattern to read ahead.
+         * \param budget Maximum bytes of items held in memory.
+         * \param threads Number of reading threads.
+         */
+        void SetReadAhead(const Indices& pattern, size_t depth = 8, size_t budget = 256 * 1024 * 1024, size_t threads = 2) const
+        {
+            m_readAhead.reset();
+
+            if (pattern.empty() || depth == 0)
+            {
+                return;
+            }
+
+            typename ReadAheadBuffer<T>::Loader loader = boost::bind(&SequentialFileStore<T>::Load, this, _1, _2);
+            m_readAhead = boost::shared_ptr<ReadAheadBuffer<T> >(new ReadAheadBuffer<T>(loader, pattern, depth, budget, threads));
+        }
+
+        /**
+         * Stop the read-ahead. A derived store has to call this in its
+         * destructor as the reading threads access its virtual methods.
+         */
+        inline void DisableReadAhead() const
+        {
+            m_readAhead.reset();
         }
 
         T operator[] (size_t idx) const
@@ -118,6 +691,16 @@ namespace seq2map
             return m_filenames;
         }
 
+        inline bool IsPacked() const
+        {
+            return m_container.get() != NULL;
+        }
+
+        inline Path GetContainerPath() const
+        {
+            return IsPacked() ? m_container->GetPath() : Path();
+        }
+
         //...
         virtual bool Store(cv::FileStorage& fs) const
         {
@@ -125,6 +708,18 @@ namespace seq2map
             {
                 fs << "root"  << m_root.string();
                 fs << "items" << m_filenames.size();
+
+                if (IsPacked())
+                {
+                    if (!m_container->Commit())
+                    {
+                        E_ERROR << "error committing container " << m_container->GetPath();
+                        return false;
+                    }
+
+                    fs << "container" << m_container->GetPath().filename().string();
+                }
+
                 fs << "files" << "[";
                 BOOST_FOREACH(const String& filename, m_filenames)
                 {
@@ -172,6 +767,28 @@ namespace seq2map
                     E_WARNING << "the number of items " << items << " does not agree with file list size " << m_filenames.size();
                     E_WARNING << "possible file corruption";
                 }
+
+                cv::FileNode containerNode = fn["container"];
+
+                if (!containerNode.empty())
+                {
+                    boost::shared_ptr<PackedFileContainer> packed(new PackedFileContainer());
+                    const Path container = m_root / (String) containerNode;
+
+                    if (!packed->Open(container))
+                    {
+                        E_ERROR << "error opening container " << container;
+                        return false;
+                    }
+
+                    if (packed->GetItems() != m_filenames.size())
+                    {
+                        E_ERROR << "the number of packed items " << packed->GetItems() << " does not agree with file list size " << m_filenames.size();
+                        return false;
+                    }
+
+                    m_container = packed;
+                }
             }
             catch (std::exception& ex)
             {
@@ -214,9 +831,53 @@ namespace seq2map
         virtual bool Append(Path& to, const T& data) const     { return data.Store(to);     }
         virtual bool Retrieve(const Path& from, T& data) const { return data.Restore(from); }
 
+        /**
+         * Serialise an item for the packed layout. A store supporting the
+         * layout has to override this and the following method.
+         */
+        virtual bool Append(std::ostream& os, const T& data) const
+        {
+            E_ERROR << "packed layout not supported by the store";
+            return false;
+        }
+
+        /**
+         * Deserialise an item from a block of a packed container.
+         */
+        virtual bool Retrieve(const MemoryBlock& blk, T& data) const
+        {
+            E_ERROR << "packed layout not supported by the store";
+            return false;
+        }
+
     private:
+        /**
+         * Read an item synchronously.
+         */
+        bool Load(size_t idx, T& data) const
+        {
+            if (IsPacked())
+            {
+                MemoryBlock blk = m_container->GetItem(idx);
+
+                if (blk.IsEmpty())
+                {
+                    E_ERROR << "item " << idx << " missing in container " << m_container->GetPath();
+                    return false;
+                }
+
+                return Retrieve(blk, data);
+            }
+
+            return Retrieve(m_root / m_filenames[idx], data);
+        }
+
         Path    m_root;
         Strings m_filenames;
+        boost::shared_ptr<PackedFileContainer> m_container;
+        mutable ItemCache::Own m_cache;
+        mutable size_t         m_cacheId;
+        mutable boost::shared_ptr<ReadAheadBuffer<T> > m_readAhead; // destroyed first
     };
 }
 #endif // SEQ_FILE_STORE_HPP
@@ -77,13 +77,85 @@ namespace seq2map
         virtual bool Store(Path& path) const { return cv::imwrite(path.string(), im); };
         virtual bool Restore(const Path& path) { return !(im = cv::imread(path.string(), cv::IMREAD_UNCHANGED)).empty(); };
 
+        /**
+         * Write the image as an uncompressed plane, preceeded by a header
+         * padded to PackedFileContainer::Alignment bytes.
+         */
+        bool Store(std::ostream& os) const;
+
+        /**
+         * Read an uncompressed plane written by Store(std::ostream&). No
+         * decoding takes place; the pixels are copied from the block.
+         */
+        bool Restore(const MemoryBlock& blk);
+
         cv::Mat im;
+
+    private:
+        struct RawHeader
+        {
+            char magic[8];
+            int  rows;
+            int  cols;
+            int  type;
+            int  stride; ///< bytes per row
+        };
+
+        static const String s_rawMagicNumber;
     };
 
+    inline size_t memoryUsage(const PersistentImage& data)
+    {
+        return sizeof(data) + data.im.total() * data.im.elemSize();
+    }
+
+    inline size_t memoryUsage(const ImageFeatureSet& data)
+    {
+        return sizeof(data) + data.GetSize() * sizeof(cv::KeyPoint) + data.GetDescriptors().total() * data.GetDescriptors().elemSize();
+    }
+
+    inline PersistentImage cloneItem(const PersistentImage& data)
+    {
+        PersistentImage copy;
+        copy.im = data.im.clone();
+
+        return copy;
+    }
+
     /**
-     * Sequence of images stored in the same folder.
+     * Mapped descriptors are shared as they are detached on write, see
+     * ImageFeatureSet::GetMutableDescriptors.
      */
-    typedef SequentialFileStore<PersistentImage> ImageStore;
+    inline ImageFeatureSet cloneItem(const ImageFeatureSet& data)
+    {
+        if (data.IsMapped()) return data;
+
+        ImageFeatureSet copy;
+        copy = data;
+
+        return copy;
+    }
+
+    /**
+     * Sequence of images stored in the same folder. When packed, the images
+     * are kept as uncompressed fixed-stride planes in a single memory-mapped
+     * container so retrieval involves no image decoding.
+     */
+    class ImageStore : public SequentialFileStore<PersistentImage>
+    {
+    public:
+        virtual ~ImageStore() { DisableReadAhead(); }
+
+        using SequentialFileStore<PersistentImage>::Append;
+        using SequentialFileStore<PersistentImage>::Retrieve;
+
+    protected:
+        //
+        // Packed layout
+        //
+        virtual bool Append(std::ostream& os, const PersistentImage& data) const { return data.Store(os);   }
+        virtual bool Retrieve(const MemoryBlock& blk, PersistentImage& data) const { return data.Restore(blk); }
+    };
 
     /**
      * A camera instance provides an image sequence in the same image size.
@@ -257,7 +329,7 @@ namespace seq2map
         // Constructor and destructor
         //
         FeatureStore(size_t index) : IndexReferenced(index) {}
-        virtual ~FeatureStore() {}
+        virtual ~FeatureStore() { DisableReadAhead(); }
 
         //
         // Creation
@@ -277,6 +349,16 @@ namespace seq2map
         virtual bool Store(cv::FileStorage& fs) const;
         virtual bool Restore(const cv::FileNode& fn);
 
+        using SequentialFileStore<ImageFeatureSet>::Append;
+        using SequentialFileStore<ImageFeatureSet>::Retrieve;
+
+    protected:
+        //
+        // Packed layout
+        //
+        virtual bool Append(std::ostream& os, const ImageFeatureSet& data) const { return data.Store(os);   }
+        virtual bool Retrieve(const MemoryBlock& blk, ImageFeatureSet& data) const { return data.Restore(blk); }
+
     private:
         friend class Sequence; // for restoring camera reference
 
@@ -292,11 +374,20 @@ namespace seq2map
       public IndexReferenced<DisparityStore>
     {
     public:
+        /**
+         * Encoding of the disparity files.
+         */
+        enum Codec
+        {
+            PNG16U, ///< 16-bit PNG images readable by any image viewer
+            RLE16U  ///< row-delta run-length coded 16-bit maps, see DisparityCodec
+        };
+
         //
         // Constructor and destructor
         //
-        DisparityStore(size_t index) : m_dspace(0, 64, 64*16), IndexReferenced(index) { UpdateMappings(); }
-        virtual ~DisparityStore() {}
+        DisparityStore(size_t index) : m_dspace(0, 64, 64*16), m_codec(PNG16U), IndexReferenced(index) { UpdateMappings(); }
+        virtual ~DisparityStore() { DisableReadAhead(); }
 
         //
         // Creation
@@ -308,6 +399,11 @@ namespace seq2map
         //
         inline RectifiedStereo::ConstOwn GetStereoPair() const { return m_stereo; }
         inline StereoMatcher::ConstOwn GetMatcher() const { return m_matcher; }
+        inline Codec GetCodec() const { return m_codec; }
+        inline void SetCodec(Codec codec) { m_codec = codec; }
+
+        static String Codec2String(Codec codec);
+        static bool String2Codec(const String& name, Codec& codec);
 
         //
         // Persistence
@@ -316,11 +412,18 @@ namespace seq2map
         virtual bool Restore(const cv::FileNode& fn);
 
         using SequentialFileStore<PersistentImage>::Append;
+        using SequentialFileStore<PersistentImage>::Retrieve;
 
     protected:
         virtual bool Append(Path& to, const PersistentImage& dpm) const;
         virtual bool Retrieve(const Path& from, PersistentImage& dpm) const;
 
+        //
+        // Packed layout
+        //
+        virtual bool Append(std::ostream& os, const PersistentImage& dpm) const;
+        virtual bool Retrieve(const MemoryBlock& blk, PersistentImage& dpm) const;
+
     private:
         friend class Sequence; // for restoring camera reference
 
@@ -331,6 +434,8 @@ namespace seq2map
         };
 
         void UpdateMappings();
+        bool EncodeMap(const cv::Mat& dpm, std::vector<uchar>& buf, const String& ext = ".png") const;
+        bool DecodeMap(const uchar* data, size_t size, cv::Mat& dpm) const;
 
         static LinearSpacedVec<double> s_dspace16U;
 
@@ -340,6 +445,7 @@ namespace seq2map
 
         LinearMapping m_dspaceTo16U;
         LinearMapping m_dspaceTo32F;
+        Codec         m_codec;
     };
 
     /**
@@ -398,6 +504,18 @@ namespace seq2map
         DisparityStore::ConstOwn GetDisparityStore(size_t index) const { return DisparityStore::Find(m_dpmStores, index); }
         RectifiedStereo::ConstOwn GetStereoPair(size_t priCamIdx, size_t secCamIdx) const;
 
+        /**
+         * Point the image store of a camera to another store, such as the
+         * container written by imcvt in packing mode. The change is made
+         * persistent by storing the sequence.
+         *
+         * \param camIdx index of the camera.
+         * \param index path to the index of the new image store.
+         * \return true if the store is restored with the same number of
+         *         frames as the camera has, false otherwise.
+         */
+        bool SetImageStore(size_t camIdx, const Path& index);
+
         //
         // Persistence
         //
@@ -0,0 +1,100 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+#include <deque>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <seq2map/common.hpp>
+
+namespace seq2map
+{
+    /**
+     * A process-wide pool of persistent worker threads. Each worker owns a
+     * deque of tasks, takes its own tasks from the back, and steals from the
+     * front of the others' deques when it runs out of work. A thread waiting
+     * for a TaskGroup runs pending tasks instead of blocking, so tasks can
+     * spawn and wait for tasks of their own.
+     */
+    class ThreadPool : public Singleton<ThreadPool>
+    {
+    public:
+        friend class Singleton<ThreadPool>;
+        typedef boost::function<void()> Task;
+
+        /**
+         * A set of tasks submitted to a pool and waited for together.
+         */
+        class TaskGroup
+        {
+        public:
+            /* ctor */ TaskGroup(ThreadPool& pool = ThreadPool::GetInstance()) : m_pool(pool), m_pending(0) {}
+            /* dtor */ virtual ~TaskGroup() { Wait(); }
+
+            /**
+             * Submit a task to the pool.
+             */
+            void Run(const Task& task);
+
+            /**
+             * Block until all the submitted tasks are done, helping the pool
+             * with pending tasks in the meantime.
+             */
+            void Wait();
+
+        private:
+            void Execute(const Task& task);
+
+            ThreadPool& m_pool;
+            size_t m_pending;
+            boost::mutex m_mtx;
+            boost::condition_variable m_done;
+        };
+
+        /**
+         * Restart the pool with a number of worker threads. Pending tasks are
+         * run by the calling thread before the restart, so the call should
+         * not be made while tasks are still being submitted.
+         *
+         * \param threads number of workers, or zero to use all the hardware
+         *        cores.
+         */
+        void SetThreads(size_t threads);
+
+        /**
+         * Get the number of worker threads.
+         */
+        size_t GetThreads() const;
+
+    protected:
+        virtual void Init() { SetThreads(0); }
+
+    private:
+        struct Queue
+        {
+            boost::mutex mtx;
+            std::deque<Task> tasks;
+        };
+
+        typedef boost::shared_ptr<Queue> QueuePtr;
+        typedef boost::shared_ptr<boost::thread> WorkerPtr;
+
+        /* ctor */ ThreadPool() : m_queued(0), m_next(0), m_stop(false) {}
+        /* dtor */ virtual ~ThreadPool() { Stop(); }
+
+        void Submit(const Task& task);
+        bool Take(Task& task);
+        bool RunPendingTask();
+        void Worker(size_t idx);
+        void Stop();
+
+        std::vector<QueuePtr> m_queues;
+        std::vector<WorkerPtr> m_workers;
+        boost::thread_specific_ptr<size_t> m_workerIdx; ///< index of the worker running on the current thread
+        size_t m_queued;
+        size_t m_next;
+        bool   m_stop;
+        mutable boost::mutex m_mtx;
+        boost::condition_variable m_wake;
+    };
+}
+#endif // THREAD_POOL_HPP
@@ -293,3 +293,180 @@ StereoMatcher::Own StereoMatcherFactory::Create(const cv::FileNode& fn)
 
     return matcher;
 }
+
+//==[ DisparityCodec ]========================================================//
+
+const String DisparityCodec::s_magicNumber = "S2MDPM16";
+
+bool DisparityCodec::Encode(const cv::Mat& dpm, double alpha, double beta, std::vector<uchar>& buf)
+{
+    if (dpm.type() != CV_32F)
+    {
+        E_ERROR << "given matrix is not a single precision disparity map";
+        return false;
+    }
+
+    if (alpha == 0)
+    {
+        E_ERROR << "degenerated disparity mapping";
+        return false;
+    }
+
+    Header header;
+    std::copy(s_magicNumber.begin(), s_magicNumber.end(), header.magic);
+    header.rows  = dpm.rows;
+    header.cols  = dpm.cols;
+    header.alpha = alpha;
+    header.beta  = beta;
+
+    buf.resize(sizeof header);
+    buf.reserve(sizeof header + dpm.total());
+    memcpy(&buf[0], &header, sizeof header);
+
+    int first = 0; // predictor of the first column
+
+    for (int i = 0; i < dpm.rows; i++)
+    {
+        const float* row = dpm.ptr<float>(i);
+        int prev = first;
+        int zeros = 0;
+
+        for (int j = 0; j < dpm.cols; j++)
+        {
+            const int v = cv::saturate_cast<ushort>(row[j] * alpha + beta);
+            const int r = v - prev;
+
+            if (j == 0) first = v;
+            prev = v;
+
+            if (r == 0)
+            {
+                zeros++;
+                if (j + 1 < dpm.cols) continue;
+            }
+
+            // flush the pending run of zero residuals
+            while (zeros > 1)
+            {
+                const int n = std::min(zeros, 65);
+                buf.push_back(static_cast<uchar>(0x80 | (n - 2)));
+                zeros -= n;
+            }
+
+            if (zeros == 1)
+            {
+                buf.push_back(0x00);
+                zeros = 0;
+            }
+
+            if (r == 0) continue;
+
+            // zigzag the residual so small magnitudes get small codes
+            const unsigned int z = static_cast<unsigned int>((r << 1) ^ (r >> 31));
+
+            if (z < 0x80)
+            {
+                buf.push_back(static_cast<uchar>(z));
+            }
+            else
+            {
+                buf.push_back(static_cast<uchar>(0xc0 | (z >> 16)));
+                buf.push_back(static_cast<uchar>((z >> 8) & 0xff));
+                buf.push_back(static_cast<uchar>( z       & 0xff));
+            }
+        }
+    }
+
+    return true;
+}
+
+bool DisparityCodec::Decode(const uchar* data, size_t size, cv::Mat& dpm)
+{
+    if (!IsEncoded(data, size))
+    {
+        E_ERROR << "magic number not found";
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, data, sizeof header);
+
+    if (header.rows < 0 || header.cols < 0 || header.alpha == 0)
+    {
+        E_ERROR << "ill-formed header";
+        return false;
+    }
+
+    // inverse of the disparity-to-16U mapping
+    const double scale = 1.0 / header.alpha;
+    const double shift = -header.beta / header.alpha;
+
+    const uchar* p   = data + sizeof header;
+    const uchar* end = data + size;
+
+    dpm.create(header.rows, header.cols, CV_32F);
+
+    int first = 0;
+
+    for (int i = 0; i < dpm.rows; i++)
+    {
+        float* row = dpm.ptr<float>(i);
+        int v = first;
+        int j = 0;
+
+        while (j < dpm.cols)
+        {
+            if (p >= end)
+            {
+                E_ERROR << "premature end of stream at row " << i;
+                return false;
+            }
+
+            const bool  head = (j == 0);
+            const uchar b = *p++;
+
+            if (b < 0x80) // short literal
+            {
+                v += static_cast<int>(b >> 1) ^ -static_cast<int>(b & 1);
+                row[j++] = static_cast<float>(v * scale + shift);
+            }
+            else if (b < 0xc0) // run of zero residuals
+            {
+                const int n = (b & 0x3f) + 2;
+
+                if (j + n > dpm.cols)
+                {
+                    E_ERROR << "run exceeds row boundary at row " << i;
+                    return false;
+                }
+
+                const float d = static_cast<float>(v * scale + shift);
+                std::fill(row + j, row + j + n, d);
+                j += n;
+            }
+            else // escaped literal
+            {
+                if (end - p < 2)
+                {
+                    E_ERROR << "premature end of stream at row " << i;
+                    return false;
+                }
+
+                const unsigned int z = ((b & 0x3fu) << 16) | (p[0] << 8) | p[1];
+                p += 2;
+
+                v += static_cast<int>(z >> 1) ^ -static_cast<int>(z & 1);
+                row[j++] = static_cast<float>(v * scale + shift);
+            }
+
+            if (head) first = v;
+        }
+    }
+
+    return true;
+}
+
+bool DisparityCodec::IsEncoded(const uchar* data, size_t size)
+{
+    return size >= sizeof(Header) && std::equal(s_magicNumber.begin(), s_magicNumber.end(), data);
+}
@@ -1,7 +1,9 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/join.hpp>
+#include <boost/interprocess/streams/bufferstream.hpp>
 #include <opencv2/cudafeatures2d.hpp>
 #include <seq2map/features.hpp>
+#include <seq2map/features_bruteforce.hpp>
 #include <seq2map/features_opencv.hpp>
 
 using namespace cv;
@@ -13,6 +15,9 @@ const seq2map::String HetergeneousDetextractor::s_detectorFileNodeName  = "detec
 const seq2map::String HetergeneousDetextractor::s_extractorFileNodeName = "extraction";
 const seq2map::String ImageFeatureSet::s_fileMagicNumber = "IMKPTDSC"; // which means IMage KeyPoinTs & DeSCriptors
 const char ImageFeatureSet::s_fileHeaderSep = ' ';
+const size_t ImageFeatureSet::s_fileBlockAlignment = 64;
+const size_t ImageFeatureSet::s_keypointColumnBytes = sizeof(float) * 5 + sizeof(int);
+const size_t ImageFeatureSet::s_maxKeyPointGrids = 4;
 
 //==[ FeatureDetectorFactory ]================================================//
 
@@ -66,6 +71,106 @@ void FeatureDetextractorFactory::Init()
 #endif // WITH_XFEATURES2D .....................................................
 }
 
+//==[ KeyPointGrid ]==========================================================//
+
+KeyPointGrid::KeyPointGrid(const KeyPoints& keypoints, float cellSize)
+: m_cellSize(cellSize > 0 ? cellSize : 1.0f), m_cols(0), m_rows(0)
+{
+    if (keypoints.empty())
+    {
+        return;
+    }
+
+    m_points.reserve(keypoints.size());
+
+    Point2f tl = keypoints[0].pt, br = keypoints[0].pt;
+
+    BOOST_FOREACH (const KeyPoint& kp, keypoints)
+    {
+        tl.x = std::min(tl.x, kp.pt.x); br.x = std::max(br.x, kp.pt.x);
+        tl.y = std::min(tl.y, kp.pt.y); br.y = std::max(br.y, kp.pt.y);
+
+        m_points.push_back(kp.pt);
+    }
+
+    // coarsen the grid if it gets too sparse
+    const double maxCells = 4.0f * keypoints.size() + 64;
+
+    while ((std::floor((br.x - tl.x) / m_cellSize) + 1) * (std::floor((br.y - tl.y) / m_cellSize) + 1) > maxCells)
+    {
+        m_cellSize *= 2;
+    }
+
+    m_origin = tl;
+    m_cols = static_cast<int>((br.x - tl.x) / m_cellSize) + 1;
+    m_rows = static_cast<int>((br.y - tl.y) / m_cellSize) + 1;
+
+    // counting sort of the key points by their buckets
+    std::vector<size_t> cells(m_points.size());
+    m_offsets.assign(m_cols * m_rows + 1, 0);
+
+    for (size_t i = 0; i < m_points.size(); i++)
+    {
+        const int col = std::min(static_cast<int>((m_points[i].x - m_origin.x) / m_cellSize), m_cols - 1);
+        const int row = std::min(static_cast<int>((m_points[i].y - m_origin.y) / m_cellSize), m_rows - 1);
+
+        cells[i] = row * m_cols + col;
+        m_offsets[cells[i] + 1]++;
+    }
+
+    for (size_t c = 1; c < m_offsets.size(); c++)
+    {
+        m_offsets[c] += m_offsets[c - 1];
+    }
+
+    std::vector<size_t> next(m_offsets.begin(), m_offsets.end() - 1);
+    m_items.resize(m_points.size());
+
+    for (size_t i = 0; i < m_points.size(); i++)
+    {
+        m_items[next[cells[i]]++] = i;
+    }
+}
+
+void KeyPointGrid::Search(const Point2f& pt, float radius, IndexList& found) const
+{
+    if (m_points.empty() || !(radius >= 0))
+    {
+        return;
+    }
+
+    const float x0 = (pt.x - radius - m_origin.x) / m_cellSize, x1 = (pt.x + radius - m_origin.x) / m_cellSize;
+    const float y0 = (pt.y - radius - m_origin.y) / m_cellSize, y1 = (pt.y + radius - m_origin.y) / m_cellSize;
+
+    // also rejects NaN locations
+    if (!(x1 >= 0 && y1 >= 0 && x0 < m_cols && y0 < m_rows))
+    {
+        return;
+    }
+
+    const int c0 = std::max(static_cast<int>(x0), 0), c1 = std::min(static_cast<int>(x1), m_cols - 1);
+    const int r0 = std::max(static_cast<int>(y0), 0), r1 = std::min(static_cast<int>(y1), m_rows - 1);
+    const float r2 = radius * radius;
+
+    for (int row = r0; row <= r1; row++)
+    {
+        for (int col = c0; col <= c1; col++)
+        {
+            const size_t cell = row * m_cols + col;
+
+            for (size_t k = m_offsets[cell]; k < m_offsets[cell + 1]; k++)
+            {
+                const Point2f d = m_points[m_items[k]] - pt;
+
+                if (d.x * d.x + d.y * d.y <= r2)
+                {
+                    found.push_back(m_items[k]);
+                }
+            }
+        }
+    }
+}
+
 //==[ ImageFeatureSet ]=======================================================//
 
 ImageFeature ImageFeatureSet::GetFeature(const size_t idx) const
@@ -110,6 +215,8 @@ ImageFeatureSet& ImageFeatureSet::operator= (const ImageFeatureSet& set)
     m_normType    = set.m_normType;
     m_keypoints   = set.m_keypoints;
     m_descriptors = set.m_descriptors.clone();
+    m_owner.reset();
+    m_grids       = set.m_grids; // same key points
 
     return *this;
 }
@@ -124,54 +231,181 @@ bool seq2map::ImageFeatureSet::Store(Path& path) const
         return false;
     }
 
+    return Store(os);
+}
+
+bool ImageFeatureSet::Restore(const Path& path)
+{
+    std::ifstream is(path.string().c_str(), std::ios::in | std::ios::binary);
+
+    if (!is.is_open())
+    {
+        E_ERROR << "error opening input stream";
+        return false;
+    }
+
+    return Restore(is);
+}
+
+bool ImageFeatureSet::Restore(const MemoryBlock& blk)
+{
+    boost::interprocess::ibufferstream is((const char*)blk.data, blk.size, std::ios::in | std::ios::binary);
+
+    String version;
+    int depth;
+    Size2i matSize;
+
+    if (!RestoreHeader(is, version, depth, matSize))
+    {
+        return false;
+    }
+
+    // only the aligned layout can be read in place
+    if (!boost::equals(version, "CV4"))
+    {
+        is.seekg(0);
+        return Restore(is);
+    }
+
+    const size_t n = static_cast<size_t>(matSize.height);
+    const size_t columnsOffset = GetAlignedSize(static_cast<size_t>(is.tellg()));
+    const size_t descOffset = GetAlignedSize(columnsOffset + n * s_keypointColumnBytes);
+    const size_t descBytes = n * static_cast<size_t>(matSize.width) * CV_ELEM_SIZE(depth);
+
+    if (descOffset + descBytes > blk.size)
+    {
+        E_ERROR << "premature end of feature block";
+        return false;
+    }
+
+    UnpackKeyPoints(blk.data + columnsOffset, n, m_keypoints);
+    m_grids.clear();
+
+    if (blk.owner)
+    {
+        // wrap the mapped memory directly, and hold its owner to keep it
+        // alive; the matrix header cannot be made read-only, so writers go
+        // through GetMutableDescriptors which detaches it first
+        m_descriptors = Mat(matSize, depth, const_cast<uchar*>(blk.data + descOffset));
+        m_owner = blk.owner;
+    }
+    else
+    {
+        m_descriptors = Mat(matSize, depth, const_cast<uchar*>(blk.data + descOffset)).clone();
+        m_owner.reset();
+    }
+
+    return true;
+}
+
+bool ImageFeatureSet::Store(std::ostream& os) const
+{
     const String type = PersistentMat::CvDepthToString(m_descriptors.depth());
+    const std::streamoff start = os.tellp();
+    const int rows = static_cast<int>(m_keypoints.size());
+    const int cols = m_descriptors.empty() ? 0 : m_descriptors.cols;
+
+    if (!m_descriptors.empty() && m_descriptors.rows != rows)
+    {
+        E_ERROR << "inconsistent size of descriptor matrix";
+        return false;
+    }
 
     // write the magic number first
     os << s_fileMagicNumber;
 
     // the header
-    os << "CV3"                       << s_fileHeaderSep;
+    os << "CV4"                       << s_fileHeaderSep;
     os << NormType2String(m_normType) << s_fileHeaderSep;
     os << type                        << s_fileHeaderSep;
 
-    os.write((char*)&m_descriptors.rows, sizeof m_descriptors.rows);
-    os.write((char*)&m_descriptors.cols, sizeof m_descriptors.cols);
+    os.write((char*)&rows, sizeof rows);
+    os.write((char*)&cols, sizeof cols);
+
+    // the key points section, written column-wise
+    std::vector<uchar> columns(m_keypoints.size() * s_keypointColumnBytes);
 
-    // the key points section
-    BOOST_FOREACH(const KeyPoint& kp, m_keypoints)
+    if (!columns.empty())
     {
-        os.write((char*)&kp.pt.x,     sizeof kp.pt.x);
-        os.write((char*)&kp.pt.y,     sizeof kp.pt.y);
-        os.write((char*)&kp.response, sizeof kp.response);
-        os.write((char*)&kp.octave,   sizeof kp.octave);
-        os.write((char*)&kp.angle,    sizeof kp.angle);
-        os.write((char*)&kp.size,     sizeof kp.size);
+        PackKeyPoints(m_keypoints, &columns[0]);
+
+        WritePadding(os, static_cast<size_t>(os.tellp() - start));
+        os.write((char*)&columns[0], columns.size());
     }
 
-    // feature vectors
+    // feature vectors, starting from an aligned position
+    WritePadding(os, static_cast<size_t>(os.tellp() - start));
     PersistentMat::Dump(m_descriptors, os);
 
-    // end of file
-    os.close();
-
-    return true;
+    return os.good();
 }
 
-bool ImageFeatureSet::Restore(const Path& path)
+bool ImageFeatureSet::Restore(std::istream& is)
 {
-    std::ifstream is(path.string().c_str(), std::ios::in | std::ios::binary);
+    const std::streamoff start = is.tellg();
 
-    if (!is.is_open())
+    String version;
+    int depth;
+    Size2i matSize;
+
+    if (!RestoreHeader(is, version, depth, matSize))
     {
-        E_ERROR << "error opening input stream";
         return false;
     }
 
+    m_keypoints.clear();
+    m_keypoints.reserve(matSize.height);
+    m_owner.reset();
+    m_grids.clear();
+
+    if (boost::equals(version, "CV3"))
+    {
+        for (int i = 0; i < matSize.height; i++)
+        {
+            cv::KeyPoint kp;
+
+            is.read((char*)&kp.pt.x,     sizeof kp.pt.x);
+            is.read((char*)&kp.pt.y,     sizeof kp.pt.y);
+            is.read((char*)&kp.response, sizeof kp.response);
+            is.read((char*)&kp.octave,   sizeof kp.octave);
+            is.read((char*)&kp.angle,    sizeof kp.angle);
+            is.read((char*)&kp.size,     sizeof kp.size);
+
+            m_keypoints.push_back(kp);
+        }
+    }
+    else
+    {
+        std::vector<uchar> columns(static_cast<size_t>(matSize.height) * s_keypointColumnBytes);
+
+        if (!columns.empty())
+        {
+            is.seekg(start + static_cast<std::streamoff>(GetAlignedSize(static_cast<size_t>(is.tellg() - start))));
+            is.read((char*)&columns[0], columns.size());
+
+            UnpackKeyPoints(&columns[0], static_cast<size_t>(matSize.height), m_keypoints);
+        }
+
+        is.seekg(start + static_cast<std::streamoff>(GetAlignedSize(static_cast<size_t>(is.tellg() - start))));
+    }
+
+    m_descriptors.create(matSize, depth);
+    PersistentMat::Dump(is, m_descriptors);
+
+    if (is.fail())
+    {
+        E_ERROR << "premature end of feature file";
+        return false;
+    }
+
+    return true;
+}
+
+bool ImageFeatureSet::RestoreHeader(std::istream& is, String& version, int& depth, cv::Size2i& matSize)
+{
     char magicNumber[8];
-    String version;
     String normType;
     String matType;
-    Size2i matSize;
 
     is.read((char*)&magicNumber, sizeof magicNumber);
 
@@ -185,44 +419,117 @@ bool ImageFeatureSet::Restore(const Path& path)
     getline(is, normType, ImageFeatureSet::s_fileHeaderSep);
     getline(is, matType,  ImageFeatureSet::s_fileHeaderSep);
 
-    if (!boost::equals(version, "CV3"))
+    if (!boost::equals(version, "CV3") && !boost::equals(version, "CV4"))
     {
         E_ERROR << "unknown file version";
         return false;
     }
 
     m_normType = String2NormType(normType);
+    depth = PersistentMat::StringToCvDepth(matType);
 
     is.read((char*)&matSize.height, sizeof matSize.height);
     is.read((char*)&matSize.width,  sizeof matSize.width);
 
-    m_keypoints.clear();
-    m_keypoints.reserve(matSize.height);
+    if (is.fail())
+    {
+        E_ERROR << "error reading file header";
+        return false;
+    }
 
-    for (int i = 0; i < matSize.height; i++)
+    return true;
+}
+
+void ImageFeatureSet::PackKeyPoints(const KeyPoints& keypoints, uchar* columns)
+{
+    const size_t n = keypoints.size();
+
+    float* x        = reinterpret_cast<float*>(columns);
+    float* y        = x + n;
+    float* response = y + n;
+    int*   octave   = reinterpret_cast<int*>(response + n);
+    float* angle    = reinterpret_cast<float*>(octave + n);
+    float* size     = angle + n;
+
+    for (size_t i = 0; i < n; i++)
     {
-        cv::KeyPoint kp;
+        const KeyPoint& kp = keypoints[i];
+
+        x[i]        = kp.pt.x;
+        y[i]        = kp.pt.y;
+        response[i] = kp.response;
+        octave[i]   = kp.octave;
+        angle[i]    = kp.angle;
+        size[i]     = kp.size;
+    }
+}
+
+void ImageFeatureSet::UnpackKeyPoints(const uchar* columns, size_t n, KeyPoints& keypoints)
+{
+    const float* x        = reinterpret_cast<const float*>(columns);
+    const float* y        = x + n;
+    const float* response = y + n;
+    const int*   octave   = reinterpret_cast<const int*>(response + n);
+    const float* angle    = reinterpret_cast<const float*>(octave + n);
+    const float* size     = angle + n;
 
-        is.read((char*)&kp.pt.x,     sizeof kp.pt.x);
-        is.read((char*)&kp.pt.y,     sizeof kp.pt.y);
-        is.read((char*)&kp.response, sizeof kp.response);
-        is.read((char*)&kp.octave,   sizeof kp.octave);
-        is.read((char*)&kp.angle,    sizeof kp.angle);
-        is.read((char*)&kp.size,     sizeof kp.size);
+    keypoints.resize(n);
 
-        m_keypoints.push_back(kp);
+    for (size_t i = 0; i < n; i++)
+    {
+        KeyPoint& kp = keypoints[i];
+
+        kp.pt.x     = x[i];
+        kp.pt.y     = y[i];
+        kp.response = response[i];
+        kp.octave   = octave[i];
+        kp.angle    = angle[i];
+        kp.size     = size[i];
+        kp.class_id = -1;
     }
+}
 
-    const int type = PersistentMat::StringToCvDepth(matType);
+void ImageFeatureSet::WritePadding(std::ostream& os, size_t offset)
+{
+    const size_t padding = GetAlignedSize(offset) - offset;
 
-    m_descriptors = Mat::zeros(matSize.height, matSize.width, type); 
-    PersistentMat::Dump(is, m_descriptors);
+    for (size_t i = 0; i < padding; i++)
+    {
+        os.put(0);
+    }
+}
+
+cv::Mat ImageFeatureSet::GetMutableDescriptors()
+{
+    // copy on write
+    if (m_owner)
+    {
+        m_descriptors = m_descriptors.clone();
+        m_owner.reset();
+    }
 
-    // TODO: add file corruption check (e.g. reaching EoF pre-maturely)
-    // ..
-    // ..
+    return m_descriptors;
+}
 
-    return true;
+const KeyPointGrid& ImageFeatureSet::GetKeyPointGrid(float cellSize) const
+{
+    KeyPointGrids::const_iterator itr = m_grids.find(cellSize);
+
+    if (itr != m_grids.end())
+    {
+        return *itr->second;
+    }
+
+    // a handful of cell sizes is expected; start over if it keeps growing
+    if (m_grids.size() >= s_maxKeyPointGrids)
+    {
+        m_grids.clear();
+    }
+
+    boost::shared_ptr<const KeyPointGrid> grid(new KeyPointGrid(m_keypoints, cellSize));
+    m_grids[cellSize] = grid;
+
+    return *grid;
 }
 
 bool ImageFeatureSet::Append(const ImageFeatureSet& set)
@@ -259,6 +566,7 @@ bool ImageFeatureSet::Append(const ImageFeatureSet& set)
 
     // append key points
     std::copy(set.m_keypoints.cbegin(), set.m_keypoints.cend(), std::back_inserter(m_keypoints));
+    m_grids.clear();
 
     // concatenate descriptor matrices
     cv::vconcat(m_descriptors, set.m_descriptors, m_descriptors);
@@ -500,6 +808,22 @@ Mat ImageFeatureMap::Draw(const cv::Mat& src, const cv::Mat& dst) const
 //==[ FeatureMatcher ]========================================================//
 
 ImageFeatureMap FeatureMatcher::operator() (const ImageFeatureSet& src, const ImageFeatureSet& dst)
+{
+    return Match(src, dst, NULL, 0);
+}
+
+ImageFeatureMap FeatureMatcher::operator() (const ImageFeatureSet& src, const ImageFeatureSet& dst, const Points2F& predictions, float radius)
+{
+    if (predictions.size() != src.GetSize())
+    {
+        E_ERROR << "the number of predictions (" << predictions.size() << ") does not match the number of features (" << src.GetSize() << ")";
+        return ImageFeatureMap(src, dst);
+    }
+
+    return Match(src, dst, &predictions, radius);
+}
+
+ImageFeatureMap FeatureMatcher::Match(const ImageFeatureSet& src, const ImageFeatureSet& dst, const Points2F* predictions, float radius)
 {
     ImageFeatureMap map(src, dst);
 
@@ -520,9 +844,15 @@ ImageFeatureMap FeatureMatcher::operator() (const ImageFeatureSet& src, const Im
     cv::Mat srcDescriptors = normalisation ? NormaliseDescriptors(src.GetDescriptors()) : src.GetDescriptors();
     cv::Mat dstDescriptors = normalisation ? NormaliseDescriptors(dst.GetDescriptors()) : dst.GetDescriptors();
 
+    // the native matchers and the guided matching find the backward matches in the same pass
+    std::vector<DMatch> backward;
+    bool singlePass = m_symmetric && (predictions || IsNativelyMatchable(srcDescriptors, metric));
+
     // perform descriptor matching in feature space
     bool ratioTest = m_maxRatio > 0.0f && m_maxRatio < 1.0f;
-    map.m_matches = MatchDescriptors(srcDescriptors, dstDescriptors, metric, ratioTest);
+    map.m_matches = predictions ?
+        MatchDescriptors(srcDescriptors, dstDescriptors, metric, ratioTest, dst.GetKeyPointGrid(radius), *predictions, radius, singlePass ? &backward : NULL) :
+        MatchDescriptors(srcDescriptors, dstDescriptors, metric, ratioTest, singlePass ? &backward : NULL);
 
     // no match found?
     if (map.m_matches.empty()) return map;
@@ -534,7 +864,12 @@ ImageFeatureMap FeatureMatcher::operator() (const ImageFeatureSet& src, const Im
     }
 
     // perform symmetry test
-    if (m_symmetric)
+    if (m_symmetric && singlePass)
+    {
+        AutoSpeedometreMeasure measure(m_symmetryTestMetre, map.m_matches.size());
+        RunSymmetryTest(map.m_matches, backward);
+    }
+    else if (m_symmetric)
     {
         IndexList mapped = map.Select(FeatureMatch::INLIER);
         cv::Mat subDescriptors = cv::Mat(mapped.size(), srcDescriptors.cols, srcDescriptors.type());
@@ -592,13 +927,7 @@ FeatureMatcher& FeatureMatcher::AddFilter(Filter::Own& filter)
 
 cv::Mat FeatureMatcher::NormaliseDescriptors(const cv::Mat& desc)
 {
-    cv::Mat normalised = cv::Mat(desc.rows, desc.cols, desc.type());
-    for (int i = 0; i < desc.rows; i++)
-    {
-        cv::normalize(desc.row(i), normalised.row(i));
-    }
-
-    return normalised;
+    return L2Matcher::Normalise(desc);
 }
 
 float FeatureMatcher::GetDistanceThreshold(float ratio, int metric, size_t d)
@@ -615,14 +944,25 @@ float FeatureMatcher::GetDistanceThreshold(float ratio, int metric, size_t d)
     return ratio;
 }
 
-FeatureMatches FeatureMatcher::MatchDescriptors(const Mat& src, const Mat& dst, int metric, bool ratioTest)
+bool FeatureMatcher::IsNativelyMatchable(const Mat& desc, int metric) const
 {
-    FeatureMatches matches;
-    matches.reserve(src.rows);
+    if (!m_exhaustive || !m_useNative || (m_useGpu && cv::cuda::getCudaEnabledDeviceCount() > 0))
+    {
+        return false;
+    }
+
+    switch (metric)
+    {
+    case NORM_HAMMING: return desc.type() == CV_8U;
+    case NORM_L2:
+    case NORM_L2SQR:   return desc.type() == CV_32F;
+    }
 
-    const int k = ratioTest ? 2 : 1;
-    std::vector<std::vector<DMatch>> knn;
+    return false;
+}
 
+void FeatureMatcher::KnnMatchDescriptors(const Mat& src, const Mat& dst, int metric, int k, std::vector<std::vector<DMatch> >& knn, std::vector<DMatch>* backward)
+{
     if (m_useGpu && cv::cuda::getCudaEnabledDeviceCount() > 0)
     {
         Ptr<cv::cuda::DescriptorMatcher> matcher = cv::cuda::DescriptorMatcher::createBFMatcher(metric);
@@ -637,6 +977,16 @@ FeatureMatches FeatureMatcher::MatchDescriptors(const Mat& src, const Mat& dst,
             matcher->knnMatch(D1, D2, knn, k);
         }
     }
+    else if (IsNativelyMatchable(src, metric) && metric == NORM_HAMMING)
+    {
+        AutoSpeedometreMeasure measure(m_descMatchingMetre, src.rows + dst.rows);
+        HammingMatcher::KnnMatch(src, dst, knn, k, backward);
+    }
+    else if (IsNativelyMatchable(src, metric))
+    {
+        AutoSpeedometreMeasure measure(m_descMatchingMetre, src.rows + dst.rows);
+        L2Matcher::KnnMatch(src, dst, knn, k, metric, backward);
+    }
     else
     {
         Ptr<cv::DescriptorMatcher> matcher = m_exhaustive ?
@@ -647,18 +997,177 @@ FeatureMatches FeatureMatcher::MatchDescriptors(const Mat& src, const Mat& dst,
             matcher->knnMatch(src, dst, knn, k);
         }
     }
+}
+
+FeatureMatches FeatureMatcher::MatchDescriptors(const Mat& src, const Mat& dst, int metric, bool ratioTest, std::vector<DMatch>* backward)
+{
+    std::vector<std::vector<DMatch> > knn;
+    KnnMatchDescriptors(src, dst, metric, ratioTest ? 2 : 1, knn, backward);
+
+    return SelectMatches(knn, metric, src.cols, ratioTest);
+}
+
+FeatureMatches FeatureMatcher::MatchDescriptors(const Mat& src, const Mat& dst, int metric, bool ratioTest, const KeyPointGrid& grid, const Points2F& predictions, float radius, std::vector<DMatch>* backward)
+{
+    const size_t k = ratioTest ? 2 : 1;
+    std::vector<std::vector<DMatch> > knn(src.rows);
+    std::vector<int> unguided;
+
+    if (backward)
+    {
+        backward->assign(dst.rows, DMatch(-1, -1, FLT_MAX));
+    }
+
+    // compare each predicted feature with the target features around the prediction
+    {
+        AutoSpeedometreMeasure measure(m_descMatchingMetre, src.rows);
+        CandidateLists candidates(src.rows);
+        CandidateDistances dists;
+        IndexList found;
+
+        for (int i = 0; i < src.rows; i++)
+        {
+            const Point2f& pt = predictions[i];
+
+            if (pt.x != pt.x || pt.y != pt.y) // NaN
+            {
+                unguided.push_back(i);
+                continue;
+            }
+
+            found.clear();
+            grid.Search(pt, radius, found);
+
+            candidates[i].assign(found.begin(), found.end());
+        }
+
+        // distances of each query to its candidate block in one pass of the
+        // native kernels; other types and metrics fall back to cv::norm
+        const bool native = m_useNative && src.type() == dst.type() && (
+            (metric == NORM_HAMMING && src.type() == CV_8U) ||
+            ((metric == NORM_L2 || metric == NORM_L2SQR) && src.type() == CV_32F));
+
+        if (native && metric == NORM_HAMMING)
+        {
+            HammingMatcher::Distances(src, dst, candidates, dists);
+        }
+        else if (native)
+        {
+            L2Matcher::Distances(src, dst, candidates, dists, metric);
+        }
+        else
+        {
+            dists.resize(src.rows);
+
+            for (int i = 0; i < src.rows; i++)
+            {
+                dists[i].resize(candidates[i].size());
+
+                for (size_t j = 0; j < candidates[i].size(); j++)
+                {
+                    dists[i][j] = static_cast<float>(cv::norm(src.row(i), dst.row(candidates[i][j]), metric));
+                }
+            }
+        }
+
+        for (int i = 0; i < src.rows; i++)
+        {
+            std::vector<DMatch>& best = knn[i];
+
+            for (size_t c = 0; c < candidates[i].size(); c++)
+            {
+                const int j = candidates[i][c];
+                const DMatch m(i, j, dists[i][c]);
+
+                best.insert(std::upper_bound(best.begin(), best.end(), m), m);
+                if (best.size() > k) best.pop_back();
+
+                if (backward && m.distance < (*backward)[j].distance)
+                {
+                    (*backward)[j] = DMatch(m.trainIdx, m.queryIdx, m.distance);
+                }
+            }
+        }
+    }
+
+    // the rest are matched exhaustively
+    if (!unguided.empty())
+    {
+        cv::Mat sub = cv::Mat(static_cast<int>(unguided.size()), src.cols, src.type());
+
+        for (size_t i = 0; i < unguided.size(); i++)
+        {
+            src.row(unguided[i]).copyTo(sub.row(static_cast<int>(i)));
+        }
+
+        std::vector<std::vector<DMatch> > subKnn;
+        std::vector<DMatch> subBackward;
+        const bool singlePass = backward && IsNativelyMatchable(sub, metric);
+
+        KnnMatchDescriptors(sub, dst, metric, static_cast<int>(k), subKnn, singlePass ? &subBackward : NULL);
+
+        for (size_t i = 0; i < subKnn.size(); i++)
+        {
+            BOOST_FOREACH (DMatch& m, subKnn[i])
+            {
+                m.queryIdx = unguided[i];
+            }
+
+            knn[unguided[i]].swap(subKnn[i]);
+        }
+
+        if (backward && !singlePass)
+        {
+            std::vector<std::vector<DMatch> > back;
+            KnnMatchDescriptors(dst, sub, metric, 1, back);
+
+            subBackward.resize(dst.rows);
+
+            BOOST_FOREACH (const std::vector<DMatch>& m, back)
+            {
+                if (!m.empty()) subBackward[m[0].queryIdx] = m[0];
+            }
+        }
+
+        if (backward)
+        {
+            for (size_t j = 0; j < subBackward.size(); j++)
+            {
+                const DMatch& m = subBackward[j];
+
+                if (m.trainIdx < 0) continue;
+
+                const int i = unguided[m.trainIdx];
+                DMatch& best = (*backward)[j];
+
+                if (m.distance < best.distance || (m.distance == best.distance && i < best.trainIdx))
+                {
+                    best = DMatch(static_cast<int>(j), i, m.distance);
+                }
+            }
+        }
+    }
+
+    return SelectMatches(knn, metric, src.cols, ratioTest);
+}
+
+FeatureMatches FeatureMatcher::SelectMatches(const std::vector<std::vector<DMatch> >& knn, int metric, int d, bool ratioTest)
+{
+    FeatureMatches matches;
+    matches.reserve(knn.size());
 
-    const float distTreshold = GetDistanceThreshold(m_maxDistance, metric, src.cols);
+    const float distTreshold = GetDistanceThreshold(m_maxDistance, metric, d);
 
     if (ratioTest)
     {
         AutoSpeedometreMeasure measure(m_ratioTestMetre, knn.size());
         BOOST_FOREACH(const std::vector<DMatch>& match, knn)
         {
-            if (match[0].distance > distTreshold) continue;
+            if (match.empty() || match[0].distance > distTreshold) continue;
 
-            float ratio = match[0].distance / match[1].distance;
-            int flag = ratio <= m_maxRatio ? FeatureMatch::INLIER : FeatureMatch::RATIO_TEST_FAILED;
+            // without a second neighbour the match cannot be shown distinctive
+            bool passed = match.size() > 1 && match[0].distance / match[1].distance <= m_maxRatio;
+            int flag = passed ? FeatureMatch::INLIER : FeatureMatch::RATIO_TEST_FAILED;
 
             matches.push_back(FeatureMatch(match[0].queryIdx, match[0].trainIdx, match[0].distance, flag));
         }
@@ -667,7 +1176,7 @@ FeatureMatches FeatureMatcher::MatchDescriptors(const Mat& src, const Mat& dst,
     {
         BOOST_FOREACH(const std::vector<DMatch>& match, knn)
         {
-            if (match[0].distance > distTreshold) continue;
+            if (match.empty() || match[0].distance > distTreshold) continue;
             matches.push_back(FeatureMatch(match[0].queryIdx, match[0].trainIdx, match[0].distance));
         }
     }
@@ -753,6 +1262,17 @@ void FeatureMatcher::RunSymmetryTest(FeatureMatches& forward, const FeatureMatch
     }
 }
 
+void FeatureMatcher::RunSymmetryTest(FeatureMatches& forward, const std::vector<DMatch>& backward)
+{
+    BOOST_FOREACH(FeatureMatch& m, forward)
+    {
+        if (m.dstIdx >= backward.size() || backward[m.dstIdx].trainIdx != static_cast<int>(m.srcIdx))
+        {
+            m.Reject(FeatureMatch::SYMMETRIC_FAILED);
+        }
+    }
+}
+
 seq2map::String FeatureMatcher::Report() const
 {
     std::vector<String> summary;
@@ -0,0 +1,722 @@
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+#define WITH_AVX512_POPCNT
+#include <immintrin.h>
+#elif defined(__AVX2__)
+#define WITH_AVX2_POPCNT
+#include <immintrin.h>
+#endif
+#include <cfloat>
+#include <climits>
+#include <boost/cstdint.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <seq2map/features_bruteforce.hpp>
+
+using namespace seq2map;
+
+namespace
+{
+    //
+    // Popcount kernels
+    //
+
+#if defined(WITH_AVX512_POPCNT)
+
+    const size_t s_kernelBytes = 64;
+    const char*  s_kernelName  = "AVX-512";
+
+    inline int HammingDistance(const uchar* a, const uchar* b, size_t bytes)
+    {
+        __m512i acc = _mm512_setzero_si512();
+
+        for (size_t i = 0; i < bytes; i += 64)
+        {
+            const __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+            acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+        }
+
+        return static_cast<int>(_mm512_reduce_add_epi64(acc));
+    }
+
+#elif defined(WITH_AVX2_POPCNT)
+
+    const size_t s_kernelBytes = 32;
+    const char*  s_kernelName  = "AVX2";
+
+    inline int HammingDistance(const uchar* a, const uchar* b, size_t bytes)
+    {
+        // nibble lookup by byte shuffling, summed by SAD into 64-bit lanes
+        const __m256i lut = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low = _mm256_set1_epi8(0x0f);
+        __m256i acc = _mm256_setzero_si256();
+
+        for (size_t i = 0; i < bytes; i += 32)
+        {
+            const __m256i x = _mm256_xor_si256(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+
+            const __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, low));
+            const __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low));
+
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+        }
+
+        return static_cast<int>(
+            _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+            _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3));
+    }
+
+#else
+
+    const size_t s_kernelBytes = 8;
+    const char*  s_kernelName  = "scalar";
+
+    inline int Popcount(boost::uint64_t x)
+    {
+#if defined(__GNUC__)
+        return __builtin_popcountll(x);
+#else
+        x = x - ((x >> 1) & 0x5555555555555555ULL);
+        x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+        x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+
+        return static_cast<int>((x * 0x0101010101010101ULL) >> 56);
+#endif
+    }
+
+    inline int HammingDistance(const uchar* a, const uchar* b, size_t bytes)
+    {
+        int dist = 0;
+
+        for (size_t i = 0; i < bytes; i += 8)
+        {
+            boost::uint64_t x, y;
+
+            memcpy(&x, a + i, sizeof x);
+            memcpy(&y, b + i, sizeof y);
+
+            dist += Popcount(x ^ y);
+        }
+
+        return dist;
+    }
+
+#endif
+
+    /**
+     * Copy descriptors to a buffer with rows zero-padded to a multiple of
+     * the kernel width, so the padding contributes nothing to the distance.
+     */
+    cv::Mat PadDescriptors(const cv::Mat& desc)
+    {
+        const size_t bytes = static_cast<size_t>(desc.cols);
+        const size_t stride = (bytes + s_kernelBytes - 1) / s_kernelBytes * s_kernelBytes;
+
+        if (stride == bytes && desc.isContinuous())
+        {
+            return desc;
+        }
+
+        cv::Mat padded = cv::Mat::zeros(desc.rows, static_cast<int>(stride), CV_8U);
+        desc.copyTo(padded.colRange(0, desc.cols));
+
+        return padded;
+    }
+
+    /**
+     * Nearest query descriptor of each training descriptor, collected while
+     * the distances are evaluated for the forward search.
+     */
+    template<typename T>
+    class ReverseSearch
+    {
+    public:
+        ReverseSearch(int rows, T worst) : m_dist(rows, worst), m_idx(rows, -1) {}
+
+        /**
+         * Queries have to be visited in ascending order for each training
+         * descriptor so ties are kept by the lowest index.
+         */
+        inline void Update(int t, int q, T dt)
+        {
+            if (dt < m_dist[t])
+            {
+                m_dist[t] = dt;
+                m_idx [t] = q;
+            }
+        }
+
+        /**
+         * Merge the results of another range of queries.
+         */
+        void Merge(const ReverseSearch& other)
+        {
+            boost::lock_guard<boost::mutex> locker(m_mtx);
+
+            for (size_t t = 0; t < m_dist.size(); t++)
+            {
+                if (other.m_idx[t] < 0) continue;
+
+                if (m_idx[t] < 0 || other.m_dist[t] < m_dist[t] || (other.m_dist[t] == m_dist[t] && other.m_idx[t] < m_idx[t]))
+                {
+                    m_dist[t] = other.m_dist[t];
+                    m_idx [t] = other.m_idx [t];
+                }
+            }
+        }
+
+        inline int Size() const            { return static_cast<int>(m_dist.size()); }
+        inline int GetIndex(int t) const   { return m_idx[t];  }
+        inline T GetDistance(int t) const  { return m_dist[t]; }
+
+    private:
+        std::vector<T>   m_dist;
+        std::vector<int> m_idx;
+        boost::mutex     m_mtx;
+    };
+
+    /**
+     * Search for the nearest neighbours of a range of query blocks.
+     */
+    class HammingSearch : public cv::ParallelLoopBody
+    {
+    public:
+        static const int QueryBlockRows = 64;
+        static const int TrainBlockRows = 256;
+
+        HammingSearch(const cv::Mat& query, const cv::Mat& train, KnnMatches& knn, int k, ReverseSearch<int>* reverse)
+        : m_query(query), m_train(train), m_knn(knn), m_k(k), m_reverse(reverse) {}
+
+        virtual void operator() (const cv::Range& blocks) const
+        {
+            const size_t bytes = static_cast<size_t>(m_query.cols);
+            const int q0 = blocks.start * QueryBlockRows;
+            const int qn = std::min(blocks.end * QueryBlockRows, m_query.rows);
+
+            boost::scoped_ptr<ReverseSearch<int> > reverse(m_reverse ? new ReverseSearch<int>(m_train.rows, INT_MAX) : NULL);
+
+            for (int qb = q0; qb < qn; qb += QueryBlockRows)
+            {
+                const int qe = std::min(qb + QueryBlockRows, qn);
+
+                // best and second best distances of each query in the block
+                int dist[QueryBlockRows][2];
+                int idx [QueryBlockRows][2];
+
+                for (int q = 0; q < qe - qb; q++)
+                {
+                    dist[q][0] = dist[q][1] = INT_MAX;
+                    idx [q][0] = idx [q][1] = -1;
+                }
+
+                // training rows are visited in ascending order for every
+                // query, so ties are broken the same way as cv::BFMatcher
+                for (int tb = 0; tb < m_train.rows; tb += TrainBlockRows)
+                {
+                    const int te = std::min(tb + TrainBlockRows, m_train.rows);
+
+                    for (int q = qb; q < qe; q++)
+                    {
+                        const uchar* a = m_query.ptr<uchar>(q);
+                        int* d = dist[q - qb];
+                        int* i = idx [q - qb];
+
+                        for (int t = tb; t < te; t++)
+                        {
+                            const int dt = HammingDistance(a, m_train.ptr<uchar>(t), bytes);
+
+                            if (reverse) reverse->Update(t, q, dt);
+                            if (dt >= d[m_k - 1]) continue;
+
+                            if (m_k > 1 && dt < d[0])
+                            {
+                                d[1] = d[0]; i[1] = i[0];
+                                d[0] = dt;   i[0] = t;
+                            }
+                            else
+                            {
+                                d[m_k - 1] = dt; i[m_k - 1] = t;
+                            }
+                        }
+                    }
+                }
+
+                for (int q = qb; q < qe; q++)
+                {
+                    std::vector<cv::DMatch>& matches = m_knn[q];
+                    matches.clear();
+
+                    for (int j = 0; j < m_k && idx[q - qb][j] >= 0; j++)
+                    {
+                        matches.push_back(cv::DMatch(q, idx[q - qb][j], static_cast<float>(dist[q - qb][j])));
+                    }
+                }
+            }
+
+            if (reverse) m_reverse->Merge(*reverse);
+        }
+
+    private:
+        const cv::Mat& m_query;
+        const cv::Mat& m_train;
+        KnnMatches&    m_knn;
+        const int      m_k;
+        ReverseSearch<int>* m_reverse;
+    };
+
+    /**
+     * Distances of a range of query descriptors to their candidates.
+     */
+    class HammingCandidates : public cv::ParallelLoopBody
+    {
+    public:
+        HammingCandidates(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates, CandidateDistances& dist)
+        : m_query(query), m_train(train), m_candidates(candidates), m_dist(dist) {}
+
+        virtual void operator() (const cv::Range& rows) const
+        {
+            const size_t bytes = static_cast<size_t>(m_query.cols);
+
+            for (int q = rows.start; q < rows.end; q++)
+            {
+                const uchar* a = m_query.ptr<uchar>(q);
+                const std::vector<int>& idx = m_candidates[q];
+                std::vector<float>& dist = m_dist[q];
+
+                dist.resize(idx.size());
+
+                for (size_t j = 0; j < idx.size(); j++)
+                {
+                    dist[j] = static_cast<float>(HammingDistance(a, m_train.ptr<uchar>(idx[j]), bytes));
+                }
+            }
+        }
+
+    private:
+        const cv::Mat&        m_query;
+        const cv::Mat&        m_train;
+        const CandidateLists& m_candidates;
+        CandidateDistances&   m_dist;
+    };
+
+    /**
+     * Check the candidate lists of a guided search.
+     */
+    bool CheckCandidates(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates)
+    {
+        if (query.cols != train.cols)
+        {
+            E_ERROR << "descriptor lengths mismatch (" << query.cols << " != " << train.cols << ")";
+            return false;
+        }
+
+        if (candidates.size() != static_cast<size_t>(query.rows))
+        {
+            E_ERROR << "candidate lists mismatch (" << candidates.size() << " != " << query.rows << ")";
+            return false;
+        }
+
+        for (size_t i = 0; i < candidates.size(); i++)
+        {
+            for (size_t j = 0; j < candidates[i].size(); j++)
+            {
+                if (candidates[i][j] < 0 || candidates[i][j] >= train.rows)
+                {
+                    E_ERROR << "candidate " << candidates[i][j] << " of query " << i << " out of range";
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+}
+
+//==[ HammingMatcher ]========================================================//
+
+const size_t HammingMatcher::KernelBytes = s_kernelBytes;
+
+bool HammingMatcher::KnnMatch(const cv::Mat& query, const cv::Mat& train, KnnMatches& knn, int k, std::vector<cv::DMatch>* reverse)
+{
+    if (query.type() != CV_8U || train.type() != CV_8U)
+    {
+        E_ERROR << "binary descriptors expected";
+        return false;
+    }
+
+    if (query.cols != train.cols)
+    {
+        E_ERROR << "descriptor lengths mismatch (" << query.cols << " != " << train.cols << ")";
+        return false;
+    }
+
+    if (k < 1 || k > 2)
+    {
+        E_ERROR << "k=" << k << " not supported";
+        return false;
+    }
+
+    knn.clear();
+    knn.resize(query.rows);
+
+    if (reverse)
+    {
+        reverse->clear();
+        reverse->resize(train.rows);
+    }
+
+    if (query.rows == 0 || train.rows == 0)
+    {
+        return true;
+    }
+
+    const cv::Mat q = PadDescriptors(query);
+    const cv::Mat t = PadDescriptors(train);
+    const int blocks = (query.rows + HammingSearch::QueryBlockRows - 1) / HammingSearch::QueryBlockRows;
+
+    ReverseSearch<int> search(reverse ? train.rows : 0, INT_MAX);
+    cv::parallel_for_(cv::Range(0, blocks), HammingSearch(q, t, knn, k, reverse ? &search : NULL));
+
+    if (reverse)
+    {
+        for (int i = 0; i < search.Size(); i++)
+        {
+            (*reverse)[i] = cv::DMatch(i, search.GetIndex(i), static_cast<float>(search.GetDistance(i)));
+        }
+    }
+
+    return true;
+}
+
+bool HammingMatcher::Distances(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates, CandidateDistances& dist)
+{
+    if (query.type() != CV_8U || train.type() != CV_8U)
+    {
+        E_ERROR << "binary descriptors expected";
+        return false;
+    }
+
+    if (!CheckCandidates(query, train, candidates))
+    {
+        return false;
+    }
+
+    dist.clear();
+    dist.resize(query.rows);
+
+    if (query.rows == 0 || train.rows == 0)
+    {
+        return true;
+    }
+
+    // padded once for all the queries
+    const cv::Mat q = PadDescriptors(query);
+    const cv::Mat t = PadDescriptors(train);
+
+    cv::parallel_for_(cv::Range(0, query.rows), HammingCandidates(q, t, candidates, dist));
+
+    return true;
+}
+
+String HammingMatcher::GetKernelName()
+{
+    return s_kernelName;
+}
+
+//==[ L2Matcher ]=============================================================//
+
+namespace
+{
+    /**
+     * Search for the nearest neighbours of a range of query blocks, one
+     * distance tile at a time.
+     */
+    class L2Search : public cv::ParallelLoopBody
+    {
+    public:
+        static const int QueryBlockRows = 64;
+        static const int TrainBlockRows = 256;
+
+        L2Search(const cv::Mat& query, const cv::Mat& train, const cv::Mat& qnorms, const cv::Mat& tnorms, KnnMatches& knn, int k, bool squared, ReverseSearch<float>* reverse)
+        : m_query(query), m_train(train), m_qnorms(qnorms), m_tnorms(tnorms), m_knn(knn), m_k(k), m_squared(squared), m_reverse(reverse) {}
+
+        virtual void operator() (const cv::Range& blocks) const
+        {
+            const int q0 = blocks.start * QueryBlockRows;
+            const int qn = std::min(blocks.end * QueryBlockRows, m_query.rows);
+            cv::Mat tile; // reused by the tiles of this thread
+
+            boost::scoped_ptr<ReverseSearch<float> > reverse(m_reverse ? new ReverseSearch<float>(m_train.rows, FLT_MAX) : NULL);
+
+            for (int qb = q0; qb < qn; qb += QueryBlockRows)
+            {
+                const int qe = std::min(qb + QueryBlockRows, qn);
+
+                float dist[QueryBlockRows][2];
+                int   idx [QueryBlockRows][2];
+
+                for (int q = 0; q < qe - qb; q++)
+                {
+                    dist[q][0] = dist[q][1] = FLT_MAX;
+                    idx [q][0] = idx [q][1] = -1;
+                }
+
+                for (int tb = 0; tb < m_train.rows; tb += TrainBlockRows)
+                {
+                    const int te = std::min(tb + TrainBlockRows, m_train.rows);
+                    const float* tn = m_tnorms.ptr<float>() + tb;
+
+                    // dot products of the blocks
+                    cv::gemm(m_query.rowRange(qb, qe), m_train.rowRange(tb, te), 1.0f, cv::noArray(), 0.0f, tile, cv::GEMM_2_T);
+
+                    for (int q = qb; q < qe; q++)
+                    {
+                        const float* dot = tile.ptr<float>(q - qb);
+                        const float  qn2 = m_qnorms.at<float>(q);
+                        float* d = dist[q - qb];
+                        int*   i = idx [q - qb];
+
+                        for (int t = 0; t < te - tb; t++)
+                        {
+                            const float dt = qn2 + tn[t] - 2.0f * dot[t];
+
+                            if (reverse) reverse->Update(tb + t, q, dt);
+                            if (dt >= d[m_k - 1]) continue;
+
+                            if (m_k > 1 && dt < d[0])
+                            {
+                                d[1] = d[0]; i[1] = i[0];
+                                d[0] = dt;   i[0] = tb + t;
+                            }
+                            else
+                            {
+                                d[m_k - 1] = dt; i[m_k - 1] = tb + t;
+                            }
+                        }
+                    }
+                }
+
+                for (int q = qb; q < qe; q++)
+                {
+                    std::vector<cv::DMatch>& matches = m_knn[q];
+                    matches.clear();
+
+                    for (int j = 0; j < m_k && idx[q - qb][j] >= 0; j++)
+                    {
+                        // rounding errors may push a distance slightly below zero
+                        const float d2 = std::max(dist[q - qb][j], 0.0f);
+                        matches.push_back(cv::DMatch(q, idx[q - qb][j], m_squared ? d2 : std::sqrt(d2)));
+                    }
+                }
+            }
+
+            if (reverse) m_reverse->Merge(*reverse);
+        }
+
+    private:
+        const cv::Mat& m_query;
+        const cv::Mat& m_train;
+        const cv::Mat& m_qnorms;
+        const cv::Mat& m_tnorms;
+        KnnMatches&    m_knn;
+        const int      m_k;
+        const bool     m_squared;
+        ReverseSearch<float>* m_reverse;
+    };
+
+    /**
+     * Distances of a range of query descriptors to their candidates.
+     */
+    class L2Candidates : public cv::ParallelLoopBody
+    {
+    public:
+        L2Candidates(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates, CandidateDistances& dist, bool squared)
+        : m_query(query), m_train(train), m_candidates(candidates), m_dist(dist), m_squared(squared) {}
+
+        virtual void operator() (const cv::Range& rows) const
+        {
+            const int d = m_query.cols;
+
+            for (int q = rows.start; q < rows.end; q++)
+            {
+                const float* a = m_query.ptr<float>(q);
+                const std::vector<int>& idx = m_candidates[q];
+                std::vector<float>& dist = m_dist[q];
+
+                dist.resize(idx.size());
+
+                for (size_t j = 0; j < idx.size(); j++)
+                {
+                    const float* b = m_train.ptr<float>(idx[j]);
+                    float d2 = 0.0f;
+
+                    for (int c = 0; c < d; c++)
+                    {
+                        const float dc = a[c] - b[c];
+                        d2 += dc * dc;
+                    }
+
+                    dist[j] = m_squared ? d2 : std::sqrt(d2);
+                }
+            }
+        }
+
+    private:
+        const cv::Mat&        m_query;
+        const cv::Mat&        m_train;
+        const CandidateLists& m_candidates;
+        CandidateDistances&   m_dist;
+        const bool            m_squared;
+    };
+
+    cv::Mat SquaredNorms(const cv::Mat& desc)
+    {
+        cv::Mat norms;
+        cv::reduce(desc.mul(desc), norms, 1, cv::REDUCE_SUM, CV_32F);
+
+        return norms;
+    }
+}
+
+bool L2Matcher::KnnMatch(const cv::Mat& query, const cv::Mat& train, KnnMatches& knn, int k, int metric, std::vector<cv::DMatch>* reverse)
+{
+    if (query.type() != CV_32F || train.type() != CV_32F)
+    {
+        E_ERROR << "single precision descriptors expected";
+        return false;
+    }
+
+    if (query.cols != train.cols)
+    {
+        E_ERROR << "descriptor lengths mismatch (" << query.cols << " != " << train.cols << ")";
+        return false;
+    }
+
+    if (k < 1 || k > 2)
+    {
+        E_ERROR << "k=" << k << " not supported";
+        return false;
+    }
+
+    if (metric != cv::NORM_L2 && metric != cv::NORM_L2SQR)
+    {
+        E_ERROR << "unsupported metric " << metric;
+        return false;
+    }
+
+    knn.clear();
+    knn.resize(query.rows);
+
+    if (reverse)
+    {
+        reverse->clear();
+        reverse->resize(train.rows);
+    }
+
+    if (query.rows == 0 || train.rows == 0)
+    {
+        return true;
+    }
+
+    const bool squared = metric == cv::NORM_L2SQR;
+    const cv::Mat qnorms = SquaredNorms(query);
+    const cv::Mat tnorms = SquaredNorms(train);
+    const int blocks = (query.rows + L2Search::QueryBlockRows - 1) / L2Search::QueryBlockRows;
+
+    ReverseSearch<float> search(reverse ? train.rows : 0, FLT_MAX);
+    cv::parallel_for_(cv::Range(0, blocks), L2Search(query, train, qnorms, tnorms, knn, k, squared, reverse ? &search : NULL));
+
+    if (reverse)
+    {
+        for (int i = 0; i < search.Size(); i++)
+        {
+            const float d2 = std::max(search.GetDistance(i), 0.0f);
+            (*reverse)[i] = cv::DMatch(i, search.GetIndex(i), squared ? d2 : std::sqrt(d2));
+        }
+    }
+
+    return true;
+}
+
+bool L2Matcher::Distances(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates, CandidateDistances& dist, int metric)
+{
+    if (query.type() != CV_32F || train.type() != CV_32F)
+    {
+        E_ERROR << "single precision descriptors expected";
+        return false;
+    }
+
+    if (metric != cv::NORM_L2 && metric != cv::NORM_L2SQR)
+    {
+        E_ERROR << "unsupported metric " << metric;
+        return false;
+    }
+
+    if (!CheckCandidates(query, train, candidates))
+    {
+        return false;
+    }
+
+    dist.clear();
+    dist.resize(query.rows);
+
+    if (query.rows == 0 || train.rows == 0)
+    {
+        return true;
+    }
+
+    cv::parallel_for_(cv::Range(0, query.rows), L2Candidates(query, train, candidates, dist, metric == cv::NORM_L2SQR));
+
+    return true;
+}
+
+namespace
+{
+    template<typename T>
+    void NormaliseRows(const cv::Mat& desc, cv::Mat& normalised)
+    {
+        const int n = desc.cols * desc.channels();
+
+        for (int i = 0; i < desc.rows; i++)
+        {
+            const T* src = desc.ptr<T>(i);
+            T* dst = normalised.ptr<T>(i);
+            double norm2 = 0;
+
+            for (int j = 0; j < n; j++)
+            {
+                norm2 += static_cast<double>(src[j]) * src[j];
+            }
+
+            // zero rows are copied as they are
+            const T scale = norm2 > 0 ? static_cast<T>(1.0 / std::sqrt(norm2)) : 1;
+
+            for (int j = 0; j < n; j++)
+            {
+                dst[j] = src[j] * scale;
+            }
+        }
+    }
+}
+
+cv::Mat L2Matcher::Normalise(const cv::Mat& desc)
+{
+    cv::Mat normalised = cv::Mat(desc.rows, desc.cols, desc.type());
+
+    switch (desc.depth())
+    {
+    case CV_32F: NormaliseRows<float> (desc, normalised); break;
+    case CV_64F: NormaliseRows<double>(desc, normalised); break;
+    default:
+        for (int i = 0; i < desc.rows; i++)
+        {
+            cv::normalize(desc.row(i), normalised.row(i));
+        }
+    }
+
+    return normalised;
+}
@@ -1,4 +1,6 @@
 #include <seq2map/geometry.hpp>
+#include <seq2map/thread_pool.hpp>
+#include <boost/bind.hpp>
 
 using namespace seq2map;
 
@@ -73,6 +75,25 @@ Geometry& Geometry::operator= (Geometry& g)
     return *this;
 }
 
+Geometry& Geometry::operator= (Geometry&& g)
+{
+    if (this != &g)
+    {
+        Reshape(g.shape, shape, mat = g.mat);
+        g.mat.release();
+    }
+
+    return *this;
+}
+
+Geometry Geometry::Reshape(Shape shape) const
+{
+    cv::Mat m = mat;
+    Reshape(this->shape, shape, m);
+
+    return Geometry(shape, m);
+}
+
 Geometry Geometry::operator- (const Geometry& g) const
 {
     if (!IsConsistent(g)) return Geometry(shape);
@@ -150,11 +171,7 @@ Geometry Geometry::Reshape(const Geometry& g) const
     }
 
     cv::Mat m = mat;
-    
-    if (!Reshape(shape, g.shape, m, g.mat.rows))
-    {
-        m = m.clone();
-    }
+    Reshape(shape, g.shape, m, g.mat.rows);
 
     return Geometry(g.shape, m);
 }
@@ -510,6 +527,336 @@ bool WeightedEuclideanMetric::FromMahalanobis(const MahalanobisMetric& metric)
 
 double MahalanobisMetric::s_rcondThreshold = 1e-10;
 
+namespace
+{
+    /**
+     * Invert a packed symmetric matrix of up to three dimensions in closed
+     * form. The reciprocal condition number is estimated by the ratio of the
+     * smallest to the largest absolute eigenvalue, as cv::invert does with
+     * cv::DECOMP_SVD for a symmetric matrix.
+     *
+     * \param c packed upper-triangular elements of the matrix.
+     * \param ic packed upper-triangular elements of the inverse.
+     * \param dims dimensionality, from 1 to 3.
+     * \return Reciprocal condition number.
+     */
+    double InvertPacked(const double* c, double* ic, int dims)
+    {
+        double l0, l1;
+
+        switch (dims)
+        {
+        case 1:
+
+            ic[0] = 1 / c[0];
+            return c[0] != 0 ? 1 : 0;
+
+        case 2:
+        {
+            const double mean = 0.5 * (c[0] + c[2]);
+            const double dev  = std::sqrt(0.25 * (c[0] - c[2]) * (c[0] - c[2]) + c[1] * c[1]);
+            const double det  = c[0] * c[2] - c[1] * c[1];
+
+            l0 = std::abs(mean + dev);
+            l1 = std::abs(mean - dev);
+
+            ic[0] =  c[2] / det;
+            ic[1] = -c[1] / det;
+            ic[2] =  c[0] / det;
+
+            break;
+        }
+
+        case 3:
+        {
+            // adjugate
+            const double a00 = c[3] * c[5] - c[4] * c[4];
+            const double a01 = c[2] * c[4] - c[1] * c[5];
+            const double a02 = c[1] * c[4] - c[2] * c[3];
+            const double a11 = c[0] * c[5] - c[2] * c[2];
+            const double a12 = c[1] * c[2] - c[0] * c[4];
+            const double a22 = c[0] * c[3] - c[1] * c[1];
+            const double det = c[0] * a00 + c[1] * a01 + c[2] * a02;
+
+            ic[0] = a00 / det; ic[1] = a01 / det; ic[2] = a02 / det;
+            ic[3] = a11 / det; ic[4] = a12 / det; ic[5] = a22 / det;
+
+            // eigenvalues by the trigonometric solution of the characteristic polynomial
+            const double q  = (c[0] + c[3] + c[5]) / 3;
+            const double p1 = c[1] * c[1] + c[2] * c[2] + c[4] * c[4];
+            const double p2 = (c[0] - q) * (c[0] - q) + (c[3] - q) * (c[3] - q) + (c[5] - q) * (c[5] - q) + 2 * p1;
+            const double p  = std::sqrt(p2 / 6);
+
+            if (p == 0)
+            {
+                l0 = l1 = std::abs(q);
+                break;
+            }
+
+            const double b00 = (c[0] - q) / p, b11 = (c[3] - q) / p, b22 = (c[5] - q) / p;
+            const double b01 = c[1] / p, b02 = c[2] / p, b12 = c[4] / p;
+            const double r = 0.5 * (b00 * (b11 * b22 - b12 * b12) - b01 * (b01 * b22 - b12 * b02) + b02 * (b01 * b12 - b11 * b02));
+            const double phi = std::acos(std::min(std::max(r, -1.0), 1.0)) / 3;
+
+            const double e0 = q + 2 * p * std::cos(phi);
+            const double e2 = q + 2 * p * std::cos(phi + 2 * CV_PI / 3);
+            const double e1 = 3 * q - e0 - e2;
+
+            l0 = std::max(std::abs(e0), std::max(std::abs(e1), std::abs(e2)));
+            l1 = std::min(std::abs(e0), std::min(std::abs(e1), std::abs(e2)));
+
+            break;
+        }
+
+        default:
+            return 0;
+        }
+
+        const double lmax = std::max(l0, l1);
+        return lmax > 0 ? std::min(l0, l1) / lmax : 0;
+    }
+
+    /**
+     * Mahalanobis norms of the rows of a D-dimensional geometry matrix,
+     * from packed inverse covariances in a single pass.
+     */
+    template<typename T, int D>
+    void MahalanobisKernel(const cv::Mat& x, const cv::Mat& icv, MahalanobisMetric::CovarianceType type, cv::Mat& d)
+    {
+        T* di = d.ptr<T>();
+
+        switch (type)
+        {
+        case MahalanobisMetric::ISOTROPIC:
+
+            for (int i = 0; i < x.rows; i++)
+            {
+                const T* xi = x.ptr<T>(i);
+                double s = 0;
+
+                for (int j = 0; j < D; j++)
+                {
+                    s += static_cast<double>(xi[j]) * xi[j];
+                }
+
+                di[i] = static_cast<T>(std::sqrt(icv.ptr<double>(i)[0] * s));
+            }
+
+            break;
+
+        case MahalanobisMetric::ANISOTROPIC_ORTHOGONAL:
+
+            for (int i = 0; i < x.rows; i++)
+            {
+                const T* xi = x.ptr<T>(i);
+                const double* wi = icv.ptr<double>(i);
+                double s = 0;
+
+                for (int j = 0; j < D; j++)
+                {
+                    s += wi[j] * xi[j] * xi[j];
+                }
+
+                di[i] = static_cast<T>(std::sqrt(s));
+            }
+
+            break;
+
+        case MahalanobisMetric::ANISOTROPIC_ROTATED:
+
+            for (int i = 0; i < x.rows; i++)
+            {
+                const T* xi = x.ptr<T>(i);
+                const double* wi = icv.ptr<double>(i);
+                double s = 0;
+
+                // packed upper-triangular elements in the order of sub2symind
+                for (int j0 = 0, k = 0; j0 < D; j0++)
+                {
+                    s += wi[k++] * xi[j0] * xi[j0];
+
+                    for (int j1 = j0 + 1; j1 < D; j1++)
+                    {
+                        s += 2 * wi[k++] * xi[j0] * xi[j1];
+                    }
+                }
+
+                di[i] = static_cast<T>(std::sqrt(s));
+            }
+
+            break;
+        }
+    }
+
+    template<typename T>
+    bool RunMahalanobisKernel(const cv::Mat& x, const cv::Mat& icv, MahalanobisMetric::CovarianceType type, cv::Mat& d)
+    {
+        switch (x.cols)
+        {
+        case 1: MahalanobisKernel<T, 1>(x, icv, type, d); return true;
+        case 2: MahalanobisKernel<T, 2>(x, icv, type, d); return true;
+        case 3: MahalanobisKernel<T, 3>(x, icv, type, d); return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * Check the leading principal minors of a packed symmetric matrix of up to
+     * three dimensions, as checkPositiveDefinite() does.
+     */
+    bool IsPositiveDefinitePacked(const double* c, int dims)
+    {
+        switch (dims)
+        {
+        case 1: return c[0] >= 0;
+        case 2: return c[0] >= 0 && c[0] * c[2] - c[1] * c[1] >= 0;
+        case 3: return c[0] >= 0 && c[0] * c[3] - c[1] * c[1] >= 0 &&
+            c[0] * (c[3] * c[5] - c[4] * c[4]) - c[1] * (c[1] * c[5] - c[4] * c[2]) + c[2] * (c[1] * c[4] - c[3] * c[2]) >= 0;
+        }
+
+        return false;
+    }
+
+    /**
+     * Propagation of packed covariances through Jacobians by C' = A * C * A'
+     * one block of rows at a time. A Jacobian is stored column by column, i.e.
+     * A(i,k) is found at k * D1 + i. An empty covariance matrix stands for
+     * identities.
+     */
+    class CovariancePropagation
+    {
+    public:
+        static const int BlockRows = 256;
+
+        CovariancePropagation(const cv::Mat& cov, const cv::Mat& jac, int d0, int d1, cv::Mat& out)
+        : m_cov(cov), m_jac(jac), m_d0(d0), m_d1(d1), m_out(out) {}
+
+        void Run(int block) const
+        {
+            const int i0 = block * BlockRows;
+            const int in = std::min(i0 + BlockRows, m_out.rows);
+
+            // the common shapes get fixed-size kernels
+            if      (m_d0 == 2 && m_d1 == 2) Propagate<2, 2>(i0, in);
+            else if (m_d0 == 3 && m_d1 == 2) Propagate<3, 2>(i0, in);
+            else if (m_d0 == 3 && m_d1 == 3) Propagate<3, 3>(i0, in);
+            else if (m_d0 == 4 && m_d1 == 3) Propagate<4, 3>(i0, in);
+            else if (m_d0 == 6 && m_d1 == 3) Propagate<6, 3>(i0, in);
+            else
+            {
+                std::vector<double> C(m_d0 * m_d0), B(m_d1 * m_d0);
+                Propagate(i0, in, m_d0, m_d1, &C[0], &B[0]);
+            }
+        }
+
+    private:
+        // the loop bounds are known at compile time so the compiler can unroll
+        // the products of the fixed-size matrices
+        template<int D0, int D1>
+        void Propagate(int i0, int in) const
+        {
+            cv::Matx<double, D0, D0> C = cv::Matx<double, D0, D0>::eye();
+            cv::Matx<double, D1, D0> A;
+
+            for (int i = i0; i < in; i++)
+            {
+                const double* c = m_cov.empty() ? NULL : m_cov.ptr<double>(m_cov.rows == 1 ? 0 : i);
+                const double* a = m_jac.ptr<double>(m_jac.rows == 1 ? 0 : i);
+                double* ci = m_out.ptr<double>(i);
+
+                // unpack C, which stays the identity when not given
+                if (c)
+                {
+                    for (int j0 = 0, k = 0; j0 < D0; j0++)
+                    {
+                        for (int j1 = j0; j1 < D0; j1++, k++)
+                        {
+                            C(j0, j1) = C(j1, j0) = c[k];
+                        }
+                    }
+                }
+
+                for (int k = 0; k < D0; k++)
+                {
+                    for (int j = 0; j < D1; j++)
+                    {
+                        A(j, k) = a[k * D1 + j];
+                    }
+                }
+
+                const cv::Matx<double, D1, D1> S = A * C * A.t();
+
+                // upper-triangular part only
+                for (int j0 = 0, k = 0; j0 < D1; j0++)
+                {
+                    for (int j1 = j0; j1 < D1; j1++, k++)
+                    {
+                        ci[k] = S(j0, j1);
+                    }
+                }
+            }
+        }
+
+        inline void Propagate(int i0, int in, int d0, int d1, double* C, double* B) const
+        {
+            for (int i = i0; i < in; i++)
+            {
+                const double* c = m_cov.empty() ? NULL : m_cov.ptr<double>(m_cov.rows == 1 ? 0 : i);
+                const double* a = m_jac.ptr<double>(m_jac.rows == 1 ? 0 : i);
+                double* ci = m_out.ptr<double>(i);
+
+                // unpack C
+                for (int j0 = 0, k = 0; j0 < d0; j0++)
+                {
+                    for (int j1 = j0; j1 < d0; j1++, k++)
+                    {
+                        C[j0 * d0 + j1] = C[j1 * d0 + j0] = c ? c[k] : (j0 == j1 ? 1 : 0);
+                    }
+                }
+
+                // B = A * C
+                for (int j0 = 0; j0 < d1; j0++)
+                {
+                    for (int j1 = 0; j1 < d0; j1++)
+                    {
+                        double b = 0;
+
+                        for (int k = 0; k < d0; k++)
+                        {
+                            b += a[k * d1 + j0] * C[k * d0 + j1];
+                        }
+
+                        B[j0 * d0 + j1] = b;
+                    }
+                }
+
+                // C' = B * A', upper-triangular part only
+                for (int j0 = 0, k = 0; j0 < d1; j0++)
+                {
+                    for (int j1 = j0; j1 < d1; j1++, k++)
+                    {
+                        double cij = 0;
+
+                        for (int l = 0; l < d0; l++)
+                        {
+                            cij += B[j0 * d0 + l] * a[l * d1 + j1];
+                        }
+
+                        ci[k] = cij;
+                    }
+                }
+            }
+        }
+
+        const cv::Mat& m_cov;
+        const cv::Mat& m_jac;
+        const int m_d0;
+        const int m_d1;
+        cv::Mat& m_out;
+    };
+}
+
 boost::shared_ptr<MahalanobisMetric> MahalanobisMetric::Identity(size_t numel, size_t dims, int depth)
 {
     const int ELEM = static_cast<int>(numel);
@@ -523,6 +870,8 @@ boost::shared_ptr<MahalanobisMetric> MahalanobisMetric::Identity(size_t numel, s
         metric->m_cov.mat.col(sub2symind(d, d, DIMS)).setTo(1.0f);
     }
 
+    metric->m_icv.mat = metric->m_cov.mat.clone(); // inverse of the identity
+
     return boost::shared_ptr<MahalanobisMetric>(metric);
 }
 
@@ -539,6 +888,7 @@ Metric::Own MahalanobisMetric::operator[] (const IndexList& indices) const
 {
     MahalanobisMetric* metric = new MahalanobisMetric(type, dims);
     metric->m_cov = m_cov[indices];
+    metric->m_icv = m_icv[indices];
 
     return Metric::Own(metric);
 }
@@ -609,9 +959,15 @@ Metric::Own MahalanobisMetric::Transform(const EuclideanTransform& tform, const
     const int N1 = static_cast<int>(n0 > n1 ? n0 : n1);
     const int DIMS = static_cast<int>(dims);
 
-    MahalanobisMetric* metric = new MahalanobisMetric(ANISOTROPIC_ROTATED, D1);
     const cv::Mat cov0 = GetFullCovMat();
-    /***/ cv::Mat cov1 = cv::Mat::zeros(N1, static_cast<int>(metric->GetCovMatCols()), cov0.depth());
+
+    if (cov0.empty())
+    {
+        return Metric::Own();
+    }
+
+    MahalanobisMetric* metric = new MahalanobisMetric(ANISOTROPIC_ROTATED, D1);
+    cv::Mat cov1;
     cv::Mat R = !jacobianOnly ? tform.GetRotation().ToMatrix() : cv::Mat();
 
     if (!R.empty() && R.depth() != cov0.depth()) 
@@ -619,97 +975,16 @@ Metric::Own MahalanobisMetric::Transform(const EuclideanTransform& tform, const
         R.convertTo(R, cov0.depth());
     }
 
-#if 1 // faster upper-triangular column-wise computation
-    // C' = (J * R) * C * (R' * J') = A * C * A' = B * A'
+#if 1 // batched fixed-size kernels
+    // C' = (J * R) * C * (R' * J') = A * C * A'
     // C : D0 x D0
     // A : D1 x D0
-    // B : D1 x D0
     // C': D1 x D1
     const cv::Mat A = jac.IsEmpty() ? cv::Mat(R.t()).reshape(1, 1) : (R.empty() ? jac.mat : jacmul(jac.mat, R)); // A = J * R
-    /***/ cv::Mat B = cv::Mat::zeros(N1, D0*D1, cov1.depth()); // B = A * C
-
-    if (n0 == 1) // one covariance via one or many Jacobians
-    {
-        for (int k = 0; k < D0; k++)
-        {
-            for (int j = 0; j < D0; j++)
-            {
-                cv::Mat Ckj = cov0.col(sub2symind(k, j, D0)); // 1-by-1 scalar
-                for (int i = 0; i < D1; i++)
-                {
-                    cv::Mat Aik = A.col(k * D1 + i);
-                    cv::Mat Bij = B.col(i * D0 + j);
-                    cv::add(Aik*Ckj, Bij, Bij);
-                }
-            }
-        }
-    }
-    else if (n1 == 1) // many covariances via one Jacobian
-    {
-        for (int k = 0; k < D0; k++)
-        {
-            for (int j = 0; j < D0; j++)
-            {
-                cv::Mat Ckj = cov0.col(sub2symind(k, j, D0));
-                for (int i = 0; i < D1; i++)
-                {
-                    cv::Mat Aik = A.col(k * D1 + i); // 1-by-1 scalar
-                    cv::Mat Bij = B.col(i * D0 + j);
-                    cv::add(Ckj*Aik, Bij, Bij);
-                }
-            }
-        }
-    }
-    else // many covariances via many Jacobians (per-element operation)
-    {
-        for (int k = 0; k < D0; k++)
-        {
-            for (int j = 0; j < D0; j++)
-            {
-                cv::Mat Ckj = cov0.col(sub2symind(k, j, D0));
-                for (int i = 0; i < D1; i++)
-                {
-                    cv::Mat Aik = A.col(k * D1 + i);
-                    cv::Mat Bij = B.col(i * D0 + j);
-                    cv::add(Aik.mul(Ckj), Bij, Bij);
-                }
-            }
-        }
-    }
-    
-    if (n1 == 1) // many covariances via one Jacobian
-    {
-        for (int i = 0; i < D1; i++)
-        {
-            for (int j = i; j < D1; j++)
-            {
-                cv::Mat Cij = cov1.col(sub2symind(i, j, D1));
-                for (int k = 0; k < D0; k++) // Cij = Bik * A'kj = Bik * Ajk
-                {
-                    cv::Mat Bik = B.col(i * D0 + k);
-                    cv::Mat Ajk = A.col(k * D1 + j);
-                    cv::add(Bik * Ajk, Cij, Cij);
-                }
-            }
-        }
-    }
-    else
-    {
-        for (int i = 0; i < D1; i++)
-        {
-            for (int j = i; j < D1; j++)
-            {
-                cv::Mat Cij = cov1.col(sub2symind(i, j, D1));
-                for (int k = 0; k < D0; k++) // Cij = Bik * A'kj = Bik * Ajk
-                {
-                    cv::Mat Bik = B.col(i * D0 + k);
-                    cv::Mat Ajk = A.col(k * D1 + j);
-                    cv::add(Bik.mul(Ajk), Cij, Cij);
-                }
-            }
-        }
-    }
+    PropagateCovMat(cov0, A, d0, d1).convertTo(cov1, cov0.depth());
 #else // explicit matrix multiplication by slice extraction
+    cov1 = cv::Mat::zeros(N1, static_cast<int>(metric->GetCovMatCols()), cov0.depth());
+
     if (jac.IsEmpty())
     {
         cv::Mat Rt = R.t();
@@ -928,6 +1203,8 @@ cv::Mat MahalanobisMetric::Update(const MahalanobisMetric& metric)
             }
         }
 
+        m_icv.mat = GetInverseCovMat(m_cov.mat);
+
         return K;
     }
 
@@ -1013,6 +1290,8 @@ cv::Mat MahalanobisMetric::Update(const MahalanobisMetric& metric)
         symmat(cov).copyTo(cov0.row(i));
     }
 
+    m_icv.mat = GetInverseCovMat(m_cov.mat);
+
     return K;
 }
 
@@ -1045,16 +1324,20 @@ bool MahalanobisMetric::SetCovarianceMat(const cv::Mat& cov)
     }
 
     m_cov.mat = cov.clone();
-    m_icv.mat = cv::Mat(); // do lazy evaluation
-    // m_icv.mat = GetInverseCovMat(cov);
 
     const int DIMS = static_cast<int>(dims);
 
     if (type == ANISOTROPIC_ROTATED)
     {
+        const bool packed = cov.depth() == CV_64F && DIMS <= 3;
+
         for (int i = 0; i < cov.rows; i++)
         {
-            if (/*cov.at<double>(i,0) != 0 &&*/ !checkPositiveDefinite(symmat(cov.row(i), DIMS)))
+            const bool pd = packed ?
+                IsPositiveDefinitePacked(cov.ptr<double>(i), DIMS) :
+                checkPositiveDefinite(symmat(cov.row(i), DIMS));
+
+            if (/*cov.at<double>(i,0) != 0 &&*/ !pd)
             {
                 E_TRACE << "entry " << i << " is not positive-definite or nearly singular";
                 m_cov.mat.row(i).setTo(0.0f); // nullify the entry
@@ -1062,6 +1345,10 @@ bool MahalanobisMetric::SetCovarianceMat(const cv::Mat& cov)
         }
     }
 
+    // computed here rather than on first use, as a metric shared by the
+    // hypotheses of ConsensusPoseEstimator is evaluated concurrently
+    m_icv.mat = GetInverseCovMat(m_cov.mat);
+
     return true;
 }
 
@@ -1075,6 +1362,23 @@ cv::Mat MahalanobisMetric::GetInverseCovMat(const cv::Mat& cov) const
     const int DIMS = static_cast<int>(dims);
     cv::Mat icv = cv::Mat(cov.rows, cov.cols, cov.type());
 
+    if (cov.depth() == CV_64F && DIMS <= 3)
+    {
+        for (int i = 0; i < cov.rows; i++)
+        {
+            double* ici = icv.ptr<double>(i);
+            const double rcond = InvertPacked(cov.ptr<double>(i), ici, DIMS);
+
+            if (rcond < s_rcondThreshold)
+            {
+                E_TRACE << "the inverse of entry " << i << " is badly scaled hence discarded (RCOND = " << rcond << ")";
+                std::fill(ici, ici + icv.cols, 0.0f);
+            }
+        }
+
+        return icv;
+    }
+
     for (int i = 0; i < cov.rows; i++)
     {
         cv::Mat S2_inv;
@@ -1197,6 +1501,55 @@ bool MahalanobisMetric::FromMahalanobis(const MahalanobisMetric& metric)
     return true;
 }
 
+cv::Mat MahalanobisMetric::PropagateCovMat(const cv::Mat& cov, const cv::Mat& jac, size_t d0, size_t d1)
+{
+    const int D0 = static_cast<int>(d0);
+    const int D1 = static_cast<int>(d1);
+
+    if ((!cov.empty() && static_cast<size_t>(cov.cols) != GetCovMatCols(ANISOTROPIC_ROTATED, d0)) ||
+        static_cast<size_t>(jac.cols) != d0 * d1 || jac.channels() != 1 || cov.channels() > 1)
+    {
+        E_ERROR << "given covariances and Jacobians do not match the dimensionalities " << d0 << " and " << d1;
+        return cv::Mat();
+    }
+
+    if (!cov.empty() && cov.rows != 1 && jac.rows != 1 && cov.rows != jac.rows)
+    {
+        E_ERROR << "given Jacobian is for " << jac.rows << " element(s) while there are " << cov.rows << " covariance(s)";
+        return cv::Mat();
+    }
+
+    cv::Mat cov64f = cov, jac64f = jac;
+
+    if (!cov.empty() && cov.depth() != CV_64F) cov.convertTo(cov64f, CV_64F);
+    if (jac.depth() != CV_64F)                 jac.convertTo(jac64f, CV_64F);
+
+    const int rows = cov.empty() || cov.rows == 1 ? jac.rows : cov.rows;
+    const int blocks = (rows + CovariancePropagation::BlockRows - 1) / CovariancePropagation::BlockRows;
+
+    cv::Mat out(rows, static_cast<int>(GetCovMatCols(ANISOTROPIC_ROTATED, d1)), CV_64F);
+    CovariancePropagation propagation(cov64f, jac64f, D0, D1, out);
+
+    if (blocks == 1)
+    {
+        propagation.Run(0);
+        return out;
+    }
+
+    // the blocks go to the shared pool rather than OpenCV's, so a call made
+    // from a RANSAC hypothesis on a pool worker does not oversubscribe cores
+    ThreadPool::TaskGroup tasks;
+
+    for (int b = 0; b < blocks; b++)
+    {
+        tasks.Run(boost::bind(&CovariancePropagation::Run, &propagation, b));
+    }
+
+    tasks.Wait();
+
+    return out;
+}
+
 Geometry MahalanobisMetric::operator() (const Geometry& x) const
 {
     if (x.shape != Geometry::ROW_MAJOR)
@@ -1216,13 +1569,18 @@ Geometry MahalanobisMetric::operator() (const Geometry& x) const
         return Geometry(x.shape);
     }
 
-    if (m_icv.mat.empty())
+    cv::Mat d = cv::Mat::zeros(x.mat.rows, 1, x.mat.depth());
+
+    // dedicated kernels for the low-dimensional cases
+    if (m_icv.mat.depth() == CV_64F && x.mat.channels() == 1)
     {
-        m_icv.mat = GetInverseCovMat(m_cov.mat);
+        switch (x.mat.depth())
+        {
+        case CV_32F: if (RunMahalanobisKernel<float> (x.mat, m_icv.mat, type, d)) return Geometry(x.shape, d); break;
+        case CV_64F: if (RunMahalanobisKernel<double>(x.mat, m_icv.mat, type, d)) return Geometry(x.shape, d); break;
+        }
     }
 
-    cv::Mat d = cv::Mat::zeros(x.mat.rows, 1, x.mat.depth());
-
     switch (type)
     {
     case ISOTROPIC:
@@ -1358,7 +1716,7 @@ Points3D& GeometricTransform::operator() (Points3D& pts) const
 
 //==[ Rotation ]==============================================================//
 
-const Rotation Rotation::Identity(Rotation::EULER_ANGLES, cv::Mat::eye(3, 3, CV_64F));
+const Rotation Rotation::Identity(Rotation::EULER_ANGLES);
 
 cv::Mat Rotation::RotX(double rad)
 {
@@ -1388,19 +1746,13 @@ cv::Mat Rotation::RotZ(double rad)
 }
 
 Rotation::Rotation(Parameterisation param, cv::Mat rmat)
-: m_param(param)
+: m_rmat(cv::Matx33d::eye()), m_rvec(0, 0, 0), m_param(param)
 {
     if (rmat.rows != 3 || rmat.cols != 3 || rmat.type() != CV_64FC1)
     {
         E_WARNING << "given matrix ignored due to wrong size and/or type";
-        m_rmat = Identity.ToMatrix();
     }
-    else
-    {
-        m_rmat = rmat;
-    }
-
-    if (!FromMatrix(m_rmat))
+    else if (!FromMatrix(rmat))
     {
         E_WARNING << "error initialising rotation matrix";
     }
@@ -1410,65 +1762,142 @@ bool Rotation::FromMatrix(const cv::Mat &rmat)
 {
     if (rmat.rows != 3 || rmat.cols != 3)
     {
-        E_ERROR << "given matrix has wrong size of " << size2string(rmat.size()), " rather than 3x3";
+        E_ERROR << "given matrix has wrong size of " << size2string(rmat.size()) << " rather than 3x3";
         return false;
     }
 
+    // cv::Rodrigues also brings a non-orthonormal matrix back to SO(3)
     cv::Mat rvec;
     cv::Rodrigues(rmat, rvec);
 
     return FromVector(rvec);
 }
 
+bool Rotation::FromVector(const Vec& rvec)
+{
+    if (rvec.size() != 3)
+    {
+        E_ERROR << "given vector has " << rvec.size() << " element(s) rather than 3";
+        return false;
+    }
+
+    FromVec(cv::Vec3d(rvec[0], rvec[1], rvec[2]));
+
+    return true;
+}
+
 bool Rotation::FromVector(const cv::Mat& rvec)
 {
-    if (rvec.total() != 3)
+    if (rvec.total() * rvec.channels() != 3)
     {
         E_ERROR << "given vector has " << rvec.total() << " element(s) rather than 3";
         return false;
     }
 
-    cv::Mat rmat;
-    rvec.reshape(1, 3).convertTo(m_rvec, m_rmat.type());
+    cv::Mat r = rvec;
+
+    if (r.depth() != CV_64F || !r.isContinuous())
+    {
+        rvec.convertTo(r, CV_64F);
+    }
 
-    cv::Rodrigues(m_rvec, rmat);
-    rmat.copyTo(m_rmat);
+    FromVec(cv::Vec3d(r.ptr<double>()));
 
     return true;
 }
 
+void Rotation::FromVec(const cv::Vec3d& rvec)
+{
+    const double theta = cv::norm(rvec);
+
+    m_rvec = rvec;
+
+    if (theta < DBL_EPSILON)
+    {
+        m_rmat = cv::Matx33d::eye();
+        return;
+    }
+
+    // R = cos(t) I + (1 - cos(t)) k k' + sin(t) [k]x, the same as cv::Rodrigues
+    const double c = std::cos(theta), s = std::sin(theta), c1 = 1.0f - c;
+    const double x = rvec[0] / theta, y = rvec[1] / theta, z = rvec[2] / theta;
+
+    m_rmat = cv::Matx33d(
+        c + c1 * x * x,     c1 * x * y - s * z, c1 * x * z + s * y,
+        c1 * x * y + s * z, c + c1 * y * y,     c1 * y * z - s * x,
+        c1 * x * z - s * y, c1 * y * z + s * x, c + c1 * z * z);
+}
+
+void Rotation::FromMatx(const cv::Matx33d& R)
+{
+    // inverse of FromVec following the logarithm map of cv::Rodrigues, less the
+    // orthonormalisation of the given matrix
+    cv::Vec3d r(R(2, 1) - R(1, 2), R(0, 2) - R(2, 0), R(1, 0) - R(0, 1));
+
+    const double s = std::sqrt((r[0] * r[0] + r[1] * r[1] + r[2] * r[2]) * 0.25f);
+    const double c = std::max(std::min((R(0, 0) + R(1, 1) + R(2, 2) - 1.0f) * 0.5f, 1.0), -1.0);
+    const double theta = std::acos(c);
+
+    if (s >= 1e-5)
+    {
+        r *= theta / (2.0f * s);
+    }
+    else if (c > 0) // theta ~ 0, where theta / sin(theta) -> 1
+    {
+        r *= 0.5f;
+    }
+    else // theta ~ pi, the axis is recovered from the diagonal
+    {
+        r[0] = std::sqrt(std::max((R(0, 0) + 1.0f) * 0.5f, 0.0));
+        r[1] = std::sqrt(std::max((R(1, 1) + 1.0f) * 0.5f, 0.0)) * (R(0, 1) < 0 ? -1.0f : 1.0f);
+        r[2] = std::sqrt(std::max((R(2, 2) + 1.0f) * 0.5f, 0.0)) * (R(0, 2) < 0 ? -1.0f : 1.0f);
+
+        if (std::abs(r[0]) < std::abs(r[1]) && std::abs(r[0]) < std::abs(r[2]) && (R(1, 2) > 0) != (r[1] * r[2] > 0))
+        {
+            r[2] = -r[2];
+        }
+
+        r *= theta / cv::norm(r);
+    }
+
+    m_rmat = R;
+    m_rvec = r;
+}
+
 bool Rotation::FromAngles(double x, double y, double z)
 {
-    cv::Mat Rx = RotX(/*x*/ ToRadian(x));
-    cv::Mat Ry = RotY(/*y*/ ToRadian(y));
-    cv::Mat Rz = RotZ(/*z*/ ToRadian(z));
+    const double cx = std::cos(ToRadian(x)), sx = std::sin(ToRadian(x));
+    const double cy = std::cos(ToRadian(y)), sy = std::sin(ToRadian(y));
+    const double cz = std::cos(ToRadian(z)), sz = std::sin(ToRadian(z));
 
-    //cv::Mat Rx = RotX(x);
-    //cv::Mat Ry = RotY(y);
-    //cv::Mat Rz = RotZ(z);
+    // Rz * Ry * Rx
+    FromMatx(cv::Matx33d(
+        cz * cy, cz * sy * sx - sz * cx, cz * sy * cx + sz * sx,
+        sz * cy, sz * sy * sx + cz * cx, sz * sy * cx - cz * sx,
+           -sy,                 cy * sx,                 cy * cx));
 
-    return FromMatrix(Rz * Ry * Rx);
+    return true;
 }
 
 void Rotation::ToVector(Vec& rvec) const
 {
-    rvec.assign((double*)m_rvec.datastart, (double*)m_rvec.dataend);
+    rvec.assign(m_rvec.val, m_rvec.val + 3);
 }
 
 void Rotation::ToAngles(double& x, double& y, double& z) const
 {
-    double r00 = m_rmat.at<double>(0, 0);
-    double r10 = m_rmat.at<double>(1, 0);
-    double r11 = m_rmat.at<double>(1, 1);
-    double r20 = m_rmat.at<double>(2, 0);
-    double r21 = m_rmat.at<double>(2, 1);
-    double r22 = m_rmat.at<double>(2, 2);
+    // inverse of FromAngles, for R = Rz * Ry * Rx
+    double r00 = m_rmat(0, 0);
+    double r10 = m_rmat(1, 0);
+    double r20 = m_rmat(2, 0);
+    double r21 = m_rmat(2, 1);
+    double r22 = m_rmat(2, 2);
 
-    double n12 = std::sqrt(r00 * r00 + r11 * r11);
+    double n01 = std::sqrt(r00 * r00 + r10 * r10);
 
-    x = ToDegree(std::atan2(r21, r22));
-    y = ToDegree(std::atan2(r20, n12));
-    z = ToDegree(std::atan2(r10, r00));
+    x = ToDegree(std::atan2( r21, r22));
+    y = ToDegree(std::atan2(-r20, n01));
+    z = ToDegree(std::atan2( r10, r00));
 
     //x = std::atan2(r21, r22);
     //y = std::atan2(r20, n12);
@@ -1477,12 +1906,12 @@ void Rotation::ToAngles(double& x, double& y, double& z) const
 
 Point3F& Rotation::operator() (Point3F& pt) const
 {
-    const double* m = m_rmat.ptr<double>();
+    const double* m = m_rmat.val;
 
     pt = Point3F(
-        (float)(m[0] * pt.x + m[3] * pt.y + m[6] * pt.z),
-        (float)(m[1] * pt.x + m[4] * pt.y + m[7] * pt.z),
-        (float)(m[2] * pt.x + m[5] * pt.y + m[8] * pt.z)
+        (float)(m[0] * pt.x + m[1] * pt.y + m[2] * pt.z),
+        (float)(m[3] * pt.x + m[4] * pt.y + m[5] * pt.z),
+        (float)(m[6] * pt.x + m[7] * pt.y + m[8] * pt.z)
     );
 
     return pt;
@@ -1490,12 +1919,12 @@ Point3F& Rotation::operator() (Point3F& pt) const
 
 Point3D& Rotation::operator() (Point3D& pt) const
 {
-    const double* m = m_rmat.ptr<double>();
+    const double* m = m_rmat.val;
 
     pt = Point3D(
-        m[0] * pt.x + m[3] * pt.y + m[6] * pt.z,
-        m[1] * pt.x + m[4] * pt.y + m[7] * pt.z,
-        m[2] * pt.x + m[5] * pt.y + m[8] * pt.z
+        m[0] * pt.x + m[1] * pt.y + m[2] * pt.z,
+        m[3] * pt.x + m[4] * pt.y + m[5] * pt.z,
+        m[6] * pt.x + m[7] * pt.y + m[8] * pt.z
     );
 
     return pt;
@@ -1512,17 +1941,24 @@ Geometry& Rotation::operator() (Geometry& g) const
         return g;
     }
 
+    cv::Mat rmat(m_rmat, false);
+
+    if (rmat.depth() != g.mat.depth())
+    {
+        rmat.convertTo(rmat, g.mat.depth());
+    }
+
     switch (g.shape)
     {
     case Geometry::ROW_MAJOR:
-        g.mat.colRange(0, 3) = g.mat.colRange(0, 3) * m_rmat.t();
+        g.mat.colRange(0, 3) = g.mat.colRange(0, 3) * rmat.t();
         break;
     case Geometry::COL_MAJOR:
-        g.mat.rowRange(0, 3) = m_rmat * g.mat.rowRange(0, 3);
+        g.mat.rowRange(0, 3) = rmat * g.mat.rowRange(0, 3);
         break;
     case Geometry::PACKED:
         g.mat = g.mat.reshape(1, static_cast<int>(g.GetElements()));
-        g.mat.colRange(0, 3) = g.mat.colRange(0, 3) * m_rmat.t();
+        g.mat.colRange(0, 3) = g.mat.colRange(0, 3) * rmat.t();
         g.mat = g.mat.reshape(static_cast<int>(d), m);
         break;
     }
@@ -1532,7 +1968,7 @@ Geometry& Rotation::operator() (Geometry& g) const
 
 bool Rotation::Store(cv::FileStorage& fs) const
 {
-    fs << "rvec" << m_rvec;
+    fs << "rvec" << cv::Mat(m_rvec, false);
     return true;
 }
 
@@ -1554,7 +1990,7 @@ bool Rotation::Store(Vec& v) const
         break;
 
     case Rotation::RODRIGUES:
-        v = m_rvec;
+        v.assign(m_rvec.val, m_rvec.val + 3);
         break;
 
     default:
@@ -1564,16 +2000,20 @@ bool Rotation::Store(Vec& v) const
 }
 
 bool Rotation::Restore(const Vec& v)
+{
+    return v.size() == GetDimension() && Restore(&v[0]);
+}
+
+bool Rotation::Restore(const double* v)
 {
     switch (m_param)
     {
     case Rotation::EULER_ANGLES:
-        if (v.size() != 3) return false;
         FromAngles(v[0], v[1], v[2]);
         break;
 
     case Rotation::RODRIGUES:
-        FromVector(v);
+        FromVec(cv::Vec3d(v[0], v[1], v[2]));
         break;
 
     default:
@@ -1585,7 +2025,7 @@ bool Rotation::Restore(const Vec& v)
 
 //==[ EuclideanTransform ]====================================================//
 
-const EuclideanTransform EuclideanTransform::Identity(Rotation::Identity.ToMatrix(), cv::Mat::zeros(3, 1, CV_64F));
+const EuclideanTransform EuclideanTransform::Identity(Rotation::EULER_ANGLES);
 
 EuclideanTransform::EuclideanTransform(const cv::Mat& rotation, const cv::Mat& tvec)
 : EuclideanTransform()
@@ -1610,36 +2050,60 @@ EuclideanTransform::EuclideanTransform(const cv::Mat& rotation, const cv::Mat& t
 
 EuclideanTransform& EuclideanTransform::operator= (const EuclideanTransform& tform)
 {
-    SetTransformMatrix(tform.m_matrix);
+    // the parameterisation of the rotation is not taken from the source
+    const Rotation::Parameterisation rform = m_rotation.GetParameterisation();
+
+    m_rotation = tform.m_rotation;
+    m_rotation.SetParametersiation(rform);
+    m_tvec = tform.m_tvec;
+
     return *this;
 }
 
 EuclideanTransform EuclideanTransform::operator<<(const EuclideanTransform& tform) const
 {
-    cv::Mat R0 = m_rotation.ToMatrix();
-    cv::Mat R1 = tform.m_rotation.ToMatrix();
+    const cv::Matx33d& R0 = m_rotation.GetMatx();
+    const cv::Matx33d& R1 = tform.m_rotation.GetMatx();
+
+    EuclideanTransform composed;
+
+    composed.m_rotation.FromMatx(R1 * R0);
+    composed.m_tvec = R1 * m_tvec + tform.m_tvec;
 
-    return EuclideanTransform(R1 * R0, R1 * m_tvec + tform.m_tvec);
+    return composed;
 }
 
 bool EuclideanTransform::SetTranslation(const cv::Mat& tvec)
 {
-    if (tvec.total() != 3)
+    if (tvec.total() * tvec.channels() != 3)
     {
         E_ERROR << "given vector has " << tvec.total() << " element(s) rather than 3";
         return false;
     }
 
-    cv::Mat _tvec;
-    tvec.convertTo(_tvec, m_tvec.type());
-    _tvec.reshape(0, 3).copyTo(m_tvec);
+    cv::Mat t = tvec;
+
+    if (t.depth() != CV_64F || !t.isContinuous())
+    {
+        tvec.convertTo(t, CV_64F);
+    }
+
+    m_tvec = cv::Vec3d(t.ptr<double>());
 
     return true;
 }
 
 bool EuclideanTransform::SetTranslation(const Vec& tvec)
 {
-    return false;
+    if (tvec.size() != 3)
+    {
+        E_ERROR << "given vector has " << tvec.size() << " element(s) rather than 3";
+        return false;
+    }
+
+    m_tvec = cv::Vec3d(tvec[0], tvec[1], tvec[2]);
+
+    return true;
 }
 
 bool EuclideanTransform::SetTransformMatrix(const cv::Mat& matrix)
@@ -1647,6 +2111,7 @@ bool EuclideanTransform::SetTransformMatrix(const cv::Mat& matrix)
     if ((matrix.rows != 3 && matrix.rows != 4) || matrix.cols != 4)
     {
         E_ERROR << "given matrix has wrong size of " << size2string(matrix.size()) << " rather than 3x4 or 4x4";
+        return false;
     }
 
     // TODO: check the fourth row if a square matrix is passed
@@ -1661,22 +2126,34 @@ bool EuclideanTransform::SetTransformMatrix(const cv::Mat& matrix)
 
 cv::Mat EuclideanTransform::GetTransformMatrix(bool sqrMat, bool preMult, int type) const
 {
-    if (!sqrMat && preMult) return m_matrix.clone(); // this is the intrinsic form
+    const cv::Matx33d& R = m_rotation.GetMatx();
+    const cv::Vec3d&   t = m_tvec;
+    const int          n = sqrMat ? 4 : 3;
 
-    cv::Mat matrix = cv::Mat::eye(sqrMat ? 4 : 3, 4, m_matrix.type());
-    m_matrix.copyTo(matrix.rowRange(0, 3).colRange(0, 4));
+    const cv::Matx44d M = preMult ?
+        cv::Matx44d(
+            R(0, 0), R(0, 1), R(0, 2), t[0],
+            R(1, 0), R(1, 1), R(1, 2), t[1],
+            R(2, 0), R(2, 1), R(2, 2), t[2],
+                  0,       0,       0,    1) :
+        cv::Matx44d(
+            R(0, 0), R(1, 0), R(2, 0), 0,
+            R(0, 1), R(1, 1), R(2, 1), 0,
+            R(0, 2), R(1, 2), R(2, 2), 0,
+               t[0],    t[1],    t[2], 1);
 
-    if (matrix.type() != type)
-    {
-        matrix.convertTo(matrix, type);
-    }
+    // the only allocation is made for the returned matrix
+    const cv::Mat m(M, false);
+    cv::Mat matrix;
+
+    (preMult ? m.rowRange(0, n) : m.colRange(0, n)).convertTo(matrix, type);
 
-    return preMult ? matrix : matrix.t();
+    return matrix;
 }
 
 cv::Mat EuclideanTransform::ToEssentialMatrix() const
 {
-    return skewsymat(m_tvec) * m_rotation.ToMatrix();
+    return skewsymat(GetTranslation()) * m_rotation.ToMatrix();
 }
 
 bool EuclideanTransform::FromEssentialMatrix(const cv::Mat& E, const GeometricMapping& m)
@@ -1699,18 +2176,25 @@ bool EuclideanTransform::FromEssentialMatrix(const cv::Mat& E, const GeometricMa
 
 EuclideanTransform EuclideanTransform::GetInverse() const
 {
-    cv::Mat Rt = m_rotation.ToMatrix().t();
-    return EuclideanTransform(Rt, -Rt*m_tvec);
+    const cv::Matx33d Rt = m_rotation.GetMatx().t();
+
+    EuclideanTransform inverse;
+
+    inverse.m_rotation.FromMatx(Rt);
+    inverse.m_tvec = -(Rt * m_tvec);
+
+    return inverse;
 }
 
 Point3F& EuclideanTransform::operator() (Point3F& pt) const
 {
-    const double* m = m_matrix.ptr<double>();
+    const double* m = m_rotation.GetMatx().val;
+    const double* t = m_tvec.val;
 
     pt = Point3F(
-        (float)(m[0] * pt.x + m[1] * pt.y + m[2]  * pt.z + m[3]),
-        (float)(m[4] * pt.x + m[5] * pt.y + m[6]  * pt.z + m[7]),
-        (float)(m[8] * pt.x + m[9] * pt.y + m[10] * pt.z + m[11])
+        (float)(m[0] * pt.x + m[1] * pt.y + m[2] * pt.z + t[0]),
+        (float)(m[3] * pt.x + m[4] * pt.y + m[5] * pt.z + t[1]),
+        (float)(m[6] * pt.x + m[7] * pt.y + m[8] * pt.z + t[2])
     );
 
     return pt;
@@ -1718,12 +2202,13 @@ Point3F& EuclideanTransform::operator() (Point3F& pt) const
 
 Point3D& EuclideanTransform::operator() (Point3D& pt) const
 {
-    const double* m = m_matrix.ptr<double>();
+    const double* m = m_rotation.GetMatx().val;
+    const double* t = m_tvec.val;
 
     pt = Point3D(
-        m[0] * pt.x + m[1] * pt.y + m[2]  * pt.z + m[3],
-        m[4] * pt.x + m[5] * pt.y + m[6]  * pt.z + m[7],
-        m[8] * pt.x + m[9] * pt.y + m[10] * pt.z + m[11]
+        m[0] * pt.x + m[1] * pt.y + m[2] * pt.z + t[0],
+        m[3] * pt.x + m[4] * pt.y + m[5] * pt.z + t[1],
+        m[6] * pt.x + m[7] * pt.y + m[8] * pt.z + t[2]
     );
 
     return pt;
@@ -1745,27 +2230,36 @@ Geometry& EuclideanTransform::operator() (Geometry& g, bool euclidean) const
         g = Geometry::MakeHomogeneous(g);
     }
 
+    // the product always goes to a new matrix, as assigning it to g.mat
+    // would write into the buffer of g when the shape is unchanged, and the
+    // buffer may be shared with the caller's source geometry
+    cv::Mat y;
+
     switch (g.shape)
     {
     case Geometry::ROW_MAJOR:
-        g.mat = g.mat * GetTransformMatrix(!euclidean, false, g.mat.type());
+        cv::gemm(g.mat, GetTransformMatrix(!euclidean, false, g.mat.type()), 1, cv::noArray(), 0, y);
         break;
     case Geometry::COL_MAJOR:
-        g.mat = GetTransformMatrix(!euclidean, true, g.mat.type()) * g.mat;
+        cv::gemm(GetTransformMatrix(!euclidean, true, g.mat.type()), g.mat, 1, cv::noArray(), 0, y);
         break;
     case Geometry::PACKED:
-        g.mat = g.mat.reshape(1, static_cast<int>(g.GetElements()));
-        g.mat = g.mat * GetTransformMatrix(!euclidean, false, g.mat.type());
-        g.mat = g.mat.reshape(euclidean ? 3 : 4, m);
+    {
+        const cv::Mat x = g.mat.reshape(1, static_cast<int>(g.GetElements()));
+        cv::gemm(x, GetTransformMatrix(!euclidean, false, x.type()), 1, cv::noArray(), 0, y);
+        y = y.reshape(euclidean ? 3 : 4, m);
         break;
     }
+    }
+
+    g.mat = y;
 
     return g;
 }
 
 bool EuclideanTransform::Store(cv::FileStorage& fs) const
 {
-    fs << "tvec" << m_tvec;
+    fs << "tvec" << cv::Mat(m_tvec, false);
     return m_rotation.Store(fs);
 }
 
@@ -1779,21 +2273,12 @@ bool EuclideanTransform::Restore(const cv::FileNode& fn)
 
 bool EuclideanTransform::Store(VectorisableD::Vec& v) const
 {
-    Vec rvec, tvec(3);
-
-    if (!m_rotation.Store(rvec))
+    if (!m_rotation.Store(v))
     {
         return false;
     }
 
-    for (int j = 0; j < 3; j++)
-    {
-        tvec[j] = m_tvec.at<double>(j);
-    }
-
-    v.clear();
-    v.insert(v.end(), rvec.begin(), rvec.end());
-    v.insert(v.end(), tvec.begin(), tvec.end());
+    v.insert(v.end(), m_tvec.val, m_tvec.val + 3);
 
     return true;
 }
@@ -1802,22 +2287,16 @@ bool EuclideanTransform::Restore(const Vec& v)
 {
     if (v.size() != GetDimension()) return false;
 
-    Vec rvec(v.begin(), v.begin() + m_rotation.GetDimension());
+    const size_t i = m_rotation.GetDimension();
 
-    if (!m_rotation.Restore(rvec))
+    if (!m_rotation.Restore(&v[0]))
     {
         return false;
     }
 
-    cv::Mat tvec(3, 1, CV_64F);
-    size_t i = m_rotation.GetDimension();
-
-    for (int j = 0; j < 3; j++)
-    {
-        tvec.at<double>(j) = v[i++];
-    }
+    m_tvec = cv::Vec3d(v[i], v[i + 1], v[i + 2]);
 
-    return SetTranslation(tvec);
+    return true;
 }
 
 //==[ Motion ]================================================================//
@@ -1927,6 +2406,44 @@ Geometry ProjectionModel::GetJacobian(const Geometry& g, const Geometry& proj) c
         jac.Reshape(g.shape);
 }
 
+//==[ PosedProjection ]=======================================================//
+
+Geometry PosedProjection::GetJacobian(const Geometry& g, const Geometry& proj) const
+{
+    Geometry x(g.shape, g.mat); // shared, as the transform writes its result to a new matrix
+    Geometry jac = this->proj->GetJacobian(pose(x, true), proj).Reshape(Geometry::ROW_MAJOR);
+
+    if (jac.mat.empty())
+    {
+        return jac;
+    }
+
+    // d(proj(R*x+t))/dx = J*R, with J stored as [dx/dX dy/dX dx/dY dy/dY dx/dZ dy/dZ]
+    const cv::Matx33d& R = pose.GetRotation().GetMatx();
+    const int type = jac.mat.type();
+
+    cv::Mat j;
+    jac.mat.convertTo(j, CV_64F);
+
+    for (int i = 0; i < j.rows; i++)
+    {
+        double* ji = j.ptr<double>(i);
+        double a[6];
+
+        for (int c = 0; c < 3; c++)
+        {
+            a[c * 2    ] = ji[0] * R(0, c) + ji[2] * R(1, c) + ji[4] * R(2, c);
+            a[c * 2 + 1] = ji[1] * R(0, c) + ji[3] * R(1, c) + ji[5] * R(2, c);
+        }
+
+        std::copy(a, a + 6, ji);
+    }
+
+    j.convertTo(jac.mat, type);
+
+    return jac;
+}
+
 //==[ PinholeModel ]==========================================================//
 
 bool seq2map::PinholeModel::operator== (const PinholeModel& rhs) const
@@ -2022,6 +2539,55 @@ Geometry PinholeModel::Project(const Geometry& g, ProjectiveSpace space) const
     return proj;
 }
 
+namespace
+{
+    // body of PinholeModel::ProjectBatch in the precision of T
+    template<typename T>
+    void ProjectPinhole(T fx, T fy, T cx, T cy, size_t n, const T* X, const T* Y, const T* Z, T* u, T* v, T* const* jac)
+    {
+        // points on the principal plane are left unscaled as in ProjectBouguet
+        for (size_t i = 0; i < n; i++)
+        {
+            const T w = Z[i] != 0 ? 1 / Z[i] : 1;
+
+            u[i] = fx * X[i] * w + cx;
+            v[i] = fy * Y[i] * w + cy;
+        }
+
+        if (!jac) return;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            const T w = Z[i] != 0 ? 1 / Z[i] : 1;
+
+            jac[0][i] = fx * w;               // dx/dX
+            jac[1][i] = 0;                    // dy/dX
+            jac[2][i] = 0;                    // dx/dY
+            jac[3][i] = fy * w;               // dy/dY
+            jac[4][i] = -fx * X[i] * w * w;   // dx/dZ
+            jac[5][i] = -fy * Y[i] * w * w;   // dy/dZ
+        }
+    }
+}
+
+void PinholeModel::ProjectBatch(size_t n, const double* X, const double* Y, const double* Z, double* u, double* v, double* const* jac) const
+{
+    double fx, fy, cx, cy;
+    GetValues(fx, fy, cx, cy);
+
+    ProjectPinhole<double>(fx, fy, cx, cy, n, X, Y, Z, u, v, jac);
+}
+
+void PinholeModel::ProjectBatch(size_t n, const float* X, const float* Y, const float* Z, float* u, float* v, float* const* jac) const
+{
+    double fx, fy, cx, cy;
+    GetValues(fx, fy, cx, cy);
+
+    ProjectPinhole<float>(
+        static_cast<float>(fx), static_cast<float>(fy), static_cast<float>(cx), static_cast<float>(cy),
+        n, X, Y, Z, u, v, jac);
+}
+
 Geometry PinholeModel::Backproject(const Geometry& g) const
 {
     const size_t d = g.GetDimension();
@@ -2060,8 +2626,8 @@ Geometry PinholeModel::GetJacobian(const Geometry& g) const
     jac.mat.col(1).setTo(0.0f);              // dy/dX
     jac.mat.col(2).setTo(0.0f);              // dx/dY
     cv::multiply(fy, w, jac.mat.col(3));     // dy/dY
-    cv::multiply( u, w, jac.mat.col(4), -1); // dx/dZ
-    cv::multiply( v, w, jac.mat.col(5), -1); // dx/dZ
+    cv::multiply( u, w, jac.mat.col(4), -fx); // dx/dZ
+    cv::multiply( v, w, jac.mat.col(5), -fy); // dy/dZ
 #else
     cv::cuda::GpuMat gmat, w, u, v, dxx, dyy, dxz, dyz;
 
@@ -2199,6 +2765,7 @@ bool PinholeModel::Restore(const Vec& v)
 //==[ BouguetModel ]==========================================================//
 
 BouguetModel::BouguetModel(const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs)
+: m_distCoeffs(14)
 {
     if (!SetCameraMatrix(cameraMatrix))   E_ERROR << "error setting camera matrix";
     if (!SetDistortionCoeffs(distCoeffs)) E_ERROR << "error setting distortion coefficients";
@@ -2218,32 +2785,186 @@ Point3D& BouguetModel::operator() (Point3D& pt) const
 
 Geometry BouguetModel::Project(const Geometry& g, ProjectiveSpace space) const
 {
-    Geometry proj(g.shape);
-
     if (g.GetDimension() != 3)
     {
         E_ERROR << "given geometry has to be 3D Euclidean (d=" << g.GetDimension() << ")";
-        return proj;
+        return Geometry(g.shape);
     }
 
-    cv::projectPoints(g.shape == Geometry::PACKED ? g.mat.reshape(1, static_cast<int>(g.GetElements())) : g.mat,
+    Geometry y(Geometry::ROW_MAJOR);
+
+    cv::projectPoints(g.Reshape(Geometry::ROW_MAJOR).mat,
         EuclideanTransform::Identity.GetRotation().ToMatrix(),
         EuclideanTransform::Identity.GetTranslation(),
-        m_matrix, m_distCoeffs, proj.mat);
+        m_matrix, m_distCoeffs, y.mat);
 
-    if (g.shape == Geometry::PACKED)
-    {
-        proj.mat = proj.mat.reshape(3, g.mat.rows); // restore to a MxNx3 matrix
-    }
+    // cv::projectPoints gives an Nx1x2 matrix
+    y.mat = y.mat.reshape(1, static_cast<int>(g.GetElements()));
 
     switch (space)
     {
     case HOMOGENEOUS_3D:
     case EUCLIDEAN_3D:
-        return Geometry::MakeHomogeneous(proj);
+        y = Geometry::MakeHomogeneous(y);
     }
 
-    return proj;
+    // restore the topology of the given geometry
+    return g.shape == Geometry::PACKED ?
+        Geometry(Geometry::PACKED, y.mat.reshape(y.mat.cols, g.mat.rows)) :
+        y.Reshape(g.shape);
+}
+
+namespace
+{
+    // body of BouguetModel::ProjectBatch in the precision of T, with the
+    // coefficients k and the sensor tilt H already converted
+    template<typename T>
+    void ProjectBouguet(T fx, T fy, T cx, T cy, const T* k, bool tilted, const cv::Matx<T, 3, 3>& H,
+        size_t n, const T* X, const T* Y, const T* Z, T* u, T* v, T* const* jac)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            const T w = Z[i] != 0 ? 1 / Z[i] : 1;
+            const T x = X[i] * w;
+            const T y = Y[i] * w;
+
+            const T r2 = x * x + y * y;
+            const T r4 = r2 * r2;
+            const T r6 = r4 * r2;
+            const T a1 = 2 * x * y;
+            const T a2 = r2 + 2 * x * x;
+            const T a3 = r2 + 2 * y * y;
+            const T c0 = 1 + k[0] * r2 + k[1] * r4 + k[4] * r6;
+            const T c1 = 1 / (1 + k[5] * r2 + k[6] * r4 + k[7] * r6);
+            const T cd = c0 * c1;
+
+            T xd = x * cd + k[2] * a1 + k[3] * a2 + k[8]  * r2 + k[9]  * r4;
+            T yd = y * cd + k[2] * a3 + k[3] * a1 + k[10] * r2 + k[11] * r4;
+
+            // derivatives of the tilted coordinates with respect to the distorted ones
+            T t00 = 1, t01 = 0, t10 = 0, t11 = 1;
+
+            if (tilted)
+            {
+                const cv::Vec<T, 3> p = H * cv::Vec<T, 3>(xd, yd, 1);
+                const T s = p[2] != 0 ? 1 / p[2] : 1;
+
+                xd = p[0] * s;
+                yd = p[1] * s;
+
+                t00 = (H(0, 0) - xd * H(2, 0)) * s;
+                t01 = (H(0, 1) - xd * H(2, 1)) * s;
+                t10 = (H(1, 0) - yd * H(2, 0)) * s;
+                t11 = (H(1, 1) - yd * H(2, 1)) * s;
+            }
+
+            u[i] = fx * xd + cx;
+            v[i] = fy * yd + cy;
+
+            if (!jac) continue;
+
+            // derivatives of the distorted coordinates with respect to the normalised ones
+            const T dc = ((k[0] + 2 * k[1] * r2 + 3 * k[4] * r4) - cd * (k[5] + 2 * k[6] * r2 + 3 * k[7] * r4)) * c1; // dcd/dr2
+            const T sx = k[8]  + 2 * k[9]  * r2; // d(s1*r2 + s2*r4)/dr2
+            const T sy = k[10] + 2 * k[11] * r2; // d(s3*r2 + s4*r4)/dr2
+
+            const T d00 = cd + 2 * x * x * dc + 2 * k[2] * y + 6 * k[3] * x + 2 * sx * x;
+            const T d01 =      2 * x * y * dc + 2 * k[2] * x + 2 * k[3] * y + 2 * sx * y;
+            const T d10 =      2 * x * y * dc + 2 * k[2] * x + 2 * k[3] * y + 2 * sy * x;
+            const T d11 = cd + 2 * y * y * dc + 6 * k[2] * y + 2 * k[3] * x + 2 * sy * y;
+
+            // derivatives of the image coordinates with respect to the normalised ones
+            const T e00 = fx * (t00 * d00 + t01 * d10);
+            const T e01 = fx * (t00 * d01 + t01 * d11);
+            const T e10 = fy * (t10 * d00 + t11 * d10);
+            const T e11 = fy * (t10 * d01 + t11 * d11);
+
+            jac[0][i] = e00 * w;                   // dx/dX
+            jac[1][i] = e10 * w;                   // dy/dX
+            jac[2][i] = e01 * w;                   // dx/dY
+            jac[3][i] = e11 * w;                   // dy/dY
+            jac[4][i] = -(e00 * x + e01 * y) * w;  // dx/dZ
+            jac[5][i] = -(e10 * x + e11 * y) * w;  // dy/dZ
+        }
+    }
+
+    // sensor tilt, as computeTiltProjectionMatrix of OpenCV
+    cv::Matx33d TiltMatrix(const double* k)
+    {
+        cv::Matx33d H = cv::Matx33d::eye();
+
+        if (k[12] != 0 || k[13] != 0)
+        {
+            const double ctx = std::cos(k[12]), stx = std::sin(k[12]);
+            const double cty = std::cos(k[13]), sty = std::sin(k[13]);
+            const cv::Matx33d Rx(1, 0, 0, 0, ctx, stx, 0, -stx, ctx);
+            const cv::Matx33d Ry(cty, 0, -sty, 0, 1, 0, sty, 0, cty);
+            const cv::Matx33d Rxy = Ry * Rx;
+
+            H = cv::Matx33d(Rxy(2, 2), 0, -Rxy(0, 2), 0, Rxy(2, 2), -Rxy(1, 2), 0, 0, 1) * Rxy;
+        }
+
+        return H;
+    }
+}
+
+void BouguetModel::ProjectBatch(size_t n, const double* X, const double* Y, const double* Z, double* u, double* v, double* const* jac) const
+{
+    double fx, fy, cx, cy;
+    GetValues(fx, fy, cx, cy);
+
+    const double* k = &m_distCoeffs[0];
+    const bool tilted = k[12] != 0 || k[13] != 0;
+
+    ProjectBouguet<double>(fx, fy, cx, cy, k, tilted, TiltMatrix(k), n, X, Y, Z, u, v, jac);
+}
+
+void BouguetModel::ProjectBatch(size_t n, const float* X, const float* Y, const float* Z, float* u, float* v, float* const* jac) const
+{
+    double fx, fy, cx, cy;
+    GetValues(fx, fy, cx, cy);
+
+    float k[14];
+
+    for (size_t i = 0; i < 14; i++)
+    {
+        k[i] = static_cast<float>(m_distCoeffs[i]);
+    }
+
+    const bool tilted = m_distCoeffs[12] != 0 || m_distCoeffs[13] != 0;
+
+    ProjectBouguet<float>(
+        static_cast<float>(fx), static_cast<float>(fy), static_cast<float>(cx), static_cast<float>(cy),
+        k, tilted, cv::Matx33f(TiltMatrix(&m_distCoeffs[0])), n, X, Y, Z, u, v, jac);
+}
+
+Geometry BouguetModel::GetJacobian(const Geometry& g) const
+{
+    if (g.shape != Geometry::ROW_MAJOR)
+    {
+        return GetJacobian(g.Reshape(Geometry::ROW_MAJOR));
+    }
+
+    Geometry jac(Geometry::ROW_MAJOR);
+
+    if (g.GetDimension() < 3)
+    {
+        E_ERROR << "given geometry has to be at least 3D (d=" << g.GetDimension() << ")";
+        return jac;
+    }
+
+    const size_t n = g.GetElements();
+
+    // the coordinates and derivatives are laid out component by component
+    cv::Mat x, y(2, static_cast<int>(n), CV_64F), j(6, static_cast<int>(n), CV_64F);
+    cv::Mat(g.mat.colRange(0, 3).t()).convertTo(x, CV_64F);
+
+    double* const dy[6] = { j.ptr<double>(0), j.ptr<double>(1), j.ptr<double>(2), j.ptr<double>(3), j.ptr<double>(4), j.ptr<double>(5) };
+
+    ProjectBatch(n, x.ptr<double>(0), x.ptr<double>(1), x.ptr<double>(2), y.ptr<double>(0), y.ptr<double>(1), dy);
+    cv::Mat(j.t()).convertTo(jac.mat, g.mat.type());
+
+    return jac;
 }
 
 Geometry BouguetModel::Backproject(const Geometry& g) const
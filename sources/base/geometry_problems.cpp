@@ -1,23 +1,414 @@
 #include <seq2map/geometry_problems.hpp>
+#include <seq2map/thread_pool.hpp>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
+#include <limits>
 #include <random>
 
+#ifdef WITH_FIVEPOINTS
+// five-point solver of Li and Hartley in 3rdparties/fivepoints
+namespace fivepoints
+{
+    typedef double Ematrix[3][3];
+    typedef double Matches[][3];
+    void compute_E_matrices(Matches q, Matches qp, Ematrix Ematrices[10], int& nroots, bool optimized);
+}
+#endif
+
 using namespace seq2map;
 
+namespace
+{
+    // selectors are shared by the hypotheses evaluated concurrently
+    boost::mutex s_metreMtx;
+
+    // number of points processed at a time by the fused projection kernel
+    const size_t s_projBlockSize = 64;
+
+    template<typename S, typename T>
+    void GatherRows(const cv::Mat& mat, size_t i0, size_t n, size_t d, T* const* cols)
+    {
+        const S* p = mat.ptr<S>() + i0 * d;
+
+        for (size_t i = 0; i < n; i++, p += d)
+        {
+            for (size_t j = 0; j < d; j++)
+            {
+                cols[j][i] = static_cast<T>(p[j]);
+            }
+        }
+    }
+
+    // scatter rows i0 to i0+n-1 of a continuous d-dimensional geometry matrix to d arrays
+    template<typename T>
+    void Gather(const cv::Mat& mat, size_t i0, size_t n, size_t d, T* const* cols)
+    {
+        if (mat.depth() == CV_32F) GatherRows<float> (mat, i0, n, d, cols);
+        else                       GatherRows<double>(mat, i0, n, d, cols);
+    }
+
+    // body of ProjectionObjective::EvaluateFused in the precision of T; the
+    // points are transformed, projected and measured a block at a time
+    template<typename T>
+    bool EvaluateProjection(const ProjectionModel& proj, bool forward, const EuclideanTransform& f, const GeometricMapping& data, T* e)
+    {
+        if (!data.metric)
+        {
+            return false;
+        }
+
+        const PosedProjection* posed = dynamic_cast<const PosedProjection*>(&proj);
+        const PinholeModel* cam = dynamic_cast<const PinholeModel*>(posed ? posed->proj.get() : &proj);
+
+        if (!cam)
+        {
+            return false;
+        }
+
+        const size_t n = data.src.GetElements();
+        const cv::Mat& src = data.src.mat;
+        const cv::Mat& dst = data.dst.mat;
+
+        // both geometries have to be stored point by point in contiguous memory
+        if (data.src.shape == Geometry::COL_MAJOR || !src.isContinuous() || data.src.GetDimension() != 4 ||
+            data.dst.shape == Geometry::COL_MAJOR || !dst.isContinuous() || data.dst.GetDimension() != 2 ||
+            (src.depth() != CV_32F && src.depth() != CV_64F) ||
+            (dst.depth() != CV_32F && dst.depth() != CV_64F) ||
+            data.dst.GetElements() != n)
+        {
+            return false;
+        }
+
+        const Metric& metric = *data.metric;
+        const EuclideanMetric*         euclidean   = dynamic_cast<const EuclideanMetric*>        (&metric);
+        const WeightedEuclideanMetric* weighted    = dynamic_cast<const WeightedEuclideanMetric*>(&metric);
+        const MahalanobisMetric*       mahalanobis = dynamic_cast<const MahalanobisMetric*>      (&metric);
+
+        T scale = 1;
+        const double* weights = NULL;
+        const double* cov = NULL;
+        size_t covStep = 0;
+
+        if (weighted)
+        {
+            const cv::Mat& w = weighted->GetWeights();
+
+            if (static_cast<size_t>(w.rows) != n || w.depth() != CV_64F || !w.isContinuous())
+            {
+                return false;
+            }
+
+            scale = weighted->scale;
+            weights = w.ptr<double>();
+        }
+        else if (euclidean)
+        {
+            scale = euclidean->scale;
+        }
+        else if (mahalanobis)
+        {
+            const Geometry& c = mahalanobis->GetCovariance();
+            const size_t n0 = c.GetElements();
+
+            if (mahalanobis->dims != 3 || c.mat.depth() != CV_64F || !c.mat.isContinuous() || (n0 != 1 && n0 != n))
+            {
+                return false;
+            }
+
+            cov = c.mat.ptr<double>();
+            covStep = n0 == 1 ? 0 : MahalanobisMetric::GetCovMatCols(mahalanobis->type, 3);
+        }
+        else
+        {
+            return false;
+        }
+
+        // the points are transformed, optionally posed, then projected
+        const EuclideanTransform tf = forward ? f : f.GetInverse();
+        const cv::Matx33d& R = tf.GetRotation().GetMatx();
+        const cv::Vec3d&   t = tf.GetTranslationVec();
+
+        cv::Matx33d M = R;
+        cv::Vec3d   m = t, c(0, 0, 0);
+
+        if (posed)
+        {
+            const cv::Matx33d& Rp = posed->pose.GetRotation().GetMatx();
+            const cv::Vec3d&   tp = posed->pose.GetTranslationVec();
+
+            M = Rp * R;
+            m = Rp * t;
+            c = tp;
+        }
+
+        // a covariance that cannot be resolved in the precision of T is discarded too
+        const T rcond = std::max<T>(static_cast<T>(MahalanobisMetric::GetConditionThreshold()), std::numeric_limits<T>::epsilon());
+        const size_t B = s_projBlockSize;
+
+        // the arithmetic below is done in T
+        const cv::Matx<T, 3, 3> Mt = M;
+        const cv::Vec<T, 3> mt = m, ct = c;
+
+        T sx[s_projBlockSize], sy[s_projBlockSize], sz[s_projBlockSize], sw[s_projBlockSize];
+        T du[s_projBlockSize], dv[s_projBlockSize];
+        T X [s_projBlockSize], Y [s_projBlockSize], Z [s_projBlockSize];
+        T u [s_projBlockSize], v [s_projBlockSize];
+        T j0[s_projBlockSize], j1[s_projBlockSize], j2[s_projBlockSize], j3[s_projBlockSize], j4[s_projBlockSize], j5[s_projBlockSize];
+
+        T* const s[4]   = { sx, sy, sz, sw };
+        T* const d[2]   = { du, dv };
+        T* const jac[6] = { j0, j1, j2, j3, j4, j5 };
+
+        for (size_t i0 = 0; i0 < n; i0 += B)
+        {
+            const size_t k = std::min(B, n - i0);
+            T* ek = e + i0;
+
+            Gather(src, i0, k, 4, s);
+            Gather(dst, i0, k, 2, d);
+
+            for (size_t i = 0; i < k; i++)
+            {
+                X[i] = Mt(0, 0) * sx[i] + Mt(0, 1) * sy[i] + Mt(0, 2) * sz[i] + mt[0] * sw[i] + ct[0];
+                Y[i] = Mt(1, 0) * sx[i] + Mt(1, 1) * sy[i] + Mt(1, 2) * sz[i] + mt[1] * sw[i] + ct[1];
+                Z[i] = Mt(2, 0) * sx[i] + Mt(2, 1) * sy[i] + Mt(2, 2) * sz[i] + mt[2] * sw[i] + ct[2];
+            }
+
+            cam->ProjectBatch(k, X, Y, Z, u, v, cov ? jac : NULL);
+
+            if (!cov)
+            {
+                for (size_t i = 0; i < k; i++)
+                {
+                    const T ru = u[i] - du[i];
+                    const T rv = v[i] - dv[i];
+
+                    ek[i] = scale * std::sqrt(ru * ru + rv * rv);
+                }
+
+                if (weights)
+                {
+                    for (size_t i = 0; i < k; i++)
+                    {
+                        ek[i] *= static_cast<T>(weights[i0 + i]);
+                    }
+                }
+
+                continue;
+            }
+
+            for (size_t i = 0; i < k; i++)
+            {
+                const double* ci = cov + (i0 + i) * covStep;
+                T C[6];
+
+                switch (mahalanobis->type)
+                {
+                case MahalanobisMetric::ISOTROPIC:
+                    C[0] = ci[0]; C[1] = 0; C[2] = 0; C[3] = ci[0]; C[4] = 0; C[5] = ci[0];
+                    break;
+                case MahalanobisMetric::ANISOTROPIC_ORTHOGONAL:
+                    C[0] = ci[0]; C[1] = 0; C[2] = 0; C[3] = ci[1]; C[4] = 0; C[5] = ci[2];
+                    break;
+                default:
+                    C[0] = ci[0]; C[1] = ci[1]; C[2] = ci[2]; C[3] = ci[3]; C[4] = ci[4]; C[5] = ci[5];
+                }
+
+                // A = J * M
+                const T a00 = j0[i] * Mt(0, 0) + j2[i] * Mt(1, 0) + j4[i] * Mt(2, 0);
+                const T a01 = j0[i] * Mt(0, 1) + j2[i] * Mt(1, 1) + j4[i] * Mt(2, 1);
+                const T a02 = j0[i] * Mt(0, 2) + j2[i] * Mt(1, 2) + j4[i] * Mt(2, 2);
+                const T a10 = j1[i] * Mt(0, 0) + j3[i] * Mt(1, 0) + j5[i] * Mt(2, 0);
+                const T a11 = j1[i] * Mt(0, 1) + j3[i] * Mt(1, 1) + j5[i] * Mt(2, 1);
+                const T a12 = j1[i] * Mt(0, 2) + j3[i] * Mt(1, 2) + j5[i] * Mt(2, 2);
+
+                // S = A * C * A'
+                const T b00 = a00 * C[0] + a01 * C[1] + a02 * C[2];
+                const T b01 = a00 * C[1] + a01 * C[3] + a02 * C[4];
+                const T b02 = a00 * C[2] + a01 * C[4] + a02 * C[5];
+                const T b10 = a10 * C[0] + a11 * C[1] + a12 * C[2];
+                const T b11 = a10 * C[1] + a11 * C[3] + a12 * C[4];
+                const T b12 = a10 * C[2] + a11 * C[4] + a12 * C[5];
+
+                const T s00 = b00 * a00 + b01 * a01 + b02 * a02;
+                const T s01 = b00 * a10 + b01 * a11 + b02 * a12;
+                const T s11 = b10 * a10 + b11 * a11 + b12 * a12;
+
+                // a badly conditioned covariance is discarded as MahalanobisMetric does
+                const T mean = static_cast<T>(0.5) * (s00 + s11);
+                const T dev  = std::sqrt(static_cast<T>(0.25) * (s00 - s11) * (s00 - s11) + s01 * s01);
+                const T l0 = std::abs(mean + dev);
+                const T l1 = std::abs(mean - dev);
+
+                if (!(std::max(l0, l1) > 0) || std::min(l0, l1) < rcond * std::max(l0, l1))
+                {
+                    ek[i] = 0;
+                    continue;
+                }
+
+                const T ru = u[i] - du[i];
+                const T rv = v[i] - dv[i];
+
+                ek[i] = std::sqrt((s11 * ru * ru - 2 * s01 * ru * rv + s00 * rv * rv) / (s00 * s11 - s01 * s01));
+            }
+        }
+
+        return true;
+    }
+
+    // real roots of x^2 + b*x + c, computed without cancellation
+    bool SolveQuadratic(double b, double c, double& r1, double& r2)
+    {
+        const double v = b * b - 4 * c;
+
+        if (v < 0)
+        {
+            r1 = r2 = -0.5 * b;
+            return false;
+        }
+
+        const double y = std::sqrt(v);
+
+        if (b < 0)
+        {
+            r1 = 0.5 * (-b + y);
+            r2 = 2 * c / (-b + y);
+        }
+        else
+        {
+            r1 = 0.5 * (-b - y);
+            r2 = 2 * c / (-b - y);
+        }
+
+        return true;
+    }
+
+    // a real root of x^3 + b*x^2 + c*x + d by Newton's method started next to it
+    double SolveCubic(double b, double c, double d)
+    {
+        double r;
+
+        if (b * b >= 3 * c)
+        {
+            // start from a quadratic approximation around a stationary point
+            const double v  = std::sqrt(b * b - 3 * c);
+            const double t1 = (-b - v) / 3;
+            const double k1 = ((t1 + b) * t1 + c) * t1 + d;
+
+            if (k1 > 0)
+            {
+                r = t1 - std::sqrt(-k1 / (3 * t1 + b));
+            }
+            else
+            {
+                const double t2 = (-b + v) / 3;
+                const double k2 = ((t2 + b) * t2 + c) * t2 + d;
+
+                r = t2 + std::sqrt(-k2 / (3 * t2 + b));
+            }
+        }
+        else
+        {
+            r = -b / 3;
+
+            if (std::abs((3 * r + 2 * b) * r + c) < 1e-4) r += 1;
+        }
+
+        for (int i = 0; i < 50; i++)
+        {
+            const double f = ((r + b) * r + c) * r + d;
+
+            if (i >= 7 && std::abs(f) < 1e-13) break;
+
+            r -= f / ((3 * r + 2 * b) * r + c);
+        }
+
+        return r;
+    }
+
+    // eigen-decomposition of a symmetric rank-2 matrix; the non-zero eigenvalues
+    // are sorted by magnitude and the eigenvectors are stored as columns
+    void EigenRank2(const cv::Matx33d& A, cv::Matx33d& V, double& e1, double& e2)
+    {
+        const cv::Vec3d v0 = cv::normalize(cv::Vec3d(A(0, 0), A(1, 0), A(2, 0)).cross(cv::Vec3d(A(0, 1), A(1, 1), A(2, 1))));
+        const double b = -A(0, 0) - A(1, 1) - A(2, 2);
+        const double c = -A(0, 1) * A(0, 1) - A(0, 2) * A(0, 2) - A(1, 2) * A(1, 2) + A(0, 0) * (A(1, 1) + A(2, 2)) + A(1, 1) * A(2, 2);
+
+        SolveQuadratic(b, c, e1, e2);
+
+        if (std::abs(e1) < std::abs(e2)) std::swap(e1, e2);
+
+        const double e[2] = { e1, e2 };
+        const double p0 = A(0, 1) * A(1, 2) - A(0, 2) * A(1, 1);
+        const double p1 = A(0, 1) * A(0, 2) - A(0, 0) * A(1, 2);
+
+        for (int k = 0; k < 2; k++)
+        {
+            const double w = 1 / (e[k] * (A(0, 0) + A(1, 1)) - A(0, 0) * A(1, 1) - e[k] * e[k] + A(0, 1) * A(0, 1));
+            const cv::Vec3d vk = cv::normalize(cv::Vec3d(-(e[k] * A(0, 2) + p0) * w, -(e[k] * A(1, 2) + p1) * w, 1));
+
+            V(0, k) = vk[0];
+            V(1, k) = vk[1];
+            V(2, k) = vk[2];
+        }
+
+        V(0, 2) = v0[0];
+        V(1, 2) = v0[1];
+        V(2, 2) = v0[2];
+    }
+
+    // Gauss-Newton refinement of the depths against the three distance constraints
+    void RefineDepths(cv::Vec3d& l, double a12, double a13, double a23, double b12, double b13, double b23)
+    {
+        for (int i = 0; i < 5; i++)
+        {
+            const cv::Vec3d r(
+                l[0] * l[0] + l[1] * l[1] + b12 * l[0] * l[1] - a12,
+                l[0] * l[0] + l[2] * l[2] + b13 * l[0] * l[2] - a13,
+                l[1] * l[1] + l[2] * l[2] + b23 * l[1] * l[2] - a23
+            );
+
+            if (std::abs(r[0]) + std::abs(r[1]) + std::abs(r[2]) < 1e-10) break;
+
+            const cv::Matx33d J(
+                2 * l[0] + b12 * l[1], 2 * l[1] + b12 * l[0], 0,
+                2 * l[0] + b13 * l[2], 0, 2 * l[2] + b13 * l[0],
+                0, 2 * l[1] + b23 * l[2], 2 * l[2] + b23 * l[1]
+            );
+
+            const double det = cv::determinant(J);
+
+            if (std::abs(det) < 1e-20) break;
+
+            const cv::Vec3d l1 = l - J.inv() * r;
+            const cv::Vec3d r1(
+                l1[0] * l1[0] + l1[1] * l1[1] + b12 * l1[0] * l1[1] - a12,
+                l1[0] * l1[0] + l1[2] * l1[2] + b13 * l1[0] * l1[2] - a13,
+                l1[1] * l1[1] + l1[2] * l1[2] + b23 * l1[1] * l1[2] - a23
+            );
+
+            // accept the step only if it reduces the error
+            if (std::abs(r1[0]) + std::abs(r1[1]) + std::abs(r1[2]) >= std::abs(r[0]) + std::abs(r[1]) + std::abs(r[2])) break;
+
+            l = l1;
+        }
+    }
+}
+
 //==[ AlignmentObjective ]====================================================//
 
 //==[ AlignmentObjective::InlierSelector ]====================================//
 
-bool AlignmentObjective::InlierSelector::operator() (const EuclideanTransform& x, IndexList& inliers, IndexList& outliers) const
+bool AlignmentObjective::InlierSelector::operator() (const EuclideanTransform& x, IndexList& inliers, IndexList& outliers, int depth) const
 {
     inliers.clear();
     outliers.clear();
 
     //try
     //{
-        metre.Start();
-        cv::Mat error = (*objective)(x);
-        metre.Stop(error.rows);
+        StartMetre();
+        cv::Mat error = depth == CV_32F ? (*objective)(x, objective->GetData(), depth) : (*objective)(x);
+        StopMetre(error.rows);
 
         if (error.type() != CV_64F)
         {
@@ -59,6 +450,146 @@ bool AlignmentObjective::InlierSelector::operator() (const EuclideanTransform& x
     return (*this)(x, inliers, outliers);
 }
 
+bool AlignmentObjective::InlierSelector::operator() (const EuclideanTransform& x, const Chunks& chunks, const SequentialTest& test, IndexList& inliers, IndexList& outliers, bool& rejected, int depth) const
+{
+    inliers.clear();
+    outliers.clear();
+    rejected = false;
+
+    double lambda = 0; // log-likelihood ratio of the model being bad
+
+    for (size_t c = 0; c < chunks.data.size(); c++)
+    {
+        const Indices& idx = chunks.indices[c];
+
+        StartMetre();
+        cv::Mat error = (*objective)(x, chunks.data[c], depth);
+        StopMetre(error.rows);
+
+        if (error.type() != CV_64F)
+        {
+            error.convertTo(error, CV_64F);
+        }
+
+        if (error.total() != idx.size())
+        {
+            E_ERROR << "objective returns " << error.total() << " residual(s) for a chunk of " << idx.size() << " element(s)";
+            return false;
+        }
+
+        const double* e = error.ptr<double>();
+
+        for (size_t i = 0; i < idx.size(); i++)
+        {
+            if (!std::isfinite(e[i]))
+            {
+                E_ERROR << "entry " << idx[i] << " is not a finite number";
+                return false;
+            }
+
+            if (e[i] > threshold)
+            {
+                outliers.push_back(idx[i]);
+                lambda += test.inconsistent;
+            }
+            else
+            {
+                inliers.push_back(idx[i]);
+                lambda += test.consistent;
+            }
+
+            if (test.IsEnabled() && lambda > test.threshold)
+            {
+                rejected = true;
+                return true;
+            }
+        }
+    }
+
+    inliers.sort();
+    outliers.sort();
+
+    return true;
+}
+
+void AlignmentObjective::InlierSelector::Split(size_t size, cv::RNG& rng, Chunks& chunks) const
+{
+    const size_t n = objective ? objective->GetData().GetSize() : 0;
+    const size_t m = size > 0 ? (n + size - 1) / size : 0;
+
+    std::vector<size_t> idx(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        idx[i] = i;
+    }
+
+    std::random_shuffle(idx.begin(), idx.end(), rng);
+
+    chunks.data.resize(m);
+    chunks.indices.resize(m);
+
+    for (size_t c = 0; c < m; c++)
+    {
+        const size_t i0 = c * size;
+        const size_t i1 = std::min(i0 + size, n);
+
+        chunks.indices[c] = Indices(idx.begin() + i0, idx.begin() + i1);
+        chunks.data[c] = objective->GetData()[IndexList(idx.begin() + i0, idx.begin() + i1)];
+    }
+}
+
+void AlignmentObjective::InlierSelector::StartMetre() const
+{
+    boost::lock_guard<boost::mutex> locker(s_metreMtx);
+
+    if (running++ == 0)
+    {
+        metre.Start();
+    }
+}
+
+void AlignmentObjective::InlierSelector::StopMetre(size_t amount) const
+{
+    boost::lock_guard<boost::mutex> locker(s_metreMtx);
+
+    if (--running == 0)
+    {
+        metre.Stop(amount);
+    }
+    else
+    {
+        metre.Update(amount);
+    }
+}
+
+//==[ AlignmentObjective::InlierSelector::SequentialTest ]====================//
+
+AlignmentObjective::InlierSelector::SequentialTest::SequentialTest(double epsilon, double delta, double cost)
+: consistent(0), inconsistent(0), threshold(-1)
+{
+    if (epsilon <= 0 || epsilon >= 1 || delta <= 0 || delta >= epsilon)
+    {
+        E_WARNING << "sequential test disabled for epsilon=" << epsilon << " and delta=" << delta;
+        return;
+    }
+
+    consistent   = std::log(delta / epsilon);
+    inconsistent = std::log((1 - delta) / (1 - epsilon));
+
+    // the optimal threshold A solves A = cost * C + 1 + log(A), where C is the
+    // expected information of a datum from a bad model (Matas and Chum, 2005)
+    const double C = (1 - delta) * inconsistent + delta * consistent;
+    const double A0 = cost * C + 1;
+    double A = A0;
+
+    for (size_t k = 0; k < 10; k++)
+    {
+        A = A0 + std::log(A);
+    }
+
+    threshold = std::log(A);
+}
+
 //==[ EpipolarObjective ]=====================================================//
 
 bool EpipolarObjective::SetData(const GeometricMapping& data, ProjectionModel::ConstOwn& src, ProjectionModel::ConstOwn& dst)
@@ -108,12 +639,12 @@ AlignmentObjective::Own EpipolarObjective::GetSubObjective(const IndexList& indi
     return AlignmentObjective::Own(sub);
 }
 
-cv::Mat EpipolarObjective::operator() (const EuclideanTransform& tform) const
+cv::Mat EpipolarObjective::Evaluate(const EuclideanTransform& tform, const GeometricMapping& data) const
 {
-    const Metric& d = *m_data.metric;
+    const Metric& d = *data.metric;
 
-    cv::Mat x0 = m_data.src.mat;
-    cv::Mat x1 = m_data.dst.mat;
+    cv::Mat x0 = data.src.mat;
+    cv::Mat x1 = data.dst.mat;
 
     const EuclideanTransform M = M0.GetInverse() >> tform >> M1;
     const cv::Mat F = M.ToEssentialMatrix();
@@ -131,7 +662,7 @@ cv::Mat EpipolarObjective::operator() (const EuclideanTransform& tform) const
     {
         // algebraic epipolar distance
         // x1' * F * x0
-        Geometry err(m_data.src.shape, xFx);
+        Geometry err(data.src.shape, xFx);
         return d(err).mat;
     }
 
@@ -143,7 +674,7 @@ cv::Mat EpipolarObjective::operator() (const EuclideanTransform& tform) const
     cv::Mat nn0 = Fx00.mul(Fx00) + Fx01.mul(Fx01);
     cv::Mat nn1 = Fx10.mul(Fx10) + Fx11.mul(Fx11);
 
-    Geometry err(m_data.src.shape);
+    Geometry err(data.src.shape);
 
     if (m_distType == SAMPSON)
     {
@@ -212,7 +743,17 @@ bool ProjectionObjective::SetData(const GeometricMapping& data)
     return true;
 }
 
-cv::Mat ProjectionObjective::operator() (const EuclideanTransform& f) const
+bool ProjectionObjective::EvaluateFused(const EuclideanTransform& f, const GeometricMapping& data, double* e) const
+{
+    return m_proj && EvaluateProjection(*m_proj, m_forward, f, data, e);
+}
+
+bool ProjectionObjective::EvaluateFused(const EuclideanTransform& f, const GeometricMapping& data, float* e) const
+{
+    return m_proj && EvaluateProjection(*m_proj, m_forward, f, data, e);
+}
+
+cv::Mat ProjectionObjective::Evaluate(const EuclideanTransform& f, const GeometricMapping& data) const
 {
     if (!m_proj)
     {
@@ -220,9 +761,16 @@ cv::Mat ProjectionObjective::operator() (const EuclideanTransform& f) const
         return cv::Mat();
     }
 
+    cv::Mat residuals(static_cast<int>(data.src.GetElements()), 1, CV_64F);
+
+    if (EvaluateFused(f, data, residuals.ptr<double>()))
+    {
+        return residuals;
+    }
+
     const EuclideanTransform tf = m_forward ? f : f.GetInverse();
 
-    Geometry x = m_data.src;
+    Geometry x(data.src.shape, data.src.mat); // shared, as the transform writes its result to a new matrix
 
     // m_metres.proj.Start();
     Geometry y = m_proj->Project(tf(x, true), ProjectionModel::EUCLIDEAN_2D);
@@ -233,11 +781,11 @@ cv::Mat ProjectionObjective::operator() (const EuclideanTransform& f) const
     // m_metres.jaco.Stop(x.GetElements());
 
     // m_metres.tfrm.Start();
-    Metric::ConstOwn d = m_data.metric->Transform(tf, jac);
+    Metric::ConstOwn d = data.metric->Transform(tf, jac);
     // m_metres.tfrm.Stop(jac.GetElements());
 
     // m_metres.eval.Start();
-    cv::Mat e = (*d)(y, m_data.dst).mat;
+    cv::Mat e = (*d)(y, data.dst).mat;
     // m_metres.eval.Stop(y.GetElements());
 
     // E_TRACE << m_metres.proj.GetElapsedSeconds();
@@ -248,6 +796,19 @@ cv::Mat ProjectionObjective::operator() (const EuclideanTransform& f) const
     return e;
 }
 
+cv::Mat ProjectionObjective::EvaluateSingle(const EuclideanTransform& f, const GeometricMapping& data) const
+{
+    cv::Mat residuals(static_cast<int>(data.src.GetElements()), 1, CV_32F);
+
+    if (EvaluateFused(f, data, residuals.ptr<float>()))
+    {
+        return residuals;
+    }
+
+    // the generic path works in double only
+    return Evaluate(f, data);
+}
+
 //==[ PhotometricObjective ]==================================================//
 
 AlignmentObjective::Own PhotometricObjective::GetSubObjective(const IndexList& indices) const
@@ -353,7 +914,7 @@ bool PhotometricObjective::SetData(const Geometry& g, const cv::Mat& src, const
     return SetData(g, p, src, false, metric, indices);
 }
 
-cv::Mat PhotometricObjective::operator() (const EuclideanTransform& tf) const
+cv::Mat PhotometricObjective::Evaluate(const EuclideanTransform& tf, const GeometricMapping& data) const
 {
     if (!m_proj)
     {
@@ -362,7 +923,7 @@ cv::Mat PhotometricObjective::operator() (const EuclideanTransform& tf) const
     }
 
     // source 3D geometry
-    Geometry x = m_data.src;
+    Geometry x(data.src.shape, data.src.mat); // shared, as the transform writes its result to a new matrix
 
     // project to the 2D image plane
     Geometry p = m_proj->Project(tf(x, true), ProjectionModel::EUCLIDEAN_2D);
@@ -374,11 +935,11 @@ cv::Mat PhotometricObjective::operator() (const EuclideanTransform& tf) const
     // find mapped pixel values
     Geometry y = Geometry(Geometry::PACKED, interp(m_dst, p32f, m_interp));
 
-    const MahalanobisMetric* m = dynamic_cast<const MahalanobisMetric*>(m_data.metric.get());
+    const MahalanobisMetric* m = dynamic_cast<const MahalanobisMetric*>(data.metric.get());
 
     if (!m)
     {
-        return (*m_data.metric)(m_data.dst, y).mat;
+        return (*data.metric)(data.dst, y).mat;
     }
 
     // error propagation for Mahalanobis metric 
@@ -399,16 +960,16 @@ cv::Mat PhotometricObjective::operator() (const EuclideanTransform& tf) const
 
     jac.mat = dI; // the new metric will be in 1D space
 
-    Metric::ConstOwn d = m_data.metric->Transform(tf, jac);
+    Metric::ConstOwn d = data.metric->Transform(tf, jac);
 
     /////////////////////////////////////////////////////////////////////////////////////////
     // PersistentMat(d->ToMahalanobis()->GetCovariance().mat.clone()).Store(Path("jac.bin"));
     // PersistentMat(x.mat).Store(Path("x.bin"));
     // PersistentMat(y.mat).Store(Path("y.bin"));
-    // PersistentMat(m_data.dst.mat.clone()).Store(Path("y0.bin"));
+    // PersistentMat(data.dst.mat.clone()).Store(Path("y0.bin"));
     /////////////////////////////////////////////////////////////////////////////////////////
 
-    return (*d)(m_data.dst, y).mat;
+    return (*d)(data.dst, y).mat;
 }
 
 //==[ PhotometricObjective::GradientImage ]===================================//
@@ -456,21 +1017,118 @@ bool RigidObjective::SetData(const GeometricMapping& data)
     return true;
 }
 
-cv::Mat RigidObjective::operator() (const EuclideanTransform& f) const
+cv::Mat RigidObjective::Evaluate(const EuclideanTransform& f, const GeometricMapping& data) const
 {
-    Metric::ConstOwn d = m_data.metric->Transform(f);
+    Metric::ConstOwn d = data.metric->Transform(f);
 
-    Geometry x = m_data.src;
+    Geometry x(data.src.shape, data.src.mat); // shared, as the transform writes its result to a new matrix
     Geometry y = f(x, true);
 
-    return (*d)(m_data.dst, y).mat;
+    return (*d)(data.dst, y).mat;
 }
 
 //==[ PoseEstimator ]=========================================================//
 
+bool PoseEstimator::Solve(const GeometricMapping& mapping, Estimates& estimates) const
+{
+    Estimate estimate;
+
+    estimates.clear();
+
+    if (!(*this)(mapping, estimate))
+    {
+        return false;
+    }
+
+    estimates.push_back(estimate);
+    return true;
+}
+
 //==[ EssentialMatrixDecomposer ]=============================================//
 
 bool EssentialMatrixDecomposer::operator() (const GeometricMapping& mapping, Estimate& estimate) const
+{
+    // all the solutions of a minimal set fit the correspondences exactly, so
+    // none of them can be singled out
+    if (m_method == FIVE_POINT && mapping.GetSize() == GetMinPoints())
+    {
+        E_ERROR << "a minimal set yields up to ten poses, use Solve() to get all of them";
+        return false;
+    }
+
+    GeometricMapping bpm;
+
+    if (!Backproject(mapping, bpm))
+    {
+        return false;
+    }
+
+    cv::Mat E;
+
+    try
+    {
+        E = cv::findEssentialMat(bpm.src.mat, bpm.dst.mat, cv::Mat::eye(3, 3, CV_64F));
+    }
+    catch (std::exception& ex)
+    {
+        E_ERROR << "cv::findEssentialMat failed : " << ex.what();
+        return false;
+    }
+
+    return estimate.pose.FromEssentialMatrix(E, bpm);
+}
+
+bool EssentialMatrixDecomposer::Solve(const GeometricMapping& mapping, Estimates& estimates) const
+{
+    if (m_method != FIVE_POINT || mapping.GetSize() != GetMinPoints())
+    {
+        return PoseEstimator::Solve(mapping, estimates);
+    }
+
+#ifdef WITH_FIVEPOINTS
+    GeometricMapping bpm;
+
+    if (!Backproject(mapping, bpm))
+    {
+        return false;
+    }
+
+    double q0[5][3], q1[5][3];
+    fivepoints::Ematrix Es[10];
+    int solutions = 0;
+
+    for (int i = 0; i < 5; i++)
+    {
+        const double* x0 = bpm.src.mat.ptr<double>(i);
+        const double* x1 = bpm.dst.mat.ptr<double>(i);
+
+        q0[i][0] = x0[0]; q0[i][1] = x0[1]; q0[i][2] = 1;
+        q1[i][0] = x1[0]; q1[i][1] = x1[1]; q1[i][2] = 1;
+    }
+
+    // the generic solver is used as the optimised one loses accuracy
+    fivepoints::compute_E_matrices(q0, q1, Es, solutions, false);
+
+    estimates.clear();
+
+    for (int k = 0; k < solutions; k++)
+    {
+        Estimate estimate;
+
+        if (Decompose(cv::Mat(3, 3, CV_64F, Es[k]), bpm, estimate.pose) == 5)
+        {
+            estimates.push_back(estimate);
+        }
+    }
+
+    return true;
+#else
+    E_ERROR << "five-point solver not built, rebuild with WITH_FIVEPOINTS to use it";
+    return false;
+#endif
+}
+
+bool EssentialMatrixDecomposer::Backproject(const GeometricMapping& mapping, GeometricMapping& bpm) const
 {
     if (!mapping.Check(2, 2))
     {
@@ -490,23 +1148,59 @@ bool EssentialMatrixDecomposer::operator() (const GeometricMapping& mapping, Est
         return false;
     }
 
-    GeometricMapping bpm;
-    bpm.src.mat = Geometry::FromHomogeneous(m_srcProj->Backproject(mapping.src)).mat;
-    bpm.dst.mat = Geometry::FromHomogeneous(m_dstProj->Backproject(mapping.dst)).mat;
+    const int n = static_cast<int>(mapping.GetSize());
 
-    cv::Mat E;
+    Geometry::FromHomogeneous(m_srcProj->Backproject(mapping.src)).mat.reshape(1, n).convertTo(bpm.src.mat, CV_64F);
+    Geometry::FromHomogeneous(m_dstProj->Backproject(mapping.dst)).mat.reshape(1, n).convertTo(bpm.dst.mat, CV_64F);
 
-    try
-    {
-        E = cv::findEssentialMat(bpm.src.mat, bpm.dst.mat, cv::Mat::eye(3, 3, CV_64F));
-    }
-    catch (std::exception& ex)
+    return true;
+}
+
+size_t EssentialMatrixDecomposer::Decompose(const cv::Mat& E, const GeometricMapping& bpm, EuclideanTransform& pose)
+{
+    cv::Mat R[2], t;
+    cv::decomposeEssentialMat(E, R[0], R[1], t);
+
+    size_t best = 0;
+
+    // pick the one of the four poses that puts the most points in front of both cameras
+    for (int k = 0; k < 4; k++)
     {
-        E_ERROR << "cv::findEssentialMat failed : " << ex.what();
-        return false;
+        const cv::Matx33d Rk = R[k / 2];
+        const cv::Vec3d   tk = (k % 2 == 0 ? 1 : -1) * cv::Vec3d(t);
+        size_t front = 0;
+
+        for (int i = 0; i < bpm.src.mat.rows; i++)
+        {
+            const double* x0 = bpm.src.mat.ptr<double>(i);
+            const double* x1 = bpm.dst.mat.ptr<double>(i);
+
+            // solve z1 * x1 = z0 * R * x0 + t for the depths z0 and z1
+            const cv::Vec3d Rx0 = Rk * cv::Vec3d(x0[0], x0[1], 1);
+            const cv::Vec3d y1(x1[0], x1[1], 1);
+            const cv::Vec3d a = y1.cross(Rx0);
+            const cv::Vec3d b = y1.cross(tk);
+            const double aa = a.dot(a);
+
+            if (aa <= 0) continue;
+
+            const double z0 = -a.dot(b) / aa;
+            const double z1 = (z0 * Rx0 + tk)[2];
+
+            if (z0 > 0 && z1 > 0)
+            {
+                front++;
+            }
+        }
+
+        if (front > best)
+        {
+            best = front;
+            pose = EuclideanTransform(cv::Mat(Rk), cv::Mat(tk));
+        }
     }
 
-    return estimate.pose.FromEssentialMatrix(E, bpm);
+    return best;
 }
 
 //==[ PerspevtivePoseEstimator ]==============================================//
@@ -531,6 +1225,14 @@ bool PerspevtivePoseEstimator::operator() (const GeometricMapping& mapping, Esti
         return false;
     }
 
+    // as in EssentialMatrixDecomposer, the solutions of a minimal set are
+    // equally consistent with the correspondences
+    if (m_method == P3P && mapping.GetSize() == GetMinPoints())
+    {
+        E_ERROR << "a minimal set yields up to four poses, use Solve() to get all of them";
+        return false;
+    }
+
     const cv::Mat opts = mapping.src.mat.reshape(3);
     const cv::Mat ipts = Geometry::FromHomogeneous(m_proj->Backproject(mapping.dst)).mat.reshape(2);
 
@@ -561,6 +1263,171 @@ bool PerspevtivePoseEstimator::operator() (const GeometricMapping& mapping, Esti
     return true;
 }
 
+bool PerspevtivePoseEstimator::Solve(const GeometricMapping& mapping, Estimates& estimates) const
+{
+    if (m_method != P3P || mapping.GetSize() != GetMinPoints())
+    {
+        return PoseEstimator::Solve(mapping, estimates);
+    }
+
+    if (!mapping.Check(3, 2))
+    {
+        E_ERROR << "invalid mapping";
+        return false;
+    }
+
+    if (!m_proj)
+    {
+        E_ERROR << "missing projection model";
+        return false;
+    }
+
+    cv::Mat opts, ipts;
+    mapping.src.mat.reshape(1, 3).convertTo(opts, CV_64F);
+    Geometry::FromHomogeneous(m_proj->Backproject(mapping.dst)).mat.reshape(1, 3).convertTo(ipts, CV_64F);
+
+    cv::Vec3d x[3], y[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        const double* xi = opts.ptr<double>(i);
+        const double* yi = ipts.ptr<double>(i);
+
+        x[i] = cv::Vec3d(xi[0], xi[1], xi[2]);
+        y[i] = cv::normalize(cv::Vec3d(yi[0], yi[1], 1));
+    }
+
+    cv::Matx33d R[4];
+    cv::Vec3d t[4];
+    const int solutions = SolveP3P(x, y, R, t);
+
+    estimates.resize(solutions);
+
+    for (int k = 0; k < solutions; k++)
+    {
+        estimates[k].pose = EuclideanTransform(cv::Mat(R[k]), cv::Mat(t[k]));
+    }
+
+    return true;
+}
+
+int PerspevtivePoseEstimator::SolveP3P(const cv::Vec3d x[3], const cv::Vec3d y[3], cv::Matx33d R[4], cv::Vec3d t[4])
+{
+    // the unknown depths l1, l2, l3 of the points satisfy the three distance constraints
+    //  l1^2 + l2^2 + b12*l1*l2 = a12, l1^2 + l3^2 + b13*l1*l3 = a13, l2^2 + l3^2 + b23*l2*l3 = a23
+    const double b12 = -2 * y[0].dot(y[1]);
+    const double b13 = -2 * y[0].dot(y[2]);
+    const double b23 = -2 * y[1].dot(y[2]);
+
+    const cv::Vec3d d12 = x[0] - x[1];
+    const cv::Vec3d d13 = x[0] - x[2];
+    const cv::Vec3d d23 = x[1] - x[2];
+    const cv::Vec3d n = d12.cross(d13);
+
+    const double a12 = d12.dot(d12);
+    const double a13 = d13.dot(d13);
+    const double a23 = d23.dot(d23);
+
+    // the object points are collinear
+    if (n.dot(n) <= 1e-12 * a12 * a13)
+    {
+        return 0;
+    }
+
+    // find a degenerate member of the pencil of the two constraint conics
+    const double c12 = -0.5 * b12, c13 = -0.5 * b13, c23 = -0.5 * b23;
+    const double blob = c12 * c23 * c13 - 1;
+    const double s12 = 1 - c12 * c12, s13 = 1 - c13 * c13, s23 = 1 - c23 * c23;
+
+    const double p3 = a13 * (a23 * s13 - a13 * s23);
+    const double p2 = 2 * blob * a23 * a13 + a13 * (2 * a12 + a13) * s23 + a23 * (a23 - a12) * s13;
+    const double p1 = a23 * (a13 - a23) * s12 - a12 * a12 * s23 - 2 * a12 * (blob * a23 + a13 * s23);
+    const double p0 = a12 * (a12 * s23 - a23 * s12);
+
+    if (p3 == 0)
+    {
+        return 0;
+    }
+
+    const double g = SolveCubic(p2 / p3, p1 / p3, p0 / p3);
+
+    const cv::Matx33d A(
+        a23 * (1 - g),          0.5 * a23 * b12,              -0.5 * a23 * b13 * g,
+        0.5 * a23 * b12,        a23 - a12 + a13 * g,          0.5 * b23 * (a13 * g - a12),
+        -0.5 * a23 * b13 * g,   0.5 * b23 * (a13 * g - a12),  g * (a13 - a23) - a12
+    );
+
+    cv::Matx33d V;
+    double e1, e2;
+
+    EigenRank2(A, V, e1, e2);
+
+    // the degenerate conic splits into the two lines l1 = w0*l2 + w1*l3
+    const double v = std::sqrt(std::max(0.0, -e2 / e1));
+    cv::Vec3d L[4];
+    int solutions = 0;
+
+    for (int k = 0; k < 2; k++)
+    {
+        const double sv = k == 0 ? v : -v;
+        const double w2 = 1 / (sv * V(0, 1) - V(0, 0));
+        const double w0 = (V(1, 0) - sv * V(1, 1)) * w2;
+        const double w1 = (V(2, 0) - sv * V(2, 1)) * w2;
+
+        // the ratio tau = l3 / l2 from substituting a line into the first constraint
+        const double a = 1 / ((a13 - a12) * w1 * w1 - a12 * b13 * w1 - a12);
+        const double b = (a13 * b12 * w1 - a12 * b13 * w0 - 2 * w0 * w1 * (a12 - a13)) * a;
+        const double c = ((a13 - a12) * w0 * w0 + a13 * b12 * w0 + a13) * a;
+
+        double tau[2];
+
+        if (!SolveQuadratic(b, c, tau[0], tau[1]))
+        {
+            continue;
+        }
+
+        for (int j = 0; j < 2; j++)
+        {
+            if (!(tau[j] > 0)) continue;
+
+            const double l2 = std::sqrt(a23 / (tau[j] * (b23 + tau[j]) + 1));
+            const double l3 = tau[j] * l2;
+            const double l1 = w0 * l2 + w1 * l3;
+
+            if (l1 >= 0 && l2 > 0)
+            {
+                L[solutions++] = cv::Vec3d(l1, l2, l3);
+            }
+        }
+    }
+
+    // the rotation maps the object point differences to those of the back-projected points
+    const cv::Matx33d Xi = cv::Matx33d(
+        d12[0], d13[0], n[0],
+        d12[1], d13[1], n[1],
+        d12[2], d13[2], n[2]
+    ).inv();
+
+    for (int k = 0; k < solutions; k++)
+    {
+        RefineDepths(L[k], a12, a13, a23, b12, b13, b23);
+
+        const cv::Vec3d z1 = L[k][0] * y[0];
+        const cv::Vec3d e12 = z1 - L[k][1] * y[1];
+        const cv::Vec3d e13 = z1 - L[k][2] * y[2];
+        const cv::Vec3d m = e12.cross(e13);
+
+        R[k] = cv::Matx33d(
+            e12[0], e13[0], m[0],
+            e12[1], e13[1], m[1],
+            e12[2], e13[2], m[2]
+        ) * Xi;
+        t[k] = z1 - R[k] * x[0];
+    }
+
+    return solutions;
+}
+
 //==[ QuatAbsOrientationSolver ]==============================================//
 
 bool QuatAbsOrientationSolver::operator() (const GeometricMapping& mapping, Estimate& estimate) const
@@ -597,6 +1464,21 @@ bool InversePoseEstimator::operator() (const GeometricMapping& mapping, Estimate
     return true;
 }
 
+bool InversePoseEstimator::Solve(const GeometricMapping& mapping, Estimates& estimates) const
+{
+    if (!m_estimator || !m_estimator->Solve(mapping, estimates))
+    {
+        return false;
+    }
+
+    BOOST_FOREACH (Estimate& estimate, estimates)
+    {
+        estimate.pose = estimate.pose.GetInverse();
+    }
+
+    return true;
+}
+
 //==[ ConsensusPoseEstimator ]================================================//
 
 bool ConsensusPoseEstimator::operator() (const GeometricMapping& mapping, Estimate& estimate) const
@@ -631,11 +1513,30 @@ bool ConsensusPoseEstimator::operator() (const GeometricMapping& mapping, Estima
 
     const size_t population = GetPopulation();
     const size_t minInliers = static_cast<size_t>(population * m_minInlierRatio);
-    const double logOneMinusConfidence = std::log(1 - m_confidence);
-    const size_t iter = std::min(m_maxIter, n > 0 ? static_cast<size_t>(std::ceil(logOneMinusConfidence / std::log(1 - std::pow(m_minInlierRatio, n)))) : 1);
+    const bool adaptive = m_strategy == ADAPTIVE_RANSAC || m_strategy == PROSAC;
+    const bool progressive = m_strategy == PROSAC && m_order.size() == m;
+    size_t iter = adaptive ? m_maxIter : GetRequiredIterations(m_minInlierRatio, n, m_confidence, m_maxIter);
     size_t numInliers = 0;
 
-    Speedometre solve, eval;
+    if (m_strategy == PROSAC && !progressive)
+    {
+        E_WARNING << "sampling order not available for all " << m << " correspondence(s), falling back to uniform sampling";
+    }
+
+    // a private generator seeded once per call keeps the global random sequence
+    // independent of how many samples are drawn ahead of the termination
+    cv::RNG rng(std::rand());
+    ProgressiveSampler sampler(m_order, n, m_maxIter);
+
+    // chunked data for the early rejection of bad hypotheses
+    const AlignmentObjective::InlierSelector::SequentialTest test(m_minInlierRatio, m_sprtDelta, m_sprtCost);
+    const bool sequential = m_sequentialTest && iter > 1 && test.IsEnabled();
+    ChunksList chunks(sequential ? m_selectors.size() : 0);
+
+    for (size_t s = 0; s < chunks.size(); s++)
+    {
+        m_selectors[s].Split(m_chunkSize, rng, chunks[s]);
+    }
 
     if (m_verbose)
     {
@@ -648,104 +1549,98 @@ bool ConsensusPoseEstimator::operator() (const GeometricMapping& mapping, Estima
         E_TRACE << std::setw(80) << std::setfill('=') << "";
     }
 
-    struct Result
-    {
-        IndexLists inliers;
-        IndexLists outliers;
-    };
+    ThreadPool& pool = ThreadPool::GetInstance();
+    const size_t batch = m_threads > 0 ? m_threads : pool.GetThreads();
+    double solveTime = 0, evalTime = 0;
+    size_t loRuns = 0;
 
-    //for (size_t k = 0, iter = m_maxIter; k < iter; k++)
-    for (size_t k = 0; k < iter; k++)
+    for (size_t k = 0; k < iter; k += batch)
     {
-        IndexList idx = DrawSamples(m, n);
-        GeometricMapping samples = mapping[idx];
-        PoseEstimator::Estimate trial;
-        Result result;
-        size_t hits = 0;
+        std::vector<Hypothesis> hypotheses(std::min(batch, iter - k));
 
-        solve.Start();
-        if (!f(samples, trial))
+        // draw the samples here in sequence to stay reproducible
+        BOOST_FOREACH (Hypothesis& h, hypotheses)
         {
-            E_ERROR << "inner pose estimator failed";
-            return false;
+            h.samples = progressive ? sampler(rng) : DrawSamples(m, n, rng);
         }
-        solve.Stop(1);
 
-        eval.Start();
-        if (!m_threaded)
+        if (hypotheses.size() == 1)
         {
-            BOOST_FOREACH(const AlignmentObjective::InlierSelector& g, m_selectors)
+            EvalHypothesis(mapping, sequential ? &chunks : NULL, &test, hypotheses[0]);
+        }
+        else
+        {
+            ThreadPool::TaskGroup tasks(pool);
+
+            BOOST_FOREACH (Hypothesis& h, hypotheses)
             {
-                EvalResult rs;
+                tasks.Run(boost::bind(&ConsensusPoseEstimator::EvalHypothesis, this, boost::cref(mapping), sequential ? &chunks : NULL, &test, boost::ref(h)));
+            }
 
-                if (!g(trial.pose, rs.accepted, rs.rejected))
-                {
-                    E_ERROR << "selector failed";
-                    return false;
-                }
+            tasks.Wait();
+        }
 
-                result.inliers .push_back(rs.accepted);
-                result.outliers.push_back(rs.rejected);
+        // the bound may have been tightened by an earlier hypothesis of the batch
+        for (size_t i = 0; i < hypotheses.size() && k + i < iter; i++)
+        {
+            Hypothesis& h = hypotheses[i];
 
-                hits += rs.accepted.size();
+            if (!h.solved)
+            {
+                E_ERROR << "inner pose estimator failed";
+                return false;
             }
-        }
-        else
-        {
-            boost::thread_group threads;
-            std::vector<EvalResult> results(m_selectors.size());
 
-            for (size_t i = 0; i < m_selectors.size(); i++)
+            if (!h.evaluated)
             {
-                threads.add_thread(
-                    new boost::thread(
-                        ConsensusPoseEstimator::EvalThread,
-                        boost::cref(m_selectors[i]),
-                        boost::cref(trial.pose),
-                        boost::ref(results[i])
-                    )
-                );
+                E_ERROR << "selector failed";
+                return false;
             }
 
-            threads.join_all();
+            solveTime += h.solveTime;
+            evalTime  += h.evalTime;
 
-            BOOST_FOREACH (const EvalResult& rs, results)
+            if (m_verbose)
             {
-                if (!rs.success)
-                {
-                    E_ERROR << "selector failed";
-                    return false;
-                }
+                E_TRACE << std::setw(6)  << std::right << (k + i + 1)
+                        << std::setw(12) << std::right << h.hits     << " (" << std::setw(3) << std::right << (100*h.hits/population)     << "%)"
+                        << std::setw(12) << std::right << numInliers << " (" << std::setw(3) << std::right << (100*numInliers/population) << "%)"
+                        << std::setw(15) << std::right << (solveTime * 1000) << " ms"
+                        << std::setw(15) << std::right << (evalTime  * 1000) << " ms"
+                        << (h.candidates == 0 ? " (no solution)" : (h.rejected ? " (rejected)" : ""));
+            }
 
-                result.inliers .push_back(rs.accepted);
-                result.outliers.push_back(rs.rejected);
+            if (h.rejected || h.hits < numInliers) continue;
 
-                hits += rs.accepted.size();
-            }
-        }
-        eval.Stop(1);
+            // local optimisation of a new best hypothesis
+            if (m_localOptimisation && loRuns < m_loMaxRuns && h.hits > numInliers && h.hits > n)
+            {
+                const size_t hits = h.hits;
 
-        if (m_verbose)
-        {
-            E_TRACE << std::setw(6)  << std::right << (k + 1)
-                    << std::setw(12) << std::right << hits       << " (" << std::setw(3) << std::right << (100*hits/population)       << "%)"
-                    << std::setw(12) << std::right << numInliers << " (" << std::setw(3) << std::right << (100*numInliers/population) << "%)"
-                    << std::setw(15) << std::right << (solve.GetElapsedSeconds() * 1000) << " ms"
-                    << std::setw(15) << std::right << (eval .GetElapsedSeconds() * 1000) << " ms";
-        }
+                loRuns++;
+
+                if (LocalOptimise(h) && m_verbose)
+                {
+                    E_TRACE << "local optimisation increases inliers from " << hits << " to " << h.hits;
+                }
+            }
 
-        if (hits < numInliers) continue;
+            // accept the trial
+            numInliers = h.hits;
+            estimate = h.trial;
+            inliers.swap(h.inliers);
+            outliers.swap(h.outliers);
 
-        // accept the trial
-        numInliers = hits;
-        estimate = trial;
-        inliers  = result.inliers;
-        outliers = result.outliers;
+            if (numInliers < minInliers || !adaptive) continue;
 
-        if (hits < minInliers) continue;
+            // convergence control
+            iter = std::min(iter, GetRequiredIterations(static_cast<double>(numInliers) / population, n, m_confidence, m_maxIter));
 
-        // convergence control
-        //iter = std::min(iter, static_cast<size_t>(std::ceil(logOneMinusConfidence / std::log(1 - std::pow(hits / population, n)))));
+            if (m_verbose && iter <= k + i + 1)
+            {
+                E_TRACE << "converged after " << (k + i + 1) << " trial(s)";
+            }
+        }
     }
 
     const bool success = numInliers >= minInliers;
@@ -762,39 +1657,21 @@ bool ConsensusPoseEstimator::operator() (const GeometricMapping& mapping, Estima
     // post-estimation non-linear optimisation
     if (success && m_optimisation)
     {
-        MultiObjectivePoseEstimation refinement;
-        refinement.SetDifferentiationStep(1e-2);
-        refinement.SetPose(estimate.pose);
-        std::vector<Indices> inliersOptim;
-
-        size_t i = 0;
-        inliersOptim.resize(m_selectors.size());
+        std::vector<Indices> inliersOptim(m_selectors.size());
 
-        BOOST_FOREACH (const AlignmentObjective::InlierSelector& g, m_selectors)
+        for (size_t i = 0; i < m_selectors.size(); i++)
         {
-            const IndexList& idx = inliers[i];
-            AlignmentObjective::Own sub = g.objective->GetSubObjective(idx);
-
-            if (!sub)
-            {
-                E_WARNING << "error building sub-objective for model " << i;
-            }
-            else if (sub->GetData().GetSize() > 0)
-            {
-                refinement.AddObjective(AlignmentObjective::ConstOwn(sub));
-                inliersOptim[i].insert(inliersOptim[i].end(), idx.begin(), idx.end());
-            }
-
-            i++;
+            inliersOptim[i].assign(inliers[i].begin(), inliers[i].end());
         }
 
+        EuclideanTransform refined = estimate.pose;
         LeastSquaresSolver::State state;
         LevenbergMarquardtAlgorithm levmar;
 
         levmar.SetVervbose(m_verbose);
         levmar.SetInitialDamp(1e-2);
 
-        if (!levmar.Solve(refinement, state))
+        if (!Refine(inliers, levmar, refined, state))
         {
             E_ERROR << "non-linear optimisation failed";
             return false;
@@ -823,7 +1700,7 @@ bool ConsensusPoseEstimator::operator() (const GeometricMapping& mapping, Estima
         EuclideanTransform initPose = estimate.pose;
         cv::Mat cov; cv::invert(state.hessian, cov);
 
-        estimate.pose = refinement.GetPose();
+        estimate.pose = refined;
         estimate.metric = Metric::Own(new MahalanobisMetric(MahalanobisMetric::ANISOTROPIC_ROTATED, 6, symmat(cov)));
         estimate.valid = true;
 
@@ -901,7 +1778,7 @@ size_t ConsensusPoseEstimator::GetPopulation() const
     return n;
 }
 
-IndexList ConsensusPoseEstimator::DrawSamples(size_t population, size_t samples)
+IndexList ConsensusPoseEstimator::DrawSamples(size_t population, size_t samples, cv::RNG& rng)
 {
     if (population < samples)
     {
@@ -920,14 +1797,208 @@ IndexList ConsensusPoseEstimator::DrawSamples(size_t population, size_t samples)
         idx[i] = i;
     }
 
-    std::random_shuffle(idx.begin(), idx.end());
+    std::random_shuffle(idx.begin(), idx.end(), rng);
 
     return IndexList(idx.begin(), std::next(idx.begin(), samples));
 }
 
-void ConsensusPoseEstimator::EvalThread(const AlignmentObjective::InlierSelector& g, const EuclideanTransform& tf, EvalResult& result)
+size_t ConsensusPoseEstimator::GetRequiredIterations(double inlierRatio, size_t samples, double confidence, size_t maxIter)
+{
+    if (samples == 0 || inlierRatio >= 1 || confidence <= 0)
+    {
+        return std::min<size_t>(maxIter, 1);
+    }
+
+    // probability of drawing an outlier-free sample
+    const double p = std::pow(inlierRatio, static_cast<double>(samples));
+
+    if (p <= 0 || confidence >= 1)
+    {
+        return maxIter;
+    }
+
+    const double k = std::ceil(std::log(1 - confidence) / std::log1p(-p));
+
+    return k < static_cast<double>(maxIter) ? std::max<size_t>(static_cast<size_t>(k), 1) : maxIter;
+}
+
+//==[ ConsensusPoseEstimator::ProgressiveSampler ]============================//
+
+ConsensusPoseEstimator::ProgressiveSampler::ProgressiveSampler(const Indices& order, size_t samples, size_t trials)
+: m_order(order), m_samples(samples), m_trial(0), m_size(samples), m_tn(static_cast<double>(std::max<size_t>(trials, 1))), m_tn1(1)
+{
+    // expected number of samples drawn only from the top-ranked subset
+    for (size_t i = 0; i < samples && i < order.size(); i++)
+    {
+        m_tn *= static_cast<double>(samples - i) / static_cast<double>(order.size() - i);
+    }
+}
+
+IndexList ConsensusPoseEstimator::ProgressiveSampler::operator() (cv::RNG& rng)
+{
+    const size_t population = m_order.size();
+
+    if (population < m_samples || m_samples == 0)
+    {
+        return DrawSamples(population, m_samples, rng);
+    }
+
+    // grow the subset once its share of trials is used up
+    if (++m_trial >= m_tn1 && m_size < population)
+    {
+        const double tn = m_tn * (m_size + 1) / (m_size + 1 - m_samples);
+
+        m_tn1 += static_cast<size_t>(std::ceil(tn - m_tn));
+        m_tn = tn;
+        m_size++;
+    }
+
+    // the newest member of the subset is always in the sample until the
+    // subset stops growing, then the draws are uniform within the subset
+    const bool pinned = m_trial < m_tn1;
+    const size_t pool = pinned ? m_size - 1 : m_size;
+    IndexList samples;
+
+    BOOST_FOREACH (size_t i, DrawSamples(pool, pinned ? m_samples - 1 : m_samples, rng))
+    {
+        samples.push_back(m_order[i]);
+    }
+
+    if (pinned)
+    {
+        samples.push_back(m_order[m_size - 1]);
+    }
+
+    return samples;
+}
+
+void ConsensusPoseEstimator::EvalHypothesis(const GeometricMapping& mapping, const ChunksList* chunks, const AlignmentObjective::InlierSelector::SequentialTest* test, Hypothesis& h) const
+{
+    boost::timer::cpu_timer timer;
+    Estimates trials;
+
+    h.solved = m_solver->Solve(mapping[h.samples], trials);
+    h.solveTime = timer.elapsed().wall * 1e-9;
+
+    if (!h.solved)
+    {
+        return;
+    }
+
+    timer.start();
+
+    const int depth = m_singlePrecision ? CV_32F : CV_64F;
+
+    h.candidates = trials.size();
+    h.rejected = true; // until a candidate survives
+
+    // keep the candidate with the most inliers
+    BOOST_FOREACH (const Estimate& trial, trials)
+    {
+        IndexLists inliers, outliers;
+        size_t hits = 0;
+        bool rejected = false;
+
+        for (size_t s = 0; s < m_selectors.size() && !rejected; s++)
+        {
+            const AlignmentObjective::InlierSelector& g = m_selectors[s];
+            IndexList accepted, declined;
+
+            if (chunks ? !g(trial.pose, (*chunks)[s], *test, accepted, declined, rejected, depth) : !g(trial.pose, accepted, declined, depth))
+            {
+                return;
+            }
+
+            hits += accepted.size();
+            inliers .push_back(accepted);
+            outliers.push_back(declined);
+        }
+
+        if (rejected || (!h.rejected && hits <= h.hits)) continue;
+
+        h.rejected = false;
+        h.trial = trial;
+        h.hits = hits;
+        h.inliers.swap(inliers);
+        h.outliers.swap(outliers);
+    }
+
+    h.evaluated = true;
+    h.evalTime = timer.elapsed().wall * 1e-9;
+}
+
+bool ConsensusPoseEstimator::Refine(const IndexLists& inliers, LevenbergMarquardtAlgorithm& levmar, EuclideanTransform& pose, LeastSquaresSolver::State& state) const
+{
+    MultiObjectivePoseEstimation refinement;
+    refinement.SetDifferentiationStep(1e-2);
+    refinement.SetPose(pose);
+
+    for (size_t s = 0; s < m_selectors.size(); s++)
+    {
+        AlignmentObjective::ConstOwn sub = m_selectors[s].objective->GetSubObjective(inliers[s]);
+
+        if (!sub)
+        {
+            E_WARNING << "error building sub-objective for model " << s;
+        }
+        else if (sub->GetData().GetSize() > 0)
+        {
+            refinement.AddObjective(sub);
+        }
+    }
+
+    if (!levmar.Solve(refinement, state))
+    {
+        return false;
+    }
+
+    pose = refinement.GetPose();
+    return true;
+}
+
+bool ConsensusPoseEstimator::LocalOptimise(Hypothesis& h) const
 {
-    result.success = g(tf, result.accepted, result.rejected);
+    EuclideanTransform refined = h.trial.pose;
+    LeastSquaresSolver::State state;
+    LevenbergMarquardtAlgorithm levmar;
+
+    // a few lightly damped updates, close to plain Gauss-Newton steps
+    levmar.SetInitialDamp(1e-4);
+    levmar.SetTermCriteria(cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, static_cast<int>(m_loIterations), 1e-6));
+
+    if (!Refine(h.inliers, levmar, refined, state))
+    {
+        return false;
+    }
+
+    IndexLists inliers, outliers;
+    size_t hits = 0;
+
+    BOOST_FOREACH (const AlignmentObjective::InlierSelector& g, m_selectors)
+    {
+        IndexList accepted, declined;
+
+        if (!g(refined, accepted, declined, m_singlePrecision ? CV_32F : CV_64F))
+        {
+            return false;
+        }
+
+        hits += accepted.size();
+        inliers .push_back(accepted);
+        outliers.push_back(declined);
+    }
+
+    if (hits <= h.hits)
+    {
+        return false;
+    }
+
+    h.trial.pose = refined;
+    h.hits = hits;
+    h.inliers.swap(inliers);
+    h.outliers.swap(outliers);
+
+    return true;
 }
 
 //==[ MultiObjectivePoseEstimation ]==========================================//
@@ -1004,7 +2075,7 @@ StructureEstimation::Estimate StructureEstimation::Estimate::operator[] (const I
 
 StructureEstimation::Estimate StructureEstimation::Estimate::operator+ (const Estimate& estimate) const
 {
-    Estimate clone(Geometry(structure), metric ? metric->Clone() : Metric::Own());
+    Estimate clone(structure.Clone(), metric ? metric->Clone() : Metric::Own());
     return clone += estimate;
 }
 
@@ -1128,56 +2199,16 @@ StructureEstimation::Estimate TwoViewTriangulation::operator() (const GeometricM
 
     // error propogation
     const int ROWS = static_cast<int>(g.GetElements());
-    const int COLS = static_cast<int>(MahalanobisMetric::GetCovMatCols(MahalanobisMetric::ANISOTROPIC_ROTATED, 3));
-    cv::Mat jac = GetJacobian(m.src, m.dst, g).mat;
-    cv::Mat cov = cv::Mat(ROWS, COLS, g.mat.depth());
+    cv::Mat jac = GetJacobian(m.src, m.dst, g).mat; // J', 4-by-3 per row
     boost::shared_ptr<const MahalanobisMetric> metric = m.metric ? m.metric->ToMahalanobis() : 0;
 
-    if (metric)
-    {
-        for (int i = 0; i < ROWS; i++)
-        {
-            cv::Mat Ci = metric->GetFullCovMat(static_cast<size_t>(i)); // C, 4-by-4
-            cv::Mat Ji = jac.row(i).reshape(1, 4); // J', 4-by-3
-
-            Ci = Ji.t() * Ci * Ji; // J * C * J', 3-by-3
-
-            // if (!checkPositiveDefinite(Ci))
-            // {
-            //   const cv::Mat C0 = metric->GetFullCovMat(static_cast<size_t>(i));
-            //
-            //   E_WARNING << "the Jacobian-transformed covariance of entry " << i << " is not positive definite";
-            //   E_WARNING << mat2string(C0, "C0");
-            //   E_WARNING << mat2string(Ci, "C1");
-            //   E_WARNING << mat2string(Ji, "J");
-            //
-            //   Ci.setTo(0);
-            // }
-
-            for (int d0 = 0; d0 < 3; d0++)
-            {
-                for (int d1 = d0; d1 < 3; d1++)
-                {
-                    cov.at<double>(i, sub2symind(d0, d1, 3)) = Ci.at<double>(d0, d1);
-                }
-            }
-        }
-    }
-    else // identity covaraince assumed
-    {
-        for (int i = 0; i < ROWS; i++)
-        {
-            cv::Mat Ji = jac.row(i).reshape(1, 4); // 4-by-3
-            cv::Mat Ci = Ji.t() * Ji; // 3-by-3
+    // J * C * J', or J * J' when identity covaraince assumed
+    cv::Mat cov = MahalanobisMetric::PropagateCovMat(metric ? metric->GetFullCovMat() : cv::Mat(), jac, 4, 3);
 
-            for (int d0 = 0; d0 < 3; d0++)
-            {
-                for (int d1 = d0; d1 < 3; d1++)
-                {
-                    cov.at<double>(i, sub2symind(d0, d1, 3)) = Ci.at<double>(d0, d1);
-                }
-            }
-        }
+    if (cov.rows != ROWS)
+    {
+        E_ERROR << "error propagating image covariances";
+        return Estimate(m.src.shape);
     }
 
     // do error propagation from motion estimate
@@ -729,7 +729,48 @@ bool MultiObjectiveOutlierFilter::operator() (ImageFeatureMap& fmap, IndexList&
         return false;
     }
 
-    estimator.SetStrategy(ConsensusPoseEstimator::RANSAC);
+    // rank the solver's correspondences by descriptor distance for progressive sampling
+    if (strategy == ConsensusPoseEstimator::PROSAC && !solverData.indices.empty())
+    {
+        const Indices matches(inliers.begin(), inliers.end());
+        std::vector<std::pair<float, size_t> > ranks;
+        Indices order;
+
+        ranks.reserve(solverData.indices.size());
+        order.reserve(solverData.indices.size());
+
+        for (size_t i = 0; i < solverData.indices.size(); i++)
+        {
+            ranks.push_back(std::make_pair(fmap[matches[solverData.indices[i]]].distance, i));
+        }
+
+        std::sort(ranks.begin(), ranks.end());
+
+        for (size_t i = 0; i < ranks.size(); i++)
+        {
+            order.push_back(ranks[i].second);
+        }
+
+        estimator.SetSamplingOrder(order);
+    }
+
+    estimator.SetStrategy(strategy);
+
+    if (sequentialTest)
+    {
+        estimator.EnableSequentialTest();
+    }
+
+    if (localOptimisation)
+    {
+        estimator.EnableLocalOptimisation();
+    }
+
+    if (singlePrecision)
+    {
+        estimator.EnableSinglePrecision();
+    }
+
     estimator.SetMaxIterations(motion.valid && !optimisation ? 1 : maxIterations);
     estimator.SetMinInlierRatio(minInlierRatio);
     estimator.SetConfidence(confidence);
@@ -926,6 +967,46 @@ String FeatureTracker::TriangulationToString(TriangulationMethod method)
     return TriangulationToString(TriangulationMethod::DISABLED);
 }
 
+bool FeatureTracker::StringToStrategy(const String& strategy, ConsensusPoseEstimator::Strategy& value)
+{
+    if (strategy.empty() || strategy.compare("RANSAC") == 0)
+    {
+        value = ConsensusPoseEstimator::RANSAC;
+        return true;
+    }
+
+    if (strategy.compare("ADAPTIVE") == 0)
+    {
+        value = ConsensusPoseEstimator::ADAPTIVE_RANSAC;
+        return true;
+    }
+
+    if (strategy.compare("PROSAC") == 0)
+    {
+        value = ConsensusPoseEstimator::PROSAC;
+        return true;
+    }
+
+    E_ERROR << "unknown consensus strategy \"" << strategy << "\"";
+    value = ConsensusPoseEstimator::RANSAC;
+
+    return false;
+}
+
+String FeatureTracker::StrategyToString(ConsensusPoseEstimator::Strategy strategy)
+{
+    switch (strategy)
+    {
+    case ConsensusPoseEstimator::RANSAC:          return "RANSAC";   break;
+    case ConsensusPoseEstimator::ADAPTIVE_RANSAC: return "ADAPTIVE"; break;
+    case ConsensusPoseEstimator::PROSAC:          return "PROSAC";   break;
+    default: break;
+    }
+
+    E_ERROR << "unknown strategy " << strategy;
+    return StrategyToString(ConsensusPoseEstimator::RANSAC);
+}
+
 void FeatureTracker::WriteParams(cv::FileStorage& fs) const
 {
     fs << "name" << GetName();
@@ -933,12 +1014,18 @@ void FeatureTracker::WriteParams(cv::FileStorage& fs) const
     fs << "outlierRejection" << "{";
     {
         fs << "model" << AlignmentToString(outlierRejection.model);
+        fs << "strategy" << StrategyToString(outlierRejection.strategy);
         fs << "confidence" << outlierRejection.confidence;
         fs << "iterations" << outlierRejection.maxIterations;
         fs << "minInliers" << outlierRejection.minInlierRatio;
         fs << "sigma" << outlierRejection.sigma;
         // fs << "epipolarEps" << outlierRejection.epipolarEps;
         fs << "fastMetric" << outlierRejection.fastMetric;
+        fs << "sequentialTest" << outlierRejection.sequentialTest;
+        fs << "fivePoint" << outlierRejection.fivePoint;
+        fs << "threePoint" << outlierRejection.threePoint;
+        fs << "localOptim" << outlierRejection.localOptim;
+        fs << "singlePrecision" << outlierRejection.singlePrecision;
         fs << "photometricDamp" << outlierRejection.photometricDamp;
     }
     fs << "}";
@@ -953,6 +1040,12 @@ void FeatureTracker::WriteParams(cv::FileStorage& fs) const
     }
     fs << "}";
 
+    fs << "guidedMatching" << "{";
+    {
+        fs << "radius" << guidedMatching.radius;
+    }
+    fs << "}";
+
     fs << "triangulation" << TriangulationToString(triangulation);
     fs << "epipolarEps"   << m_epipolarEps;
 }
@@ -962,13 +1055,20 @@ bool FeatureTracker::ReadParams(const cv::FileNode& fn)
     String name;
     const cv::FileNode oj = fn["outlierRejection"];
     const cv::FileNode ij = fn["inlierInjection"];
+    const cv::FileNode gm = fn["guidedMatching"];
 
     oj["model"]       >> m_alignString;
+    oj["strategy"]    >> m_strategy;
     oj["confidence"]  >> outlierRejection.confidence;
     oj["iterations"]  >> outlierRejection.maxIterations;
     oj["minInliers"]  >> outlierRejection.minInlierRatio;
     oj["sigma"]       >> outlierRejection.sigma;
     oj["fastMetric"]  >> outlierRejection.fastMetric;
+    oj["sequentialTest"] >> outlierRejection.sequentialTest;
+    oj["fivePoint"]   >> outlierRejection.fivePoint;
+    oj["threePoint"]  >> outlierRejection.threePoint;
+    oj["localOptim"]  >> outlierRejection.localOptim;
+    oj["singlePrecision"] >> outlierRejection.singlePrecision;
     oj["photometricDamp"] >> outlierRejection.photometricDamp;
 
     ij["flow"]        >> m_flowString;
@@ -976,6 +1076,8 @@ bool FeatureTracker::ReadParams(const cv::FileNode& fn)
     ij["levels"]      >> inlierInjection.levels;
     ij["bidirectionalTol"] >> inlierInjection.bidirectionalTol;
 
+    gm["radius"]      >> guidedMatching.radius;
+
     fn["name"] >> name;
     fn["epipolarEps"]   >> m_epipolarEps;
     fn["triangulation"] >> m_triangulation;
@@ -1003,6 +1105,11 @@ void FeatureTracker::ApplyParams()
         E_ERROR << "error applying triangulation setting";
     }
 
+    if (!StringToStrategy(m_strategy, outlierRejection.strategy))
+    {
+        E_ERROR << "error applying consensus strategy setting";
+    }
+
     // need to explicitly specify now
     // outlierRejection.model |= OutlierRejectionScheme::FORWARD_PROJ_ALIGN;
     outlierRejection.epipolarEps = inlierInjection.epipolarEps = m_epipolarEps;
@@ -1019,12 +1126,19 @@ void FeatureTracker::ApplyParams()
     E_INFO << "enabled alignment model : " << boost::algorithm::join(models, ", ");
     E_INFO << "optical flow direction  : " << (m_flowString.empty() ? "DISABLED" : m_flowString);
     E_INFO << "triangulation method    : " << TriangulationToString(triangulation);
+    E_INFO << "RANSAC strategy         : " << StrategyToString(outlierRejection.strategy);
     E_INFO << "RANSAC iterations       : " << outlierRejection.maxIterations;
     E_INFO << "RANSAC confidence       : " << (100.0f * outlierRejection.confidence) << "%";
     E_INFO << "minimum inlier ratio    : " << (100.0f * outlierRejection.minInlierRatio) << "%";
     E_INFO << "inlier sigma            : " << outlierRejection.sigma;
     E_INFO << "fast metric evaluation  : " << (outlierRejection.fastMetric ? "YES" : "NO");
+    E_INFO << "early hypothesis reject.: " << (outlierRejection.sequentialTest ? "YES" : "NO");
+    E_INFO << "local optimisation      : " << (outlierRejection.localOptim ? "YES" : "NO");
+    E_INFO << "single-precision RANSAC : " << (outlierRejection.singlePrecision ? "YES" : "NO");
+    E_INFO << "epipolar pose solver    : " << (outlierRejection.fivePoint ? "FIVE-POINT" : "EIGHT-POINT");
+    E_INFO << "projective pose solver  : " << (outlierRejection.threePoint ? "P3P" : "EPNP");
     E_INFO << "flow bidirectional tol. : " << inlierInjection.bidirectionalTol << " pixel(s)";
+    E_INFO << "guided matching radius  : " << guidedMatching.radius << " pixel(s)" << (guidedMatching.radius > 0 ? "" : " (DISABLED)");
     E_INFO << "epipolar tolerance      : " << (1/m_epipolarEps) << " normalised pixel(s)";
 }
 
@@ -1041,6 +1155,7 @@ FeatureTracker::Options FeatureTracker::GetOptions(int flag)
         ("triangulation",    po::value<String>(&m_triangulation    )->default_value(   ""), "Pose-motion triangulation method; valid strings are \"MIDPOINT\" and \"OPTIMAL\". Set to empty string to disable the feature.")
         ("epipolar-eps",     po::value<double>(&m_epipolarEps      )->default_value( 1000), "Threshold for epipolar constraint, as the inverse of the tolerable epipolar distance in normalised pixel. Ths value must be positive.")
         ("sigma",            po::value<double>(&oj.sigma           )->default_value(1.00f), "Threshold for inlier selection. The value must be positive.")
+        ("ransac-strategy",  po::value<String>(&m_strategy         )->default_value("RANSAC"), "Sampling and termination strategy of the RANSAC process. \"RANSAC\" runs a fixed number of iterations derived from the minimum inlier ratio, \"ADAPTIVE\" stops as soon as the confidence is reached by the best hypothesis, and \"PROSAC\" additionally draws samples from the matches with the smallest descriptor distances first.")
         ("ransac-iter",      po::value<size_t>(&oj.maxIterations   )->default_value(  100), "Max number of iterations for the RANSAC outlier rejection process.")
         ("ransac-conf",      po::value<double>(&oj.confidence      )->default_value(0.99f), "The confidence of obtaining a valid estimate at the end of the RANSAC process. The value is used to calculate a required iteration number.")
         ("ransac-ratio",     po::value<double>(&oj.minInlierRatio  )->default_value(0.70f), "Minimum ratio of inliers required to consider a hypothesis valid.")
@@ -1048,7 +1163,13 @@ FeatureTracker::Options FeatureTracker::GetOptions(int flag)
         ("flow-level",       po::value<size_t>(&ij.levels          )->default_value(    3), "Level of pyramid for optical flow computation.")
         ("flow-bidir-tol",   po::value<double>(&ij.bidirectionalTol)->default_value(    1), "Threshold of the forward-backward flow error, in image pixels. Set to a non-positive value to disable the test.")
         ("block-size",       po::value<size_t>(&ij.blockSize       )->default_value(    5), "Block size for optical flow computation and epipolar search.")
+        ("guided-radius",    po::value<double>(&guidedMatching.radius)->default_value(0), "Radius of the windows around the feature locations predicted by a motion prior, in which descriptors are matched. Set to a non-positive value to match all features exhaustively.")
         ("fast-metric",      po::bool_switch  (&oj.fastMetric      )->default_value(false), "Apply metric reduction to accelerate error evaluation.")
+        ("five-point",       po::bool_switch  (&oj.fivePoint       )->default_value(false), "Solve epipolar alignment hypotheses from five correspondences by the minimal solver instead of eight (requires a build with WITH_FIVEPOINTS).")
+        ("p3p",              po::bool_switch  (&oj.threePoint      )->default_value(false), "Solve projective alignment hypotheses from three correspondences by the closed-form P3P solver instead of six.")
+        ("ransac-lo",        po::bool_switch  (&oj.localOptim      )->default_value(false), "Refine each new best RANSAC hypothesis over its inliers before carrying on sampling (LO-RANSAC).")
+        ("ransac-sprt",      po::bool_switch  (&oj.sequentialTest  )->default_value(false), "Abandon a RANSAC hypothesis as soon as a sequential probability ratio test finds it unlikely to reach the minimum inlier ratio.")
+        ("ransac-float",     po::bool_switch  (&oj.singlePrecision )->default_value(false), "Evaluate RANSAC hypotheses in single precision where the alignment models support it. The final refinement is always done in double precision.")
         ("photometric-damp", po::value<double>(&oj.photometricDamp )->default_value(1.00f), "Weighting factor for photometric error; effective only for reduced metric.")
         ("show",             po::bool_switch  (&rendering          )->default_value( true), "Render feature tracking and visualise it.")
         ;
@@ -1127,6 +1248,34 @@ IndexList FeatureTracker::GetFeatureImageIndices(const ImageFeatureSet& f, const
     return indices;
 }
 
+Points2F FeatureTracker::PredictFeatureLocations(const StructureEstimation::Estimate& g, const ProjectionModel& p, const EuclideanTransform& motion, size_t n) const
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    Points2F predictions(n, Point2F(nan, nan));
+
+    if (g.structure.IsEmpty())
+    {
+        return predictions;
+    }
+
+    const cv::Mat pts = g.structure.mat.reshape(3);
+
+    for (size_t k = 0; k < n && k < static_cast<size_t>(pts.rows); k++)
+    {
+        Point3D gk = pts.at<Point3D>(static_cast<int>(k));
+
+        if (gk.z <= 0) continue;
+
+        // move the point to the target frame and see if it stays in front of the camera
+        if (motion(gk).z <= 0) continue;
+
+        p(gk);
+        predictions[k] = Point2F(static_cast<float>(gk.x), static_cast<float>(gk.y));
+    }
+
+    return predictions;
+}
+
 GeometricMapping FeatureTracker::FindFeaturesFlow(const cv::Mat& Ii, const cv::Mat& Ij, const ImageFeatureSet& fi, AlignmentObjective::Own& eval, const EuclideanTransform& pose, std::vector<bool>& tracked)
 {
     assert(fi.GetSize() == tracked.size());
@@ -1363,6 +1512,9 @@ bool FeatureTracker::operator() (Map& map, Source& si, Frame& ti, Source& sj, Fr
     boost::shared_ptr<MultiObjectiveOutlierFilter> filter;
     GeometricMapping::ImageToImageBuilder flow;
 
+    // the egomotion of the last run serves as a constant-velocity prior
+    const PoseEstimator::Estimate lastMotion = stats.motion;
+
     // initialise statistics
     stats = Stats();
     stats.fresh = (!mi.valid || !mj.valid) && ti.GetIndex() != tj.GetIndex();
@@ -1402,6 +1554,11 @@ bool FeatureTracker::operator() (Map& map, Source& si, Frame& ti, Source& sj, Fr
             new MultiObjectiveOutlierFilter(outlierRejection.maxIterations, outlierRejection.minInlierRatio, outlierRejection.confidence, outlierRejection.sigma)
             );
 
+        filter->strategy = outlierRejection.strategy;
+        filter->sequentialTest = outlierRejection.sequentialTest;
+        filter->localOptimisation = outlierRejection.localOptim;
+        filter->singlePrecision = outlierRejection.singlePrecision;
+
         if (ti == tj)
         {
             filter->motion.pose = EuclideanTransform::Identity;
@@ -1425,12 +1582,14 @@ bool FeatureTracker::operator() (Map& map, Source& si, Frame& ti, Source& sj, Fr
             filter->optimisation = true;
         }
 
+        const PerspevtivePoseEstimator::Method pnpMethod = outlierRejection.threePoint ? PerspevtivePoseEstimator::P3P : PerspevtivePoseEstimator::EPNP;
+
         if (outlierRejection.model & FORWARD_PROJ_ALIGN)
         {
             if (pj)
             {
                 filter->builders.push_back(MultiObjectiveOutlierFilter::ObjectiveBuilder::Own(
-                    new PerspectiveObjectiveBuilder(pj, gi, true, outlierRejection.fastMetric, false, stats.objectives[FORWARD_PROJ_ALIGN])
+                    new PerspectiveObjectiveBuilder(pj, gi, true, outlierRejection.fastMetric, false, pnpMethod, stats.objectives[FORWARD_PROJ_ALIGN])
                 ));
 
                 // build extra projective constraints for pj for egomotion refinement
@@ -1441,7 +1600,7 @@ bool FeatureTracker::operator() (Map& map, Source& si, Frame& ti, Source& sj, Fr
 
                     MultiObjectiveOutlierFilter::ObjectiveBuilder::Own builder =
                         MultiObjectiveOutlierFilter::ObjectiveBuilder::Own(
-                            new PerspectiveObjectiveBuilder(pj, gji, true, outlierRejection.fastMetric, true, stats.objectives[XFORWARD_PROJ_ALIGN])
+                            new PerspectiveObjectiveBuilder(pj, gji, true, outlierRejection.fastMetric, true, pnpMethod, stats.objectives[XFORWARD_PROJ_ALIGN])
                         );
 
                     size_t n = 0;
@@ -1481,7 +1640,7 @@ bool FeatureTracker::operator() (Map& map, Source& si, Frame& ti, Source& sj, Fr
             if (pi)
             {
                 filter->builders.push_back(MultiObjectiveOutlierFilter::ObjectiveBuilder::Own(
-                    new PerspectiveObjectiveBuilder(pi, gj, false, outlierRejection.fastMetric, false, stats.objectives[BACKWARD_PROJ_ALIGN])
+                    new PerspectiveObjectiveBuilder(pi, gj, false, outlierRejection.fastMetric, false, pnpMethod, stats.objectives[BACKWARD_PROJ_ALIGN])
                 ));
 
                 // build extra projective constraints for pi for egomotion refinement
@@ -1492,7 +1651,7 @@ bool FeatureTracker::operator() (Map& map, Source& si, Frame& ti, Source& sj, Fr
 
                     MultiObjectiveOutlierFilter::ObjectiveBuilder::Own builder =
                         MultiObjectiveOutlierFilter::ObjectiveBuilder::Own(
-                            new PerspectiveObjectiveBuilder(pi, gij, false, outlierRejection.fastMetric, true, stats.objectives[XBACKWARD_PROJ_ALIGN])
+                            new PerspectiveObjectiveBuilder(pi, gij, false, outlierRejection.fastMetric, true, pnpMethod, stats.objectives[XBACKWARD_PROJ_ALIGN])
                         );
 
                     size_t n = 0;
@@ -1572,10 +1731,21 @@ bool FeatureTracker::operator() (Map& map, Source& si, Frame& ti, Source& sj, Fr
 
         if (outlierRejection.model & EPIPOLAR_ALIGN)
         {
+#ifndef WITH_FIVEPOINTS
+            if (outlierRejection.fivePoint)
+            {
+                E_WARNING << "five-point solver not built, rebuild with WITH_FIVEPOINTS to use it";
+                E_WARNING << "epipolar alignment falls back to the eight-point solver";
+
+                outlierRejection.fivePoint = false;
+            }
+#endif
             if (pi && pj)
             {
                 filter->builders.push_back(MultiObjectiveOutlierFilter::ObjectiveBuilder::Own(
-                    new EpipolarObjectiveBuilder(pi, pj, outlierRejection.epipolarEps, stats.objectives[EPIPOLAR_ALIGN])
+                    new EpipolarObjectiveBuilder(pi, pj, outlierRejection.epipolarEps,
+                        outlierRejection.fivePoint ? EssentialMatrixDecomposer::FIVE_POINT : EssentialMatrixDecomposer::EIGHT_POINT,
+                        stats.objectives[EPIPOLAR_ALIGN])
                 ));
             }
             else
@@ -1590,7 +1760,28 @@ bool FeatureTracker::operator() (Map& map, Source& si, Frame& ti, Source& sj, Fr
         matcher.GetFilters().push_back(FeatureMatcher::Filter::Own(filter));
     }
 
-    ImageFeatureMap fmap = matcher(fi, fj);
+    // predict where the features reappear for guided matching
+    PoseEstimator::Estimate prior;
+
+    if (ti == tj)
+    {
+        prior.pose  = EuclideanTransform::Identity;
+        prior.valid = true;
+    }
+    else if (mi.valid && mj.valid)
+    {
+        prior.pose  = mi.pose.GetInverse() >> mj.pose;
+        prior.valid = true;
+    }
+    else
+    {
+        prior = lastMotion;
+    }
+
+    const bool guided = guidedMatching.radius > 0 && prior.valid && pj && !gi.structure.IsEmpty();
+    ImageFeatureMap fmap = guided ?
+        matcher(fi, fj, PredictFeatureLocations(gi, *pj, prior.pose, fi.GetSize()), static_cast<float>(guidedMatching.radius)) :
+        matcher(fi, fj);
 
     // dispose the outlier filter and apply the solved egomotion whenever useful
     if (outlierRejection.model)
@@ -2013,7 +2204,7 @@ bool FeatureTracker::PerspectiveObjectiveBuilder::Build(GeometricMapping& data,
 
 PoseEstimator::Own FeatureTracker::PerspectiveObjectiveBuilder::GetSolver() const
 {
-    PoseEstimator::Own estimator = PoseEstimator::Own(new PerspevtivePoseEstimator(p));
+    PoseEstimator::Own estimator = PoseEstimator::Own(new PerspevtivePoseEstimator(p, method));
     return forward ? estimator : PoseEstimator::Own(new InversePoseEstimator(estimator));
 }
 
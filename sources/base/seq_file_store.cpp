@@ -0,0 +1,330 @@
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <seq2map/seq_file_store.hpp>
+
+using namespace seq2map;
+
+namespace ipc = boost::interprocess;
+
+//==[ PackedFileContainer ]===================================================//
+
+const seq2map::String PackedFileContainer::s_magicNumber = "S2MPACK1";
+const size_t PackedFileContainer::Alignment;
+
+bool PackedFileContainer::Create(const Path& path)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+
+    if (m_stream.is_open())
+    {
+        m_stream.close();
+    }
+
+    m_stream.open(path.string().c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (!m_stream.is_open())
+    {
+        E_ERROR << "error opening output stream to " << path;
+        return false;
+    }
+
+    // the magic number padded to the first aligned position
+    std::vector<char> header(Alignment, 0);
+    std::copy(s_magicNumber.begin(), s_magicNumber.end(), header.begin());
+
+    m_stream.write(&header[0], header.size());
+
+    m_path    = path;
+    m_dataEnd = header.size();
+    m_dirty   = true;
+    m_mapped  = MemoryBlock();
+    m_mappedEnd = 0;
+    m_items.clear();
+
+    return WriteIndex();
+}
+
+bool PackedFileContainer::Open(const Path& path)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+
+    if (m_stream.is_open())
+    {
+        m_stream.close();
+    }
+
+    m_path  = path;
+    m_dirty = false;
+    m_items.clear();
+
+    if (!Map())
+    {
+        return false;
+    }
+
+    const size_t magicBytes   = s_magicNumber.size();
+    const size_t trailerBytes = sizeof(boost::uint64_t) * 2 + magicBytes;
+
+    if (m_mapped.size < Alignment + trailerBytes ||
+        !std::equal(s_magicNumber.begin(), s_magicNumber.end(), m_mapped.data))
+    {
+        E_ERROR << "magic number not found in " << path;
+        return false;
+    }
+
+    const uchar* trailer = m_mapped.data + m_mapped.size - trailerBytes;
+    boost::uint64_t tableOffset, items;
+
+    memcpy(&tableOffset, trailer,                           sizeof tableOffset);
+    memcpy(&items,       trailer + sizeof(boost::uint64_t), sizeof items);
+
+    if (!std::equal(s_magicNumber.begin(), s_magicNumber.end(), trailer + sizeof(boost::uint64_t) * 2) ||
+        tableOffset + items * sizeof(Entry) + trailerBytes > m_mapped.size)
+    {
+        E_ERROR << "corrupted offset table in " << path;
+        return false;
+    }
+
+    m_items.resize(static_cast<size_t>(items));
+
+    if (items > 0)
+    {
+        memcpy(&m_items[0], m_mapped.data + tableOffset, items * sizeof(Entry));
+    }
+
+    BOOST_FOREACH (const Entry& item, m_items)
+    {
+        if (item.offset + item.bytes > tableOffset)
+        {
+            E_ERROR << "item out of bound in " << path;
+            m_items.clear();
+
+            return false;
+        }
+    }
+
+    m_dataEnd   = tableOffset;
+    m_mappedEnd = tableOffset;
+
+    return true;
+}
+
+bool PackedFileContainer::Append(const String& bytes)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+
+    if (!m_stream.is_open())
+    {
+        if (m_path.empty())
+        {
+            E_ERROR << "container not created";
+            return false;
+        }
+
+        m_stream.open(m_path.string().c_str(), std::ios::in | std::ios::out | std::ios::binary);
+
+        if (!m_stream.is_open())
+        {
+            E_ERROR << "error opening output stream to " << m_path;
+            return false;
+        }
+    }
+
+    // pad the item to keep the next one aligned
+    const size_t padding = (Alignment - bytes.size() % Alignment) % Alignment;
+    const std::vector<char> zeros(padding, 0);
+
+    m_stream.seekp(static_cast<std::streamoff>(m_dataEnd));
+    m_stream.write(bytes.data(), bytes.size());
+
+    if (padding > 0)
+    {
+        m_stream.write(&zeros[0], padding);
+    }
+
+    if (!m_stream.good())
+    {
+        E_ERROR << "error writing to " << m_path;
+        return false;
+    }
+
+    Entry item;
+    item.offset = m_dataEnd;
+    item.bytes  = bytes.size();
+
+    m_items.push_back(item);
+    m_dataEnd += bytes.size() + padding;
+    m_dirty = true;
+
+    return true;
+}
+
+bool PackedFileContainer::Commit()
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    return WriteIndex();
+}
+
+MemoryBlock PackedFileContainer::GetItem(size_t idx)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+
+    if (idx >= m_items.size())
+    {
+        return MemoryBlock();
+    }
+
+    const Entry& item = m_items[idx];
+
+    // remap the file when it has grown since last mapping
+    if (item.offset + item.bytes > m_mappedEnd)
+    {
+        if (!WriteIndex() || !Map())
+        {
+            return MemoryBlock();
+        }
+    }
+
+    return MemoryBlock(m_mapped.data + item.offset, static_cast<size_t>(item.bytes), m_mapped.owner);
+}
+
+bool PackedFileContainer::WriteIndex()
+{
+    if (!m_dirty)
+    {
+        return true;
+    }
+
+    if (!m_stream.is_open())
+    {
+        E_ERROR << "container not opened for writing";
+        return false;
+    }
+
+    // the table is always written after the last item, overwriting the
+    // previous one, and the file never shrinks as the table only grows
+    const boost::uint64_t tableOffset = m_dataEnd;
+    const boost::uint64_t items = m_items.size();
+
+    m_stream.seekp(static_cast<std::streamoff>(tableOffset));
+
+    if (!m_items.empty())
+    {
+        m_stream.write((char*)&m_items[0], m_items.size() * sizeof(Entry));
+    }
+
+    m_stream.write((char*)&tableOffset, sizeof tableOffset);
+    m_stream.write((char*)&items,       sizeof items);
+    m_stream.write(s_magicNumber.data(), s_magicNumber.size());
+    m_stream.flush();
+
+    if (!m_stream.good())
+    {
+        E_ERROR << "error writing offset table to " << m_path;
+        return false;
+    }
+
+    m_dirty = false;
+
+    return true;
+}
+
+bool PackedFileContainer::Map()
+{
+    try
+    {
+        // the pages are mapped privately so a stray write to an item wrapped
+        // in place lands in a copy instead of faulting or reaching the file
+        ipc::file_mapping file(m_path.string().c_str(), ipc::read_only);
+        boost::shared_ptr<ipc::mapped_region> region(new ipc::mapped_region(file, ipc::copy_on_write));
+
+        m_mapped    = MemoryBlock(static_cast<const uchar*>(region->get_address()), region->get_size(), region);
+        m_mappedEnd = m_dataEnd;
+    }
+    catch (std::exception& ex)
+    {
+        E_ERROR << "error mapping " << m_path;
+        E_ERROR << ex.what();
+
+        m_mapped    = MemoryBlock();
+        m_mappedEnd = 0;
+
+        return false;
+    }
+
+    return true;
+}
+
+//==[ ItemCache ]=============================================================//
+
+size_t ItemCache::Register()
+{
+    boost::lock_guard<boost::mutex> locker(m_mtx);
+    return m_stores++;
+}
+
+ItemCache::Item ItemCache::Find(const Key& key)
+{
+    boost::lock_guard<boost::mutex> locker(m_mtx);
+    Index::iterator itr = m_index.find(key);
+
+    if (itr == m_index.end())
+    {
+        m_misses++;
+        return Item();
+    }
+
+    m_hits++;
+    m_entries.splice(m_entries.begin(), m_entries, itr->second);
+
+    return itr->second->item;
+}
+
+void ItemCache::Insert(const Key& key, const Item& item, size_t bytes)
+{
+    boost::lock_guard<boost::mutex> locker(m_mtx);
+
+    if (bytes > m_capacity)
+    {
+        return;
+    }
+
+    Index::iterator itr = m_index.find(key);
+
+    if (itr != m_index.end())
+    {
+        m_bytes -= itr->second->bytes;
+        m_entries.erase(itr->second);
+        m_index.erase(itr);
+    }
+
+    while (m_bytes + bytes > m_capacity && !m_entries.empty())
+    {
+        const Entry& lru = m_entries.back();
+
+        m_bytes -= lru.bytes;
+        m_index.erase(lru.key);
+        m_entries.pop_back();
+    }
+
+    Entry entry;
+    entry.key   = key;
+    entry.item  = item;
+    entry.bytes = bytes;
+
+    m_entries.push_front(entry);
+    m_index[key] = m_entries.begin();
+    m_bytes += bytes;
+}
+
+void ItemCache::Clear()
+{
+    boost::lock_guard<boost::mutex> locker(m_mtx);
+
+    m_entries.clear();
+    m_index.clear();
+
+    m_bytes  = 0;
+    m_hits   = 0;
+    m_misses = 0;
+}
@@ -1,3 +1,4 @@
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/make_shared.hpp>
@@ -106,6 +107,64 @@ bool Sensor::Restore(const cv::FileNode& fn)
     return m_extrinsics.Restore(fn["extrinsics"]);
 }
 
+//==[ PersistentImage ]=======================================================//
+
+const String PersistentImage::s_rawMagicNumber = "S2MRAW01";
+
+bool PersistentImage::Store(std::ostream& os) const
+{
+    if (im.empty())
+    {
+        E_ERROR << "empty image";
+        return false;
+    }
+
+    const cv::Mat plane = im.isContinuous() ? im : im.clone();
+    const size_t headerBytes = PackedFileContainer::Alignment;
+
+    RawHeader header;
+    std::copy(s_rawMagicNumber.begin(), s_rawMagicNumber.end(), header.magic);
+    header.rows   = plane.rows;
+    header.cols   = plane.cols;
+    header.type   = plane.type();
+    header.stride = static_cast<int>(plane.cols * plane.elemSize());
+
+    std::vector<char> padded(headerBytes, 0);
+    memcpy(&padded[0], &header, sizeof header);
+
+    os.write(&padded[0], padded.size());
+    os.write((char*)plane.data, plane.total() * plane.elemSize());
+
+    return os.good();
+}
+
+bool PersistentImage::Restore(const MemoryBlock& blk)
+{
+    const size_t headerBytes = PackedFileContainer::Alignment;
+
+    if (blk.size < headerBytes || !std::equal(s_rawMagicNumber.begin(), s_rawMagicNumber.end(), blk.data))
+    {
+        E_ERROR << "raw image header not found";
+        return false;
+    }
+
+    RawHeader header;
+    memcpy(&header, blk.data, sizeof header);
+
+    if (header.rows < 0 || header.cols < 0 ||
+        static_cast<size_t>(header.stride) != header.cols * CV_ELEM_SIZE(header.type) ||
+        headerBytes + static_cast<size_t>(header.rows) * header.stride > blk.size)
+    {
+        E_ERROR << "ill-formed raw image of " << header.rows << "x" << header.cols << " (type=" << header.type << ")";
+        return false;
+    }
+
+    const cv::Mat plane(header.rows, header.cols, header.type, const_cast<uchar*>(blk.data + headerBytes), header.stride);
+    plane.copyTo(im);
+
+    return true;
+}
+
 //==[ FeatureStore ]==========================================================//
 
 bool FeatureStore::Create(const Path& root, Camera::ConstOwn& camera, FeatureDetextractor::Own& dxtor)
@@ -219,6 +278,8 @@ bool DisparityStore::Store(cv::FileStorage& fs) const
     }
     fs << "}";
 
+    fs << "codec" << Codec2String(m_codec);
+
     if (!m_matcher) // no stereo matcher available?
     {
         return true;
@@ -253,6 +314,19 @@ bool DisparityStore::Restore(const cv::FileNode& fn)
 
         UpdateMappings();
 
+        String codec;
+        fn["codec"] >> codec;
+
+        if (codec.empty())
+        {
+            m_codec = PNG16U; // stores created before the codec was introduced
+        }
+        else if (!String2Codec(codec, m_codec))
+        {
+            E_ERROR << "unknown disparity codec \"" << codec << "\"";
+            return false;
+        }
+
         cv::FileNode matcherNode = fn["matcher"];
 
         if (matcherNode.empty())
@@ -288,39 +362,139 @@ bool DisparityStore::Restore(const cv::FileNode& fn)
 
 bool DisparityStore::Append(Path& to, const PersistentImage& data) const
 {
-    cv::Mat dpm32F = data.im;
-    cv::Mat dpm16U;
+    std::vector<uchar> buf;
+
+    // the image format follows the extension of the file as cv::imwrite does
+    if (!EncodeMap(data.im, buf, to.has_extension() ? to.extension().string() : ".png"))
+    {
+        return false;
+    }
+
+    std::ofstream os(to.string().c_str(), std::ios::out | std::ios::binary);
+
+    if (!os.is_open())
+    {
+        E_ERROR << "error opening output stream to " << to;
+        return false;
+    }
+
+    os.write((char*)&buf[0], buf.size());
+
+    return os.good();
+}
+
+bool DisparityStore::Retrieve(const Path& from, PersistentImage& data) const
+{
+    std::ifstream is(from.string().c_str(), std::ios::in | std::ios::binary);
+
+    if (!is.is_open())
+    {
+        E_ERROR << "error reading " << from;
+        return false;
+    }
+
+    std::vector<uchar> buf(static_cast<size_t>(filesize(from)));
+
+    if (buf.empty() || !is.read((char*)&buf[0], buf.size()))
+    {
+        E_ERROR << "error reading " << from;
+        return false;
+    }
+
+    if (!DecodeMap(&buf[0], buf.size(), data.im))
+    {
+        E_ERROR << "error decoding " << from;
+        return false;
+    }
+
+    return true;
+}
+
+bool DisparityStore::Append(std::ostream& os, const PersistentImage& data) const
+{
+    std::vector<uchar> buf;
+
+    if (!EncodeMap(data.im, buf))
+    {
+        return false;
+    }
+
+    os.write((char*)&buf[0], buf.size());
+
+    return os.good();
+}
+
+bool DisparityStore::Retrieve(const MemoryBlock& blk, PersistentImage& data) const
+{
+    return !blk.IsEmpty() && DecodeMap(blk.data, blk.size, data.im);
+}
+
+String DisparityStore::Codec2String(Codec codec)
+{
+    switch (codec)
+    {
+    case PNG16U: return "PNG16U";
+    case RLE16U: return "RLE16U";
+    }
+
+    return "UNKNOWN";
+}
+
+bool DisparityStore::String2Codec(const String& name, Codec& codec)
+{
+    if      (boost::iequals(name, "PNG16U")) codec = PNG16U;
+    else if (boost::iequals(name, "RLE16U")) codec = RLE16U;
+    else return false;
 
+    return true;
+}
+
+bool DisparityStore::EncodeMap(const cv::Mat& dpm32F, std::vector<uchar>& buf, const String& ext) const
+{
     if (dpm32F.type() != CV_32F)
     {
         E_ERROR << "given matrix is not a single precision disparity map";
         return false;
     }
 
+    if (m_codec == RLE16U)
+    {
+        return DisparityCodec::Encode(dpm32F, m_dspaceTo16U.alpha, m_dspaceTo16U.beta, buf);
+    }
+
     // linearily remap the disparity map to a 16U image
+    cv::Mat dpm16U;
     dpm32F.convertTo(dpm16U, CV_16U, m_dspaceTo16U.alpha, m_dspaceTo16U.beta);
 
-    return cv::imwrite(to.string(), dpm16U);
+    return cv::imencode(ext, dpm16U, buf);
 }
 
-bool DisparityStore::Retrieve(const Path& from, PersistentImage& data) const
+bool DisparityStore::DecodeMap(const uchar* data, size_t size, cv::Mat& dpm32F) const
 {
-    cv::Mat dpm16U = cv::imread(from.string(), cv::IMREAD_UNCHANGED);
+    // the stream is identified by its content so a store can be read
+    // regardless of the codec it is currently set to write
+    if (DisparityCodec::IsEncoded(data, size))
+    {
+        return DisparityCodec::Decode(data, size, dpm32F);
+    }
+
+    const cv::Mat buf(1, static_cast<int>(size), CV_8U, const_cast<uchar*>(data));
+    const cv::Mat dpm16U = cv::imdecode(buf, cv::IMREAD_UNCHANGED);
 
     if (dpm16U.empty())
     {
-        E_ERROR << "error reading " << from;
+        E_ERROR << "error decoding image";
         return false;
     }
 
     if (dpm16U.type() != CV_16U)
     {
-        E_ERROR << "not a 16-bit single channel disparity image: " << from;
+        E_ERROR << "not a 16-bit single channel disparity image";
         return false;
     }
 
     // linearily remap the 16U image to a float disparity image
-    dpm16U.convertTo(data.im, CV_32F, m_dspaceTo32F.alpha, m_dspaceTo32F.beta);
+    dpm16U.convertTo(dpm32F, CV_32F, m_dspaceTo32F.alpha, m_dspaceTo32F.beta);
 
     return true;
 }
@@ -759,6 +933,35 @@ RectifiedStereo::ConstOwn Sequence::GetStereoPair(size_t priCamIdx, size_t secCa
     return RectifiedStereo::ConstOwn();
 }
 
+bool Sequence::SetImageStore(size_t camIdx, const Path& index)
+{
+    Camera::Map::iterator itr = m_cameras.find(camIdx);
+
+    if (itr == m_cameras.end() || !itr->second)
+    {
+        E_ERROR << "missing camera " << camIdx;
+        return false;
+    }
+
+    Camera& cam = *itr->second;
+    ImageStore store;
+
+    if (!store.Restore(index))
+    {
+        E_ERROR << "error restoring image store from " << index;
+        return false;
+    }
+
+    // the frames are referred to by index by the other stores of the sequence
+    if (cam.GetFrames() > 0 && store.GetItems() != cam.GetFrames())
+    {
+        E_ERROR << "the number of images " << store.GetItems() << " does not agree with the frames " << cam.GetFrames() << " of camera " << camIdx;
+        return false;
+    }
+
+    return cam.GetImageStore().Restore(index);
+}
+
 bool Sequence::Store(Path& path) const
 {
     if (dirExists(path))
@@ -0,0 +1,243 @@
+#include <boost/bind.hpp>
+#include <seq2map/thread_pool.hpp>
+
+using namespace seq2map;
+
+//==[ ThreadPool::TaskGroup ]=================================================//
+
+void ThreadPool::TaskGroup::Run(const Task& task)
+{
+    {
+        boost::lock_guard<boost::mutex> locker(m_mtx);
+        m_pending++;
+    }
+
+    m_pool.Submit(boost::bind(&TaskGroup::Execute, this, task));
+}
+
+void ThreadPool::TaskGroup::Wait()
+{
+    for (;;)
+    {
+        {
+            boost::lock_guard<boost::mutex> locker(m_mtx);
+
+            if (m_pending == 0)
+            {
+                return;
+            }
+        }
+
+        if (m_pool.RunPendingTask())
+        {
+            continue;
+        }
+
+        // the remaining tasks are all running on the other threads
+        boost::unique_lock<boost::mutex> locker(m_mtx);
+
+        while (m_pending > 0)
+        {
+            m_done.wait(locker);
+        }
+    }
+}
+
+void ThreadPool::TaskGroup::Execute(const Task& task)
+{
+    try
+    {
+        task();
+    }
+    catch (std::exception& ex)
+    {
+        E_ERROR << "exception caught in task: " << ex.what();
+    }
+
+    boost::lock_guard<boost::mutex> locker(m_mtx);
+
+    if (--m_pending == 0)
+    {
+        m_done.notify_all();
+    }
+}
+
+//==[ ThreadPool ]============================================================//
+
+void ThreadPool::SetThreads(size_t threads)
+{
+    if (threads == 0)
+    {
+        threads = std::max<size_t>(boost::thread::hardware_concurrency(), 1);
+    }
+
+    if (threads == GetThreads())
+    {
+        return;
+    }
+
+    while (RunPendingTask()) {}
+
+    Stop();
+
+    {
+        boost::lock_guard<boost::mutex> locker(m_mtx);
+
+        m_stop   = false;
+        m_next   = 0;
+        m_queued = 0;
+        m_queues.clear();
+
+        for (size_t i = 0; i < threads; i++)
+        {
+            m_queues.push_back(QueuePtr(new Queue()));
+        }
+    }
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        m_workers.push_back(WorkerPtr(new boost::thread(boost::bind(&ThreadPool::Worker, this, i))));
+    }
+}
+
+size_t ThreadPool::GetThreads() const
+{
+    boost::lock_guard<boost::mutex> locker(m_mtx);
+    return m_queues.size();
+}
+
+void ThreadPool::Submit(const Task& task)
+{
+    if (m_queues.empty())
+    {
+        task();
+        return;
+    }
+
+    // a worker keeps the tasks it spawns, others spread them round-robin
+    const size_t* worker = m_workerIdx.get();
+    size_t idx;
+
+    if (worker)
+    {
+        idx = *worker;
+    }
+    else
+    {
+        boost::lock_guard<boost::mutex> locker(m_mtx);
+        idx = m_next++ % m_queues.size();
+    }
+
+    {
+        Queue& q = *m_queues[idx];
+        boost::lock_guard<boost::mutex> locker(q.mtx);
+
+        q.tasks.push_back(task);
+    }
+
+    boost::lock_guard<boost::mutex> locker(m_mtx);
+
+    m_queued++;
+    m_wake.notify_one();
+}
+
+bool ThreadPool::Take(Task& task)
+{
+    const size_t n = m_queues.size();
+    const size_t* worker = m_workerIdx.get();
+    bool found = false;
+
+    // the most recent task of the own queue first
+    if (worker)
+    {
+        Queue& q = *m_queues[*worker];
+        boost::lock_guard<boost::mutex> locker(q.mtx);
+
+        if (!q.tasks.empty())
+        {
+            task = q.tasks.back();
+            q.tasks.pop_back();
+            found = true;
+        }
+    }
+
+    // then the oldest task of the others
+    for (size_t k = 0; !found && k < n; k++)
+    {
+        const size_t idx = ((worker ? *worker : 0) + k + 1) % n;
+
+        Queue& q = *m_queues[idx];
+        boost::lock_guard<boost::mutex> locker(q.mtx);
+
+        if (!q.tasks.empty())
+        {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+            found = true;
+        }
+    }
+
+    if (found)
+    {
+        boost::lock_guard<boost::mutex> locker(m_mtx);
+        m_queued--;
+    }
+
+    return found;
+}
+
+bool ThreadPool::RunPendingTask()
+{
+    Task task;
+
+    if (!Take(task))
+    {
+        return false;
+    }
+
+    task();
+
+    return true;
+}
+
+void ThreadPool::Worker(size_t idx)
+{
+    m_workerIdx.reset(new size_t(idx));
+
+    for (;;)
+    {
+        if (RunPendingTask())
+        {
+            continue;
+        }
+
+        boost::unique_lock<boost::mutex> locker(m_mtx);
+
+        if (m_stop)
+        {
+            break;
+        }
+
+        if (m_queued == 0)
+        {
+            m_wake.wait(locker);
+        }
+    }
+}
+
+void ThreadPool::Stop()
+{
+    {
+        boost::lock_guard<boost::mutex> locker(m_mtx);
+
+        m_stop = true;
+        m_wake.notify_all();
+    }
+
+    BOOST_FOREACH (const WorkerPtr& worker, m_workers)
+    {
+        worker->join();
+    }
+
+    m_workers.clear();
+}
@@ -0,0 +1,13 @@
+// Builds Ematrix_5pt.cc of 3rdparties/fivepoints with its symbols kept in namespace
+// fivepoints. The solver is licensed under GPL-3 or a commercial licence from
+// NICTA; see the header of the wrapped source and WITH_FIVEPOINTS in CMake.
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+namespace fivepoints
+{
+#include "../../3rdparties/fivepoints/Ematrix_5pt.cc"
+}
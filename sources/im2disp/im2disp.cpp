@@ -1,4 +1,5 @@
 #include <seq2map/app.hpp>
+#include <seq2map/pipeline.hpp>
 #include <seq2map/sequence.hpp>
 
 using namespace seq2map;
@@ -17,15 +18,42 @@ protected:
     virtual bool Execute();
 
 private:
+    /**
+     * A disparity map encoded by a worker, waiting to be appended to the
+     * disparity store in order.
+     */
+    struct Encoded
+    {
+        enum State { SKIPPED, ENCODED, FAILED };
+
+        Encoded() : state(SKIPPED), pixels(0), secs(0) {}
+
+        State  state;
+        String filename;
+        String bytes;
+        String reason;
+        size_t pixels;
+        double secs; ///< time spent on stereo matching
+    };
+
+    StereoMatcher::Own CloneMatcher() const;
+    String GetOutputFileName(size_t idx) const;
+
+    bool ProcessSerially(Speedometre& metre, size_t& frames);
+    bool ProcessParallelly(Speedometre& metre, size_t& frames);
+    void MatchWorker(ReorderBuffer<Encoded>& ordered, StereoMatcher::Own matcher);
+
     String m_priPath;
     String m_secPath;
     String m_outPath;
     String m_matcherName;
     String m_geometry;
     String m_extension;
+    String m_codec;
     String m_index;
     int    m_priCamIdx;
     int    m_secCamIdx;
+    int    m_threads;
     StereoMatcherFactory::BasePtr m_matcher;
     ImageStore     m_priImageStore;
     ImageStore     m_secImageStore;
@@ -76,7 +104,9 @@ void MyApp::SetOptions(Options& o, Options& h, Positional& p)
         ("pri",       po::value<int>   (&m_priCamIdx  )->default_value(         -1), "Index of the primary camera for IN-SEQ mode.")
         ("sec",       po::value<int>   (&m_secCamIdx  )->default_value(         -1), "Index of the secondary camera for IN-SEQ mode.")
     //  ("geometry",  po::value<String>(&m_geometry   )->default_value(       "LR"), "Configuration of stereo cameras. This option is automatically determined for IN-SEQ mode.")
-        ("ext,e",     po::value<String>(&m_extension  )->default_value(     ".png"), "The extension name of the output disparity files. Must be a valid image extension supported by OpenCV.")
+        ("ext,e",     po::value<String>(&m_extension  )->default_value(     ".png"), "The extension name of the output disparity files. Must be a valid image extension supported by OpenCV when PNG16U codec is used.")
+        ("threads,t", po::value<int>   (&m_threads    )->default_value(          1), "Number of frames matched in parallel. Each thread uses its own stereo matcher created with the same parameters. Set to zero to use one thread per hardware core.")
+        ("codec",     po::value<String>(&m_codec      )->default_value(   "PNG16U"), "Encoding of the output disparity files, must be one of PNG16U, RLE16U. Files are written with the \".dpm\" extension when RLE16U is used with the default extension.")
         ("cam,c",     po::value<String>(&m_index      )->default_value("index.yml"), "Path to where the index of generated feature files to be written. Set to empty to disable index generation. This option is ignored for IN-SEQ mode.");
 
     // three positional arguments - input and output directories
@@ -217,6 +247,31 @@ bool MyApp::Init()
     }
 
     Path outPath = Path(m_outPath);
+    DisparityStore::Codec codec;
+
+    if (!DisparityStore::String2Codec(m_codec, codec))
+    {
+        E_ERROR << "unknown disparity codec \"" << m_codec << "\"";
+        return false;
+    }
+
+    if (codec == DisparityStore::RLE16U && m_extension == ".png")
+    {
+        m_extension = ".dpm";
+    }
+
+    m_dispStore.SetCodec(codec);
+
+    if (m_threads == 0)
+    {
+        m_threads = static_cast<int>(boost::thread::hardware_concurrency());
+    }
+
+    if (m_threads < 1)
+    {
+        E_ERROR << "invalid number of threads " << m_threads;
+        return false;
+    }
 
     if (!m_dispStore.Create(m_outPath, pair, StereoMatcher::ConstOwn(m_matcher)))
     {
@@ -240,85 +295,269 @@ bool MyApp::Execute()
         E_INFO << "secondary source: " << fullpath(m_secImageStore.GetRoot());
         E_INFO << "output folder:    " << fullpath(m_dispStore.GetRoot());
 
-        for (size_t i = 0; i < files; i++)
+        if (!(m_threads > 1 ? ProcessParallelly(metre, frames) : ProcessSerially(metre, frames)))
         {
-            Path pri(m_priImageStore.GetItemPath(i));
-            Path sec(m_secImageStore.GetItemPath(i));
-            Path dst(m_dispStore.GetRoot() / m_priImageStore.GetFileNames()[i]);
+            return false;
+        }
 
-            dst.replace_extension(m_extension);
+        if (!m_index.empty())
+        {
+            Path to = m_dispStore.GetRoot() / Path(m_index);
+            cv::FileStorage fs(to.string(), cv::FileStorage::WRITE);
 
-            cv::Mat im0 = m_priImageStore[i].im;
-            cv::Mat im1 = m_secImageStore[i].im;
+            if (!m_dispStore.Store(fs))
+            {
+                E_ERROR << "error storing index to " << to;
+                return false;
+            }
 
-            PersistentImage dp;
+            E_INFO << "index written to " << to;
+        }
+
+        for (size_t i = 0; i < m_dispStore.GetItems(); i++)
+        {
+            bytes += filesize(m_dispStore.GetItemPath(i));
+        }
+
+        E_INFO << "disparity map(s) from " << frames << " frame(s) computed and stored";
+        E_INFO << "file storage:     " << (bytes / 1024.0f / 1024.0f) << " MBytes";
+        E_INFO << "computation time: " << metre.GetElapsedSeconds() << " secs";
+    }
+    catch (std::exception& ex)
+    {
+        E_FATAL << "exception caught in main loop: " << ex.what();
+        return false;
+    }
+
+    return true;
+}
+
+String MyApp::GetOutputFileName(size_t idx) const
+{
+    Path dst(m_priImageStore.GetFileNames()[idx]);
+    dst.replace_extension(m_extension);
+
+    return dst.filename().string();
+}
+
+bool MyApp::ProcessSerially(Speedometre& metre, size_t& frames)
+{
+    for (size_t i = 0; i < m_priImageStore.GetItems(); i++)
+    {
+        Path pri(m_priImageStore.GetItemPath(i));
+        Path sec(m_secImageStore.GetItemPath(i));
+        Path dst(m_dispStore.GetRoot() / GetOutputFileName(i));
+
+        cv::Mat im0 = m_priImageStore[i].im;
+        cv::Mat im1 = m_secImageStore[i].im;
+
+        PersistentImage dp;
+
+        if (im0.empty())
+        {
+            E_INFO << "skipped unreadable primary file " << pri;
+            continue;
+        }
+
+        if (im1.empty())
+        {
+            E_INFO << "skipped unreadable secondary file " << sec;
+            continue;
+        }
+
+        im0 = im0.channels() == 3 ? rgb2gray(im0) : im0;
+        im1 = im1.channels() == 3 ? rgb2gray(im1) : im1;
+
+        metre.Start();
+        dp.im = m_matcher->Match(im0, im1);
+        metre.Stop(dp.im.total());
+
+        if (dp.im.empty())
+        {
+            E_ERROR << "error computing disparity map";
+            continue;
+        }
+
+        if (!m_dispStore.Append(dst.filename().string(), dp))
+        {
+            E_FATAL << "error writing disparity map to " << dst;
+            return false;
+        }
+
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(2) << metre.GetSpeed() << " " << metre.GetUnit();
+
+        frames++;
+
+        E_INFO << "processed " << pri.filename() << " -> " << dst.filename() << " [" << ss.str() << "]";
+    }
+
+    return true;
+}
+
+StereoMatcher::Own MyApp::CloneMatcher() const
+{
+    // round-trip the parameters through an in-memory file storage so the
+    // clone is built by the factory exactly as when restoring a store
+    cv::FileStorage out(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+
+    out << "matcher" << "{";
+    bool stored = m_matcher->Store(out);
+    out << "}";
 
-            if (im0.empty())
+    if (!stored)
+    {
+        E_ERROR << "error storing stereo matcher parameters";
+        return StereoMatcher::Own();
+    }
+
+    cv::FileStorage in(out.releaseAndGetString(), cv::FileStorage::READ | cv::FileStorage::MEMORY);
+    StereoMatcher::Own matcher = StereoMatcherFactory::GetInstance().Create(in["matcher"]);
+
+    if (matcher)
+    {
+        matcher->ApplyParams();
+    }
+
+    return matcher;
+}
+
+bool MyApp::ProcessParallelly(Speedometre& metre, size_t& frames)
+{
+    const size_t threads = static_cast<size_t>(m_threads);
+
+    ReorderBuffer<Encoded> ordered(m_priImageStore.GetItems(), 2 * threads);
+    boost::thread_group workers;
+
+    for (size_t k = 0; k < threads; k++)
+    {
+        StereoMatcher::Own matcher = k > 0 ? CloneMatcher() : m_matcher;
+
+        if (!matcher)
+        {
+            E_ERROR << "error creating stereo matcher for thread " << k;
+            ordered.Abort();
+            workers.join_all();
+
+            return false;
+        }
+
+        workers.create_thread(boost::bind(&MyApp::MatchWorker, this, boost::ref(ordered), matcher));
+    }
+
+    E_INFO << threads << " frame(s) are matched in parallel";
+
+    // the disparity maps are appended to the store in the original order
+    Encoded item;
+    bool okay = true;
+
+    metre.Start();
+
+    for (size_t i = 0; okay && ordered.Get(item); i++)
+    {
+        const Path pri(m_priImageStore.GetItemPath(i));
+
+        switch (item.state)
+        {
+        case Encoded::SKIPPED:
+            E_INFO << "skipped " << item.reason;
+            continue;
+
+        case Encoded::FAILED:
+            E_FATAL << "error processing " << pri << ", " << item.reason;
+            okay = false;
+            continue;
+
+        case Encoded::ENCODED:
+            if (!m_dispStore.AppendEncoded(item.filename, item.bytes))
             {
-                E_INFO << "skipped unreadable primary file " << pri;
+                E_FATAL << "error writing disparity map to " << item.filename;
+                okay = false;
                 continue;
             }
+        }
+
+        metre.Update(item.pixels);
+
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(2) << metre.GetSpeed() << " " << metre.GetUnit() << ", ";
+        ss << std::fixed << std::setprecision(0) << (item.secs * 1000.0f) << " ms/frame";
+
+        frames++;
+
+        E_INFO << "processed " << pri.filename() << " -> " << item.filename << " [" << ss.str() << "]";
+    }
+
+    if (!okay)
+    {
+        ordered.Abort();
+    }
+
+    workers.join_all();
+    metre.Stop(0);
+
+    return okay;
+}
 
-            if (im1.empty())
+void MyApp::MatchWorker(ReorderBuffer<Encoded>& ordered, StereoMatcher::Own matcher)
+{
+    size_t idx;
+
+    while (ordered.Next(idx))
+    {
+        Encoded item;
+
+        try
+        {
+            cv::Mat im0 = m_priImageStore[idx].im;
+            cv::Mat im1 = m_secImageStore[idx].im;
+
+            if (im0.empty() || im1.empty())
             {
-                E_INFO << "skipped unreadable secondary file " << sec;
+                item.reason = "unreadable " + (im0.empty() ? m_priImageStore : m_secImageStore).GetItemPath(idx).string();
+                ordered.Put(idx, item);
+
                 continue;
             }
 
             im0 = im0.channels() == 3 ? rgb2gray(im0) : im0;
             im1 = im1.channels() == 3 ? rgb2gray(im1) : im1;
 
+            Speedometre metre;
+            PersistentImage dp;
+
             metre.Start();
-            dp.im = m_matcher->Match(im0, im1);
+            dp.im = matcher->Match(im0, im1);
             metre.Stop(dp.im.total());
 
+            item.filename = GetOutputFileName(idx);
+            item.pixels   = dp.im.total();
+            item.secs     = metre.GetElapsedSeconds();
+
             if (dp.im.empty())
             {
-                E_ERROR << "error computing disparity map";
-                continue;
+                item.reason = "error computing disparity map for " + item.filename;
             }
-
-            if (!m_dispStore.Append(dst.filename().string(), dp))
+            else if (!m_dispStore.Encode(item.filename, dp, item.bytes))
             {
-                E_FATAL << "error writing disparity map to " << dst;
-                return false;
+                item.state  = Encoded::FAILED;
+                item.reason = "error encoding " + item.filename;
             }
-
-            std::stringstream ss;
-            ss << std::fixed << std::setprecision(2) << metre.GetSpeed() << " " << metre.GetUnit();
-
-            frames++;
-            bytes += filesize(dst);
-
-            E_INFO << "processed " << pri.filename() << " -> " << dst.filename() << " [" << ss.str() << "]";
-        }
-
-        if (!m_index.empty())
-        {
-            Path to = m_dispStore.GetRoot() / Path(m_index);
-            cv::FileStorage fs(to.string(), cv::FileStorage::WRITE);
-
-            if (!m_dispStore.Store(fs))
+            else
             {
-                E_ERROR << "error storing index to " << to;
-                return false;
+                item.state = Encoded::ENCODED;
             }
-
-            E_INFO << "index written to " << to;
+        }
+        catch (std::exception& ex)
+        {
+            item.state  = Encoded::FAILED;
+            item.reason = ex.what();
         }
 
-        E_INFO << "disparity map(s) from " << frames << " frame(s) computed and stored";
-        E_INFO << "file storage:     " << (bytes / 1024.0f / 1024.0f) << " MBytes";
-        E_INFO << "computation time: " << metre.GetElapsedSeconds() << " secs";
-    }
-    catch (std::exception& ex)
-    {
-        E_FATAL << "exception caught in main loop: " << ex.what();
-        return false;
+        ordered.Put(idx, item);
     }
-
-    return true;
 }
+
 /*
 class OpA : public ChainedOp<int>
 {
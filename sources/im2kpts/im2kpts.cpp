@@ -1,5 +1,6 @@
 #include <iomanip>
 #include <seq2map/app.hpp>
+#include <seq2map/pipeline.hpp>
 #include <seq2map/sequence.hpp>
 
 using namespace seq2map;
@@ -18,6 +19,62 @@ protected:
     virtual bool Execute();
 
 private:
+    /**
+     * A frame passed from the reading stage to the detection stage.
+     */
+    struct Decoded
+    {
+        size_t  idx;
+        cv::Mat im;
+    };
+
+    /**
+     * Features passed from the detection stage to the encoding stage.
+     */
+    struct Extracted
+    {
+        size_t idx;
+        size_t pixels;
+        bool   okay;
+        ImageFeatureSet features;
+    };
+
+    /**
+     * An encoded item waiting to be appended to the feature store in order.
+     */
+    struct Encoded
+    {
+        enum State { SKIPPED, ENCODED, FAILED };
+
+        Encoded() : state(SKIPPED), pixels(0), features(0) {}
+
+        State  state;
+        String filename;
+        String bytes;
+        size_t pixels;
+        size_t features;
+    };
+
+    struct Pipeline
+    {
+        Pipeline(size_t items, size_t window, size_t capacity, size_t decoders, size_t detectors)
+        : ordered(items, window), decoded(capacity, decoders), extracted(capacity, detectors) {}
+
+        ReorderBuffer<Encoded>  ordered;
+        BoundedQueue<Decoded>   decoded;
+        BoundedQueue<Extracted> extracted;
+    };
+
+    FeatureDetextractor::Own CreateDetextractor() const;
+    String GetOutputFileName(size_t idx) const;
+
+    bool ProcessSerially(Speedometre& metre, size_t& frames, size_t& features);
+    bool ProcessPipelined(Speedometre& metre, size_t& frames, size_t& features);
+
+    void DecodeWorker(Pipeline& pipeline);
+    void DetectWorker(Pipeline& pipeline, FeatureDetextractor::Own dxtor);
+    void EncodeWorker(Pipeline& pipeline);
+
     String m_seqPath;
     String m_outPath;
     String m_detector;
@@ -25,7 +82,14 @@ private:
     String m_extension;
     String m_index;
     int    m_camIdx;
-    FeatureDetextractorFactory::BasePtr m_dxtor;    
+    bool   m_pack;
+    bool   m_pipeline;
+    int    m_decoders;
+    int    m_detectors;
+    int    m_encoders;
+    int    m_queueSize;
+    Strings m_dxtorArgs;
+    FeatureDetextractorFactory::BasePtr m_dxtor;
     ImageStore   m_imageStore;
     FeatureStore m_featureStore;
 };
@@ -102,7 +166,13 @@ void MyApp::SetOptions(Options& o, Options& h, Positional& p)
         ("extract,x", po::value<String>(&m_xtractor )->default_value(         ""), xtractorDesc.c_str())
         ("index",     po::value<String>(&m_index    )->default_value("index.yml"), "Path to where the index of generated feature files to be written. Set to empty to disable index generation. This option is ignored for IN-SEQ mode.")
         ("cam,c",     po::value<int>   (&m_camIdx   )->default_value(         -1), "Select camera from a sequence database to enable IN-SEQ mode.")
-        ("ext,e",     po::value<String>(&m_extension)->default_value(     ".dat"), "The extension name of the output feature files.");
+        ("ext,e",     po::value<String>(&m_extension)->default_value(     ".dat"), "The extension name of the output feature files.")
+        ("pack",      po::bool_switch  (&m_pack     )->default_value(      false), "Pack all the features into a single container file instead of writing one file per frame.")
+        ("pipeline",  po::bool_switch  (&m_pipeline )->default_value(      false), "Process frames concurrently in a pipeline of reading, detection-and-extraction and encoding-and-writing stages. The output is identical to that of a serial run.")
+        ("decoders",  po::value<int>   (&m_decoders )->default_value(          2), "Number of image reading threads in pipeline mode.")
+        ("detectors", po::value<int>   (&m_detectors)->default_value(          0), "Number of feature detection and extraction threads in pipeline mode. Set to zero to use one thread per hardware core.")
+        ("encoders",  po::value<int>   (&m_encoders )->default_value(          2), "Number of feature encoding and writing threads in pipeline mode.")
+        ("queue",     po::value<int>   (&m_queueSize)->default_value(         16), "Capacity of the queues between the stages in pipeline mode.");
 
     // two positional arguments - input and output directories
     h.add_options()
@@ -120,27 +190,35 @@ bool MyApp::ProcessUnknownArgs(const Strings& args)
         return false;
     }
 
-    m_detector = m_detector.empty() ? m_xtractor : m_detector;
-    m_dxtor = FeatureDetextractorFactory::GetInstance().Create(m_detector, m_xtractor);
+    m_detector  = m_detector.empty() ? m_xtractor : m_detector;
+    m_dxtorArgs = args;
+    m_dxtor     = CreateDetextractor();
+
+    return m_dxtor.get() != NULL;
+}
+
+FeatureDetextractor::Own MyApp::CreateDetextractor() const
+{
+    FeatureDetextractor::Own dxtor = FeatureDetextractorFactory::GetInstance().Create(m_detector, m_xtractor);
 
-    if (!m_dxtor)
+    if (!dxtor)
     {
         E_FATAL << "error creating feature detector-and-extractor object";
-        return false;
+        return FeatureDetextractor::Own();
     }
 
     // Finally the last mile..
     // parse options for the detector and extractor!
     try
     {
-        Parameterised::Options detectorOptions = m_dxtor->GetOptions(DETECTION_OPTIONS);
-        Parameterised::Options xtractorOptions = m_dxtor->GetOptions(EXTRACTION_OPTIONS);
+        Parameterised::Options detectorOptions = dxtor->GetOptions(DETECTION_OPTIONS);
+        Parameterised::Options xtractorOptions = dxtor->GetOptions(EXTRACTION_OPTIONS);
         Parameterised::Options opts;
 
         opts.add(detectorOptions).add(xtractorOptions);
 
         po::variables_map vm;
-        po::parsed_options parsed = po::command_line_parser(args).options(opts).run();
+        po::parsed_options parsed = po::command_line_parser(m_dxtorArgs).options(opts).run();
 
         // store the parsed values to the detector object's internal data member(s)
         po::store(parsed, vm);
@@ -151,12 +229,12 @@ bool MyApp::ProcessUnknownArgs(const Strings& args)
         E_FATAL << "error parsing feature-specific arguments: " << ex.what();
         std::cout << "Try to use -h with -k and/or -x to see the supported options for specific feature detectior/extractor" << std::endl;
 
-        return false;
+        return FeatureDetextractor::Own();
     }
 
-    m_dxtor->ApplyParams();
+    dxtor->ApplyParams();
 
-    return true;
+    return dxtor;
 }
 
 bool MyApp::Init()
@@ -243,6 +321,33 @@ bool MyApp::Init()
         return false;
     }
 
+    if (m_pack && !m_featureStore.Pack())
+    {
+        E_ERROR << "error packing feature store " << outPath;
+        return false;
+    }
+
+    if (m_pack && m_index.empty())
+    {
+        E_WARNING << "index generation disabled, the packed features will not be accessible from a feature store";
+    }
+
+    if (m_pipeline)
+    {
+        if (m_detectors == 0)
+        {
+            m_detectors = static_cast<int>(boost::thread::hardware_concurrency());
+        }
+
+        if (m_decoders < 1 || m_detectors < 1 || m_encoders < 1 || m_queueSize < 1)
+        {
+            E_ERROR << "invalid pipeline configuration (decoders=" << m_decoders << ", detectors=" << m_detectors << ", encoders=" << m_encoders << ", queue=" << m_queueSize << ")";
+            return false;
+        }
+
+        E_INFO << "pipeline mode selected with " << m_decoders << " reader(s), " << m_detectors << " detector(s) and " << m_encoders << " writer(s)";
+    }
+
     return true;
 }
 
@@ -260,42 +365,9 @@ bool MyApp::Execute()
         E_INFO << "source folder set to " << fullpath(srcStore.GetRoot());
         E_INFO << "output folder set to " << fullpath(dstStore.GetRoot());
 
-        for (size_t i = 0; i < m_imageStore.GetItems(); i++)
+        if (!(m_pipeline ? ProcessPipelined(metre, frames, features) : ProcessSerially(metre, frames, features)))
         {
-            Path src(srcStore.GetItemPath(i));
-            Path dst(src.filename());
-
-            dst.replace_extension(m_extension);
-
-            cv::Mat im = m_imageStore[i].im;
-
-            if (im.empty())
-            {
-                E_INFO << "skipped unreadable file " << src;
-                continue;
-            }
-
-            im = im.channels() == 3 ? rgb2gray(im) : im;
-
-            metre.Start();
-            ImageFeatureSet f = m_dxtor->DetectAndExtractFeatures(im);
-            metre.Stop(im.total());
-
-            if (!dstStore.Append(dst.filename().string(), f))
-            {
-                E_FATAL << "error writing features to " << dst;
-                return false;
-            }
-
-            std::stringstream ss;
-            ss << std::fixed << std::setprecision(2) << metre.GetSpeed() << " " << metre.GetUnit();
-
-            frames++;
-
-            features += f.GetSize();
-            bytes += filesize(dstStore.GetItemPath(i));
-
-            E_INFO << "processed " << src.filename() << " -> " << dst.filename() << " [" << ss.str() << "]";
+            return false;
         }
 
         if (!m_index.empty())
@@ -312,6 +384,18 @@ bool MyApp::Execute()
             E_INFO << "index written to " << to;
         }
 
+        if (dstStore.IsPacked())
+        {
+            bytes = filesize(dstStore.GetContainerPath());
+        }
+        else
+        {
+            for (size_t i = 0; i < dstStore.GetItems(); i++)
+            {
+                bytes += filesize(dstStore.GetItemPath(i));
+            }
+        }
+
         E_INFO << "image feature extraction procedure finished, " << features << " feature(s) detected from " << frames << " frame(s)";
         E_INFO << "file storage:     " << (bytes / 1024.0f / 1024.0f) << " MBytes";
         E_INFO << "computation time: " << metre.GetElapsedSeconds() << " secs";
@@ -325,6 +409,218 @@ bool MyApp::Execute()
     return true;
 }
 
+String MyApp::GetOutputFileName(size_t idx) const
+{
+    Path dst(m_imageStore.GetItemPath(idx).filename());
+    dst.replace_extension(m_extension);
+
+    return dst.string();
+}
+
+bool MyApp::ProcessSerially(Speedometre& metre, size_t& frames, size_t& features)
+{
+    for (size_t i = 0; i < m_imageStore.GetItems(); i++)
+    {
+        Path src(m_imageStore.GetItemPath(i));
+        Path dst(GetOutputFileName(i));
+
+        cv::Mat im = m_imageStore[i].im;
+
+        if (im.empty())
+        {
+            E_INFO << "skipped unreadable file " << src;
+            continue;
+        }
+
+        im = im.channels() == 3 ? rgb2gray(im) : im;
+
+        metre.Start();
+        ImageFeatureSet f = m_dxtor->DetectAndExtractFeatures(im);
+        metre.Stop(im.total());
+
+        if (!m_featureStore.Append(dst.string(), f))
+        {
+            E_FATAL << "error writing features to " << dst;
+            return false;
+        }
+
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(2) << metre.GetSpeed() << " " << metre.GetUnit();
+
+        frames++;
+        features += f.GetSize();
+
+        E_INFO << "processed " << src.filename() << " -> " << dst.filename() << " [" << ss.str() << "]";
+    }
+
+    return true;
+}
+
+bool MyApp::ProcessPipelined(Speedometre& metre, size_t& frames, size_t& features)
+{
+    const size_t decoders  = static_cast<size_t>(m_decoders);
+    const size_t detectors = static_cast<size_t>(m_detectors);
+    const size_t encoders  = static_cast<size_t>(m_encoders);
+    const size_t capacity  = static_cast<size_t>(m_queueSize);
+
+    // frames in flight are bounded by the queues and the working threads,
+    // which in turn bounds the number of out-of-order items held back
+    const size_t window = 2 * capacity + decoders + detectors + encoders;
+
+    Pipeline pipeline(m_imageStore.GetItems(), window, capacity, decoders, detectors);
+    boost::thread_group workers;
+
+    for (size_t k = 0; k < detectors; k++)
+    {
+        // each detection thread owns a detector-and-extractor instance
+        FeatureDetextractor::Own dxtor = k > 0 ? CreateDetextractor() : m_dxtor;
+
+        if (!dxtor)
+        {
+            return false;
+        }
+
+        workers.create_thread(boost::bind(&MyApp::DetectWorker, this, boost::ref(pipeline), dxtor));
+    }
+
+    for (size_t k = 0; k < decoders; k++)
+    {
+        workers.create_thread(boost::bind(&MyApp::DecodeWorker, this, boost::ref(pipeline)));
+    }
+
+    for (size_t k = 0; k < encoders; k++)
+    {
+        workers.create_thread(boost::bind(&MyApp::EncodeWorker, this, boost::ref(pipeline)));
+    }
+
+    // items are appended to the feature store in the original order
+    Encoded item;
+    bool okay = true;
+
+    metre.Start();
+
+    for (size_t i = 0; okay && pipeline.ordered.Get(item); i++)
+    {
+        const Path src(m_imageStore.GetItemPath(i));
+
+        switch (item.state)
+        {
+        case Encoded::SKIPPED:
+            E_INFO << "skipped unreadable file " << src;
+            continue;
+
+        case Encoded::FAILED:
+            E_FATAL << "error processing " << src;
+            okay = false;
+            continue;
+
+        case Encoded::ENCODED:
+            if (!m_featureStore.AppendEncoded(item.filename, item.bytes))
+            {
+                E_FATAL << "error writing features to " << item.filename;
+                okay = false;
+                continue;
+            }
+        }
+
+        metre.Update(item.pixels);
+
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(2) << metre.GetSpeed() << " " << metre.GetUnit();
+
+        frames++;
+        features += item.features;
+
+        E_INFO << "processed " << src.filename() << " -> " << item.filename << " [" << ss.str() << "]";
+    }
+
+    if (!okay)
+    {
+        pipeline.ordered.Abort();
+        pipeline.decoded.Abort();
+        pipeline.extracted.Abort();
+    }
+
+    workers.join_all();
+    metre.Stop(0);
+
+    return okay;
+}
+
+void MyApp::DecodeWorker(Pipeline& pipeline)
+{
+    size_t idx;
+
+    while (pipeline.ordered.Next(idx))
+    {
+        Decoded frame;
+        frame.idx = idx;
+        frame.im  = m_imageStore[idx].im;
+
+        if (frame.im.empty())
+        {
+            pipeline.ordered.Put(idx, Encoded()); // skipped
+            continue;
+        }
+
+        frame.im = frame.im.channels() == 3 ? rgb2gray(frame.im) : frame.im;
+
+        if (!pipeline.decoded.Push(frame))
+        {
+            break;
+        }
+    }
+
+    pipeline.decoded.Close();
+}
+
+void MyApp::DetectWorker(Pipeline& pipeline, FeatureDetextractor::Own dxtor)
+{
+    Decoded frame;
+
+    while (pipeline.decoded.Pop(frame))
+    {
+        Extracted item;
+        item.idx    = frame.idx;
+        item.pixels = frame.im.total();
+        item.okay   = true;
+
+        try
+        {
+            item.features = dxtor->DetectAndExtractFeatures(frame.im);
+        }
+        catch (std::exception& ex)
+        {
+            E_ERROR << "exception caught in detection thread: " << ex.what();
+            item.okay = false;
+        }
+
+        if (!pipeline.extracted.Push(item))
+        {
+            break;
+        }
+    }
+
+    pipeline.extracted.Close();
+}
+
+void MyApp::EncodeWorker(Pipeline& pipeline)
+{
+    Extracted item;
+
+    while (pipeline.extracted.Pop(item))
+    {
+        Encoded encoded;
+        encoded.filename = GetOutputFileName(item.idx);
+        encoded.pixels   = item.pixels;
+        encoded.features = item.features.GetSize();
+        encoded.state    = item.okay && m_featureStore.Encode(encoded.filename, item.features, encoded.bytes) ?
+            Encoded::ENCODED : Encoded::FAILED;
+
+        pipeline.ordered.Put(item.idx, encoded);
+    }
+}
+
 int main(int argc, char* argv[])
 {
     MyApp app(argc, argv);
@@ -0,0 +1,194 @@
+#include <seq2map/app.hpp>
+#include <seq2map/disparity.hpp>
+
+using namespace seq2map;
+namespace po = boost::program_options;
+
+class MyApp : public App
+{
+public:
+    MyApp(int argc, char* argv[]) : App(argc, argv) {}
+
+protected:
+    virtual void SetOptions(Options&, Options&, Positional&);
+    virtual void ShowHelp(const Options&) const;
+    virtual bool Init();
+    virtual bool Execute();
+
+private:
+    struct Measure
+    {
+        Measure(const String& name)
+        : name(name), encoder(name + " encoding", "px/s"), decoder(name + " decoding", "px/s"), bytes(0) {}
+
+        String name;
+        Speedometre encoder;
+        Speedometre decoder;
+        size_t bytes;
+    };
+
+    void Report(const Measure& m, size_t frames, size_t pixels) const;
+
+    String m_inPath;
+    double m_alpha;
+    double m_beta;
+    int    m_repeats;
+    Paths  m_files;
+};
+
+void MyApp::ShowHelp(const Options& o) const
+{
+    std::cout << "Throughput comparison of disparity codecs against 16-bit PNG." << std::endl;
+    std::cout << std::endl;
+    std::cout << "Usage: " << std::endl;
+    std::cout << "  " << m_exec.string() << " [options] <disparity_dir>" << std::endl;
+    std::cout << std::endl;
+    std::cout << o << std::endl;
+}
+
+void MyApp::SetOptions(Options& o, Options& h, Positional& p)
+{
+    o.add_options()
+        ("alpha",   po::value<double>(&m_alpha  )->default_value(16.0f), "Scale of the linear mapping from disparity to the 16-bit values stored in the PNG files.")
+        ("beta",    po::value<double>(&m_beta   )->default_value( 0.0f), "Offset of the linear mapping from disparity to the 16-bit values stored in the PNG files.")
+        ("repeats", po::value<int>   (&m_repeats)->default_value(    5), "Number of times each file is encoded and decoded.");
+
+    h.add_options()
+        ("in",      po::value<String>(&m_inPath )->default_value(   ""), "Input folder containing 16-bit PNG disparity maps.");
+
+    p.add("in", 1);
+}
+
+bool MyApp::Init()
+{
+    if (m_inPath.empty())
+    {
+        E_ERROR << "missing input folder";
+        return false;
+    }
+
+    if (m_alpha == 0 || m_repeats < 1)
+    {
+        E_ERROR << "invalid arguments";
+        return false;
+    }
+
+    m_files = enumerateFiles(m_inPath, ".png");
+
+    if (m_files.empty())
+    {
+        E_ERROR << "no PNG file found in " << m_inPath;
+        return false;
+    }
+
+    E_INFO << m_files.size() << " file(s) will be processed";
+
+    return true;
+}
+
+bool MyApp::Execute()
+{
+    Measure png("PNG16U"), rle("RLE16U");
+    size_t frames = 0, pixels = 0;
+
+    try
+    {
+        BOOST_FOREACH (const Path& file, m_files)
+        {
+            const cv::Mat src = cv::imread(file.string(), cv::IMREAD_UNCHANGED);
+
+            if (src.empty() || src.type() != CV_16U)
+            {
+                E_INFO << "skipped non-16U image file " << file;
+                continue;
+            }
+
+            cv::Mat dpm32F;
+            src.convertTo(dpm32F, CV_32F, 1.0f / m_alpha, -m_beta / m_alpha);
+
+            std::vector<uchar> pngBuf, rleBuf;
+            cv::Mat pngDpm, rleDpm, dpm16U;
+
+            for (int k = 0; k < m_repeats; k++)
+            {
+                // the current path: remapping to 16U then PNG encoding
+                png.encoder.Start();
+                dpm32F.convertTo(dpm16U, CV_16U, m_alpha, m_beta);
+                cv::imencode(".png", dpm16U, pngBuf);
+                png.encoder.Stop(dpm32F.total());
+
+                png.decoder.Start();
+                dpm16U = cv::imdecode(pngBuf, cv::IMREAD_UNCHANGED);
+                dpm16U.convertTo(pngDpm, CV_32F, 1.0f / m_alpha, -m_beta / m_alpha);
+                png.decoder.Stop(dpm32F.total());
+
+                rle.encoder.Start();
+                DisparityCodec::Encode(dpm32F, m_alpha, m_beta, rleBuf);
+                rle.encoder.Stop(dpm32F.total());
+
+                rle.decoder.Start();
+                bool decoded = DisparityCodec::Decode(&rleBuf[0], rleBuf.size(), rleDpm);
+                rle.decoder.Stop(dpm32F.total());
+
+                if (!decoded)
+                {
+                    E_ERROR << "error decoding " << file;
+                    return false;
+                }
+            }
+
+            // both paths have to reproduce the same quantised map
+            cv::Mat rle16U;
+            rleDpm.convertTo(rle16U, CV_16U, m_alpha, m_beta);
+
+            if (cv::countNonZero(rle16U != src) > 0)
+            {
+                E_ERROR << "lossy round trip of " << file;
+                return false;
+            }
+
+            png.bytes += pngBuf.size();
+            rle.bytes += rleBuf.size();
+
+            frames++;
+            pixels += src.total();
+
+            E_INFO << file.filename() << " : " << pngBuf.size() << " bytes (PNG16U) vs " << rleBuf.size() << " bytes (RLE16U)";
+        }
+    }
+    catch (std::exception& ex)
+    {
+        E_FATAL << "exception caught in main loop: " << ex.what();
+        return false;
+    }
+
+    if (frames == 0)
+    {
+        E_ERROR << "no 16-bit disparity map processed";
+        return false;
+    }
+
+    Report(png, frames, pixels);
+    Report(rle, frames, pixels);
+
+    return true;
+}
+
+void MyApp::Report(const Measure& m, size_t frames, size_t pixels) const
+{
+    const double runs = static_cast<double>(m_repeats * frames);
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2);
+    ss << "encoding " << (m.encoder.GetSpeed() / 1e6) << " Mpx/s (" << (1000.0f * m.encoder.GetElapsedSeconds() / runs) << " ms/frame), ";
+    ss << "decoding " << (m.decoder.GetSpeed() / 1e6) << " Mpx/s (" << (1000.0f * m.decoder.GetElapsedSeconds() / runs) << " ms/frame), ";
+    ss << "size " << (m.bytes / 1024.0f / 1024.0f) << " MBytes (" << (8.0f * m.bytes / pixels) << " bits/px)";
+
+    E_INFO << m.name << " " << ss.str();
+}
+
+int main(int argc, char* argv[])
+{
+    MyApp app(argc, argv);
+    return app.Run();
+}
@@ -1,24 +1,24 @@
 #include <boost/program_options.hpp>
 #include <opencv2/opencv.hpp>
-#include <seq2map/common.hpp>
+#include <seq2map/sequence.hpp>
 
 using namespace std;
 using namespace cv;
 using namespace seq2map;
 
-bool parseArgs(int, char*[], string&, string&, string&, string&, int&, int&, bool&, bool&, bool&, double&);
+bool parseArgs(int, char*[], string&, string&, string&, string&, int&, int&, bool&, bool&, bool&, double&, bool&, string&, int&);
 bool checkPaths(const string&, const string&);
 bool convertImage(Mat& im, int ibbp, int obbp, bool grey);
 
 int main(int argc, char* argv[])
 {
-	string in, out, pattern, ext;
-	int ibpp, obpp;
-	bool flipX, flipY, greyscale;
+	string in, out, pattern, ext, seq;
+	int ibpp, obpp, cam;
+	bool flipX, flipY, greyscale, pack;
 	double ratio;
 
 	initLogFile();
-	if (!parseArgs(argc, argv, in, out, pattern, ext, ibpp, obpp, flipX, flipY, greyscale, ratio)) return -1;
+	if (!parseArgs(argc, argv, in, out, pattern, ext, ibpp, obpp, flipX, flipY, greyscale, ratio, pack, seq, cam)) return -1;
 
 	// make the flip code for cv::flip
 	int flipCode = (flipX && flipY) ? -1 : (flipX ? 0 : 1);
@@ -38,9 +38,19 @@ int main(int argc, char* argv[])
 	{
 		Path  srcDir(in), dstDir(out);
 		Paths srcFiles = enumerateFiles(srcDir);
+		ImageStore store;
 
 		int i = 0;
 
+		// in packing mode the converted images go to a single container of
+		// uncompressed planes, indexed by an image store profile; the root
+		// is made absolute when the profile is referred to by a sequence
+		if (pack && !(store.Create(seq.empty() ? dstDir : fullpath(dstDir)) && store.Pack("images.pack")))
+		{
+			E_FATAL << "error creating image container in " << dstDir.string();
+			return -1;
+		}
+
 		BOOST_FOREACH(Path srcPath, srcFiles)
 		{
 			Path dstPath(dstDir / srcPath.filename());
@@ -86,11 +96,54 @@ int main(int argc, char* argv[])
 				flip(im, im, flipCode);
 			}
 
-			imwrite(dstPath.string(), im);
+			if (pack)
+			{
+				PersistentImage image;
+				image.im = im;
+
+				if (!store.Append(dstPath.filename().string(), image))
+				{
+					E_FATAL << "error packing " << srcPath.string();
+					return -1;
+				}
+			}
+			else
+			{
+				imwrite(dstPath.string(), im);
+			}
+
 			i++;
 
 			E_INFO << srcPath.string() << " -> " << dstPath.string();
 		}
+
+		if (pack)
+		{
+			Path index = dstDir / "index.yml";
+
+			if (!store.Store(index))
+			{
+				E_FATAL << "error writing image store index to " << index.string();
+				return -1;
+			}
+
+			E_INFO << i << " image(s) packed to " << store.GetContainerPath().string() << " indexed by " << index.string();
+
+			// let the sequence read the camera's frames from the container
+			if (!seq.empty())
+			{
+				Sequence sequence;
+				Path seqPath(seq);
+
+				if (!sequence.Restore(seqPath) || !sequence.SetImageStore(static_cast<size_t>(cam), index) || !sequence.Store(seqPath))
+				{
+					E_FATAL << "error updating image store of camera " << cam << " in sequence " << seq;
+					return -1;
+				}
+
+				E_INFO << "image store of camera " << cam << " in " << seqPath.string() << " now reading from " << index.string();
+			}
+		}
 	}
 	catch (exception ex)
 	{
@@ -101,7 +154,7 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
-bool parseArgs(int argc, char* argv[], string& in, string& out, string& pattern, string& ext, int& ibpp, int& obpp, bool& flipX, bool& flipY, bool& grey, double& ratio)
+bool parseArgs(int argc, char* argv[], string& in, string& out, string& pattern, string& ext, int& ibpp, int& obpp, bool& flipX, bool& flipY, bool& grey, double& ratio, bool& pack, string& seq, int& cam)
 {
 	namespace po = boost::program_options;
 	po::options_description o("options");
@@ -114,7 +167,10 @@ bool parseArgs(int argc, char* argv[], string& in, string& out, string& pattern,
 		("ratio,r",	po::value<double>(&ratio)->default_value(1.0f),	"Positive sampling ratio. Default sets 1.0 to disable down-sampling.")
 		("flipX",	po::value<bool>(&flipX)->default_value(false)->zero_tokens(),	"Flip image vertically.")
 		("flipY",	po::value<bool>(&flipY)->default_value(false)->zero_tokens(),	"Flip image horizontally.")
-		("grey,g",	po::value<bool>(&grey)->default_value(false)->zero_tokens(),	"Convert to greyscale image.");
+		("grey,g",	po::value<bool>(&grey)->default_value(false)->zero_tokens(),	"Convert to greyscale image.")
+		("pack,p",	po::value<bool>(&pack)->default_value(false)->zero_tokens(),	"Write the converted images as uncompressed planes to a single memory-mapped container \"images.pack\" with an image store index \"index.yml\", instead of individual image files.")
+		("seq,s",	po::value<string>(&seq)->default_value(""),		"Path to a sequence database whose camera is to read the packed images. The image store of the camera is rewritten to the container. Requires --pack.")
+		("cam,c",	po::value<int>(&cam)->default_value(0),			"Index of the camera in the sequence given by --seq.");
 
 	po::options_description h("hiddens");
 	h.add_options()
@@ -171,6 +227,18 @@ bool parseArgs(int argc, char* argv[], string& in, string& out, string& pattern,
 				cerr << "ratio=" << ratio << " is out of range (0,1]" << endl;
 				okay &= false;
 			}
+
+			if (!seq.empty() && !pack)
+			{
+				cerr << "--seq works only in packing mode" << endl;
+				okay &= false;
+			}
+
+			if (cam < 0)
+			{
+				cerr << "cam=" << cam << " must not be negative" << endl;
+				okay &= false;
+			}
 		}
 	}
 	catch (po::error& pe)
@@ -0,0 +1,209 @@
+#include <iomanip>
+#include <seq2map/app.hpp>
+#include <seq2map/mapping.hpp>
+
+using namespace seq2map;
+namespace po = boost::program_options;
+
+/**
+ * A matrix allocator counting the bytes requested by cv::Mat, delegating the
+ * actual work to the standard allocator of OpenCV.
+ */
+class CountingAllocator : public cv::MatAllocator
+{
+public:
+    CountingAllocator() : m_std(cv::Mat::getStdAllocator()), m_bytes(0), m_allocs(0) {}
+
+    virtual cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags, cv::UMatUsageFlags usageFlags) const
+    {
+        cv::UMatData* u = m_std->allocate(dims, sizes, type, data, step, flags, usageFlags);
+
+        if (u && !data) // user-allocated data are not counted
+        {
+            boost::lock_guard<boost::mutex> locker(m_mtx);
+
+            m_bytes += u->size;
+            m_allocs++;
+        }
+
+        return u;
+    }
+
+    virtual bool allocate(cv::UMatData* u, int accessFlags, cv::UMatUsageFlags usageFlags) const
+    {
+        return m_std->allocate(u, accessFlags, usageFlags);
+    }
+
+    virtual void deallocate(cv::UMatData* u) const
+    {
+        m_std->deallocate(u);
+    }
+
+    void Reset()
+    {
+        boost::lock_guard<boost::mutex> locker(m_mtx);
+        m_bytes = m_allocs = 0;
+    }
+
+    size_t GetBytes()  const { boost::lock_guard<boost::mutex> locker(m_mtx); return m_bytes;  }
+    size_t GetAllocs() const { boost::lock_guard<boost::mutex> locker(m_mtx); return m_allocs; }
+
+private:
+    cv::MatAllocator* m_std;
+    mutable size_t m_bytes;
+    mutable size_t m_allocs;
+    mutable boost::mutex m_mtx;
+};
+
+class MyApp : public App
+{
+public:
+    MyApp(int argc, char* argv[]) : App(argc, argv) {}
+
+protected:
+    virtual void SetOptions(Options&, Options&, Positional&);
+    virtual void ShowHelp(const Options&) const;
+    virtual bool Init();
+    virtual bool Execute();
+
+private:
+    String m_seqPath;
+    size_t m_kptsStoreId;
+    int    m_dispStoreId;
+    int    m_start;
+    int    m_until;
+    int    m_seed;
+
+    Sequence m_seq;
+    FeatureStore::ConstOwn   m_featureStore;
+    DisparityStore::ConstOwn m_disparityStore;
+
+    FeatureTracker m_tracker;
+};
+
+void MyApp::ShowHelp(const Options& o) const
+{
+    std::cout << "Memory allocation and runtime of the feature tracker over a sequence." << std::endl;
+    std::cout << std::endl;
+    std::cout << "Usage: " << m_exec.string() << " [options] <sequence_database>" << std::endl;
+    std::cout << o << std::endl;
+}
+
+void MyApp::SetOptions(Options& o, Options& h, Positional& p)
+{
+    o.add_options()
+        ("feature-store,f",   po::value<size_t>(&m_kptsStoreId)->default_value( 0), "Source feature store")
+        ("disparity-store,d", po::value<int>   (&m_dispStoreId)->default_value( 0), "Optional disparity store, set to -1 to disable using disparity maps.")
+        ("start",             po::value<int>   (&m_start      )->default_value( 0), "Start frame.")
+        ("until",             po::value<int>   (&m_until      )->default_value(-1), "Last frame. Set to negative number to go through the whole sequence.")
+        ("seed",              po::value<int>   (&m_seed       )->default_value( 0), "Seed for random number generation.")
+    ;
+
+    o.add(m_tracker.GetOptions());
+
+    h.add_options()
+        ("seq", po::value<String>(&m_seqPath)->default_value(""), "Path to the input sequence.");
+
+    p.add("seq", 1);
+}
+
+bool MyApp::Init()
+{
+    if (m_seqPath.empty())
+    {
+        E_ERROR << "missing input path";
+        return false;
+    }
+
+    if (!m_seq.Restore(m_seqPath))
+    {
+        E_ERROR << "error restoring sequence from " << m_seqPath;
+        return false;
+    }
+
+    m_featureStore   = m_seq.GetFeatureStore(m_kptsStoreId);
+    m_disparityStore = m_dispStoreId > -1 ? m_seq.GetDisparityStore(static_cast<size_t>(m_dispStoreId)) : DisparityStore::ConstOwn();
+
+    if (!m_featureStore)
+    {
+        E_ERROR << "missing feature store " << m_kptsStoreId;
+        return false;
+    }
+
+    if (m_dispStoreId > -1 && !m_disparityStore)
+    {
+        E_ERROR << "missing disparity store";
+        return false;
+    }
+
+    // the same hypotheses are drawn in every run for comparable figures
+    std::srand(static_cast<unsigned int>(m_seed));
+
+    return true;
+}
+
+bool MyApp::Execute()
+{
+    Map map;
+    Source& src = map.AddSource(m_featureStore, m_disparityStore);
+
+    m_tracker.ApplyParams();
+
+    CountingAllocator allocator;
+    Speedometre metre("Tracking", "calls/s");
+    size_t calls = 0, bytes = 0, allocs = 0, peak = 0;
+
+    const size_t until = m_until > 0 && m_until > m_start ? static_cast<size_t>(m_until) : m_seq.GetFrames() - 1;
+    map.GetFrame(m_start).pose.valid = true;
+
+    cv::Mat::setDefaultAllocator(&allocator);
+
+    for (size_t t = static_cast<size_t>(m_start); t < until; t++)
+    {
+        allocator.Reset();
+
+        metre.Start();
+        bool success = m_tracker(map, src, map.GetFrame(t), src, map.GetFrame(t + 1));
+        metre.Stop(1);
+
+        if (!success)
+        {
+            cv::Mat::setDefaultAllocator(NULL);
+
+            E_ERROR << "error tracking frame " << t << " -> " << (t + 1);
+            return false;
+        }
+
+        E_INFO << "frame " << t << " -> " << (t + 1) << " : "
+            << (allocator.GetBytes() / 1024.0f / 1024.0f) << " MBytes in " << allocator.GetAllocs() << " allocation(s)";
+
+        bytes  += allocator.GetBytes();
+        allocs += allocator.GetAllocs();
+        peak    = std::max(peak, allocator.GetBytes());
+        calls++;
+    }
+
+    cv::Mat::setDefaultAllocator(NULL); // back to the standard allocator
+
+    if (calls == 0)
+    {
+        E_ERROR << "no frame tracked";
+        return false;
+    }
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2);
+    ss << (bytes / 1024.0f / 1024.0f / calls) << " MBytes/call (max. " << (peak / 1024.0f / 1024.0f) << " MBytes), ";
+    ss << (allocs / static_cast<double>(calls)) << " allocations/call, ";
+    ss << metre.GetSpeed() << " calls/s";
+
+    E_INFO << "FeatureTracker " << ss.str();
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    MyApp app(argc, argv);
+    return app.Run();
+}
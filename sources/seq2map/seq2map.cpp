@@ -1,5 +1,6 @@
 #include <seq2map/app.hpp>
 #include <seq2map/mapping.hpp>
+#include <seq2map/thread_pool.hpp>
 
 using namespace seq2map;
 
@@ -50,6 +51,9 @@ public:
      */
     inline bool IsSynched() const { return m_source.frame == m_target.frame; }
 
+    inline const Node& GetSource() const { return m_source; }
+    inline const Node& GetTarget() const { return m_target; }
+
     //
     // Persistence
     //
@@ -80,8 +84,38 @@ public:
         size_t dispStore;
     };
 
+    struct ReadAheadOptions
+    {
+        ReadAheadOptions() : depth(8), budget(512), threads(2) {}
+
+        size_t depth;   ///< number of retrievals to read ahead in each store, zero to disable
+        size_t budget;  ///< total memory budget in MBytes
+        size_t threads; ///< number of reading threads per store
+    };
+
+    struct CacheOptions
+    {
+        CacheOptions() : capacity(1024) {}
+
+        size_t capacity; ///< capacity in MBytes shared by all stores, zero to disable
+    };
+
     bool operator() (Map& map, size_t t, size_t n);
 
+    /**
+     * Attach a cache shared by the feature, image and disparity stores of
+     * the map's sources, so a frame retrieved by more than one tracking path
+     * is decoded only once.
+     */
+    void AttachCache(Map& map);
+
+    /**
+     * Declare to the stores of the map's sources the order in which their
+     * items are retrieved by the tracking paths over frames [t0, tn), so the
+     * items can be read ahead while tracking.
+     */
+    void DeclareAccessPattern(Map& map, size_t t0, size_t tn) const;
+
     //
     // Persistence
     //
@@ -90,6 +124,9 @@ public:
 
     std::vector<SourceDef> sources;
     std::vector<TrackingPath> tracking;
+    ReadAheadOptions readAheadOptions;
+    CacheOptions cacheOptions;
+    ItemCache::Own cache;
 };
 
 class MyApp : public App
@@ -112,6 +149,7 @@ protected:
     Map      map;
     Mapper   mapper;
     double   minKfCovis;
+    size_t   threads;
 };
 
 TrackingPath::TrackingPath(size_t s0, size_t t0, size_t s1, size_t t1)
@@ -293,6 +331,107 @@ bool Mapper::operator() (Map& map, size_t t, size_t n)
     return true;
 }
 
+void Mapper::AttachCache(Map& map)
+{
+    cache = cacheOptions.capacity > 0 ? ItemCache::Own(new ItemCache(cacheOptions.capacity * 1024 * 1024)) : ItemCache::Own();
+
+    std::set<const void*> attached;
+
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        const Source& src = map.GetSource(i);
+
+        if (src.store && attached.insert(src.store.get()).second)
+        {
+            src.store->SetCache(cache);
+        }
+
+        if (src.store && src.store->GetCamera() && attached.insert(&src.store->GetCamera()->GetImageStore()).second)
+        {
+            src.store->GetCamera()->GetImageStore().SetCache(cache);
+        }
+
+        if (src.dpm && attached.insert(src.dpm.get()).second)
+        {
+            src.dpm->SetCache(cache);
+        }
+    }
+
+    if (cache)
+    {
+        E_INFO << "frame cache of " << cacheOptions.capacity << " MBytes attached to " << attached.size() << " store(s)";
+    }
+}
+
+void Mapper::DeclareAccessPattern(Map& map, size_t t0, size_t tn) const
+{
+    typedef std::map<const FeatureStore*,   Indices> FeaturePatterns;
+    typedef std::map<const ImageStore*,     Indices> ImagePatterns;
+    typedef std::map<const DisparityStore*, Indices> DisparityPatterns;
+
+    FeaturePatterns   features;
+    ImagePatterns     images;
+    DisparityPatterns disparities;
+
+    // follow the order of retrievals made in FeatureTracker::operator()
+    for (size_t t = t0; t < tn; t++)
+    {
+        BOOST_FOREACH (const TrackingPath& tr, tracking)
+        {
+            if (!tr.InScope(t, tn)) continue;
+
+            const TrackingPath::Node nodes[] = { tr.GetSource(), tr.GetTarget() };
+
+            for (size_t k = 0; k < 2; k++)
+            {
+                const Source& src = map.GetSource(nodes[k].source);
+                const size_t frame = nodes[k].frame + t;
+
+                if (src.store)
+                {
+                    features[src.store.get()].push_back(frame);
+
+                    if (src.store->GetCamera())
+                    {
+                        images[&src.store->GetCamera()->GetImageStore()].push_back(frame);
+                    }
+                }
+
+                if (src.dpm)
+                {
+                    disparities[src.dpm.get()].push_back(frame);
+                }
+            }
+        }
+    }
+
+    const size_t stores = features.size() + images.size() + disparities.size();
+
+    if (stores == 0 || readAheadOptions.depth == 0)
+    {
+        return;
+    }
+
+    const size_t budget = readAheadOptions.budget * 1024 * 1024 / stores;
+
+    for (FeaturePatterns::const_iterator itr = features.begin(); itr != features.end(); itr++)
+    {
+        itr->first->SetReadAhead(itr->second, readAheadOptions.depth, budget, readAheadOptions.threads);
+    }
+
+    for (ImagePatterns::const_iterator itr = images.begin(); itr != images.end(); itr++)
+    {
+        itr->first->SetReadAhead(itr->second, readAheadOptions.depth, budget, readAheadOptions.threads);
+    }
+
+    for (DisparityPatterns::const_iterator itr = disparities.begin(); itr != disparities.end(); itr++)
+    {
+        itr->first->SetReadAhead(itr->second, readAheadOptions.depth, budget, readAheadOptions.threads);
+    }
+
+    E_INFO << "read-ahead enabled for " << stores << " store(s), depth=" << readAheadOptions.depth << ", budget=" << readAheadOptions.budget << " MBytes";
+}
+
 bool Mapper::Store(Path& to) const
 {
     cv::FileStorage fs(to.string(), cv::FileStorage::WRITE);
@@ -316,6 +455,16 @@ bool Mapper::Store(Path& to) const
     }
     fs << "]";
 
+    fs << "readAhead" << "{";
+    fs << "depth"   << readAheadOptions.depth;
+    fs << "budget"  << readAheadOptions.budget;
+    fs << "threads" << readAheadOptions.threads;
+    fs << "}";
+
+    fs << "cache" << "{";
+    fs << "capacity" << cacheOptions.capacity;
+    fs << "}";
+
     return true;
 }
 
@@ -359,6 +508,22 @@ bool Mapper::Restore(const Path& from)
 
             tracking.push_back(tr);
         }
+
+        cv::FileNode readAheadNode = fs["readAhead"];
+
+        if (!readAheadNode.empty())
+        {
+            readAheadNode["depth"]   >> readAheadOptions.depth;
+            readAheadNode["budget"]  >> readAheadOptions.budget;
+            readAheadNode["threads"] >> readAheadOptions.threads;
+        }
+
+        cv::FileNode cacheNode = fs["cache"];
+
+        if (!cacheNode.empty())
+        {
+            cacheNode["capacity"] >> cacheOptions.capacity;
+        }
     }
     catch (std::exception& ex)
     {
@@ -388,6 +553,7 @@ void MyApp::SetOptions(Options& o, Options& h, Positional& p)
         ("start",    po::value<size_t>(&start     )->default_value(   0), "Start frame.")
         ("until",    po::value<size_t>(&until     )->default_value(   0), "Last frame. Set to zero to go through the whole sequence.")
         ("kf-covis", po::value<double>(&minKfCovis)->default_value(0.3f), "Minimum covisibility to consider a frame keyframe.")
+        ("threads",  po::value<size_t>(&threads   )->default_value(   0), "Number of worker threads. Set to zero to use all the hardware cores.")
         ;
 
     h.add_options()
@@ -399,6 +565,8 @@ void MyApp::SetOptions(Options& o, Options& h, Positional& p)
 
 bool MyApp::Init()
 {
+    ThreadPool::GetInstance().SetThreads(threads);
+
     if (seqPath.empty())
     {
         E_ERROR << "missing input path";
@@ -470,6 +638,9 @@ bool MyApp::Init()
         }
     }
 
+    mapper.AttachCache(map);
+    mapper.DeclareAccessPattern(map, start, until);
+
     return true;
 }
 
@@ -507,6 +678,15 @@ bool MyApp::Execute()
         }
     }
 
+    if (mapper.cache)
+    {
+        const ItemCache& cache = *mapper.cache;
+        const size_t lookups = cache.GetHits() + cache.GetMisses();
+
+        E_INFO << "frame cache: " << cache.GetHits() << " hit(s), " << cache.GetMisses() << " miss(es), hit rate "
+            << std::fixed << std::setprecision(2) << (lookups > 0 ? 100.0f * cache.GetHits() / lookups : 0.0f) << "%";
+    }
+
     if (!map.Store(Path(outPath)))
     {
         E_ERROR << "error saving map to \"" << outPath << "\"";
@@ -1,5 +1,6 @@
 #define BOOST_TEST_MODULE "Features"
 #include <boost/test/unit_test.hpp>
+#include <seq2map/features_bruteforce.hpp>
 #include <seq2map/sequence.hpp>
 
 using namespace seq2map;
@@ -48,3 +49,264 @@ BOOST_AUTO_TEST_CASE(matching)
 
     //cv::waitKey(0);
 }
+
+BOOST_AUTO_TEST_CASE(packed_store)
+{
+    const Path root = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    const Path index = root / "index.yml";
+
+    Camera::ConstOwn cam;
+    FeatureDetextractor::Own dxtor;
+    FeatureStore src(0), dst(1);
+    std::vector<ImageFeatureSet> fsets;
+
+    BOOST_REQUIRE(src.Create(root, cam, dxtor) && src.Pack());
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        KeyPoints keypoints;
+        cv::Mat descriptors(static_cast<int>(100 * (i + 1)), 32, CV_8U);
+
+        cv::randu(descriptors, 0, 256);
+
+        for (int j = 0; j < descriptors.rows; j++)
+        {
+            keypoints.push_back(cv::KeyPoint(static_cast<float>(j), static_cast<float>(i), 1.0f));
+        }
+
+        fsets.push_back(ImageFeatureSet(keypoints, descriptors, cv::NORM_HAMMING));
+
+        std::stringstream ss;
+        ss << i << ".dat";
+
+        BOOST_REQUIRE(src.Append(ss.str(), fsets.back()));
+    }
+
+    cv::FileStorage fs(index.string(), cv::FileStorage::WRITE);
+    BOOST_REQUIRE(src.Store(fs));
+    fs.release();
+
+    fs.open(index.string(), cv::FileStorage::READ);
+    BOOST_REQUIRE(dst.Restore(fs.root()));
+    BOOST_REQUIRE(dst.IsPacked());
+    BOOST_REQUIRE(dst.GetItems() == fsets.size());
+
+    for (size_t i = 0; i < fsets.size(); i++)
+    {
+        ImageFeatureSet f;
+
+        BOOST_REQUIRE(dst.Retrieve(i, f));
+        BOOST_CHECK(f.GetSize() == fsets[i].GetSize());
+        BOOST_CHECK(f.GetNormType() == fsets[i].GetNormType());
+        BOOST_CHECK(f.GetKeyPoints().back().pt == fsets[i].GetKeyPoints().back().pt);
+        BOOST_CHECK(cv::countNonZero(f.GetDescriptors() != fsets[i].GetDescriptors()) == 0);
+        BOOST_CHECK(reinterpret_cast<size_t>(f.GetDescriptors().data) % 64 == 0); // mapped in place
+        BOOST_CHECK(f.IsMapped());
+
+        // writing detaches the set from the mapped block
+        const uchar* mapped = f.GetDescriptors().data;
+        cv::Mat desc = f.GetMutableDescriptors();
+        desc.setTo(0);
+
+        BOOST_CHECK(!f.IsMapped());
+        BOOST_CHECK(desc.data != mapped);
+
+        ImageFeatureSet g;
+        BOOST_REQUIRE(dst.Retrieve(i, g));
+        BOOST_CHECK(cv::countNonZero(g.GetDescriptors() != fsets[i].GetDescriptors()) == 0);
+    }
+
+    boost::filesystem::remove_all(root);
+}
+
+BOOST_AUTO_TEST_CASE(hamming_knn)
+{
+    // 61-byte AKAZE-like descriptors exercise the zero padding of the kernel
+    cv::Mat query(500, 61, CV_8U), train(700, 61, CV_8U);
+
+    cv::randu(query, 0, 256);
+    cv::randu(train, 0, 256);
+
+    // duplicated rows make ties to test the ordering of equal distances
+    train.rowRange(0, 50).copyTo(train.rowRange(100, 150));
+    query.rowRange(0, 50).copyTo(train.rowRange(200, 250));
+
+    for (int k = 1; k <= 2; k++)
+    {
+        KnnMatches expected, actual;
+
+        cv::BFMatcher(cv::NORM_HAMMING).knnMatch(query, train, expected, k);
+        BOOST_REQUIRE(HammingMatcher::KnnMatch(query, train, actual, k));
+        BOOST_REQUIRE(actual.size() == expected.size());
+
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            BOOST_REQUIRE(actual[i].size() == expected[i].size());
+
+            for (size_t j = 0; j < expected[i].size(); j++)
+            {
+                BOOST_CHECK_EQUAL(actual[i][j].queryIdx, expected[i][j].queryIdx);
+                BOOST_CHECK_EQUAL(actual[i][j].trainIdx, expected[i][j].trainIdx);
+                BOOST_CHECK_EQUAL(actual[i][j].distance, expected[i][j].distance);
+            }
+        }
+    }
+
+    // the backward matches found in the same pass
+    std::vector<cv::DMatch> expected, actual;
+    KnnMatches knn;
+
+    cv::BFMatcher(cv::NORM_HAMMING).match(train, query, expected);
+    BOOST_REQUIRE(HammingMatcher::KnnMatch(query, train, knn, 2, &actual));
+    BOOST_REQUIRE(actual.size() == expected.size());
+
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        BOOST_CHECK_EQUAL(actual[i].queryIdx, expected[i].queryIdx);
+        BOOST_CHECK_EQUAL(actual[i].trainIdx, expected[i].trainIdx);
+        BOOST_CHECK_EQUAL(actual[i].distance, expected[i].distance);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(l2_knn)
+{
+    // unit-length SIFT-like descriptors spanning several tiles
+    cv::Mat query(300, 128, CV_32F), train(600, 128, CV_32F);
+
+    cv::randu(query, 0.0f, 1.0f);
+    cv::randu(train, 0.0f, 1.0f);
+
+    query = L2Matcher::Normalise(query);
+    train = L2Matcher::Normalise(train);
+
+    for (int i = 0; i < query.rows; i++)
+    {
+        BOOST_CHECK_CLOSE(cv::norm(query.row(i)), 1.0f, 1e-3);
+    }
+
+    // zero rows are left as they are
+    const cv::Mat zero = L2Matcher::Normalise(cv::Mat::zeros(2, 128, CV_32F));
+    BOOST_CHECK_EQUAL(cv::countNonZero(zero), 0);
+
+    for (int k = 1; k <= 2; k++)
+    {
+        KnnMatches expected, actual;
+
+        cv::BFMatcher(cv::NORM_L2).knnMatch(query, train, expected, k);
+        BOOST_REQUIRE(L2Matcher::KnnMatch(query, train, actual, k, cv::NORM_L2));
+        BOOST_REQUIRE(actual.size() == expected.size());
+
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            BOOST_REQUIRE(actual[i].size() == expected[i].size());
+
+            // distances agree up to rounding errors of the expansion
+            BOOST_CHECK_EQUAL(actual[i][0].trainIdx, expected[i][0].trainIdx);
+
+            for (size_t j = 0; j < expected[i].size(); j++)
+            {
+                BOOST_CHECK_SMALL(actual[i][j].distance - expected[i][j].distance, 1e-3f);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(candidate_distances)
+{
+    cv::RNG rng(1);
+    cv::Mat bq(100, 61, CV_8U), bt(300, 61, CV_8U);
+    cv::Mat fq(100, 128, CV_32F), ft(300, 128, CV_32F);
+
+    rng.fill(bq, cv::RNG::UNIFORM, 0, 256);
+    rng.fill(bt, cv::RNG::UNIFORM, 0, 256);
+    rng.fill(fq, cv::RNG::UNIFORM, 0.0f, 1.0f);
+    rng.fill(ft, cv::RNG::UNIFORM, 0.0f, 1.0f);
+
+    // a few random candidates per query, some of them with none
+    CandidateLists candidates(100);
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        const int n = rng.uniform(0, 12);
+
+        for (int j = 0; j < n; j++)
+        {
+            candidates[i].push_back(rng.uniform(0, 300));
+        }
+    }
+
+    CandidateDistances hamming, l2, l2sqr;
+
+    BOOST_REQUIRE(HammingMatcher::Distances(bq, bt, candidates, hamming));
+    BOOST_REQUIRE(L2Matcher::Distances(fq, ft, candidates, l2, cv::NORM_L2));
+    BOOST_REQUIRE(L2Matcher::Distances(fq, ft, candidates, l2sqr, cv::NORM_L2SQR));
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        const int q = static_cast<int>(i);
+
+        BOOST_REQUIRE(hamming[i].size() == candidates[i].size());
+        BOOST_REQUIRE(l2[i].size() == candidates[i].size());
+        BOOST_REQUIRE(l2sqr[i].size() == candidates[i].size());
+
+        for (size_t j = 0; j < candidates[i].size(); j++)
+        {
+            const int t = candidates[i][j];
+
+            BOOST_CHECK_EQUAL(hamming[i][j], static_cast<float>(cv::norm(bq.row(q), bt.row(t), cv::NORM_HAMMING)));
+            BOOST_CHECK_SMALL(l2[i][j] - static_cast<float>(cv::norm(fq.row(q), ft.row(t), cv::NORM_L2)), 1e-4f);
+            BOOST_CHECK_SMALL(l2sqr[i][j] - static_cast<float>(cv::norm(fq.row(q), ft.row(t), cv::NORM_L2SQR)), 1e-3f);
+        }
+    }
+
+    // out-of-range candidates are rejected
+    candidates[0].push_back(300);
+    BOOST_CHECK(!HammingMatcher::Distances(bq, bt, candidates, hamming));
+}
+
+BOOST_AUTO_TEST_CASE(keypoint_grid)
+{
+    cv::RNG rng(1);
+    KeyPoints keypoints(800);
+
+    BOOST_FOREACH (cv::KeyPoint& kp, keypoints)
+    {
+        kp.pt = cv::Point2f(rng.uniform(0.0f, 1241.0f), rng.uniform(0.0f, 376.0f));
+    }
+
+    ImageFeatureSet f(keypoints, cv::Mat::zeros(static_cast<int>(keypoints.size()), 32, CV_8U), cv::NORM_HAMMING);
+    const KeyPointGrid& grid = f.GetKeyPointGrid(20.0f);
+
+    for (int k = 0; k < 200; k++)
+    {
+        const cv::Point2f pt(rng.uniform(-50.0f, 1300.0f), rng.uniform(-50.0f, 420.0f));
+        const float radius = rng.uniform(0.0f, 50.0f);
+
+        IndexList found;
+        grid.Search(pt, radius, found);
+
+        std::vector<size_t> actual(found.begin(), found.end()), expected;
+        std::sort(actual.begin(), actual.end());
+
+        for (size_t i = 0; i < keypoints.size(); i++)
+        {
+            const cv::Point2f d = keypoints[i].pt - pt;
+            if (d.x * d.x + d.y * d.y <= radius * radius) expected.push_back(i);
+        }
+
+        BOOST_CHECK(actual == expected);
+    }
+
+    // grids are kept across requests of different cell sizes and copies
+    const KeyPointGrid& coarse = f.GetKeyPointGrid(40.0f);
+    BOOST_CHECK(&f.GetKeyPointGrid(20.0f) == &grid);
+    BOOST_CHECK(&f.GetKeyPointGrid(40.0f) == &coarse);
+
+    ImageFeatureSet g;
+    g = f;
+    BOOST_CHECK(&g.GetKeyPointGrid(20.0f) == &grid);
+
+    // but not once the key points change
+    BOOST_REQUIRE(g.Append(f));
+    BOOST_CHECK(&g.GetKeyPointGrid(20.0f) != &grid);
+}
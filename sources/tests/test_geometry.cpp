@@ -74,6 +74,74 @@ BOOST_AUTO_TEST_CASE(rotation)
     BOOST_CHECK(R0 == R1);
 }
 
+BOOST_AUTO_TEST_CASE(euclidean_transform)
+{
+    const double EPSILON = 1e-10;
+    cv::RNG rng(1);
+
+    EuclideanTransform a, b;
+    a.GetRotation().FromAngles(10, -25, 40);
+    a.SetTranslation(cv::Vec3d(1.0, -2.0, 0.5));
+    b.GetRotation().FromAngles(-5, 15, 170);
+    b.SetTranslation(cv::Vec3d(-0.2, 0.3, 4.0));
+
+    const cv::Mat A = a.GetTransformMatrix(true);
+    const cv::Mat B = b.GetTransformMatrix(true);
+    cv::Mat At32f;
+    cv::Mat(A.rowRange(0, 3).t()).convertTo(At32f, CV_32F);
+
+    // fixed-size composition and inversion agree with the matrix products
+    BOOST_CHECK_SMALL(cv::norm((a << b).GetTransformMatrix(true), B * A), EPSILON);
+    BOOST_CHECK_SMALL(cv::norm((a >> b).GetTransformMatrix(true), A * B), EPSILON);
+    BOOST_CHECK_SMALL(cv::norm(a.GetInverse().GetTransformMatrix(true), A.inv()), EPSILON);
+    BOOST_CHECK_SMALL(cv::norm(a.GetTransformMatrix(false, false, CV_32F), At32f, cv::NORM_INF), 1e-6);
+    BOOST_CHECK((a << a.GetInverse()).IsIdentity());
+
+    // closed-form Rodrigues formulae agree with cv::Rodrigues, near zero and pi included
+    const double angles[] = { 0.0, 1e-9, 1e-3, 1.0, 3.0, CV_PI - 1e-4 };
+
+    for (size_t i = 0; i < sizeof(angles) / sizeof(double); i++)
+    {
+        cv::Vec3d axis;
+        rng.fill(axis, cv::RNG::UNIFORM, -1, 1);
+
+        const cv::Vec3d rvec = axis * (angles[i] / cv::norm(axis));
+        cv::Matx33d rmat;
+        cv::Rodrigues(rvec, rmat);
+
+        Rotation r0, r1;
+        r0.FromVec(rvec);
+        r1.FromMatx(rmat);
+
+        BOOST_CHECK_SMALL(cv::norm(r0.GetMatx() - rmat), EPSILON);
+        BOOST_CHECK_SMALL(cv::norm(r1.GetVec()  - rvec), 1e-6);
+    }
+
+    // vectorisation round trips in both parameterisations
+    EuclideanTransform::Vec v;
+    EuclideanTransform c(Rotation::RODRIGUES), d(Rotation::RODRIGUES);
+    c = b;
+
+    BOOST_CHECK(c.Store(v) && v.size() == c.GetDimension());
+    BOOST_CHECK(d.Restore(v));
+    BOOST_CHECK_SMALL(cv::norm(d.GetTransformMatrix(), B.rowRange(0, 3)), EPSILON);
+
+    EuclideanTransform e(Rotation::EULER_ANGLES);
+
+    BOOST_CHECK(a.Store(v) && v.size() == a.GetDimension());
+    BOOST_CHECK(e.Restore(v));
+    BOOST_CHECK_SMALL(cv::norm(e.GetTransformMatrix(), A.rowRange(0, 3)), 1e-6);
+
+    // points are transformed the same way as geometry
+    Point3D pt(1.0, 2.0, 3.0);
+    Geometry g(Geometry::ROW_MAJOR, (cv::Mat_<double>(1, 3) << pt.x, pt.y, pt.z));
+
+    a(pt);
+    a(g);
+
+    BOOST_CHECK_SMALL(cv::norm(cv::Vec3d(pt.x, pt.y, pt.z) - cv::Vec3d(g.mat.ptr<double>())), EPSILON);
+}
+
 BOOST_AUTO_TEST_CASE(mahalanobis)
 {
     const double EPSILON = 1e-10;
@@ -187,3 +255,144 @@ BOOST_AUTO_TEST_CASE(mahalanobis)
         static_cast<MahalanobisMetric*>(m12.get())->GetFullCovMat()
     ), EPSILON);
 }
+
+BOOST_AUTO_TEST_CASE(projection_jacobian)
+{
+    const int n = 50;
+    const double h = 1e-6;
+    cv::RNG rng(1);
+
+    cv::Mat K = (cv::Mat_<double>(3, 3) << 700, 0, 600, 0, 710, 180, 0, 0, 1);
+    cv::Mat D = (cv::Mat_<double>(14, 1) << -0.3, 0.1, 1e-3, -2e-3, 0.01, 1e-3, -1e-3, 1e-4, 1e-3, -1e-3, 2e-3, -2e-3, 0.01, -0.02);
+
+    EuclideanTransform pose;
+    pose.GetRotation().FromAngles(5, -10, 15);
+    pose.SetTranslation(cv::Vec3d(-0.5, 0.0, 0.1));
+
+    ProjectionModel::Own bouguet(new BouguetModel(K, D));
+    ProjectionModel::Own posed(new PosedProjection(pose, bouguet));
+
+    cv::Mat x(n, 3, CV_64F);
+    rng.fill(x.colRange(0, 2), cv::RNG::UNIFORM, -10, 10);
+    rng.fill(x.col(2), cv::RNG::UNIFORM, 5, 50);
+
+    const ProjectionModel::Own models[] = { bouguet, posed };
+
+    for (size_t m = 0; m < 2; m++)
+    {
+        const ProjectionModel& proj = *models[m];
+        const Geometry g(Geometry::ROW_MAJOR, x);
+        const cv::Mat jac = proj.GetJacobian(g).mat;
+
+        BOOST_REQUIRE_EQUAL(jac.rows, n);
+        BOOST_REQUIRE_EQUAL(jac.cols, 6);
+
+        // the closed-form derivatives agree with central differences
+        for (int j = 0; j < 3; j++)
+        {
+            cv::Mat x0 = x.clone(), x1 = x.clone();
+            x0.col(j) -= h;
+            x1.col(j) += h;
+
+            const cv::Mat y0 = proj.Project(Geometry(Geometry::ROW_MAJOR, x0)).mat;
+            const cv::Mat y1 = proj.Project(Geometry(Geometry::ROW_MAJOR, x1)).mat;
+            const cv::Mat dy = (y1 - y0) / (2 * h);
+
+            BOOST_CHECK_LT(cv::norm(jac.colRange(j * 2, j * 2 + 2), dy, cv::NORM_INF), 1e-4 * cv::norm(dy, cv::NORM_INF));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(mahalanobis_kernels)
+{
+    const int n = 20;
+    cv::RNG rng(1);
+
+    for (int dims = 1; dims <= 4; dims++)
+    {
+        cv::Mat x(n, dims, CV_64F), cov(n, dims * (dims + 1) / 2, CV_64F);
+        rng.fill(x, cv::RNG::UNIFORM, -10, 10);
+
+        for (int i = 0; i < n; i++)
+        {
+            cv::Mat A(dims, dims, CV_64F);
+            rng.fill(A, cv::RNG::UNIFORM, -1, 1);
+            symmat(A * A.t() + cv::Mat::eye(dims, dims, CV_64F) * 0.1).copyTo(cov.row(i));
+        }
+
+        MahalanobisMetric metric(MahalanobisMetric::ANISOTROPIC_ROTATED, dims, cov);
+        const cv::Mat d = metric(Geometry(Geometry::ROW_MAJOR, x)).mat;
+
+        BOOST_REQUIRE_EQUAL(d.rows, n);
+
+        // distances agree with the ones from the full inverse covariances
+        for (int i = 0; i < n; i++)
+        {
+            const cv::Mat xi = x.row(i);
+            const cv::Mat di = xi * metric.GetFullCovMat(i).inv(cv::DECOMP_SVD) * xi.t();
+
+            BOOST_CHECK_CLOSE(d.at<double>(i), std::sqrt(di.at<double>(0)), 1e-8);
+        }
+
+        // and so do the ones of a single-precision geometry
+        cv::Mat x32f;
+        x.convertTo(x32f, CV_32F);
+
+        cv::Mat d32f = metric(Geometry(Geometry::ROW_MAJOR, x32f)).mat;
+
+        BOOST_REQUIRE_EQUAL(d32f.type(), CV_32F);
+
+        d32f.convertTo(d32f, CV_64F);
+        BOOST_CHECK_LT(cv::norm(d32f, d, cv::NORM_INF), 1e-4 * cv::norm(d, cv::NORM_INF));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(covariance_propagation)
+{
+    // the shapes with fixed-size kernels and one left to the generic loop, over
+    // enough elements to be split into several blocks
+    const int shapes[][2] = { { 2, 2 }, { 3, 2 }, { 3, 3 }, { 4, 3 }, { 6, 3 }, { 5, 4 } };
+    const int n = 300;
+    cv::RNG rng(1);
+
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+    {
+        const int d0 = shapes[s][0];
+        const int d1 = shapes[s][1];
+
+        std::vector<cv::Mat> C(n);
+        cv::Mat cov(n, d0 * (d0 + 1) / 2, CV_64F), jac(n, d0 * d1, CV_64F);
+        rng.fill(jac, cv::RNG::UNIFORM, -1, 1);
+
+        for (int i = 0; i < n; i++)
+        {
+            cv::Mat A(d0, d0, CV_64F);
+            rng.fill(A, cv::RNG::UNIFORM, -1, 1);
+
+            C[i] = A * A.t() + cv::Mat::eye(d0, d0, CV_64F) * 0.1;
+            symmat(C[i]).copyTo(cov.row(i));
+        }
+
+        const cv::Mat given  = MahalanobisMetric::PropagateCovMat(cov, jac, d0, d1);
+        const cv::Mat shared = MahalanobisMetric::PropagateCovMat(cov.row(0), jac, d0, d1);
+        const cv::Mat ident  = MahalanobisMetric::PropagateCovMat(cv::Mat(), jac, d0, d1);
+
+        BOOST_REQUIRE_EQUAL(given.rows,  n);
+        BOOST_REQUIRE_EQUAL(shared.rows, n);
+        BOOST_REQUIRE_EQUAL(ident.rows,  n);
+
+        for (int i = 0; i < n; i++)
+        {
+            // the Jacobians are stored column by column
+            const cv::Mat J = jac.row(i).reshape(1, d0).t();
+
+            const cv::Mat expected0 = symmat(J * C[i] * J.t());
+            const cv::Mat expected1 = symmat(J * C[0] * J.t());
+            const cv::Mat expected2 = symmat(J * J.t());
+
+            BOOST_CHECK_LT(cv::norm(given.row(i),  expected0, cv::NORM_INF), 1e-10 * cv::norm(expected0, cv::NORM_INF));
+            BOOST_CHECK_LT(cv::norm(shared.row(i), expected1, cv::NORM_INF), 1e-10 * cv::norm(expected1, cv::NORM_INF));
+            BOOST_CHECK_LT(cv::norm(ident.row(i),  expected2, cv::NORM_INF), 1e-10 * cv::norm(expected2, cv::NORM_INF));
+        }
+    }
+}
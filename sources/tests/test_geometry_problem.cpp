@@ -5,6 +5,43 @@
 
 using namespace seq2map;
 
+namespace
+{
+    /**
+     * Synthesise world-to-image correspondences of a normalised pinhole
+     * camera at the given pose. Gaussian noise is added to the image points
+     * and the first outliers of them are displaced well beyond the noise.
+     */
+    GeometricMapping MakeProjectionMapping(const EuclideanTransform& pose, int n, int outliers, double sigma, cv::RNG& rng)
+    {
+        cv::Mat y(n, 3, CV_64F), R = pose.GetRotation().ToMatrix(), t = pose.GetTranslation();
+        rng.fill(y.colRange(0, 2), cv::RNG::UNIFORM, -5, 5);
+        rng.fill(y.col(2), cv::RNG::UNIFORM, 5, 20);
+
+        GeometricMapping::WorldToImageBuilder builder;
+
+        for (int i = 0; i < n; i++)
+        {
+            // object points are placed in front of the camera
+            cv::Mat x = R.t() * (y.row(i).t() - t);
+            Point2D p(y.at<double>(i, 0) / y.at<double>(i, 2), y.at<double>(i, 1) / y.at<double>(i, 2));
+
+            p.x += rng.gaussian(sigma);
+            p.y += rng.gaussian(sigma);
+
+            if (i < outliers)
+            {
+                p.x += rng.uniform(0.05, 0.2) * (rng.uniform(0, 2) ? 1 : -1);
+                p.y += rng.uniform(0.05, 0.2) * (rng.uniform(0, 2) ? 1 : -1);
+            }
+
+            builder.Add(Point3D(x.at<double>(0), x.at<double>(1), x.at<double>(2)), p, i);
+        }
+
+        return builder.Build();
+    }
+}
+
 BOOST_AUTO_TEST_CASE(ransac)
 {
     Sequence seq;
@@ -190,3 +227,526 @@ BOOST_AUTO_TEST_CASE(photometric)
     BOOST_CHECK(cv::norm(drift) < 0.1f);
     E_INFO << mat2string(drift, "drift");
 }
+
+BOOST_AUTO_TEST_CASE(sequential_test)
+{
+    const int n = 1000;
+    cv::RNG rng(1);
+
+    cv::Mat src(n, 3, CV_64F), dst;
+    rng.fill(src, cv::RNG::UNIFORM, -10, 10);
+
+    EuclideanTransform truth, wrong;
+    truth.SetTranslation(cv::Vec3d(1, 2, 3));
+    wrong.SetTranslation(cv::Vec3d(6, 7, 8));
+
+    // 30% of the correspondences are outliers
+    dst = src + cv::repeat(cv::Mat(cv::Vec3d(1, 2, 3)).t(), n, 1);
+    cv::Mat noise(n * 3 / 10, 3, CV_64F);
+    rng.fill(noise, cv::RNG::UNIFORM, 5, 10);
+    dst.rowRange(0, noise.rows) += noise;
+
+    GeometricMapping mapping;
+    mapping.src = Geometry(Geometry::ROW_MAJOR, src);
+    mapping.dst = Geometry(Geometry::ROW_MAJOR, dst);
+    mapping.metric = Metric::Own(new EuclideanMetric());
+
+    boost::shared_ptr<RigidObjective> objective(new RigidObjective());
+    BOOST_REQUIRE(objective->SetData(mapping));
+
+    AlignmentObjective::InlierSelector selector = objective->GetSelector(0.1f);
+    AlignmentObjective::InlierSelector::SequentialTest test(0.5f, 0.05f, 200);
+    AlignmentObjective::InlierSelector::Chunks chunks;
+    selector.Split(64, rng, chunks);
+
+    IndexList inliers0, outliers0, inliers1, outliers1;
+    bool rejected;
+
+    BOOST_REQUIRE(test.IsEnabled());
+    BOOST_REQUIRE(selector(truth, inliers0, outliers0));
+
+    // a good model is evaluated in full and gives the same partition
+    BOOST_CHECK(selector(truth, chunks, test, inliers1, outliers1, rejected));
+    BOOST_CHECK(!rejected);
+    BOOST_CHECK(inliers0 == inliers1);
+    BOOST_CHECK(outliers0 == outliers1);
+    BOOST_CHECK_EQUAL(inliers1.size(), static_cast<size_t>(n - n * 3 / 10));
+
+    // a bad model is abandoned within the first chunk
+    BOOST_CHECK(selector(wrong, chunks, test, inliers1, outliers1, rejected));
+    BOOST_CHECK(rejected);
+    BOOST_CHECK_LE(inliers1.size() + outliers1.size(), static_cast<size_t>(64));
+}
+
+#ifdef WITH_FIVEPOINTS
+BOOST_AUTO_TEST_CASE(five_point)
+{
+    cv::RNG rng(1);
+    ProjectionModel::ConstOwn proj(new PinholeModel());
+
+    EuclideanTransform truth;
+    truth.GetRotation().FromAngles(2, -3, 1);
+    truth.SetTranslation(cv::Vec3d(0.2, -0.1, 1.0));
+
+    cv::Mat x0(5, 3, CV_64F), R = truth.GetRotation().ToMatrix(), t = truth.GetTranslation();
+    rng.fill(x0.colRange(0, 2), cv::RNG::UNIFORM, -5, 5);
+    rng.fill(x0.col(2), cv::RNG::UNIFORM, 10, 20);
+
+    GeometricMapping::ImageToImageBuilder builder;
+
+    for (int i = 0; i < x0.rows; i++)
+    {
+        cv::Mat x1 = R * x0.row(i).t() + t;
+
+        builder.Add(
+            cv::Point2f(static_cast<float>(x0.at<double>(i, 0) / x0.at<double>(i, 2)), static_cast<float>(x0.at<double>(i, 1) / x0.at<double>(i, 2))),
+            cv::Point2f(static_cast<float>(x1.at<double>(0)    / x1.at<double>(2)),    static_cast<float>(x1.at<double>(1)    / x1.at<double>(2))),
+            i
+        );
+    }
+
+    GeometricMapping mapping = builder.Build();
+    EssentialMatrixDecomposer solver(proj, proj, EssentialMatrixDecomposer::FIVE_POINT);
+    PoseEstimator::Estimates estimates;
+
+    BOOST_REQUIRE_EQUAL(solver.GetMinPoints(), static_cast<size_t>(5));
+    BOOST_REQUIRE(solver.Solve(mapping, estimates));
+    BOOST_REQUIRE(!estimates.empty());
+
+    // a single estimate of a minimal set would be an arbitrary pick
+    PoseEstimator::Estimate single;
+    BOOST_CHECK(!solver(mapping, single));
+
+    // the true motion is among the hypotheses, up to the scale of translation
+    cv::Mat t0 = t / cv::norm(t);
+    double best = DBL_MAX;
+
+    BOOST_FOREACH (const PoseEstimator::Estimate& estimate, estimates)
+    {
+        cv::Mat t1 = estimate.pose.GetTranslation() / cv::norm(estimate.pose.GetTranslation());
+        double err = cv::norm(estimate.pose.GetRotation().ToMatrix() - R) + cv::norm(t1 - t0);
+
+        best = std::min(best, err);
+    }
+
+    BOOST_CHECK_LT(best, 1e-3);
+}
+#endif // WITH_FIVEPOINTS
+
+BOOST_AUTO_TEST_CASE(p3p)
+{
+    cv::RNG rng(1);
+    ProjectionModel::ConstOwn proj(new PinholeModel());
+
+    EuclideanTransform truth;
+    truth.GetRotation().FromAngles(30, -45, 10);
+    truth.SetTranslation(cv::Vec3d(0.5, -1.0, 2.0));
+
+    cv::Mat y(3, 3, CV_64F), R = truth.GetRotation().ToMatrix(), t = truth.GetTranslation();
+    rng.fill(y.colRange(0, 2), cv::RNG::UNIFORM, -5, 5);
+    rng.fill(y.col(2), cv::RNG::UNIFORM, 5, 10);
+
+    GeometricMapping::WorldToImageBuilder builder;
+
+    for (int i = 0; i < y.rows; i++)
+    {
+        // object points are placed in front of the camera
+        cv::Mat x = R.t() * (y.row(i).t() - t);
+
+        builder.Add(
+            Point3D(x.at<double>(0), x.at<double>(1), x.at<double>(2)),
+            Point2D(y.at<double>(i, 0) / y.at<double>(i, 2), y.at<double>(i, 1) / y.at<double>(i, 2)),
+            i
+        );
+    }
+
+    GeometricMapping mapping = builder.Build();
+    PerspevtivePoseEstimator solver(proj, PerspevtivePoseEstimator::P3P);
+    PoseEstimator::Estimates estimates;
+
+    BOOST_REQUIRE_EQUAL(solver.GetMinPoints(), static_cast<size_t>(3));
+    BOOST_REQUIRE(solver.Solve(mapping, estimates));
+    BOOST_REQUIRE(!estimates.empty());
+    BOOST_CHECK_LE(estimates.size(), static_cast<size_t>(4));
+
+    PoseEstimator::Estimate single;
+    BOOST_CHECK(!solver(mapping, single));
+
+    // the true pose is among the hypotheses
+    double best = DBL_MAX;
+
+    BOOST_FOREACH (const PoseEstimator::Estimate& estimate, estimates)
+    {
+        double err = cv::norm(estimate.pose.GetRotation().ToMatrix() - R) + cv::norm(estimate.pose.GetTranslation() - t);
+        best = std::min(best, err);
+    }
+
+    BOOST_CHECK_LT(best, 1e-3);
+}
+
+BOOST_AUTO_TEST_CASE(projection_kernel)
+{
+    const int n = 100;
+    cv::RNG rng(1);
+
+    cv::Mat K = (cv::Mat_<double>(3, 3) << 700, 0, 600, 0, 710, 180, 0, 0, 1);
+    cv::Mat D = (cv::Mat_<double>(5, 1) << -0.3, 0.1, 1e-3, -2e-3, 0.01);
+    ProjectionModel::ConstOwn proj(new BouguetModel(K, D));
+
+    EuclideanTransform tform;
+    tform.GetRotation().FromAngles(1, -2, 3);
+    tform.SetTranslation(cv::Vec3d(0.1, -0.2, 1.0));
+
+    // points in front of the camera with random anisotropic covariances
+    cv::Mat src(n, 3, CV_64F), dst(n, 2, CV_64F), cov(n, 6, CV_64F);
+    rng.fill(src.colRange(0, 2), cv::RNG::UNIFORM, -10, 10);
+    rng.fill(src.col(2), cv::RNG::UNIFORM, 5, 50);
+    rng.fill(dst.col(0), cv::RNG::UNIFORM, 0, 1200);
+    rng.fill(dst.col(1), cv::RNG::UNIFORM, 0, 360);
+
+    for (int i = 0; i < n; i++)
+    {
+        cv::Mat A(3, 3, CV_64F);
+        rng.fill(A, cv::RNG::UNIFORM, -1, 1);
+        symmat(A * A.t() + cv::Mat::eye(3, 3, CV_64F) * 0.1).copyTo(cov.row(i));
+    }
+
+    GeometricMapping mapping;
+    mapping.src = Geometry(Geometry::ROW_MAJOR, src);
+    mapping.dst = Geometry(Geometry::ROW_MAJOR, dst);
+    mapping.metric = Metric::Own(new MahalanobisMetric(MahalanobisMetric::ANISOTROPIC_ROTATED, 3, cov));
+
+    // the camera alone, and posed in the frame of the data
+    EuclideanTransform camPose;
+    camPose.GetRotation().FromAngles(-2, 1, 4);
+    camPose.SetTranslation(cv::Vec3d(0.05, 0.1, -0.2));
+
+    ProjectionModel::Own bouguet = proj->Clone();
+    const ProjectionModel::ConstOwn models[2] = { proj, ProjectionModel::ConstOwn(new PosedProjection(camPose, bouguet)) };
+
+    BOOST_FOREACH (const ProjectionModel::ConstOwn& model, models)
+    {
+        ProjectionObjective objective(model);
+        BOOST_REQUIRE(objective.SetData(mapping));
+
+        // the fused kernel agrees with the chain of generic operations
+        Geometry x = objective.GetData().src;
+        Geometry y = model->Project(tform(x, true), ProjectionModel::EUCLIDEAN_2D);
+        Geometry jac = model->GetJacobian(x, y);
+        cv::Mat expected = (*mapping.metric->Transform(tform, jac))(y, mapping.dst).mat;
+
+        cv::Mat fused(n, 1, CV_64F);
+        BOOST_REQUIRE(objective.EvaluateFused(tform, objective.GetData(), fused.ptr<double>()));
+
+        expected.reshape(1, n).convertTo(expected, CV_64F);
+        BOOST_CHECK_LT(cv::norm(fused, expected, cv::NORM_INF), 1e-6 * cv::norm(expected, cv::NORM_INF));
+
+        // so does the single-precision kernel, up to the rounding of floats
+        cv::Mat single(n, 1, CV_32F);
+        BOOST_REQUIRE(objective.EvaluateFused(tform, objective.GetData(), single.ptr<float>()));
+
+        single.convertTo(single, CV_64F);
+        BOOST_CHECK_LT(cv::norm(single, expected, cv::NORM_INF), 1e-3 * cv::norm(expected, cv::NORM_INF));
+    }
+
+    // a point on the principal plane does not blow up the pinhole kernels
+    const double X[2] = { 1, 2 }, Y[2] = { -1, 3 }, Z[2] = { 0, 4 };
+    double u[2], v[2];
+    const float Xf[2] = { 1, 2 }, Yf[2] = { -1, 3 }, Zf[2] = { 0, 4 };
+    float uf[2], vf[2];
+
+    PinholeModel(K).ProjectBatch(2, X, Y, Z, u, v);
+    PinholeModel(K).ProjectBatch(2, Xf, Yf, Zf, uf, vf);
+
+    for (int i = 0; i < 2; i++)
+    {
+        BOOST_CHECK(std::isfinite(u[i])  && std::isfinite(v[i]));
+        BOOST_CHECK(std::isfinite(uf[i]) && std::isfinite(vf[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(structure_transform)
+{
+    EuclideanTransform tform;
+    tform.GetRotation().FromAngles(10, -25, 40);
+    tform.SetTranslation(cv::Vec3d(1.0, -2.0, 0.5));
+
+    // homogeneous points keep their size and type through the transform
+    cv::Mat src(20, 4, CV_64F);
+    cv::randu(src, -10, 10);
+    src.col(3).setTo(1.0);
+
+    const cv::Mat original = src.clone();
+    const cv::Mat expected = src * tform.GetTransformMatrix(true, false);
+
+    // the transformed estimate must not write into the structure it shares
+    const StructureEstimation::Estimate g0(Geometry(Geometry::ROW_MAJOR, src));
+    StructureEstimation::Estimate g1 = g0.Transform(tform);
+
+    BOOST_CHECK_EQUAL(cv::norm(src, original, cv::NORM_INF), 0);
+    BOOST_CHECK_SMALL(cv::norm(g1.structure.mat, expected, cv::NORM_INF), 1e-10);
+
+    // nor in the other shapes
+    cv::Mat srcT = src.t();
+    Geometry cols(Geometry::COL_MAJOR, srcT);
+    Geometry packed(Geometry::PACKED, src.reshape(4, src.rows));
+
+    tform(cols, false);
+    tform(packed, false);
+
+    BOOST_CHECK_EQUAL(cv::norm(srcT, cv::Mat(original.t()), cv::NORM_INF), 0);
+    BOOST_CHECK_EQUAL(cv::norm(src, original, cv::NORM_INF), 0);
+    BOOST_CHECK_SMALL(cv::norm(cv::Mat(cols.mat.t()), expected, cv::NORM_INF), 1e-10);
+    BOOST_CHECK_SMALL(cv::norm(packed.mat.reshape(1, src.rows), expected, cv::NORM_INF), 1e-10);
+}
+
+BOOST_AUTO_TEST_CASE(ransac_threads)
+{
+    cv::RNG rng(1);
+    ProjectionModel::ConstOwn proj(new PinholeModel());
+
+    EuclideanTransform truth;
+    truth.GetRotation().FromAngles(5, -10, 3);
+    truth.SetTranslation(cv::Vec3d(0.3, -0.2, 1.0));
+
+    const GeometricMapping mapping = MakeProjectionMapping(truth, 300, 90, 1e-4, rng);
+    AlignmentObjective::Own objective(new ProjectionObjective(proj));
+    PoseEstimator::ConstOwn solver(new PerspevtivePoseEstimator(proj, PerspevtivePoseEstimator::P3P));
+
+    BOOST_REQUIRE(objective->SetData(mapping));
+
+    ConsensusPoseEstimator estimator;
+    estimator.AddSelector(objective->GetSelector(1e-3));
+    estimator.SetSolver(solver);
+    estimator.SetStrategy(ConsensusPoseEstimator::ADAPTIVE_RANSAC);
+    estimator.SetMaxIterations(200);
+    estimator.SetMinInlierRatio(0.5f);
+    estimator.SetConfidence(0.99f);
+    estimator.EnableSequentialTest();
+    estimator.EnableLocalOptimisation();
+
+    // the same seed gives the same outcome however many hypotheses run at a time
+    const size_t threads[2] = { 1, 4 };
+    EuclideanTransform poses[2];
+    ConsensusPoseEstimator::IndexLists inliers[2], outliers[2];
+
+    for (size_t k = 0; k < 2; k++)
+    {
+        PoseEstimator::Estimate estimate;
+
+        estimator.SetThreads(threads[k]);
+        std::srand(7);
+
+        BOOST_REQUIRE(estimator(mapping, estimate, inliers[k], outliers[k]));
+        poses[k] = estimate.pose;
+    }
+
+    BOOST_CHECK_EQUAL(cv::norm(poses[0].GetTransformMatrix(), poses[1].GetTransformMatrix(), cv::NORM_INF), 0);
+    BOOST_CHECK(inliers[0] == inliers[1]);
+    BOOST_CHECK(outliers[0] == outliers[1]);
+    BOOST_CHECK_LT(cv::norm(poses[0].GetTransformMatrix(), truth.GetTransformMatrix(), cv::NORM_INF), 1e-2);
+}
+
+BOOST_AUTO_TEST_CASE(required_iterations)
+{
+    struct Case { double w; size_t s; double p; size_t k; };
+    const Case cases[] =
+    {
+        { 0.5, 3, 0.99,  35 },
+        { 0.7, 6, 0.99,  37 },
+        { 0.5, 8, 0.95, 766 },
+        { 0.9, 5, 0.999,  8 }
+    };
+
+    BOOST_FOREACH (const Case& c, cases)
+    {
+        const double k = std::ceil(std::log(1 - c.p) / std::log(1 - std::pow(c.w, static_cast<double>(c.s))));
+
+        BOOST_CHECK_EQUAL(static_cast<size_t>(k), c.k);
+        BOOST_CHECK_EQUAL(ConsensusPoseEstimator::GetRequiredIterations(c.w, c.s, c.p, 1000), c.k);
+        BOOST_CHECK_EQUAL(ConsensusPoseEstimator::GetRequiredIterations(c.w, c.s, c.p, 10), std::min<size_t>(c.k, 10));
+    }
+
+    // a clean population needs a single trial, a hopeless one the maximum
+    BOOST_CHECK_EQUAL(ConsensusPoseEstimator::GetRequiredIterations(1.0, 3, 0.99, 1000), static_cast<size_t>(1));
+    BOOST_CHECK_EQUAL(ConsensusPoseEstimator::GetRequiredIterations(0.0, 3, 0.99, 1000), static_cast<size_t>(1000));
+}
+
+BOOST_AUTO_TEST_CASE(prosac)
+{
+    const int n = 300, outliers = 120;
+    cv::RNG rng(2);
+    ProjectionModel::ConstOwn proj(new PinholeModel());
+
+    EuclideanTransform truth;
+    truth.GetRotation().FromAngles(-8, 4, 12);
+    truth.SetTranslation(cv::Vec3d(-0.4, 0.1, 0.8));
+
+    const GeometricMapping mapping = MakeProjectionMapping(truth, n, outliers, 1e-4, rng);
+    AlignmentObjective::Own objective(new ProjectionObjective(proj));
+    PoseEstimator::ConstOwn solver(new PerspevtivePoseEstimator(proj, PerspevtivePoseEstimator::P3P));
+
+    BOOST_REQUIRE(objective->SetData(mapping));
+
+    // a ranking that is mostly right: inliers come first, every tenth place
+    // is taken by an outlier, and the rest of the outliers trail
+    Indices order;
+    int j = 0;
+
+    for (int i = outliers; i < n; i++)
+    {
+        if (order.size() % 10 == 9) order.push_back(j++);
+        order.push_back(i);
+    }
+
+    while (j < outliers) order.push_back(j++);
+
+    BOOST_REQUIRE_EQUAL(order.size(), static_cast<size_t>(n));
+
+    ConsensusPoseEstimator estimator;
+    estimator.AddSelector(objective->GetSelector(1e-3));
+    estimator.SetSolver(solver);
+    estimator.SetStrategy(ConsensusPoseEstimator::PROSAC);
+    estimator.SetSamplingOrder(order);
+    estimator.SetMaxIterations(1000);
+    estimator.SetMinInlierRatio(0.5f);
+    estimator.SetConfidence(0.99f);
+
+    PoseEstimator::Estimate estimate;
+    ConsensusPoseEstimator::IndexLists inliers, outliersFound;
+
+    std::srand(3);
+
+    BOOST_REQUIRE(estimator(mapping, estimate, inliers, outliersFound));
+    BOOST_CHECK_LT(cv::norm(estimate.pose.GetTransformMatrix(), truth.GetTransformMatrix(), cv::NORM_INF), 1e-2);
+    BOOST_CHECK_GE(inliers[0].size(), static_cast<size_t>(n - outliers) * 95 / 100);
+    BOOST_CHECK_LE(inliers[0].size(), static_cast<size_t>(n - outliers));
+}
+
+BOOST_AUTO_TEST_CASE(local_optimisation)
+{
+    cv::RNG rng(3);
+    ProjectionModel::ConstOwn proj(new PinholeModel());
+
+    EuclideanTransform truth;
+    truth.GetRotation().FromAngles(3, 7, -5);
+    truth.SetTranslation(cv::Vec3d(0.2, 0.3, -0.6));
+
+    // noise at half the threshold leaves minimal-sample poses short of many inliers
+    const GeometricMapping mapping = MakeProjectionMapping(truth, 400, 120, 5e-4, rng);
+    AlignmentObjective::Own objective(new ProjectionObjective(proj));
+    PoseEstimator::ConstOwn solver(new PerspevtivePoseEstimator(proj, PerspevtivePoseEstimator::P3P));
+
+    BOOST_REQUIRE(objective->SetData(mapping));
+
+    ConsensusPoseEstimator estimator;
+    estimator.AddSelector(objective->GetSelector(1e-3));
+    estimator.SetSolver(solver);
+    estimator.SetStrategy(ConsensusPoseEstimator::RANSAC);
+    estimator.SetMaxIterations(200);
+    estimator.SetMinInlierRatio(0.3f);
+    estimator.SetConfidence(0.99f);
+
+    // both runs draw the same samples, so the local optimisation can only add inliers
+    PoseEstimator::Estimate plain, local;
+    ConsensusPoseEstimator::IndexLists inliers[2], outliers[2];
+
+    std::srand(5);
+    BOOST_REQUIRE(estimator(mapping, plain, inliers[0], outliers[0]));
+
+    estimator.EnableLocalOptimisation();
+
+    std::srand(5);
+    BOOST_REQUIRE(estimator(mapping, local, inliers[1], outliers[1]));
+
+    BOOST_CHECK_GE(inliers[1][0].size(), inliers[0][0].size());
+    BOOST_CHECK_LT(cv::norm(local.pose.GetTransformMatrix(), truth.GetTransformMatrix(), cv::NORM_INF), 1e-2);
+}
+
+BOOST_AUTO_TEST_CASE(single_precision)
+{
+    cv::RNG rng(4);
+    ProjectionModel::ConstOwn proj(new PinholeModel());
+
+    EuclideanTransform truth;
+    truth.GetRotation().FromAngles(-6, 2, 9);
+    truth.SetTranslation(cv::Vec3d(0.1, -0.3, 0.5));
+
+    // the noise is far below the threshold so no inlier is borderline
+    const GeometricMapping mapping = MakeProjectionMapping(truth, 300, 90, 1e-4, rng);
+    AlignmentObjective::Own objective(new ProjectionObjective(proj));
+    PoseEstimator::ConstOwn solver(new PerspevtivePoseEstimator(proj, PerspevtivePoseEstimator::P3P));
+
+    BOOST_REQUIRE(objective->SetData(mapping));
+
+    cv::Mat e64 = (*objective)(truth);
+    cv::Mat e32 = (*objective)(truth, objective->GetData(), CV_32F);
+
+    BOOST_REQUIRE_EQUAL(e32.depth(), CV_32F);
+    e32.convertTo(e32, CV_64F);
+    BOOST_CHECK_LT(cv::norm(e32, e64, cv::NORM_INF), 1e-5);
+
+    // the hypotheses are selected through the single-precision kernel, with
+    // and without the sequential test, and end with the same inliers
+    for (int sprt = 0; sprt < 2; sprt++)
+    {
+        ConsensusPoseEstimator estimator;
+        estimator.AddSelector(objective->GetSelector(1e-3));
+        estimator.SetSolver(solver);
+        estimator.SetStrategy(ConsensusPoseEstimator::ADAPTIVE_RANSAC);
+        estimator.SetMaxIterations(200);
+        estimator.SetMinInlierRatio(0.5f);
+        estimator.SetConfidence(0.99f);
+        estimator.EnableOptimisation();
+
+        if (sprt) estimator.EnableSequentialTest();
+
+        ConsensusPoseEstimator::IndexLists inliers[2], outliers[2];
+
+        for (size_t k = 0; k < 2; k++)
+        {
+            PoseEstimator::Estimate estimate;
+
+            if (k == 1) estimator.EnableSinglePrecision();
+            std::srand(11);
+
+            BOOST_REQUIRE(estimator(mapping, estimate, inliers[k], outliers[k]));
+            BOOST_CHECK_LT(cv::norm(estimate.pose.GetTransformMatrix(), truth.GetTransformMatrix(), cv::NORM_INF), 1e-2);
+        }
+
+        BOOST_CHECK(inliers[0] == inliers[1]);
+        BOOST_CHECK(outliers[0] == outliers[1]);
+    }
+
+    // an objective without a single-precision kernel falls back to double precision
+    const int n = 200;
+    cv::Mat src(n, 3, CV_64F), R = truth.GetRotation().ToMatrix(), t = truth.GetTranslation();
+    rng.fill(src, cv::RNG::UNIFORM, -10, 10);
+
+    cv::Mat dst = src * R.t() + cv::repeat(cv::Mat(t.t()), n, 1);
+    cv::Mat noise(n / 4, 3, CV_64F);
+    rng.fill(noise, cv::RNG::UNIFORM, 1, 2);
+    dst.rowRange(0, noise.rows) += noise;
+
+    GeometricMapping rigid;
+    rigid.src = Geometry(Geometry::ROW_MAJOR, src);
+    rigid.dst = Geometry(Geometry::ROW_MAJOR, dst);
+    rigid.metric = Metric::Own(new EuclideanMetric());
+
+    AlignmentObjective::Own rigidObjective(new RigidObjective());
+    BOOST_REQUIRE(rigidObjective->SetData(rigid));
+
+    cv::Mat r64 = (*rigidObjective)(truth);
+    cv::Mat r32 = (*rigidObjective)(truth, rigidObjective->GetData(), CV_32F);
+
+    BOOST_CHECK_EQUAL(r32.depth(), CV_64F);
+    BOOST_CHECK_EQUAL(cv::norm(r32, r64, cv::NORM_INF), 0);
+
+    AlignmentObjective::InlierSelector selector = rigidObjective->GetSelector(0.1);
+    IndexList inliers64, outliers64, inliers32, outliers32;
+
+    BOOST_REQUIRE(selector(truth, inliers64, outliers64));
+    BOOST_REQUIRE(selector(truth, inliers32, outliers32, CV_32F));
+    BOOST_CHECK(inliers64 == inliers32);
+    BOOST_CHECK_EQUAL(inliers64.size(), static_cast<size_t>(n - n / 4));
+}
@@ -0,0 +1,129 @@
+#define BOOST_TEST_MODULE "Sequence"
+#include <boost/test/unit_test.hpp>
+#include <seq2map/sequence.hpp>
+
+using namespace seq2map;
+
+BOOST_AUTO_TEST_CASE(packed_image_store)
+{
+    const Path root = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("seq2map-%%%%-%%%%");
+    const size_t frames = 3;
+
+    // a sequence of one camera reading individual image files
+    Camera cam(0);
+    ImageStore& files = cam.GetImageStore();
+    ImageStore packed;
+
+    BOOST_REQUIRE(files.Create(root / "images"));
+    BOOST_REQUIRE(packed.Create(root / "packed") && packed.Pack("images.pack"));
+
+    for (size_t i = 0; i < frames; i++)
+    {
+        PersistentImage image;
+        image.im = cv::Mat(24, 32, CV_8UC3, cv::Scalar(i, 2 * i, 3 * i));
+
+        std::stringstream ss;
+        ss << i << ".png";
+
+        BOOST_REQUIRE(files.Append(ss.str(), image));
+        BOOST_REQUIRE(packed.Append(ss.str(), image));
+    }
+
+    Path index = root / "packed" / "index.yml";
+    BOOST_REQUIRE(packed.Store(index));
+
+    {
+        cv::FileStorage fs((root / "index.yml").string(), cv::FileStorage::WRITE);
+        fs << "sequence" << "packed_image_store";
+        fs << "keypoints" << "kpt";
+        fs << "disparity" << "dpm";
+        fs << "cameras" << "[" << "{";
+        BOOST_REQUIRE(cam.Store(fs));
+        fs << "}" << "]";
+        fs << "stereo" << "[" << "]";
+    }
+
+    // the camera is pointed to the container as imcvt --seq does
+    Sequence seq;
+    Path seqPath = root;
+
+    BOOST_REQUIRE(seq.Restore(seqPath));
+    BOOST_REQUIRE(seq.SetImageStore(0, index));
+    BOOST_REQUIRE(seq.Store(seqPath));
+
+    // and reads the packed frames once the sequence is restored again
+    Sequence restored;
+    BOOST_REQUIRE(restored.Restore(root));
+
+    Camera::ConstOwn restoredCam = restored.GetCamera(0);
+    BOOST_REQUIRE(restoredCam);
+
+    const ImageStore& store = restoredCam->GetImageStore();
+    BOOST_CHECK(store.IsPacked());
+    BOOST_CHECK_EQUAL(store.GetItems(), frames);
+
+    for (size_t i = 0; i < frames; i++)
+    {
+        PersistentImage image;
+        BOOST_REQUIRE(store.Retrieve(i, image));
+        BOOST_CHECK_EQUAL(image.im.type(), CV_8UC3);
+        BOOST_CHECK_EQUAL(cv::norm(image.im, cv::Mat(24, 32, CV_8UC3, cv::Scalar(i, 2 * i, 3 * i)), cv::NORM_INF), 0);
+    }
+
+    // a store of a different number of frames is refused
+    ImageStore shorter;
+    Path shorterIndex = root / "shorter" / "index.yml";
+
+    BOOST_REQUIRE(shorter.Create(root / "shorter"));
+    BOOST_REQUIRE(shorter.Store(shorterIndex));
+    BOOST_CHECK(!restored.SetImageStore(0, shorterIndex));
+    BOOST_CHECK(!restored.SetImageStore(1, index));
+
+    boost::filesystem::remove_all(root);
+}
+
+BOOST_AUTO_TEST_CASE(cached_items)
+{
+    const Path root = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("seq2map-%%%%-%%%%");
+    const cv::Mat im0(24, 32, CV_8UC3, cv::Scalar(1, 2, 3));
+
+    ImageStore store;
+    BOOST_REQUIRE(store.Create(root));
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        PersistentImage image;
+        image.im = im0.clone();
+
+        std::stringstream ss;
+        ss << i << ".png";
+
+        BOOST_REQUIRE(store.Append(ss.str(), image));
+    }
+
+    ItemCache::Own cache(new ItemCache(1024 * 1024));
+    Indices pattern;
+
+    pattern.push_back(0);
+    pattern.push_back(0);
+    pattern.push_back(1);
+
+    store.SetCache(cache);
+    store.SetReadAhead(pattern);
+
+    // writing to a retrieved item touches neither the cache nor the read-ahead
+    for (size_t k = 0; k < pattern.size(); k++)
+    {
+        PersistentImage image;
+
+        BOOST_REQUIRE(store.Retrieve(pattern[k], image));
+        BOOST_CHECK_EQUAL(cv::norm(image.im, im0, cv::NORM_INF), 0);
+
+        image.im.setTo(255);
+    }
+
+    BOOST_CHECK_EQUAL(cache->GetHits(), 1);
+
+    store.DisableReadAhead();
+    boost::filesystem::remove_all(root);
+}